@@ -53,6 +53,7 @@
         "MOM_Achieved" "Achieved"
         "MOM_Rank" "Rank"
         "MOM_Leaderboards_WatchReplay" "Watch Replay"
+        "MOM_Leaderboards_RaceTimes" "Race These Times"
         "MOM_Leaderboards_SteamProfile" "Steam Profile"
         "MOM_Calculating" "Calculating..."
         "MOM_MapRank" "Map Rank: %mRank%"
@@ -157,6 +158,7 @@
         "MOM_MapSelector_LastPlayed" "Last Played"
         "MOM_MapSelector_DownloadMap" "Download Map"
         "MOM_MapSelector_RemoveFromQueue" "Remove from Download Queue"
+        "MOM_MapSelector_PrioritizeDownload" "Download Next"
         "MOM_MapSelector_CancelDownload" "Cancel Download"
         "MOM_MapSelector_ConfirmCancel" "Cancel Download?"
         "MOM_MapSelector_ConfirmCancelMsg" "Are you sure you want to cancel this map download?"
@@ -0,0 +1,238 @@
+#!/usr/bin/perl
+#
+# Compiles a fixed set of VMFs with vbsp, vvis and vrad, collects the time and
+# peak memory each tool reports per phase ("-phasetimes") and compares them
+# against a stored baseline.
+#
+# usage: perl benchmark_maptools.pl -bin <dir with vbsp/vvis/vrad> -game <gamedir> [options]
+#
+#   -maps <dir|file.vmf>  : VMFs to compile, can be given more than once
+#                           (default: ../../../game/momentum/mapsrc)
+#   -out <dir>            : Where the maps are compiled and the results written
+#                           (default: ./maptools_benchmark)
+#   -baseline <file>      : Baseline to compare against (default: <out>/baseline.json)
+#   -update               : Store this run as the new baseline instead of comparing
+#   -runs <n>             : Compile every map n times and keep the fastest run (default: 1)
+#   -threshold <percent>  : Fail when a phase is this much slower than the baseline (default: 10)
+#   -minseconds <s>       : Ignore slowdowns smaller than this, phases this short are noise (default: 0.5)
+#   -vbspargs/-vvisargs/-vradargs "<args>" : Extra options for each tool
+#
+# Exits with 1 if anything got slower than the threshold allows, 2 if a tool failed.
+#
+
+use strict;
+use File::Basename;
+use File::Copy;
+use File::Path;
+use File::Spec;
+use JSON::PP;
+
+my $bindir;
+my $gamedir;
+my @mapargs;
+my $outdir = "maptools_benchmark";
+my $baselinefile;
+my $update = 0;
+my $runs = 1;
+my $threshold = 10;
+my $minseconds = 0.5;
+my %toolargs = ( "vbsp" => "", "vvis" => "", "vrad" => "" );
+
+while( @ARGV )
+{
+	my $arg = shift @ARGV;
+	if( $arg eq "-bin" )			{ $bindir = shift @ARGV; }
+	elsif( $arg eq "-game" )		{ $gamedir = shift @ARGV; }
+	elsif( $arg eq "-maps" )		{ push @mapargs, shift @ARGV; }
+	elsif( $arg eq "-out" )			{ $outdir = shift @ARGV; }
+	elsif( $arg eq "-baseline" )	{ $baselinefile = shift @ARGV; }
+	elsif( $arg eq "-update" )		{ $update = 1; }
+	elsif( $arg eq "-runs" )		{ $runs = shift @ARGV; }
+	elsif( $arg eq "-threshold" )	{ $threshold = shift @ARGV; }
+	elsif( $arg eq "-minseconds" )	{ $minseconds = shift @ARGV; }
+	elsif( $arg =~ /^-(vbsp|vvis|vrad)args$/ )	{ $toolargs{$1} = shift @ARGV; }
+	else
+	{
+		die "unknown option $arg\n";
+	}
+}
+
+die "usage: perl benchmark_maptools.pl -bin <dir> -game <gamedir> [options]\n" if( !defined( $bindir ) || !defined( $gamedir ) );
+die "-runs must be at least 1\n" if( $runs < 1 );
+
+if( !@mapargs )
+{
+	push @mapargs, File::Spec->catdir( dirname( File::Spec->rel2abs( $0 ) ), "..", "..", "..", "game", "momentum", "mapsrc" );
+}
+
+my @vmfs;
+foreach my $maparg ( @mapargs )
+{
+	if( -d $maparg )
+	{
+		push @vmfs, sort glob( File::Spec->catfile( $maparg, "*.vmf" ) );
+	}
+	else
+	{
+		push @vmfs, $maparg;
+	}
+}
+die "no VMFs to compile\n" if( !@vmfs );
+
+mkpath( $outdir );
+$baselinefile = File::Spec->catfile( $outdir, "baseline.json" ) if( !defined( $baselinefile ) );
+
+# vvis only looks at the base name of the map, so everything runs from the output directory
+$bindir = File::Spec->rel2abs( $bindir );
+$gamedir = File::Spec->rel2abs( $gamedir );
+$baselinefile = File::Spec->rel2abs( $baselinefile );
+@vmfs = map { File::Spec->rel2abs( $_ ) } @vmfs;
+chdir( $outdir ) || die "can't change to $outdir\n";
+
+sub FindTool
+{
+	my $tool = shift;
+	foreach my $name ( $tool, "$tool.exe", "${tool}_linux" )
+	{
+		my $path = File::Spec->catfile( $bindir, $name );
+		return $path if( -f $path );
+	}
+	die "can't find $tool in $bindir\n";
+}
+
+sub ReadJSON
+{
+	my $filename = shift;
+	open( my $fh, "<", $filename ) || return undef;
+	local $/;
+	my $text = <$fh>;
+	close $fh;
+	return decode_json( $text );
+}
+
+sub WriteJSON
+{
+	my ( $filename, $data ) = @_;
+	open( my $fh, ">", $filename ) || die "can't write $filename\n";
+	print $fh JSON::PP->new->pretty->canonical->encode( $data );
+	close $fh;
+}
+
+# Keeps the fastest of several runs of the same phase, and the smallest peak.
+sub MergeRun
+{
+	my ( $best, $run ) = @_;
+	return $run if( !defined( $best ) );
+
+	foreach my $phase ( keys %{ $run->{phases} }, "" )
+	{
+		my $kept = ( $phase eq "" ) ? $best->{total} : $best->{phases}{$phase};
+		my $new = ( $phase eq "" ) ? $run->{total} : $run->{phases}{$phase};
+		if( !defined( $kept ) )
+		{
+			$best->{phases}{$phase} = $new;
+			next;
+		}
+		foreach my $key ( "wall", "cpu", "peak_rss_mb" )
+		{
+			$kept->{$key} = $new->{$key} if( $new->{$key} < $kept->{$key} );
+		}
+	}
+	return $best;
+}
+
+#
+# Compile everything
+#
+my %results;
+my @tools = ( "vbsp", "vvis", "vrad" );
+my %toolpaths = map { $_ => FindTool( $_ ) } @tools;
+
+foreach my $vmf ( @vmfs )
+{
+	my $map = basename( $vmf, ".vmf" );
+	copy( $vmf, "$map.vmf" ) || die "can't copy $vmf to $outdir\n";
+
+	for( my $run = 0; $run < $runs; $run++ )
+	{
+		foreach my $tool ( @tools )
+		{
+			my $timesfile = "$map.$tool.json";
+			unlink $timesfile;
+
+			my $target = ( $tool eq "vbsp" ) ? "$map.vmf" : $map;
+			my $cmd = "\"$toolpaths{$tool}\" -game \"$gamedir\" -phasetimes \"$timesfile\" $toolargs{$tool} \"$target\"";
+			print "$map ($tool, run " . ( $run + 1 ) . "/$runs)\n";
+
+			my $log = "$map.$tool.log";
+			if( system( "$cmd > \"$log\" 2>&1" ) != 0 )
+			{
+				print STDERR "$tool failed on $map, see $log\n";
+				exit 2;
+			}
+
+			my $times = ReadJSON( $timesfile );
+			if( !defined( $times ) )
+			{
+				print STDERR "$tool didn't write $timesfile\n";
+				exit 2;
+			}
+
+			$results{$map}{$tool} = MergeRun( $results{$map}{$tool}, $times );
+		}
+	}
+}
+
+WriteJSON( "results.json", \%results );
+print "\nwrote " . File::Spec->catfile( $outdir, "results.json" ) . "\n";
+
+if( $update || !-f $baselinefile )
+{
+	WriteJSON( $baselinefile, \%results );
+	print "wrote baseline $baselinefile\n";
+	exit 0;
+}
+
+#
+# Compare against the baseline
+#
+my $baseline = ReadJSON( $baselinefile ) || die "can't read $baselinefile\n";
+my $regressions = 0;
+
+printf "\n%-24s %-6s %-16s %10s %10s %8s %10s %10s\n", "map", "tool", "phase", "base (s)", "now (s)", "change", "base (MB)", "now (MB)";
+foreach my $map ( sort keys %results )
+{
+	foreach my $tool ( @tools )
+	{
+		my $now = $results{$map}{$tool};
+		my $base = $baseline->{$map}{$tool};
+		if( !defined( $base ) )
+		{
+			printf "%-24s %-6s no baseline\n", $map, $tool;
+			next;
+		}
+
+		foreach my $phase ( ( sort keys %{ $now->{phases} } ), "total" )
+		{
+			my $cur = ( $phase eq "total" ) ? $now->{total} : $now->{phases}{$phase};
+			my $old = ( $phase eq "total" ) ? $base->{total} : $base->{phases}{$phase};
+			next if( !defined( $old ) );
+
+			my $change = ( $old->{wall} > 0 ) ? ( $cur->{wall} - $old->{wall} ) * 100 / $old->{wall} : 0;
+			my $slower = ( $change > $threshold ) && ( $cur->{wall} - $old->{wall} > $minseconds );
+			$regressions++ if( $slower );
+
+			printf "%-24s %-6s %-16s %10.2f %10.2f %+7.1f%% %10.1f %10.1f%s\n", $map, $tool, $phase,
+				$old->{wall}, $cur->{wall}, $change, $old->{peak_rss_mb}, $cur->{peak_rss_mb}, $slower ? "  SLOWER" : "";
+		}
+	}
+}
+
+if( $regressions )
+{
+	print "\n$regressions phase(s) more than $threshold% slower than $baselinefile\n";
+	exit 1;
+}
+
+print "\nno phase more than $threshold% slower than $baselinefile\n";
+exit 0;
@@ -11,7 +11,6 @@ RecvPropString(RECVINFO(m_szGhostName)),
 RecvPropBool(RECVINFO(m_bSpectated)),
 RecvPropInt(RECVINFO(m_fFlags)),
 RecvPropDataTable(RECVINFO_DT(m_Data), SPROP_PROXY_ALWAYS_YES | SPROP_CHANGES_OFTEN, &REFERENCE_RECV_TABLE(DT_MomRunEntityData)),
-RecvPropDataTable(RECVINFO_DT(m_RunStats), SPROP_PROXY_ALWAYS_YES | SPROP_CHANGES_OFTEN, &REFERENCE_RECV_TABLE(DT_MomRunStats)),
 END_RECV_TABLE();
 
 C_MomentumGhostBaseEntity::C_MomentumGhostBaseEntity(): m_iv_vecViewOffset("C_MomentumGhostBaseEntity::m_iv_vecViewOffset")
@@ -25,6 +24,14 @@ C_MomentumGhostBaseEntity::C_MomentumGhostBaseEntity(): m_iv_vecViewOffset("C_Mo
     AddVar(&m_vecViewOffset, &m_iv_vecViewOffset, LATCH_SIMULATION_VAR);
 }
 
+void C_MomentumGhostBaseEntity::PostDataUpdate(DataUpdateType_t updateType)
+{
+    if (updateType == DATA_UPDATE_CREATED)
+        g_pRunStatsReceiver->ApplyPendingStats(m_index, &m_RunStats);
+
+    BaseClass::PostDataUpdate(updateType);
+}
+
 float C_MomentumGhostBaseEntity::GetCurrentRunTime()
 {
     return 0.0f;
@@ -12,6 +12,7 @@ public:
     C_MomentumGhostBaseEntity();
 
     bool IsValidIDTarget() OVERRIDE{ return true; }
+    void PostDataUpdate(DataUpdateType_t updateType) OVERRIDE;
 
     virtual bool IsReplayGhost() const { return false; }
     virtual bool IsOnlineGhost() const { return false; }
@@ -26,7 +27,7 @@ public:
     RUN_ENT_TYPE GetEntType() OVERRIDE { return RUN_ENT_GHOST; }
     CNetworkVarEmbedded(CMomRunEntityData, m_Data);
     virtual CMomRunEntityData *GetRunEntData() OVERRIDE { return &m_Data; }
-    CNetworkVarEmbedded(CMomRunStats, m_RunStats);
+    CMomRunStats m_RunStats;
     virtual CMomRunStats *GetRunStats() OVERRIDE {return &m_RunStats;}
     virtual int GetEntIndex() OVERRIDE { return m_index; }
     virtual float GetCurrentRunTime() OVERRIDE;
@@ -19,7 +19,6 @@ RecvPropFloat(RECVINFO(m_fDuckTimer)),
 RecvPropArray3(RECVINFO_ARRAY(m_iZoneCount), RecvPropInt(RECVINFO(m_iZoneCount[0]), SPROP_UNSIGNED)),
 RecvPropArray3(RECVINFO_ARRAY(m_iLinearTracks), RecvPropInt(RECVINFO(m_iLinearTracks[0]), SPROP_UNSIGNED)),
 RecvPropDataTable(RECVINFO_DT(m_Data), SPROP_PROXY_ALWAYS_YES | SPROP_CHANGES_OFTEN, &REFERENCE_RECV_TABLE(DT_MomRunEntityData)),
-RecvPropDataTable(RECVINFO_DT(m_RunStats), SPROP_PROXY_ALWAYS_YES | SPROP_CHANGES_OFTEN, &REFERENCE_RECV_TABLE(DT_MomRunStats)),
 END_RECV_TABLE();
 
 BEGIN_PREDICTION_DATA(C_MomentumPlayer)
@@ -106,6 +105,8 @@ void C_MomentumPlayer::PostDataUpdate(DataUpdateType_t updateType)
             Assert(s_pLocalPlayer == nullptr);
             s_pLocalPlayer = this;
         }
+
+        g_pRunStatsReceiver->ApplyPendingStats(m_index, &m_RunStats);
     }
 
     // C_BaseEntity assumes we're networking the entity's angles, so pretend that it
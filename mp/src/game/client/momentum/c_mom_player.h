@@ -59,7 +59,7 @@ class C_MomentumPlayer : public C_BasePlayer, public CMomRunEntity
     RUN_ENT_TYPE GetEntType() OVERRIDE { return RUN_ENT_PLAYER; }
     CNetworkVarEmbedded(CMomRunEntityData, m_Data);
     virtual CMomRunEntityData *GetRunEntData() OVERRIDE { return &m_Data; }
-    CNetworkVarEmbedded(CMomRunStats, m_RunStats);
+    CMomRunStats m_RunStats;
     virtual CMomRunStats *GetRunStats() OVERRIDE { return &m_RunStats; };
     virtual int GetEntIndex() OVERRIDE { return m_index; }
     virtual float GetCurrentRunTime() OVERRIDE;
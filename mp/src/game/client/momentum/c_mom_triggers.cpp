@@ -6,7 +6,9 @@
 
 #include "mom_shareddefs.h"
 #include "dt_utlvector_recv.h"
-#include "debugoverlay_shared.h"
+#include "physics.h"
+#include "vcollide.h"
+#include "mom_profiler.h"
 
 #include "tier0/memdbgon.h"
 
@@ -15,55 +17,123 @@ static MAKE_TOGGLE_CONVAR(mom_zone_end_outline_enable, "1", FCVAR_CLIENTCMD_CAN_
 static MAKE_TOGGLE_CONVAR(mom_zone_stage_outline_enable, "1", FCVAR_CLIENTCMD_CAN_EXECUTE | FCVAR_ARCHIVE, "Enable outline for stage zone(s).");
 static MAKE_TOGGLE_CONVAR(mom_zone_checkpoint_outline_enable, "1", FCVAR_CLIENTCMD_CAN_EXECUTE | FCVAR_ARCHIVE, "Enable outline for checkpoint zone(s).");
 
-static ConVar mom_zone_start_outline_color("mom_zone_start_outline_color", "00FF00FF", FCVAR_CLIENTCMD_CAN_EXECUTE | FCVAR_ARCHIVE, "Color of the start zone.");
-static ConVar mom_zone_end_outline_color("mom_zone_end_outline_color", "FF0000FF", FCVAR_CLIENTCMD_CAN_EXECUTE | FCVAR_ARCHIVE, "Color of the end zone.");
-static ConVar mom_zone_stage_outline_color("mom_zone_stage_outline_color", "0000FFFF", FCVAR_CLIENTCMD_CAN_EXECUTE | FCVAR_ARCHIVE, "Color of the stage zone(s).");
-static ConVar mom_zone_checkpoint_outline_color("mom_zone_checkpoint_outline_color", "FFFF00FF", FCVAR_CLIENTCMD_CAN_EXECUTE | FCVAR_ARCHIVE, "Color of the checkpoint zone(s).");
+static void OnOutlineColorChanged(IConVar *pVar, const char *pOldValue, float flOldValue);
 
-CTriggerOutlineRenderer::CTriggerOutlineRenderer()
+static ConVar mom_zone_start_outline_color("mom_zone_start_outline_color", "00FF00FF", FCVAR_CLIENTCMD_CAN_EXECUTE | FCVAR_ARCHIVE, "Color of the start zone.", OnOutlineColorChanged);
+static ConVar mom_zone_end_outline_color("mom_zone_end_outline_color", "FF0000FF", FCVAR_CLIENTCMD_CAN_EXECUTE | FCVAR_ARCHIVE, "Color of the end zone.", OnOutlineColorChanged);
+static ConVar mom_zone_stage_outline_color("mom_zone_stage_outline_color", "0000FFFF", FCVAR_CLIENTCMD_CAN_EXECUTE | FCVAR_ARCHIVE, "Color of the stage zone(s).", OnOutlineColorChanged);
+static ConVar mom_zone_checkpoint_outline_color("mom_zone_checkpoint_outline_color", "FFFF00FF", FCVAR_CLIENTCMD_CAN_EXECUTE | FCVAR_ARCHIVE, "Color of the checkpoint zone(s).", OnOutlineColorChanged);
+
+enum ZoneOutlineColor_t
 {
-    m_pVertices = nullptr;
-    m_vertexCount = 0;
-}
+    OUTLINE_COLOR_START = 0,
+    OUTLINE_COLOR_END,
+    OUTLINE_COLOR_STAGE,
+    OUTLINE_COLOR_CHECKPOINT,
+
+    OUTLINE_COLOR_COUNT
+};
 
-CTriggerOutlineRenderer::~CTriggerOutlineRenderer()
+static ConVar *s_pOutlineColorVars[OUTLINE_COLOR_COUNT] =
 {
-    if (m_pVertices)
-        MemAlloc_FreeAligned(m_pVertices);
-    m_pVertices = nullptr;
+    &mom_zone_start_outline_color,
+    &mom_zone_end_outline_color,
+    &mom_zone_stage_outline_color,
+    &mom_zone_checkpoint_outline_color,
+};
+
+// The hex colors are parsed again only after one of the convars changed
+static Color s_OutlineColors[OUTLINE_COLOR_COUNT];
+static bool s_bOutlineColorValid[OUTLINE_COLOR_COUNT];
+static bool s_bOutlineColorsDirty = true;
+
+static void OnOutlineColorChanged(IConVar *pVar, const char *pOldValue, float flOldValue)
+{
+    s_bOutlineColorsDirty = true;
 }
 
-bool CTriggerOutlineRenderer::RenderBrushModelSurface(IClientEntity* pBaseEntity, IBrushSurface* pBrushSurface)
+static bool GetCachedOutlineColor(ZoneOutlineColor_t type, Color &outColor)
 {
-    const int vertices = pBrushSurface->GetVertexCount();
-    if (vertices > m_vertexCount)
+    if (s_bOutlineColorsDirty)
     {
-        m_vertexCount = vertices;
-        if (m_pVertices)
-            m_pVertices = static_cast<BrushVertex_t *>(MemAlloc_ReallocAligned(m_pVertices, sizeof(BrushVertex_t) * m_vertexCount, 64));
-        else
-            m_pVertices = static_cast<BrushVertex_t *>(MemAlloc_AllocAligned(sizeof(BrushVertex_t) * m_vertexCount, 64));
+        for (int i = 0; i < OUTLINE_COLOR_COUNT; i++)
+            s_bOutlineColorValid[i] = MomUtil::GetColorFromHex(s_pOutlineColorVars[i]->GetString(), s_OutlineColors[i]);
+
+        s_bOutlineColorsDirty = false;
     }
-    pBrushSurface->GetVertexData(m_pVertices);
+
+    outColor = s_OutlineColors[type];
+    return s_bOutlineColorValid[type];
+}
+
+CZoneOutlineMesh::CZoneOutlineMesh() : m_pMesh(nullptr), m_bBuilt(false)
+{
+}
+
+CZoneOutlineMesh::~CZoneOutlineMesh()
+{
+    Destroy();
+}
+
+void CZoneOutlineMesh::Build(const CUtlVector<Vector> &vecLinePoints, const Color &color)
+{
+    Destroy();
+
+    m_Color = color;
+    m_bBuilt = true;
+
+    const int iLines = vecLinePoints.Count() / 2;
+    if (!iLines)
+        return;
+
+    if (!m_Material.IsValid())
+        m_Material.Init("momentum/zone_outline", TEXTURE_GROUP_OTHER);
+
     CMatRenderContextPtr pRenderContext(materials);
+    m_pMesh = pRenderContext->CreateStaticMesh(VERTEX_POSITION | VERTEX_NORMAL | VERTEX_COLOR, TEXTURE_GROUP_STATIC_VERTEX_BUFFER_OTHER, m_Material);
 
     CMeshBuilder builder;
-    builder.Begin(pRenderContext->GetDynamicMesh(true, nullptr, nullptr, 
-                                                 materials->FindMaterial("momentum/zone_outline", TEXTURE_GROUP_OTHER)),
-                    MATERIAL_LINE_LOOP, vertices);
+    builder.Begin(m_pMesh, MATERIAL_LINES, iLines);
 
-    for (int i = 0; i < vertices; i++)
+    for (int i = 0; i < iLines * 2; i++)
     {
-        const BrushVertex_t& vertex = m_pVertices[i];
-
-        builder.Position3fv(vertex.m_Pos.Base());
-        builder.Normal3fv(vertex.m_Normal.Base());
-        builder.Color4ub(outlineColor.r(), outlineColor.g(), outlineColor.b(), outlineColor.a());
+        builder.Position3fv(vecLinePoints[i].Base());
+        builder.Normal3f(0.0f, 0.0f, 1.0f);
+        builder.Color4ub(color.r(), color.g(), color.b(), color.a());
         builder.AdvanceVertex();
     }
 
-    builder.End(false, true);
-    return false;
+    builder.End();
+}
+
+void CZoneOutlineMesh::Draw(const matrix3x4_t &modelToWorld)
+{
+    if (!m_pMesh)
+        return;
+
+    CMatRenderContextPtr pRenderContext(materials);
+    pRenderContext->Bind(m_Material);
+
+    pRenderContext->MatrixMode(MATERIAL_MODEL);
+    pRenderContext->PushMatrix();
+    pRenderContext->LoadMatrix(modelToWorld);
+
+    m_pMesh->Draw();
+
+    pRenderContext->MatrixMode(MATERIAL_MODEL);
+    pRenderContext->PopMatrix();
+}
+
+void CZoneOutlineMesh::Destroy()
+{
+    if (m_pMesh)
+    {
+        CMatRenderContextPtr pRenderContext(materials);
+        pRenderContext->DestroyStaticMesh(m_pMesh);
+        m_pMesh = nullptr;
+    }
+
+    m_bBuilt = false;
 }
 
 IMPLEMENT_CLIENTCLASS_DT(C_BaseMomZoneTrigger, DT_BaseMomZoneTrigger, CBaseMomZoneTrigger)
@@ -76,39 +146,136 @@ C_BaseMomZoneTrigger::C_BaseMomZoneTrigger()
 {
     m_flZoneHeight = 0.0f;
     m_iTrackNumber = -1; // TRACK_ALL
+    m_bOutlineDirty = true;
 }
 
-void C_BaseMomZoneTrigger::DrawOutlineModel(const Color& outlineColor)
+void C_BaseMomZoneTrigger::OnDataChanged(DataUpdateType_t type)
 {
-    const int iNum = m_vecZonePoints.Count();
+    BaseClass::OnDataChanged(type);
 
-    if (iNum <= 2)
+    // Zones are only networked when they spawn or get edited
+    m_bOutlineDirty = true;
+}
+
+void C_BaseMomZoneTrigger::DrawOutline(const Color &outlineColor)
+{
+    if (m_bOutlineDirty || !m_OutlineMesh.IsBuilt() || m_OutlineMesh.GetColor() != outlineColor)
+    {
+        CUtlVector<Vector> vecLinePoints;
+        if (GetModel())
+            GetBrushOutlineLines(vecLinePoints);
+        else
+            GetPointOutlineLines(vecLinePoints);
+
+        m_OutlineMesh.Build(vecLinePoints, outlineColor);
+        m_bOutlineDirty = false;
+    }
+
+    if (GetModel())
+    {
+        m_OutlineMesh.Draw(EntityToWorldTransform());
+    }
+    else
+    {
+        matrix3x4_t identity;
+        SetIdentityMatrix(identity);
+        m_OutlineMesh.Draw(identity);
+    }
+}
+
+void C_BaseMomZoneTrigger::GetBrushOutlineLines(CUtlVector<Vector> &vecLinePoints)
+{
+    // The brush surfaces are only handed out while drawing, and only the ones facing the view,
+    // so the edges are taken from the collision model instead
+    vcollide_t *pCollide = modelinfo->GetVCollide(GetModel());
+    if (!pCollide)
         return;
 
-    // Bottom
-    for (int i = 0; i < iNum; i++)
+    struct OutlineEdge_t
     {
-        const auto cur = m_vecZonePoints[i];
-        const auto next = i == (iNum - 1) ? m_vecZonePoints[0] : m_vecZonePoints[i+1];
-        debugoverlay->AddLineOverlayAlpha(cur, next, outlineColor.r(), outlineColor.g(), outlineColor.b(), outlineColor.a(), false, 0.0f);
+        Vector m_vecStart, m_vecEnd, m_vecNormal;
+        bool m_bInner; // Between two triangles of the same face
+    };
+    CUtlVector<OutlineEdge_t> vecEdges;
+
+    for (int iSolid = 0; iSolid < pCollide->solidCount; iSolid++)
+    {
+        Vector *pVerts = nullptr;
+        const int iVerts = physcollision->CreateDebugMesh(pCollide->solids[iSolid], &pVerts);
+
+        for (int iTri = 0; iTri + 2 < iVerts; iTri += 3)
+        {
+            const Vector *pTri = &pVerts[iTri];
+            Vector vecNormal = CrossProduct(pTri[1] - pTri[0], pTri[2] - pTri[0]);
+            if (VectorNormalize(vecNormal) < 0.001f)
+                continue;
+
+            for (int iEdge = 0; iEdge < 3; iEdge++)
+            {
+                const Vector &vecStart = pTri[iEdge];
+                const Vector &vecEnd = pTri[(iEdge + 1) % 3];
+
+                bool bFound = false;
+                FOR_EACH_VEC(vecEdges, i)
+                {
+                    OutlineEdge_t &edge = vecEdges[i];
+                    if ((VectorsAreEqual(edge.m_vecStart, vecEnd, 0.01f) && VectorsAreEqual(edge.m_vecEnd, vecStart, 0.01f)) ||
+                        (VectorsAreEqual(edge.m_vecStart, vecStart, 0.01f) && VectorsAreEqual(edge.m_vecEnd, vecEnd, 0.01f)))
+                    {
+                        edge.m_bInner |= DotProduct(edge.m_vecNormal, vecNormal) > 0.999f;
+                        bFound = true;
+                        break;
+                    }
+                }
+
+                if (!bFound)
+                {
+                    OutlineEdge_t edge = { vecStart, vecEnd, vecNormal, false };
+                    vecEdges.AddToTail(edge);
+                }
+            }
+        }
+
+        physcollision->DestroyDebugMesh(iVerts, pVerts);
     }
 
-    // Connecting lines
-    for (int i = 0; i < iNum; i++)
+    FOR_EACH_VEC(vecEdges, i)
     {
-        const Vector &cur = m_vecZonePoints[i];
-        const Vector next(cur.x, cur.y, cur.z + m_flZoneHeight);
-        debugoverlay->AddLineOverlayAlpha(cur, next, outlineColor.r(), outlineColor.g(), outlineColor.b(), outlineColor.a(), false, 0.0f);
+        if (vecEdges[i].m_bInner)
+            continue;
+
+        vecLinePoints.AddToTail(vecEdges[i].m_vecStart);
+        vecLinePoints.AddToTail(vecEdges[i].m_vecEnd);
     }
+}
+
+void C_BaseMomZoneTrigger::GetPointOutlineLines(CUtlVector<Vector> &vecLinePoints)
+{
+    const int iNum = m_vecZonePoints.Count();
+
+    if (iNum <= 2)
+        return;
+
+    vecLinePoints.EnsureCapacity(iNum * 6);
 
-    // Top
     for (int i = 0; i < iNum; i++)
     {
-        auto cur = m_vecZonePoints[i];
-        auto next = i == (iNum - 1) ? m_vecZonePoints[0] : m_vecZonePoints[i + 1];
-        Vector curUp(cur.x, cur.y, cur.z + m_flZoneHeight);
-        Vector nextUp(next.x, next.y, next.z + m_flZoneHeight);
-        debugoverlay->AddLineOverlayAlpha(curUp, nextUp, outlineColor.r(), outlineColor.g(), outlineColor.b(), outlineColor.a(), false, 0.0f);
+        const Vector &cur = m_vecZonePoints[i];
+        const Vector &next = i == (iNum - 1) ? m_vecZonePoints[0] : m_vecZonePoints[i + 1];
+        const Vector curUp(cur.x, cur.y, cur.z + m_flZoneHeight);
+        const Vector nextUp(next.x, next.y, next.z + m_flZoneHeight);
+
+        // Bottom
+        vecLinePoints.AddToTail(cur);
+        vecLinePoints.AddToTail(next);
+
+        // Connecting line
+        vecLinePoints.AddToTail(cur);
+        vecLinePoints.AddToTail(curUp);
+
+        // Top
+        vecLinePoints.AddToTail(curUp);
+        vecLinePoints.AddToTail(nextUp);
     }
 }
 
@@ -119,23 +286,19 @@ bool C_BaseMomZoneTrigger::ShouldDraw()
 
 int C_BaseMomZoneTrigger::DrawModel(int flags)
 {
+    MOM_PROF_SCOPE("C_BaseMomZoneTrigger::DrawModel");
+
     if (ShouldDrawOutline())
     {
-        if ((flags & STUDIO_RENDER) && (flags & (STUDIO_SHADOWDEPTHTEXTURE | STUDIO_SHADOWDEPTHTEXTURE)) == 0)
+        if ((flags & STUDIO_RENDER) && (flags & STUDIO_SHADOWDEPTHTEXTURE) == 0)
         {
-            if (GetOutlineColor())
+            Color outlineColor;
+            if (GetOutlineColor(outlineColor))
             {
-                if (GetModel())
-                {
-                    render->InstallBrushSurfaceRenderer(&m_OutlineRenderer);
-                    BaseClass::DrawModel(flags);
-                    render->InstallBrushSurfaceRenderer(nullptr);
-                }
-                else
-                {
-                    DrawOutlineModel(m_OutlineRenderer.outlineColor);
+                DrawOutline(outlineColor);
+
+                if (!GetModel())
                     return 1;
-                }
             }
         }
     }
@@ -156,9 +319,9 @@ bool C_TriggerTimerStart::ShouldDrawOutline()
     return mom_zone_start_outline_enable.GetBool();
 }
 
-bool C_TriggerTimerStart::GetOutlineColor()
+bool C_TriggerTimerStart::GetOutlineColor(Color &outColor)
 {
-    return MomUtil::GetColorFromHex(mom_zone_start_outline_color.GetString(), m_OutlineRenderer.outlineColor);
+    return GetCachedOutlineColor(OUTLINE_COLOR_START, outColor);
 }
 
 LINK_ENTITY_TO_CLASS(trigger_momentum_timer_stop, C_TriggerTimerStop);
@@ -171,9 +334,9 @@ bool C_TriggerTimerStop::ShouldDrawOutline()
     return mom_zone_end_outline_enable.GetBool();
 }
 
-bool C_TriggerTimerStop::GetOutlineColor()
+bool C_TriggerTimerStop::GetOutlineColor(Color &outColor)
 {
-    return MomUtil::GetColorFromHex(mom_zone_end_outline_color.GetString(), m_OutlineRenderer.outlineColor);
+    return GetCachedOutlineColor(OUTLINE_COLOR_END, outColor);
 }
 
 LINK_ENTITY_TO_CLASS(trigger_momentum_timer_stage, C_TriggerStage);
@@ -186,9 +349,9 @@ bool C_TriggerStage::ShouldDrawOutline()
     return mom_zone_stage_outline_enable.GetBool();
 }
 
-bool C_TriggerStage::GetOutlineColor()
+bool C_TriggerStage::GetOutlineColor(Color &outColor)
 {
-    return MomUtil::GetColorFromHex(mom_zone_stage_outline_color.GetString(), m_OutlineRenderer.outlineColor);
+    return GetCachedOutlineColor(OUTLINE_COLOR_STAGE, outColor);
 }
 
 LINK_ENTITY_TO_CLASS(trigger_momentum_timer_checkpoint, C_TriggerCheckpoint);
@@ -201,9 +364,9 @@ bool C_TriggerCheckpoint::ShouldDrawOutline()
     return mom_zone_checkpoint_outline_enable.GetBool();
 }
 
-bool C_TriggerCheckpoint::GetOutlineColor()
+bool C_TriggerCheckpoint::GetOutlineColor(Color &outColor)
 {
-    return MomUtil::GetColorFromHex(mom_zone_checkpoint_outline_color.GetString(), m_OutlineRenderer.outlineColor);
+    return GetCachedOutlineColor(OUTLINE_COLOR_CHECKPOINT, outColor);
 }
 
 LINK_ENTITY_TO_CLASS(trigger_momentum_slide, C_TriggerSlide);
@@ -1,15 +1,27 @@
 #pragma once
 
-class CTriggerOutlineRenderer : public IBrushRenderer
+#include "materialsystem/MaterialSystemUtil.h"
+
+// Outline of a zone baked into a static mesh of lines. It is only rebuilt when the zone or its color changes.
+class CZoneOutlineMesh
 {
 public:
-    CTriggerOutlineRenderer();
-    virtual ~CTriggerOutlineRenderer();
-    bool RenderBrushModelSurface(IClientEntity* pBaseEntity, IBrushSurface* pBrushSurface) OVERRIDE;
-    Color outlineColor;
+    CZoneOutlineMesh();
+    ~CZoneOutlineMesh();
+
+    // Points are taken in pairs, one line each
+    void Build(const CUtlVector<Vector> &vecLinePoints, const Color &color);
+    void Draw(const matrix3x4_t &modelToWorld);
+    void Destroy();
+
+    bool IsBuilt() const { return m_bBuilt; }
+    const Color &GetColor() const { return m_Color; }
+
 private:
-    BrushVertex_t *m_pVertices;
-    int m_vertexCount;
+    IMesh *m_pMesh;
+    CMaterialReference m_Material;
+    Color m_Color;
+    bool m_bBuilt;
 };
 
 class C_BaseMomZoneTrigger : public C_BaseEntity
@@ -21,9 +33,9 @@ public:
     C_BaseMomZoneTrigger();
 
     virtual bool ShouldDrawOutline() { return false; }
-    virtual bool GetOutlineColor() { return false; }
+    virtual bool GetOutlineColor(Color &outColor) { return false; }
 
-    void DrawOutlineModel(const Color &outlineColor);
+    void OnDataChanged(DataUpdateType_t type) OVERRIDE;
     bool ShouldDraw() OVERRIDE;
     int DrawModel(int flags) OVERRIDE;
 
@@ -33,7 +45,13 @@ public:
     float m_flZoneHeight;
 
 protected:
-    CTriggerOutlineRenderer m_OutlineRenderer;
+    void DrawOutline(const Color &outlineColor);
+    // Model space edges of the brush model, world space edges of the point zone
+    void GetBrushOutlineLines(CUtlVector<Vector> &vecLinePoints);
+    void GetPointOutlineLines(CUtlVector<Vector> &vecLinePoints);
+
+    CZoneOutlineMesh m_OutlineMesh;
+    bool m_bOutlineDirty;
 };
 
 class C_TriggerTimerStart : public C_BaseMomZoneTrigger
@@ -42,7 +60,7 @@ class C_TriggerTimerStart : public C_BaseMomZoneTrigger
     DECLARE_CLASS(C_TriggerTimerStart, C_BaseMomZoneTrigger);
     DECLARE_CLIENTCLASS();
     bool ShouldDrawOutline() OVERRIDE;
-    bool GetOutlineColor() OVERRIDE;
+    bool GetOutlineColor(Color &outColor) OVERRIDE;
 };
 
 class C_TriggerTimerStop : public C_BaseMomZoneTrigger
@@ -52,7 +70,7 @@ class C_TriggerTimerStop : public C_BaseMomZoneTrigger
     DECLARE_CLIENTCLASS();
 
     bool ShouldDrawOutline() OVERRIDE;
-    bool GetOutlineColor() OVERRIDE;
+    bool GetOutlineColor(Color &outColor) OVERRIDE;
 };
 
 class C_TriggerStage : public C_BaseMomZoneTrigger
@@ -62,7 +80,7 @@ public:
     DECLARE_CLIENTCLASS();
 
     bool ShouldDrawOutline() OVERRIDE;
-    bool GetOutlineColor() OVERRIDE;
+    bool GetOutlineColor(Color &outColor) OVERRIDE;
 };
 
 class C_TriggerCheckpoint : public C_BaseMomZoneTrigger
@@ -72,7 +90,7 @@ public:
     DECLARE_CLIENTCLASS();
 
     bool ShouldDrawOutline() OVERRIDE;
-    bool GetOutlineColor() OVERRIDE;
+    bool GetOutlineColor(Color &outColor) OVERRIDE;
 };
 
 class C_TriggerSlide : public C_BaseMomZoneTrigger
@@ -8,8 +8,15 @@
 
 #include "IMessageboxPanel.h"
 
+#include "tier0/valve_minmax_off.h"
+#include <cryptopp/sha.h>
+#include <cryptopp/hex.h>
+#include "tier0/valve_minmax_on.h"
+
 #include "tier0/memdbgon.h"
 
+#define DOWNLOAD_PART_EXT ".part"
+
 static MAKE_TOGGLE_CONVAR(mom_api_log_requests, "0", FCVAR_ARCHIVE | FCVAR_REPLICATED, "If 1, API requests will be logged to console.\n");
 static MAKE_TOGGLE_CONVAR(mom_api_log_requests_sensitive, "0", FCVAR_ARCHIVE | FCVAR_REPLICATED, "If 1, API requests that are sensitive will also be logged to console.\n"
 "!!!!!!! DANGER! Only set this if you know what you are doing! This could potentially expose an API key! !!!!!!!");
@@ -331,11 +338,204 @@ HTTPRequestHandle CAPIRequests::DownloadFile(const char* pszURL, CallbackFunc si
     return handle;
 }
 
+// Hashes what an earlier attempt downloaded, then the data that came in meanwhile
+static unsigned HashPartFileThread(void *pParam)
+{
+    DownloadRequest *pCall = static_cast<DownloadRequest *>(pParam);
+
+    FileHandle_t hPart = g_pFullFileSystem->Open(CFmtStr("%s" DOWNLOAD_PART_EXT, pCall->m_szFileName), "rb", pCall->m_szFilePathID);
+    if (hPart)
+    {
+        uint8 buf[64 * 1024];
+        uint64 uLeft = pCall->m_uResumeOffset;
+        while (uLeft && !pCall->m_bStopHashing)
+        {
+            const int toRead = uLeft < sizeof(buf) ? static_cast<int>(uLeft) : sizeof(buf);
+            const int read = g_pFullFileSystem->Read(buf, toRead, hPart);
+            if (read <= 0)
+                break;
+
+            pCall->m_pHash->Update(buf, read);
+            uLeft -= read;
+        }
+        g_pFullFileSystem->Close(hPart);
+    }
+
+    CUtlVector<uint8> vecPending;
+    while (!pCall->m_bStopHashing)
+    {
+        {
+            AUTO_LOCK(pCall->m_HashMutex);
+            if (pCall->m_vecPendingHash.IsEmpty())
+            {
+                pCall->m_bPartHashed = true;
+                break;
+            }
+            vecPending.Swap(pCall->m_vecPendingHash);
+        }
+
+        pCall->m_pHash->Update(vecPending.Base(), vecPending.Count());
+        vecPending.RemoveAll();
+    }
+
+    return 0;
+}
+
+// Waits for the part file hash, or stops it when the hash isn't needed anymore
+static void JoinHashThread(DownloadRequest *pCall, bool bStop)
+{
+    if (!pCall->m_hHashThread)
+        return;
+
+    pCall->m_bStopHashing = bStop;
+    ThreadJoin(pCall->m_hHashThread);
+    ReleaseThreadHandle(pCall->m_hHashThread);
+    pCall->m_hHashThread = nullptr;
+}
+
+static void HashDownloadData(DownloadRequest *pCall, const uint8 *pData, uint32 size)
+{
+    {
+        AUTO_LOCK(pCall->m_HashMutex);
+        if (!pCall->m_bPartHashed)
+        {
+            pCall->m_vecPendingHash.AddMultipleToTail(size, pData);
+            return;
+        }
+    }
+
+    pCall->m_pHash->Update(pData, size);
+}
+
+HTTPRequestHandle CAPIRequests::DownloadFileToDisk(const char *pszURL, CallbackFunc size, CallbackFunc prog, CallbackFunc end,
+                                                   const char *pFileName, const char *pFileHash, const char *pFilePathID /* = "GAME"*/,
+                                                   bool bAuth /* = false*/)
+{
+    if (!pFileName)
+        return INVALID_HTTPREQUEST_HANDLE;
+
+    APIRequest *req = new APIRequest;
+    if (!CreateAPIRequest(req, pszURL, k_EHTTPMethodGET, bAuth))
+    {
+        delete req;
+        return INVALID_HTTPREQUEST_HANDLE;
+    }
+
+    HTTPRequestHandle handle = req->handle;
+    delete req;
+
+    DownloadRequest *callback = new DownloadRequest();
+    callback->handle = handle;
+    callback->sizeFunc = size;
+    callback->progressFunc = prog;
+    callback->completeFunc = end;
+    callback->m_bStreamToFile = true;
+    V_FixupPathName(callback->m_szFileName, sizeof(callback->m_szFileName), pFileName);
+    Q_strncpy(callback->m_szFilePathID, pFilePathID, sizeof(callback->m_szFilePathID));
+    if (pFileHash)
+        Q_strncpy(callback->m_szFileHash, pFileHash, sizeof(callback->m_szFileHash));
+    callback->m_pHash = new CryptoPP::SHA1;
+
+    // Pick up where an interrupted download left off, the hash has to go over what is there already
+    CFmtStr partFile("%s" DOWNLOAD_PART_EXT, callback->m_szFileName);
+    if (g_pFullFileSystem->FileExists(partFile, pFilePathID))
+        callback->m_uResumeOffset = g_pFullFileSystem->Size(partFile, pFilePathID);
+
+    callback->m_hFile = g_pFullFileSystem->Open(partFile, callback->m_uResumeOffset ? "ab" : "wb", pFilePathID);
+    if (!callback->m_hFile)
+    {
+        Warning("%s --- Failed to open %s for writing!\n", __FUNCTION__, partFile.Get());
+        SteamHTTP()->ReleaseHTTPRequest(handle);
+        delete callback->m_pHash;
+        delete callback;
+        return INVALID_HTTPREQUEST_HANDLE;
+    }
+
+    if (callback->m_uResumeOffset)
+        SteamHTTP()->SetHTTPRequestHeaderValue(handle, "Range", CFmtStr("bytes=%llu-", callback->m_uResumeOffset));
+
+    SteamAPICall_t apiHandle;
+    if (!SteamHTTP()->SendHTTPRequestAndStreamResponse(handle, &apiHandle))
+    {
+        Warning("%s --- Failed to send HTTP request for downloading!\n", __FUNCTION__);
+        SteamHTTP()->ReleaseHTTPRequest(handle); // GC
+        g_pFullFileSystem->Close(callback->m_hFile);
+        delete callback->m_pHash;
+        delete callback;
+        return INVALID_HTTPREQUEST_HANDLE;
+    }
+
+    // Big part files take a while to hash, the data is only needed by the time the download completes
+    if (callback->m_uResumeOffset)
+    {
+        callback->m_bPartHashed = false;
+        callback->m_hHashThread = CreateSimpleThread(&HashPartFileThread, callback);
+    }
+
+    callback->m_dSentTime = Plat_FloatTime();
+    callback->completeResult = new CCallResult<CAPIRequests, HTTPRequestCompleted_t>();
+    callback->completeResult->Set(apiHandle, this, &CAPIRequests::OnDownloadHTTPComplete);
+    m_mapDownloadCalls.Insert(handle, callback);
+    return handle;
+}
+
+void CAPIRequests::FinishDiskDownload(DownloadRequest *pCall, bool bSuccess, KeyValues *pKvComplete)
+{
+    pKvComplete->SetUint64("resumed", pCall->m_uResumeOffset);
+
+    JoinHashThread(pCall, !bSuccess);
+
+    if (pCall->m_hFile)
+    {
+        g_pFullFileSystem->Close(pCall->m_hFile);
+        pCall->m_hFile = FILESYSTEM_INVALID_HANDLE;
+    }
+
+    CFmtStr partFile("%s" DOWNLOAD_PART_EXT, pCall->m_szFileName);
+
+    if (bSuccess)
+    {
+        byte digest[CryptoPP::SHA1::DIGESTSIZE];
+        pCall->m_pHash->Final(digest);
+
+        std::string hash;
+        CryptoPP::HexEncoder encoder(new CryptoPP::StringSink(hash), false, 0, "");
+        encoder.Put(digest, sizeof(digest));
+        encoder.MessageEnd();
+
+        if (pCall->m_szFileHash[0] && Q_stricmp(hash.c_str(), pCall->m_szFileHash))
+        {
+            Warning("Downloaded %s does not match its hash, deleting it!\n", pCall->m_szFileName);
+            g_pFullFileSystem->RemoveFile(partFile, pCall->m_szFilePathID);
+            pKvComplete->SetBool("hash_mismatch", true);
+            bSuccess = false;
+        }
+        else
+        {
+            if (g_pFullFileSystem->FileExists(pCall->m_szFileName, pCall->m_szFilePathID))
+                g_pFullFileSystem->RemoveFile(pCall->m_szFileName, pCall->m_szFilePathID);
+
+            bSuccess = g_pFullFileSystem->RenameFile(partFile, pCall->m_szFileName, pCall->m_szFilePathID);
+        }
+    }
+
+    // Failed downloads keep their part file to be resumed, cancelled ones are thrown away
+    if (pCall->m_bCancelled)
+        g_pFullFileSystem->RemoveFile(partFile, pCall->m_szFilePathID);
+
+    delete pCall->m_pHash;
+    pCall->m_pHash = nullptr;
+
+    pKvComplete->SetBool("error", !bSuccess);
+}
+
 bool CAPIRequests::CancelDownload(HTTPRequestHandle handle)
 {
     const auto downloadCallbackIndx = m_mapDownloadCalls.Find(handle);
     if (downloadCallbackIndx != m_mapDownloadCalls.InvalidIndex())
     {
+        m_mapDownloadCalls[downloadCallbackIndx]->m_bCancelled = true;
+
         HTTPRequestCompleted_t mock;
         mock.m_hRequest = handle;
         mock.m_bRequestSuccessful = false;
@@ -367,6 +567,16 @@ void CAPIRequests::Shutdown()
         delete[] m_pAPIKey;
     }
 
+    // Leave the part files of the downloads to disk to be resumed next time
+    FOR_EACH_MAP_FAST(m_mapDownloadCalls, i)
+    {
+        DownloadRequest *pCall = m_mapDownloadCalls[i];
+        JoinHashThread(pCall, true);
+        if (pCall->m_hFile)
+            g_pFullFileSystem->Close(pCall->m_hFile);
+        delete pCall->m_pHash;
+    }
+
     // This also cancels any outstanding API/download requests
     m_mapAPICalls.PurgeAndDeleteElements();
     m_mapDownloadCalls.PurgeAndDeleteElements();
@@ -467,12 +677,34 @@ void CAPIRequests::OnDownloadHTTPHeader(HTTPRequestHeadersReceived_t* pCallback)
 
                 if (fileSize)
                 {
+                    DownloadRequest *call = m_mapDownloadCalls[downloadCallbackIndx];
+
                     KeyValuesAD headers("Headers");
                     headers->SetUint64("request", pCallback->m_hRequest);
-                    headers->SetUint64("size", fileSize);
 
-                    DownloadRequest *call = m_mapDownloadCalls[downloadCallbackIndx];
-                    call->m_bufFileData.EnsureCapacity(fileSize);
+                    if (call->m_bStreamToFile)
+                    {
+                        // The server may not do ranges and send the whole file instead, start over then
+                        uint32 rangeSize;
+                        if (call->m_uResumeOffset && !SteamHTTP()->GetHTTPResponseHeaderSize(pCallback->m_hRequest, "Content-Range", &rangeSize))
+                        {
+                            JoinHashThread(call, true);
+                            g_pFullFileSystem->Close(call->m_hFile);
+                            call->m_hFile = g_pFullFileSystem->Open(CFmtStr("%s" DOWNLOAD_PART_EXT, call->m_szFileName), "wb", call->m_szFilePathID);
+                            call->m_bPartHashed = true;
+                            call->m_vecPendingHash.Purge();
+                            call->m_pHash->Restart();
+                            call->m_uResumeOffset = 0;
+                        }
+
+                        headers->SetUint64("size", fileSize + call->m_uResumeOffset);
+                    }
+                    else
+                    {
+                        headers->SetUint64("size", fileSize);
+                        call->m_bufFileData.EnsureCapacity(fileSize);
+                    }
+
                     call->sizeFunc(headers);
                 }
             }
@@ -492,16 +724,27 @@ void CAPIRequests::OnDownloadHTTPData(HTTPRequestDataReceived_t* pCallback)
         if (SteamHTTP()->GetHTTPStreamingResponseBodyData(pCallback->m_hRequest, pCallback->m_cOffset, pDataTemp, pCallback->m_cBytesReceived))
         {
             DownloadRequest *call = m_mapDownloadCalls[downloadCallbackIndx];
-            // Add the data to the download buffer
-            call->m_bufFileData.Put(pDataTemp, pCallback->m_cBytesReceived);
+            if (call->m_bStreamToFile)
+            {
+                // Straight to the part file
+                if (call->m_hFile)
+                    g_pFullFileSystem->Write(pDataTemp, pCallback->m_cBytesReceived, call->m_hFile);
+                HashDownloadData(call, pDataTemp, pCallback->m_cBytesReceived);
+            }
+            else
+            {
+                // Add the data to the download buffer
+                call->m_bufFileData.Put(pDataTemp, pCallback->m_cBytesReceived);
+            }
 
             KeyValuesAD prog("Progress");
             prog->SetUint64("request", pCallback->m_hRequest);
             float percent = 0.0f;
             if (SteamHTTP()->GetHTTPDownloadProgressPct(pCallback->m_hRequest, &percent))
                 prog->SetFloat("percent", percent);
-            prog->SetInt("offset", pCallback->m_cOffset);
+            prog->SetInt("offset", pCallback->m_cOffset + call->m_uResumeOffset);
             prog->SetInt("size", pCallback->m_cBytesReceived);
+            prog->SetPtr("data", pDataTemp);
             call->progressFunc(prog);
         }
 
@@ -520,20 +763,37 @@ void CAPIRequests::OnDownloadHTTPComplete(HTTPRequestCompleted_t* pCallback, boo
         KeyValuesAD comp("Complete");
         comp->SetUint64("request", pCallback->m_hRequest);
         comp->SetFloat("duration", Plat_FloatTime() - call->m_dSentTime);
-        if (bIO || !pCallback->m_bRequestSuccessful || pCallback->m_eStatusCode != k_EHTTPStatusCode200OK)
+
+        const bool bSuccess = !bIO && pCallback->m_bRequestSuccessful &&
+            (pCallback->m_eStatusCode == k_EHTTPStatusCode200OK ||
+             (call->m_bStreamToFile && pCallback->m_eStatusCode == k_EHTTPStatusCode206PartialContent));
+
+        if (!bSuccess)
         {
             comp->SetBool("error", true);
             comp->SetInt("code", pCallback->m_eStatusCode);
             comp->SetBool("bIO", bIO);
+
+            // The part file is no good for this file anymore
+            if (call->m_bStreamToFile && pCallback->m_eStatusCode == k_EHTTPStatusCode416RequestedRangeNotSatisfiable)
+                call->m_bCancelled = true;
         }
-        else if (call->m_bSaveToFile)
+
+        if (call->m_bStreamToFile)
         {
-            bool bWrote = g_pFullFileSystem->WriteFile(call->m_szFileName, call->m_szFilePathID, call->m_bufFileData);
-            comp->SetBool("error", !bWrote);
+            FinishDiskDownload(call, bSuccess, comp);
         }
-        else
+        else if (bSuccess)
         {
-            comp->SetPtr("buf", &call->m_bufFileData);
+            if (call->m_bSaveToFile)
+            {
+                bool bWrote = g_pFullFileSystem->WriteFile(call->m_szFileName, call->m_szFilePathID, call->m_bufFileData);
+                comp->SetBool("error", !bWrote);
+            }
+            else
+            {
+                comp->SetPtr("buf", &call->m_bufFileData);
+            }
         }
         call->completeFunc(comp);
         m_mapDownloadCalls.RemoveAt(downloadCallbackIndx);
@@ -692,4 +952,36 @@ bool CAPIRequests::CheckAPIResponse(HTTPRequestCompleted_t* pCallback, bool bIOF
 }
 
 CAPIRequests s_APIRequests;
-CAPIRequests *g_pAPIRequests = &s_APIRequests;
\ No newline at end of file
+CAPIRequests *g_pAPIRequests = &s_APIRequests;
+
+static void OnDebugDownloadSize(KeyValues *pKv)
+{
+    Msg("Downloading %llu bytes...\n", pKv->GetUint64("size"));
+}
+
+static void OnDebugDownloadProgress(KeyValues *pKv) {}
+
+static void OnDebugDownloadEnd(KeyValues *pKv)
+{
+    if (pKv->GetBool("error"))
+        Warning("Download failed (code %i%s).\n", pKv->GetInt("code"), pKv->GetBool("hash_mismatch") ? ", hash mismatch" : "");
+    else
+        Msg("Download done in %.2f seconds, %llu bytes were resumed.\n", pKv->GetFloat("duration"), pKv->GetUint64("resumed"));
+}
+
+// For trying the resumable downloads out against any (local) file server
+CON_COMMAND(mom_download_file, "Downloads a file the way maps are downloaded, resuming it if it was interrupted.\n"
+                               "Usage: mom_download_file <URL> <file, relative to the game folder> [SHA1]\n")
+{
+    if (args.ArgC() < 3)
+    {
+        Msg("%s", mom_download_file_command.GetHelpText());
+        return;
+    }
+
+    if (g_pAPIRequests->DownloadFileToDisk(args[1], UtlMakeDelegate(&OnDebugDownloadSize), UtlMakeDelegate(&OnDebugDownloadProgress),
+                                           UtlMakeDelegate(&OnDebugDownloadEnd), args[2], args.ArgC() > 3 ? args[3] : nullptr) == INVALID_HTTPREQUEST_HANDLE)
+    {
+        Warning("Failed to start downloading %s!\n", args[1]);
+    }
+}
@@ -5,10 +5,16 @@
 #include "steam/isteamhttp.h"
 #include "steam/isteamuser.h"
 #include "utldelegate.h"
+#include "filesystem.h"
+#include "tier0/threadtools.h"
 
 typedef CUtlDelegate<void (KeyValues *pKv)> CallbackFunc;
 
 class CAPIRequests;
+namespace CryptoPP
+{
+    class SHA1;
+}
 
 struct APIRequest
 {
@@ -41,11 +47,14 @@ struct APIRequest
 
 struct DownloadRequest
 {
-    DownloadRequest() : handle(INVALID_HTTPREQUEST_HANDLE), completeResult(nullptr), m_bSaveToFile(true)
+    DownloadRequest() : handle(INVALID_HTTPREQUEST_HANDLE), completeResult(nullptr), m_bSaveToFile(true),
+        m_bStreamToFile(false), m_hFile(FILESYSTEM_INVALID_HANDLE), m_uResumeOffset(0), m_pHash(nullptr),
+        m_bCancelled(false), m_hHashThread(nullptr), m_bPartHashed(true), m_bStopHashing(false)
     {
         m_szFileName[0] = '\0';
         m_szFilePathID[0] = '\0';
         m_szURL[0] = '\0';
+        m_szFileHash[0] = '\0';
     }
 
     ~DownloadRequest()
@@ -67,6 +76,7 @@ struct DownloadRequest
     //  "percent"   (float)     The percent of download completion (NOTE: not very reliable for progress, use offset and size!)
     //  "offset"    (uint32)    The offset (from 0) of the bytes being downloaded
     //  "size"      (uint32)    The size of the chunk of data being downloaded, in bytes
+    //  "data"      (pointer)   The chunk of data, only valid during the call
     CallbackFunc progressFunc;
     // The last function to be called when downloading a file.
     // Data in the response KeyValues:
@@ -75,6 +85,9 @@ struct DownloadRequest
     //  "code"      (int)       The HTTP status code of the request if it failed, otherwise 0
     //  "duration"  (float)     The amount of time in seconds it took to download the file
     //  "buf"       (pointer)   If the request was created with a nullptr filename, a pointer to the buffer is passed here
+    // Downloads made with DownloadFileToDisk also pass:
+    //  "resumed"   (uint64)    How many bytes were already downloaded by an earlier attempt
+    //  "hash_mismatch" (bool)  If the file was complete but did not match the expected hash (it is deleted)
     CallbackFunc completeFunc;
 
     char m_szURL[256];
@@ -84,6 +97,22 @@ struct DownloadRequest
     double m_dSentTime;
     CUtlBuffer m_bufFileData;
 
+    // DownloadFileToDisk, the data goes straight to the part file instead of m_bufFileData
+    bool m_bStreamToFile;
+    FileHandle_t m_hFile;
+    uint64 m_uResumeOffset;
+    CryptoPP::SHA1 *m_pHash; // Of everything in the part file so far
+    char m_szFileHash[41];
+    bool m_bCancelled;
+
+    // The part file of an earlier attempt is hashed on a worker thread, the data that comes in meanwhile
+    // waits in m_vecPendingHash until the worker catches up and sets m_bPartHashed
+    ThreadHandle_t m_hHashThread;
+    CThreadMutex m_HashMutex;
+    CUtlVector<uint8> m_vecPendingHash;
+    bool m_bPartHashed;
+    volatile bool m_bStopHashing;
+
     bool operator==(const DownloadRequest &other) const
     {
         return handle == other.handle;
@@ -168,6 +197,20 @@ public:
     HTTPRequestHandle DownloadFile(const char *pszURL, CallbackFunc size, CallbackFunc prog, CallbackFunc end,
                                    const char *pFileName, const char *pFilePathID = "GAME", bool bAuth = false);
 
+    /**
+     * Downloads a file straight to disk, for files too big to be kept in memory (maps).
+     * The data is appended to "<pFileName>.part" as it arrives and hashed on the way. If the part file is already there
+     * from an interrupted download, only the rest of the file is requested (HTTP range request).
+     * Once complete and matching pFileHash, the part file is renamed to pFileName, so pFileName is never partial.
+     * The size and progress functions get the size and offsets of the whole file, not just of what is left of it.
+     * @param pFileHash     (Optional) The SHA1 the file must have, lowercase hex, nullptr to not check it
+     * See DownloadFile for the other parameters.
+     * @return The handle of the request, will be an invalid handle if the request fails
+     */
+    HTTPRequestHandle DownloadFileToDisk(const char *pszURL, CallbackFunc size, CallbackFunc prog, CallbackFunc end,
+                                         const char *pFileName, const char *pFileHash, const char *pFilePathID = "GAME",
+                                         bool bAuth = false);
+
     /**
      * @param handle    The handle of the request to cancel
      * @return true if the download was cancelled, otherwise false
@@ -187,6 +230,8 @@ protected:
     STEAM_CALLBACK(CAPIRequests, OnDownloadHTTPHeader, HTTPRequestHeadersReceived_t);
     STEAM_CALLBACK(CAPIRequests, OnDownloadHTTPData, HTTPRequestDataReceived_t);
     void OnDownloadHTTPComplete(HTTPRequestCompleted_t *pParam, bool bIO);
+    // Closes the part file of a DownloadFileToDisk request, and moves it in place if it is complete and good
+    void FinishDiskDownload(DownloadRequest *pCall, bool bSuccess, KeyValues *pKvComplete);
 
     // Base HTTP response method, the CallbackFunc is passed the JSON object here
     void OnHTTPResp(HTTPRequestCompleted_t *pParam, bool bIOFailure);
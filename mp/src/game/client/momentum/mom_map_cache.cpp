@@ -142,11 +142,12 @@ bool CMapCache::StartDownloadingMap(MapData* pData)
 {
     // We either don't have it, or it's outdated, so let's get the latest one!
     const char *pFilePath = CFmtStr("maps/%s.bsp", pData->m_szMapName).Get();
-    HTTPRequestHandle handle = g_pAPIRequests->DownloadFile(pData->m_szDownloadURL,
-                                                            UtlMakeDelegate(this, &CMapCache::MapDownloadSize),
-                                                            UtlMakeDelegate(this, &CMapCache::MapDownloadProgress),
-                                                            UtlMakeDelegate(this, &CMapCache::MapDownloadEnd),
-                                                            pFilePath, "GAME", true);
+    // Written straight to disk and checked against the map hash as it downloads, resuming any interrupted download
+    HTTPRequestHandle handle = g_pAPIRequests->DownloadFileToDisk(pData->m_szDownloadURL,
+                                                                  UtlMakeDelegate(this, &CMapCache::MapDownloadSize),
+                                                                  UtlMakeDelegate(this, &CMapCache::MapDownloadProgress),
+                                                                  UtlMakeDelegate(this, &CMapCache::MapDownloadEnd),
+                                                                  pFilePath, pData->m_szHash, "GAME", true);
     if (handle != INVALID_HTTPREQUEST_HANDLE)
     {
         m_mapFileDownloads.Insert(handle, pData->m_uID);
@@ -174,6 +175,7 @@ bool CMapCache::AddMapToDownloadQueue(MapData *pData)
         return StartDownloadingMap(pData); // Just add it to the active downloads
 
     m_mapQueuedDownload.Insert(pData->m_uID, pData);
+    m_vecQueuedDownloadOrder.AddToTail(pData->m_uID);
     MapDownloadQueued(pData, true);
 
     return true;
@@ -315,6 +317,7 @@ void CMapCache::AddMapToCache(KeyValues* pMap, APIModelSource source)
     {
         // Update it
         *m_mapMapCache[indx] = *pData;
+        m_SearchIndex.UpdateMap(m_mapMapCache[indx]);
         // Update other UI about this update if need be
         if (m_mapMapCache[indx]->WasUpdated())
             m_mapMapCache[indx]->SendDataUpdate();
@@ -325,6 +328,7 @@ void CMapCache::AddMapToCache(KeyValues* pMap, APIModelSource source)
     {
         m_dictMapNames.Insert(pData->m_szMapName, pData->m_uID);
         m_mapMapCache.Insert(pData->m_uID, pData);
+        m_SearchIndex.UpdateMap(pData);
 
         // Force an update event if not from disk
         if (source != MODEL_FROM_DISK)
@@ -565,6 +569,7 @@ void CMapCache::MapDownloadEnd(KeyValues* pKvComplete)
     if (fileIndx != m_mapFileDownloads.InvalidIndex())
     {
         const auto id = m_mapFileDownloads[fileIndx];
+        bool bRetry = false;
 
         if (pKvComplete->GetBool("error"))
         {
@@ -573,6 +578,9 @@ void CMapCache::MapDownloadEnd(KeyValues* pKvComplete)
                 Log("Download of map %u cancelled successfully.\n", id);
             else
                 Warning("Could not download map! Error code: %i\n", code);
+
+            // The part of it that was downloaded before was likely of an older version of the map, it's gone now
+            bRetry = pKvComplete->GetBool("hash_mismatch") && pKvComplete->GetUint64("resumed") > 0;
         }
         else
         {
@@ -593,12 +601,41 @@ void CMapCache::MapDownloadEnd(KeyValues* pKvComplete)
         pEvent->SetInt("id", id);
         g_pModuleComms->FireEvent(pEvent, FIRE_LOCAL_ONLY);
 
+        MapData *pRetry = bRetry ? GetMapDataByID(id) : nullptr;
+        if (pRetry && StartDownloadingMap(pRetry))
+            return;
+
         // Check and add to download
-        if (m_mapQueuedDownload.Count())
-            DownloadMap(m_mapQueuedDownload.Key(m_mapQueuedDownload.FirstInorder()));
+        StartQueuedDownloads();
     }
 }
 
+void CMapCache::StartQueuedDownloads()
+{
+    // Copied, starting a download takes it off the queue
+    CUtlVector<uint32> vecQueued;
+    vecQueued.CopyArray(m_vecQueuedDownloadOrder.Base(), m_vecQueuedDownloadOrder.Count());
+
+    FOR_EACH_VEC(vecQueued, i)
+    {
+        if ((unsigned)mom_map_download_queue_parallel.GetInt() <= m_mapFileDownloads.Count())
+            break;
+
+        // It was okay to overwrite the map when it was queued
+        if (DownloadMap(vecQueued[i], true) != MAP_DL_OK)
+            RemoveMapFromDownloadQueue(vecQueued[i], true);
+    }
+}
+
+bool CMapCache::PrioritizeDownload(uint32 uMapID)
+{
+    if (!m_vecQueuedDownloadOrder.FindAndRemove(uMapID))
+        return false;
+
+    m_vecQueuedDownloadOrder.AddToHead(uMapID);
+    return true;
+}
+
 bool CMapCache::IsMapDownloading(uint32 uMapID)
 {
     auto indx = m_mapFileDownloads.FirstInorder();
@@ -623,19 +660,7 @@ void CMapCache::OnDownloadQueueSizeChanged()
 {
     // We only care if it got bigger, and if we have queued maps... smaller/no queue doesn't affect anything
     if (m_mapQueuedDownload.Count())
-    {
-        const int diff = mom_map_download_queue_parallel.GetInt() - m_mapFileDownloads.Count();
-        if (diff > 0)
-        {
-            int count = 0;
-            // Work backwards as adding to active downloads is going to remove from here
-            for(auto i = m_mapQueuedDownload.MaxElement(); m_mapQueuedDownload.IsValidIndex(i) && count < diff; i--)
-            {
-                if (StartDownloadingMap(m_mapQueuedDownload[i]))
-                    count++;
-            }
-        }
-    }
+        StartQueuedDownloads();
 }
 
 void CMapCache::OnDownloadQueueToggled()
@@ -646,9 +671,11 @@ void CMapCache::OnDownloadQueueToggled()
         // Only start downloading if auto is 1
         if (mom_map_download_auto.GetBool())
         {
-            // Work backwards as adding to active downloads is going to remove from here
-            for (auto i = m_mapQueuedDownload.MaxElement(); m_mapQueuedDownload.IsValidIndex(i); i--)
-                StartDownloadingMap(m_mapQueuedDownload[i]);
+            // Copied, as adding to active downloads is going to remove from here
+            CUtlVector<uint32> vecQueued;
+            vecQueued.CopyArray(m_vecQueuedDownloadOrder.Base(), m_vecQueuedDownloadOrder.Count());
+            FOR_EACH_VEC(vecQueued, i)
+                StartDownloadingMap(m_mapQueuedDownload[m_mapQueuedDownload.Find(vecQueued[i])]);
         }
         else
         {
@@ -656,6 +683,7 @@ void CMapCache::OnDownloadQueueToggled()
             FOR_EACH_MAP_FAST(m_mapQueuedDownload, i)
                 MapDownloadQueued(m_mapQueuedDownload[i], false);
             m_mapQueuedDownload.RemoveAll();
+            m_vecQueuedDownloadOrder.RemoveAll();
         }
     }
 }
@@ -669,6 +697,7 @@ void CMapCache::RemoveMapFromDownloadQueue(uint32 uMapID, bool bSendEvent /* = f
             MapDownloadQueued(m_mapQueuedDownload[indx], false);
 
         m_mapQueuedDownload.RemoveAt(indx);
+        m_vecQueuedDownloadOrder.FindAndRemove(uMapID);
     }
 }
 
@@ -677,6 +706,7 @@ void CMapCache::PostInit()
     ListenForGameEvent("site_auth");
 
     g_pModuleComms->ListenForEvent("pre_level_init", UtlMakeDelegate(this, &CMapCache::PreLevelInit));
+    g_pModuleComms->ListenForEvent("map_data_update", UtlMakeDelegate(this, &CMapCache::OnMapDataUpdate));
 
     // Load the cache from disk
     LoadMapCacheFromDisk();
@@ -715,6 +745,15 @@ void CMapCache::PreLevelInit(KeyValues* pKv)
     SetMapGamemode(pMapName);
 }
 
+void CMapCache::OnMapDataUpdate(KeyValues* pKv)
+{
+    // Only the main data, the info and the personal best hold indexed fields
+    if (!pKv->GetBool("main") && !pKv->GetBool("info") && !pKv->GetBool("pb"))
+        return;
+
+    m_SearchIndex.UpdateMap(GetMapDataByID(pKv->GetInt("id")));
+}
+
 void CMapCache::LevelInitPreEntity()
 {
     if (m_pCurrentMapData && m_pCurrentMapData->m_bInLibrary)
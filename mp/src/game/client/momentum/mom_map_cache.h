@@ -3,6 +3,7 @@
 #include "mom_api_models.h"
 #include "steam/isteamhttp.h"
 #include "IMapList.h"
+#include "mom_map_search_index.h"
 
 enum MapDownloadResponse
 {
@@ -43,6 +44,8 @@ public:
     void AddMapToCache(KeyValues *pMap, APIModelSource source);
     void FireMapCacheUpdateEvent(APIModelSource source);
 
+    const CMapSearchIndex *GetSearchIndex() const { return &m_SearchIndex; }
+
     bool UpdateMapInfo(uint32 uMapID);
     uint32 GetUpdateIntervalForMap(MapData *pData);
 
@@ -51,9 +54,12 @@ public:
     void OnDownloadQueueSizeChanged();
     void OnDownloadQueueToggled();
     void RemoveMapFromDownloadQueue(uint32 uMapID, bool bSendEvent = false);
+    // Moves a queued map to the front of the download queue
+    bool PrioritizeDownload(uint32 uMapID);
 protected:
     void PostInit() OVERRIDE;
     void PreLevelInit(KeyValues *pKv); // Called from server before Server's LevelInitPre/Post entity
+    void OnMapDataUpdate(KeyValues *pKv); // Keeps the search index in sync with the changes made to the maps
     void LevelInitPreEntity() OVERRIDE;
     void LevelShutdownPostEntity() OVERRIDE;
     void Shutdown() OVERRIDE;
@@ -85,6 +91,7 @@ private:
     void ToggleMapLibraryOrFavorite(KeyValues *pKv, bool bIsLibrary, bool bAdded);
     bool StartDownloadingMap(MapData *pData);
     bool AddMapToDownloadQueue(MapData *pData);
+    void StartQueuedDownloads(); // Fills up the free parallel downloads from the queue
 
     MapData *m_pCurrentMapData;
 
@@ -92,7 +99,10 @@ private:
     CUtlMap<uint32, MapData*> m_mapMapCache;
     CUtlMap<uint32, MapData*> m_mapQueuedDelete;
     CUtlMap<uint32, MapData*> m_mapQueuedDownload;
+    CUtlVector<uint32> m_vecQueuedDownloadOrder; // The queued maps in the order they get downloaded in
     CUtlMap<HTTPRequestHandle, uint32> m_mapFileDownloads;
+
+    CMapSearchIndex m_SearchIndex;
 };
 
 extern CMapCache* g_pMapCache;
\ No newline at end of file
@@ -0,0 +1,454 @@
+#include "cbase.h"
+
+#include "mom_map_search_index.h"
+#include "mom_api_models.h"
+
+#include "tier0/memdbgon.h"
+
+#define MIN_SLOT_CAPACITY 1024
+
+static uint32 MakeGram(const char *pText, int iLength)
+{
+    uint32 gram = 0;
+    for (int i = 0; i < iLength; i++)
+        gram |= static_cast<uint32>(static_cast<uint8>(pText[i])) << (i * 8);
+    return gram;
+}
+
+static int __cdecl CompareGrams(const uint32 *pGram1, const uint32 *pGram2)
+{
+    return *pGram1 < *pGram2 ? -1 : (*pGram1 > *pGram2 ? 1 : 0);
+}
+
+static int __cdecl ComparePostingSizes(const CUtlVector<int> *const *pPosting1, const CUtlVector<int> *const *pPosting2)
+{
+    return (*pPosting1)->Count() - (*pPosting2)->Count();
+}
+
+// Index of the first slot in the posting that is >= iSlot
+static int PostingLowerBound(const CUtlVector<int> &posting, int iSlot)
+{
+    int iLow = 0, iHigh = posting.Count();
+    while (iLow < iHigh)
+    {
+        const int iMid = (iLow + iHigh) / 2;
+        if (posting[iMid] < iSlot)
+            iLow = iMid + 1;
+        else
+            iHigh = iMid;
+    }
+    return iLow;
+}
+
+CMapSearchIndex::CMapSearchIndex() : m_iSlotCapacity(0)
+{
+    SetDefLessFunc(m_mapSlotsByMapID);
+    SetDefLessFunc(m_mapGramPostings);
+    V_memset(m_iDifficultyCounts, 0, sizeof(m_iDifficultyCounts));
+}
+
+void CMapSearchIndex::UpdateMap(const MapData *pData)
+{
+    if (!pData)
+        return;
+
+    int iSlot = GetMapSlot(pData->m_uID);
+    if (iSlot == -1)
+    {
+        iSlot = m_vecEntries.AddToTail();
+        EnsureSlotCapacity(iSlot + 1);
+
+        m_mapSlotsByMapID.Insert(pData->m_uID, iSlot);
+        m_vecEntries[iSlot].m_uMapID = pData->m_uID;
+        m_bitsUsed.Set(iSlot);
+    }
+    else
+    {
+        ClearAttributes(iSlot);
+    }
+
+    SetAttributes(iSlot, pData);
+
+    // Most updates do not touch the name or credits, only redo the postings when they changed
+    CUtlString strText;
+    BuildText(pData, strText);
+    if (Q_strcmp(m_vecEntries[iSlot].m_strText.String(), strText.String()) != 0)
+    {
+        UnindexText(iSlot);
+        IndexText(iSlot, strText.String());
+    }
+}
+
+void CMapSearchIndex::RemoveAll()
+{
+    m_vecEntries.RemoveAll();
+    m_mapSlotsByMapID.RemoveAll();
+    m_mapGramPostings.RemoveAll();
+    m_vecPostings.RemoveAll();
+
+    if (!m_iSlotCapacity)
+        return;
+
+    m_bitsUsed.ClearAll();
+    m_bitsLinear.ClearAll();
+    m_bitsCompleted.ClearAll();
+    for (int i = 0; i < GAMEMODE_COUNT; i++)
+        m_bitsGameMode[i].ClearAll();
+    for (int i = 0; i < 256; i++)
+    {
+        if (m_bitsDifficulty[i].GetNumBits())
+            m_bitsDifficulty[i].ClearAll();
+    }
+    V_memset(m_iDifficultyCounts, 0, sizeof(m_iDifficultyCounts));
+}
+
+int CMapSearchIndex::GetMapSlot(uint32 uMapID) const
+{
+    const auto indx = m_mapSlotsByMapID.Find(uMapID);
+    return m_mapSlotsByMapID.IsValidIndex(indx) ? m_mapSlotsByMapID[indx] : -1;
+}
+
+void CMapSearchIndex::FindMaps(const MapFilters_t &filters, CLargeVarBitVec &result) const
+{
+    if (!m_iSlotCapacity)
+    {
+        result.Resize(BITS_PER_INT, true);
+        return;
+    }
+
+    result.Resize(m_iSlotCapacity, true);
+
+    char szQuery[MAX_MAP_NAME];
+    LowerText(filters.m_szMapName, szQuery, sizeof(szQuery));
+
+    bool bVerify = false;
+    if (szQuery[0])
+        bVerify = MatchText(szQuery, result);
+    else
+        m_bitsUsed.CopyTo(&result);
+
+    ApplyAttributeFilters(filters, result);
+
+    // The grams of longer queries only narrow it down to the maps that have all of them somewhere
+    if (bVerify)
+    {
+        for (int iSlot = result.FindNextSetBit(0); iSlot != -1; iSlot = result.FindNextSetBit(iSlot + 1))
+        {
+            if (!Q_strstr(m_vecEntries[iSlot].m_strText.String(), szQuery))
+                result.Clear(iSlot);
+        }
+    }
+}
+
+bool CMapSearchIndex::SlotPassesFilters(int iSlot, const MapFilters_t &filters) const
+{
+    if (!m_vecEntries.IsValidIndex(iSlot) || !m_vecEntries[iSlot].m_uMapID)
+        return false;
+
+    const MapEntry_t &entry = m_vecEntries[iSlot];
+
+    if (filters.m_szMapName[0])
+    {
+        char szQuery[MAX_MAP_NAME];
+        LowerText(filters.m_szMapName, szQuery, sizeof(szQuery));
+        if (!Q_strstr(entry.m_strText.String(), szQuery))
+            return false;
+    }
+
+    if (filters.m_iDifficultyLow > 0 && entry.m_iDifficulty < filters.m_iDifficultyLow)
+        return false;
+    if (filters.m_iDifficultyHigh > 0 && entry.m_iDifficulty > filters.m_iDifficultyHigh)
+        return false;
+
+    if (filters.m_iGameMode > 0 && filters.m_iGameMode != entry.m_iGameMode)
+        return false;
+
+    if (filters.m_bHideCompleted && entry.m_bCompleted)
+        return false;
+
+    // Map layout (0 = all, 1 = show staged maps only, 2 = show linear maps only)
+    if (filters.m_iMapLayout > 0 && entry.m_bLinear + 1 != filters.m_iMapLayout)
+        return false;
+
+    return true;
+}
+
+void CMapSearchIndex::EnsureSlotCapacity(int iSlots)
+{
+    if (iSlots <= m_iSlotCapacity)
+        return;
+
+    int iCapacity = max(m_iSlotCapacity, MIN_SLOT_CAPACITY);
+    while (iCapacity < iSlots)
+        iCapacity *= 2;
+
+    m_iSlotCapacity = iCapacity;
+
+    // Growing keeps the bits that are set
+    m_bitsUsed.Resize(iCapacity);
+    m_bitsLinear.Resize(iCapacity);
+    m_bitsCompleted.Resize(iCapacity);
+    for (int i = 0; i < GAMEMODE_COUNT; i++)
+        m_bitsGameMode[i].Resize(iCapacity);
+    // Difficulty bitmaps are only allocated once a map has that difficulty
+    for (int i = 0; i < 256; i++)
+    {
+        if (m_bitsDifficulty[i].GetNumBits())
+            m_bitsDifficulty[i].Resize(iCapacity);
+    }
+}
+
+void CMapSearchIndex::SetAttributes(int iSlot, const MapData *pData)
+{
+    MapEntry_t &entry = m_vecEntries[iSlot];
+
+    entry.m_iDifficulty = pData->m_MainTrack.m_iDifficulty;
+    if (m_iDifficultyCounts[entry.m_iDifficulty]++ == 0 && m_bitsDifficulty[entry.m_iDifficulty].GetNumBits() != m_iSlotCapacity)
+        m_bitsDifficulty[entry.m_iDifficulty].Resize(m_iSlotCapacity, true);
+    m_bitsDifficulty[entry.m_iDifficulty].Set(iSlot);
+
+    entry.m_iGameMode = pData->m_eType;
+    if (entry.m_iGameMode >= 0 && entry.m_iGameMode < GAMEMODE_COUNT)
+        m_bitsGameMode[entry.m_iGameMode].Set(iSlot);
+
+    entry.m_bLinear = pData->m_MainTrack.m_bIsLinear;
+    m_bitsLinear.Set(iSlot, entry.m_bLinear);
+
+    entry.m_bCompleted = pData->m_PersonalBest.m_bValid;
+    m_bitsCompleted.Set(iSlot, entry.m_bCompleted);
+}
+
+void CMapSearchIndex::ClearAttributes(int iSlot)
+{
+    MapEntry_t &entry = m_vecEntries[iSlot];
+
+    m_bitsDifficulty[entry.m_iDifficulty].Clear(iSlot);
+    m_iDifficultyCounts[entry.m_iDifficulty]--;
+
+    if (entry.m_iGameMode >= 0 && entry.m_iGameMode < GAMEMODE_COUNT)
+        m_bitsGameMode[entry.m_iGameMode].Clear(iSlot);
+
+    m_bitsLinear.Clear(iSlot);
+    m_bitsCompleted.Clear(iSlot);
+}
+
+void CMapSearchIndex::IndexText(int iSlot, const char *pText)
+{
+    MapEntry_t &entry = m_vecEntries[iSlot];
+    entry.m_strText.Set(pText);
+    GetGrams(pText, entry.m_vecGrams);
+
+    FOR_EACH_VEC(entry.m_vecGrams, i)
+    {
+        const uint32 gram = entry.m_vecGrams[i];
+
+        auto indx = m_mapGramPostings.Find(gram);
+        if (!m_mapGramPostings.IsValidIndex(indx))
+            indx = m_mapGramPostings.Insert(gram, m_vecPostings.AddToTail());
+
+        CUtlVector<int> &posting = m_vecPostings[m_mapGramPostings[indx]];
+        if (posting.IsEmpty() || posting.Tail() < iSlot)
+            posting.AddToTail(iSlot);
+        else
+            posting.InsertBefore(PostingLowerBound(posting, iSlot), iSlot);
+    }
+}
+
+void CMapSearchIndex::UnindexText(int iSlot)
+{
+    MapEntry_t &entry = m_vecEntries[iSlot];
+
+    FOR_EACH_VEC(entry.m_vecGrams, i)
+    {
+        const auto indx = m_mapGramPostings.Find(entry.m_vecGrams[i]);
+        if (!m_mapGramPostings.IsValidIndex(indx))
+            continue;
+
+        CUtlVector<int> &posting = m_vecPostings[m_mapGramPostings[indx]];
+        const int iPos = PostingLowerBound(posting, iSlot);
+        if (iPos < posting.Count() && posting[iPos] == iSlot)
+            posting.Remove(iPos);
+    }
+
+    entry.m_vecGrams.RemoveAll();
+    entry.m_strText.Clear();
+}
+
+bool CMapSearchIndex::MatchText(const char *pLowerText, CLargeVarBitVec &result) const
+{
+    // Queries up to 3 characters are a gram themselves, longer ones have to contain all of their trigrams
+    CUtlVector<uint32> vecGrams;
+    const int iLength = Q_strlen(pLowerText);
+    if (iLength <= 3)
+    {
+        vecGrams.AddToTail(MakeGram(pLowerText, iLength));
+    }
+    else
+    {
+        for (int i = 0; i + 3 <= iLength; i++)
+            vecGrams.AddToTail(MakeGram(pLowerText + i, 3));
+    }
+
+    CUtlVector<const CUtlVector<int> *> vecPostings;
+    FOR_EACH_VEC(vecGrams, i)
+    {
+        const auto pPosting = FindPosting(vecGrams[i]);
+        if (!pPosting || pPosting->IsEmpty())
+        {
+            result.ClearAll();
+            return false;
+        }
+
+        vecPostings.AddToTail(pPosting);
+    }
+
+    // Start from the rarest gram to keep the candidate set small
+    vecPostings.Sort(ComparePostingSizes);
+
+    result.ClearAll();
+    const CUtlVector<int> &first = *vecPostings[0];
+    FOR_EACH_VEC(first, i)
+        result.Set(first[i]);
+
+    if (vecPostings.Count() > 1)
+    {
+        CLargeVarBitVec bits(m_iSlotCapacity);
+        for (int i = 1; i < vecPostings.Count(); i++)
+        {
+            bits.ClearAll();
+            const CUtlVector<int> &posting = *vecPostings[i];
+            FOR_EACH_VEC(posting, j)
+                bits.Set(posting[j]);
+
+            result.And(bits, &result);
+        }
+    }
+
+    return iLength > 3;
+}
+
+void CMapSearchIndex::ApplyAttributeFilters(const MapFilters_t &filters, CLargeVarBitVec &result) const
+{
+    CLargeVarBitVec bits(m_iSlotCapacity);
+
+    // Difficulty
+    if (filters.m_iDifficultyLow > 0 || filters.m_iDifficultyHigh > 0)
+    {
+        const int iLow = filters.m_iDifficultyLow > 0 ? filters.m_iDifficultyLow : 0;
+        const int iHigh = filters.m_iDifficultyHigh > 0 ? min(filters.m_iDifficultyHigh, 255) : 255;
+
+        bits.ClearAll();
+        for (int i = iLow; i <= iHigh; i++)
+        {
+            if (m_iDifficultyCounts[i])
+                bits.Or(m_bitsDifficulty[i], &bits);
+        }
+
+        result.And(bits, &result);
+    }
+
+    // Game mode (if it's a surf/bhop/etc map or not)
+    if (filters.m_iGameMode > 0)
+    {
+        if (filters.m_iGameMode < GAMEMODE_COUNT)
+            result.And(m_bitsGameMode[filters.m_iGameMode], &result);
+        else
+            result.ClearAll();
+    }
+
+    if (filters.m_bHideCompleted)
+    {
+        m_bitsCompleted.Not(&bits);
+        result.And(bits, &result);
+    }
+
+    // Map layout (0 = all, 1 = show staged maps only, 2 = show linear maps only)
+    if (filters.m_iMapLayout == 1)
+    {
+        m_bitsLinear.Not(&bits);
+        result.And(bits, &result);
+    }
+    else if (filters.m_iMapLayout == 2)
+    {
+        result.And(m_bitsLinear, &result);
+    }
+}
+
+const CUtlVector<int> *CMapSearchIndex::FindPosting(uint32 gram) const
+{
+    const auto indx = m_mapGramPostings.Find(gram);
+    return m_mapGramPostings.IsValidIndex(indx) ? &m_vecPostings[m_mapGramPostings[indx]] : nullptr;
+}
+
+void CMapSearchIndex::BuildText(const MapData *pData, CUtlString &out)
+{
+    char szLower[MAX_PLAYER_NAME_LENGTH > MAX_MAP_NAME ? MAX_PLAYER_NAME_LENGTH : MAX_MAP_NAME];
+
+    LowerText(pData->m_szMapName, szLower, sizeof(szLower));
+    out.Append(szLower);
+
+    if (pData->m_Submitter.m_szAlias[0])
+    {
+        LowerText(pData->m_Submitter.m_szAlias, szLower, sizeof(szLower));
+        out.Append('\n');
+        out.Append(szLower);
+    }
+
+    FOR_EACH_VEC(pData->m_vecCredits, i)
+    {
+        const char *pAlias = pData->m_vecCredits[i].m_User.m_szAlias;
+        if (!pAlias[0] || !Q_stricmp(pAlias, pData->m_Submitter.m_szAlias))
+            continue;
+
+        LowerText(pAlias, szLower, sizeof(szLower));
+        out.Append('\n');
+        out.Append(szLower);
+    }
+}
+
+void CMapSearchIndex::GetGrams(const char *pText, CUtlVector<uint32> &vecGrams)
+{
+    vecGrams.RemoveAll();
+
+    // Grams never span two of the newline separated parts
+    const char *pPart = pText;
+    while (*pPart)
+    {
+        int iPartLength = 0;
+        while (pPart[iPartLength] && pPart[iPartLength] != '\n')
+            iPartLength++;
+
+        for (int i = 0; i < iPartLength; i++)
+        {
+            for (int n = 1; n <= 3 && i + n <= iPartLength; n++)
+                vecGrams.AddToTail(MakeGram(pPart + i, n));
+        }
+
+        pPart += iPartLength;
+        if (*pPart == '\n')
+            pPart++;
+    }
+
+    vecGrams.Sort(CompareGrams);
+
+    // Remove the duplicates
+    int iUnique = 0;
+    FOR_EACH_VEC(vecGrams, i)
+    {
+        if (i == 0 || vecGrams[i] != vecGrams[iUnique - 1])
+            vecGrams[iUnique++] = vecGrams[i];
+    }
+    vecGrams.RemoveMultipleFromTail(vecGrams.Count() - iUnique);
+}
+
+void CMapSearchIndex::LowerText(const char *pIn, char *pOut, int outSize)
+{
+    // ASCII only, other bytes (UTF-8) are kept as they are
+    int i = 0;
+    for (; pIn[i] && i < outSize - 1; i++)
+    {
+        const char c = pIn[i];
+        pOut[i] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+    }
+    pOut[i] = '\0';
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "bitvec.h"
+#include "mom_shareddefs.h"
+#include "utlmap.h"
+#include "IMapList.h"
+
+struct MapData;
+
+// In-memory index over the maps of the map cache, used by the map list filters.
+// Every map gets a slot, and the filters are answered with bitmaps over the slots: one per difficulty and game mode,
+// and one for the linear and completed maps. The text filter is matched against the map name and the aliases of the
+// submitter and credited people (case insensitive), using the posting lists of every 1, 2 and 3 character gram of them.
+class CMapSearchIndex
+{
+public:
+    CMapSearchIndex();
+
+    // Adds the map, or reindexes it if it is already in the index. Maps stay in the map cache once they are in it
+    // (deleting a map only removes its file), so they are never taken out of the index either.
+    void UpdateMap(const MapData *pData);
+    void RemoveAll();
+
+    // Returns the slot of the map, -1 if it is not indexed. Slots stay the same until RemoveAll.
+    int GetMapSlot(uint32 uMapID) const;
+    int GetSlotCount() const { return m_iSlotCapacity; }
+
+    // Sets the bit of the slot of every map passing the filters, the result is resized to GetSlotCount() bits
+    void FindMaps(const MapFilters_t &filters, CLargeVarBitVec &result) const;
+    bool SlotPassesFilters(int iSlot, const MapFilters_t &filters) const;
+
+private:
+    struct MapEntry_t
+    {
+        uint32 m_uMapID;
+        uint8 m_iDifficulty;
+        int m_iGameMode;
+        bool m_bLinear;
+        bool m_bCompleted;
+        CUtlString m_strText; // Lowercase name and aliases, separated by newlines
+        CUtlVector<uint32> m_vecGrams; // Sorted, the posting lists this entry is in
+    };
+
+    void EnsureSlotCapacity(int iSlots);
+    void SetAttributes(int iSlot, const MapData *pData);
+    void ClearAttributes(int iSlot);
+    void IndexText(int iSlot, const char *pText);
+    void UnindexText(int iSlot);
+    bool MatchText(const char *pLowerText, CLargeVarBitVec &result) const;
+    void ApplyAttributeFilters(const MapFilters_t &filters, CLargeVarBitVec &result) const;
+    const CUtlVector<int> *FindPosting(uint32 gram) const;
+
+    static void BuildText(const MapData *pData, CUtlString &out);
+    static void GetGrams(const char *pText, CUtlVector<uint32> &vecGrams);
+    static void LowerText(const char *pIn, char *pOut, int outSize);
+
+    CUtlVector<MapEntry_t> m_vecEntries;
+    CUtlMap<uint32, int> m_mapSlotsByMapID;
+    int m_iSlotCapacity;
+
+    // Posting lists, sorted by slot
+    CUtlMap<uint32, int> m_mapGramPostings;
+    CUtlVector<CUtlVector<int> > m_vecPostings;
+
+    CLargeVarBitVec m_bitsUsed;
+    CLargeVarBitVec m_bitsDifficulty[256];
+    int m_iDifficultyCounts[256];
+    CLargeVarBitVec m_bitsGameMode[GAMEMODE_COUNT];
+    CLargeVarBitVec m_bitsLinear;
+    CLargeVarBitVec m_bitsCompleted;
+};
@@ -0,0 +1,328 @@
+#include "cbase.h"
+
+#include <ctime>
+
+#include "mom_replay_cache.h"
+#include "mom_modulecomms.h"
+#include "util/mom_util.h"
+#include "filesystem.h"
+#include "fmtstr.h"
+
+#include "tier0/memdbgon.h"
+
+#define RECORDING_CACHE_INDEX_FILE RECORDING_PATH "/" RECORDING_CACHE_PATH "/index.vdf"
+
+static MAKE_CONVAR(mom_replay_cache_size, "256", FCVAR_ARCHIVE,
+                   "Megabytes of downloaded replays kept in the replay cache.\n", 16, 8192);
+
+CMomReplayCache::CMomReplayCache() : CAutoGameSystem("CMomReplayCache"), m_pIndex(nullptr), m_bIndexDirty(false)
+{
+    SetDefLessFunc(m_mapDownloads);
+}
+
+void CMomReplayCache::PostInit()
+{
+    g_pFullFileSystem->CreateDirHierarchy(RECORDING_PATH "/" RECORDING_CACHE_PATH, "MOD");
+    LoadIndex();
+}
+
+void CMomReplayCache::LevelShutdownPostEntity()
+{
+    if (m_bIndexDirty)
+        SaveIndex();
+}
+
+void CMomReplayCache::Shutdown()
+{
+    FOR_EACH_MAP_FAST(m_mapDownloads, i)
+    {
+        g_pAPIRequests->CancelDownload(m_mapDownloads.Key(i));
+    }
+    m_mapDownloads.RemoveAll();
+
+    if (m_pIndex)
+    {
+        if (m_bIndexDirty)
+            SaveIndex();
+
+        m_pIndex->deleteThis();
+        m_pIndex = nullptr;
+    }
+}
+
+void CMomReplayCache::GetReplayPath(const char *pHash, char *pOut, int outSize, bool bRelative)
+{
+    if (bRelative)
+        Q_snprintf(pOut, outSize, "%s/%s%s", RECORDING_CACHE_PATH, pHash, EXT_RECORDING_FILE);
+    else
+        Q_snprintf(pOut, outSize, "%s/%s/%s%s", RECORDING_PATH, RECORDING_CACHE_PATH, pHash, EXT_RECORDING_FILE);
+}
+
+void CMomReplayCache::LoadIndex()
+{
+    m_pIndex = new KeyValues("ReplayCache");
+    m_pIndex->LoadFromFile(g_pFullFileSystem, RECORDING_CACHE_INDEX_FILE, "MOD");
+
+    bool bChanged = false;
+    char path[MAX_PATH];
+
+    // Forget about the replays that were deleted by hand
+    KeyValues *pEntry = m_pIndex->GetFirstTrueSubKey();
+    while (pEntry)
+    {
+        KeyValues *pNext = pEntry->GetNextTrueSubKey();
+        GetReplayPath(pEntry->GetName(), path, sizeof(path), false);
+        if (!g_pFullFileSystem->FileExists(path, "MOD"))
+        {
+            m_pIndex->RemoveSubKey(pEntry);
+            pEntry->deleteThis();
+            bChanged = true;
+        }
+        pEntry = pNext;
+    }
+
+    // And pick up the ones that never made it into the index, as the least recently used
+    FileFindHandle_t found;
+    const char *pFoundFile = g_pFullFileSystem->FindFirstEx(RECORDING_PATH "/" RECORDING_CACHE_PATH "/*" EXT_RECORDING_FILE, "MOD", &found);
+    while (pFoundFile)
+    {
+        char hash[41];
+        V_FileBase(pFoundFile, hash, sizeof(hash));
+        if (!m_pIndex->FindKey(hash))
+        {
+            GetReplayPath(hash, path, sizeof(path), false);
+            KeyValues *pNew = m_pIndex->FindKey(hash, true);
+            pNew->SetInt("size", g_pFullFileSystem->Size(path, "MOD"));
+            pNew->SetUint64("used", 0);
+            bChanged = true;
+        }
+        pFoundFile = g_pFullFileSystem->FindNext(found);
+    }
+    g_pFullFileSystem->FindClose(found);
+
+    if (bChanged)
+    {
+        EvictReplays(nullptr);
+        SaveIndex();
+    }
+}
+
+void CMomReplayCache::SaveIndex()
+{
+    m_bIndexDirty = false;
+
+    if (!m_pIndex->SaveToFile(g_pFullFileSystem, RECORDING_CACHE_INDEX_FILE, "MOD"))
+        Warning("Failed to save the replay cache index!\n");
+}
+
+void CMomReplayCache::EvictReplays(const char *pKeepHash)
+{
+    int64 iTotal = 0;
+    FOR_EACH_TRUE_SUBKEY(m_pIndex, pEntry)
+    {
+        iTotal += pEntry->GetInt("size");
+    }
+
+    const int64 iBudget = static_cast<int64>(mom_replay_cache_size.GetInt()) * 1024 * 1024;
+    while (iTotal > iBudget)
+    {
+        KeyValues *pOldest = nullptr;
+        FOR_EACH_TRUE_SUBKEY(m_pIndex, pEntry)
+        {
+            if (pKeepHash && FStrEq(pEntry->GetName(), pKeepHash))
+                continue;
+
+            if (m_vecPinned.HasElement(CUtlString(pEntry->GetName())))
+                continue;
+
+            if (!pOldest || pEntry->GetUint64("used") < pOldest->GetUint64("used"))
+                pOldest = pEntry;
+        }
+
+        if (!pOldest)
+            break;
+
+        char path[MAX_PATH];
+        GetReplayPath(pOldest->GetName(), path, sizeof(path), false);
+        g_pFullFileSystem->RemoveFile(path, "MOD");
+
+        iTotal -= pOldest->GetInt("size");
+        m_pIndex->RemoveSubKey(pOldest);
+        pOldest->deleteThis();
+    }
+}
+
+bool CMomReplayCache::GetCachedReplay(const char *pHash, char *pPathOut, int outSize)
+{
+    if (!m_pIndex || !pHash || !pHash[0])
+        return false;
+
+    KeyValues *pEntry = m_pIndex->FindKey(pHash);
+    if (!pEntry)
+        return false;
+
+    char path[MAX_PATH];
+    GetReplayPath(pHash, path, sizeof(path), false);
+    if (!g_pFullFileSystem->FileExists(path, "MOD"))
+    {
+        m_pIndex->RemoveSubKey(pEntry);
+        pEntry->deleteThis();
+        SaveIndex();
+        return false;
+    }
+
+    // Lookups are frequent, a lost use time only makes the replay look a bit older
+    pEntry->SetUint64("used", time(nullptr));
+    m_bIndexDirty = true;
+
+    GetReplayPath(pHash, pPathOut, outSize, true);
+    return true;
+}
+
+bool CMomReplayCache::IsDownloading(const char *pHash) const
+{
+    FOR_EACH_MAP_FAST(m_mapDownloads, i)
+    {
+        if (FStrEq(m_mapDownloads[i].m_szHash, pHash))
+            return true;
+    }
+
+    return false;
+}
+
+void CMomReplayCache::PinReplay(const char *pHash)
+{
+    if (pHash && pHash[0])
+        m_vecPinned.AddToTail(pHash);
+}
+
+void CMomReplayCache::UnpinReplay(const char *pHash)
+{
+    if (pHash && pHash[0])
+        m_vecPinned.FindAndRemove(pHash);
+}
+
+HTTPRequestHandle CMomReplayCache::DownloadReplay(const char *pURL, const char *pHash, bool bPlay, CallbackFunc complete)
+{
+    if (!pURL || !pHash || !pHash[0] || IsDownloading(pHash))
+        return INVALID_HTTPREQUEST_HANDLE;
+
+    // Kept in memory and only written once the hash is checked
+    const HTTPRequestHandle handle = g_pAPIRequests->DownloadFile(pURL,
+                                                                  UtlMakeDelegate(this, &CMomReplayCache::OnDownloadSize),
+                                                                  UtlMakeDelegate(this, &CMomReplayCache::OnDownloadProgress),
+                                                                  UtlMakeDelegate(this, &CMomReplayCache::OnDownloadComplete),
+                                                                  nullptr, "MOD", true);
+    if (handle == INVALID_HTTPREQUEST_HANDLE)
+        return handle;
+
+    Download_t download;
+    Q_strncpy(download.m_szHash, pHash, sizeof(download.m_szHash));
+    download.m_bPlay = bPlay;
+    download.m_Complete = complete;
+    m_mapDownloads.Insert(handle, download);
+
+    if (bPlay)
+    {
+        KeyValues *pKv = new KeyValues("replay_download_start");
+        pKv->SetString("hash", pHash);
+        g_pModuleComms->FireEvent(pKv, FIRE_FOREIGN_ONLY);
+    }
+
+    return handle;
+}
+
+void CMomReplayCache::OnDownloadSize(KeyValues *pKv)
+{
+    const auto indx = m_mapDownloads.Find(pKv->GetUint64("request"));
+    if (indx == m_mapDownloads.InvalidIndex() || !m_mapDownloads[indx].m_bPlay)
+        return;
+
+    // Lets the server size its buffer once instead of growing it with every chunk
+    KeyValues *pSize = new KeyValues("replay_download_size");
+    pSize->SetString("hash", m_mapDownloads[indx].m_szHash);
+    pSize->SetUint64("size", pKv->GetUint64("size"));
+    g_pModuleComms->FireEvent(pSize, FIRE_FOREIGN_ONLY);
+}
+
+void CMomReplayCache::OnDownloadProgress(KeyValues *pKv)
+{
+    const auto indx = m_mapDownloads.Find(pKv->GetUint64("request"));
+    if (indx == m_mapDownloads.InvalidIndex() || !m_mapDownloads[indx].m_bPlay)
+        return;
+
+    // The server parses the replay as it arrives
+    KeyValues *pData = new KeyValues("replay_download_data");
+    pData->SetString("hash", m_mapDownloads[indx].m_szHash);
+    pData->SetPtr("data", pKv->GetPtr("data"));
+    pData->SetInt("offset", pKv->GetInt("offset"));
+    pData->SetInt("size", pKv->GetInt("size"));
+    g_pModuleComms->FireEvent(pData, FIRE_FOREIGN_ONLY);
+}
+
+void CMomReplayCache::OnDownloadComplete(KeyValues *pKv)
+{
+    const auto indx = m_mapDownloads.Find(pKv->GetUint64("request"));
+    if (indx == m_mapDownloads.InvalidIndex())
+        return;
+
+    Download_t download = m_mapDownloads[indx];
+    m_mapDownloads.RemoveAt(indx);
+
+    bool bError = pKv->GetBool("error");
+    CUtlBuffer *pBuf = static_cast<CUtlBuffer *>(pKv->GetPtr("buf"));
+    if (!bError && pBuf)
+    {
+        char hash[41];
+        char path[MAX_PATH];
+        GetReplayPath(download.m_szHash, path, sizeof(path), false);
+
+        if (!MomUtil::GetSHA1Hash(*pBuf, hash, sizeof(hash)) || Q_stricmp(hash, download.m_szHash))
+        {
+            Warning("The downloaded replay %s does not match its hash!\n", download.m_szHash);
+            bError = true;
+        }
+        else if (!g_pFullFileSystem->WriteFile(path, "MOD", *pBuf))
+        {
+            Warning("Failed to write the replay %s to the replay cache!\n", download.m_szHash);
+            bError = true;
+        }
+        else
+        {
+            KeyValues *pEntry = m_pIndex->FindKey(download.m_szHash, true);
+            pEntry->SetInt("size", pBuf->TellPut());
+            pEntry->SetUint64("used", time(nullptr));
+            EvictReplays(download.m_szHash);
+            SaveIndex();
+        }
+    }
+    else
+    {
+        bError = true;
+    }
+
+    if (download.m_bPlay)
+    {
+        KeyValues *pEnd = new KeyValues("replay_download_end");
+        pEnd->SetString("hash", download.m_szHash);
+        pEnd->SetBool("error", bError);
+        g_pModuleComms->FireEvent(pEnd, FIRE_FOREIGN_ONLY);
+    }
+
+    if (!download.m_Complete.IsEmpty())
+    {
+        char file[MAX_PATH];
+        GetReplayPath(download.m_szHash, file, sizeof(file), true);
+
+        KeyValuesAD complete("Complete");
+        complete->SetUint64("request", pKv->GetUint64("request"));
+        complete->SetBool("error", bError);
+        complete->SetInt("code", pKv->GetInt("code"));
+        complete->SetString("hash", download.m_szHash);
+        complete->SetString("file", file);
+        download.m_Complete(complete);
+    }
+}
+
+static CMomReplayCache s_MomReplayCache;
+CMomReplayCache *g_pMomReplayCache = &s_MomReplayCache;
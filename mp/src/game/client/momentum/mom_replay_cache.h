@@ -0,0 +1,55 @@
+#pragma once
+
+#include "mom_api_requests.h"
+
+// Downloaded replays, stored in the recordings folder under cache/<run hash> (the SHA1 of the file), so a run is
+// only downloaded once. The cache is bounded by mom_replay_cache_size, the least recently used replays go first.
+// A download can also be streamed to the server as it arrives (see CMomReplayDownloadSystem), the playback then
+// starts as soon as the header and the first frames are in.
+class CMomReplayCache : public CAutoGameSystem
+{
+public:
+    CMomReplayCache();
+
+    // CAutoGameSystem
+    void PostInit() OVERRIDE;
+    void LevelShutdownPostEntity() OVERRIDE;
+    void Shutdown() OVERRIDE;
+
+    // Fills in the path of the replay relative to the recordings folder if it is cached, which counts as a use
+    bool GetCachedReplay(const char *pHash, char *pPathOut, int outSize);
+    // Downloads the replay into the cache, with bPlay the server plays it back while it downloads.
+    // The complete function gets "request", "error", "hash" and "file" (the path GetCachedReplay would give).
+    HTTPRequestHandle DownloadReplay(const char *pURL, const char *pHash, bool bPlay, CallbackFunc complete);
+    bool IsDownloading(const char *pHash) const;
+
+    // Pinned replays are never evicted, for replays that were looked up but are not loaded yet. Pins are counted,
+    // every PinReplay needs its UnpinReplay.
+    void PinReplay(const char *pHash);
+    void UnpinReplay(const char *pHash);
+
+private:
+    struct Download_t
+    {
+        char m_szHash[41];
+        bool m_bPlay;
+        CallbackFunc m_Complete;
+    };
+
+    void OnDownloadSize(KeyValues *pKv);
+    void OnDownloadProgress(KeyValues *pKv);
+    void OnDownloadComplete(KeyValues *pKv);
+
+    void LoadIndex();
+    void SaveIndex();
+    void EvictReplays(const char *pKeepHash);
+
+    static void GetReplayPath(const char *pHash, char *pOut, int outSize, bool bRelative);
+
+    KeyValues *m_pIndex; // Run hash -> "size" and "used" (when it was last downloaded or played)
+    bool m_bIndexDirty; // Only the "used" times changed since the last save, written out on level shutdown
+    CUtlVector<CUtlString> m_vecPinned; // Once per pin
+    CUtlMap<HTTPRequestHandle, Download_t> m_mapDownloads;
+};
+
+extern CMomReplayCache *g_pMomReplayCache;
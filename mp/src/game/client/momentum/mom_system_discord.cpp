@@ -11,6 +11,7 @@
 #include "mom_shareddefs.h"
 #include "util/mom_util.h"
 #include "steam/steam_api.h"
+#include "mom_profiler.h"
 
 #include "tier0/memdbgon.h"
 
@@ -163,6 +164,8 @@ void CMomentumDiscord::LevelShutdownPreEntity()
 // Called every frame
 void CMomentumDiscord::Update(float frametime)
 {
+    MOM_PROF_SCOPE("CMomentumDiscord::Update");
+
     if (!(m_bValid && mom_discord_enable.GetBool()))
         return;
 
@@ -13,6 +13,7 @@
 #include "mom_shareddefs.h"
 #include "momentum/util/mom_util.h"
 #include "c_mom_replay_entity.h"
+#include "mom_profiler.h"
 
 #include "tier0/memdbgon.h"
 
@@ -257,6 +258,8 @@ void C_RunComparisons::FireGameEvent(IGameEvent *event)
 
 void C_RunComparisons::OnThink()
 {
+    MOM_PROF_SCOPE("C_RunComparisons::OnThink");
+
     if (!m_bLoadedComparison)
         return;
 
@@ -636,6 +639,8 @@ int C_RunComparisons::GetCurrentZone() const
 
 void C_RunComparisons::Paint()
 {
+    MOM_PROF_SCOPE("C_RunComparisons::Paint");
+
     if (!GetRunComparisons())
         return;
 
@@ -13,6 +13,7 @@
 #include "util/mom_util.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
+#include "mom_profiler.h"
 #include "tier0/memdbgon.h"
 
 using namespace vgui;
@@ -218,6 +219,8 @@ void CHudDamageIndicator::DrawDamageIndicator(int x0, int y0, int x1, int y1, fl
 
 void CHudDamageIndicator::Paint()
 {
+    MOM_PROF_SCOPE("CHudDamageIndicator::Paint");
+
     // Iterate backwards, because we might remove them as we go
     int iSize = m_vecDamages.Count();
     for (int i = iSize - 1; i >= 0; i--)
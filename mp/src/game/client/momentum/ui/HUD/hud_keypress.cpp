@@ -14,6 +14,7 @@
 #include "c_mom_online_ghost.h"
 #include "mom_player_shared.h"
 #include "mom_shareddefs.h"
+#include "mom_profiler.h"
 
 #include "tier0/memdbgon.h"
 
@@ -132,6 +133,8 @@ void CHudKeyPressDisplay::Init()
 
 void CHudKeyPressDisplay::Paint()
 {
+    MOM_PROF_SCOPE("CHudKeyPressDisplay::Paint");
+
     // create local variable so we can mutate it without worry
     int nButtons = m_nButtons;
     // do we need to invert the +left/+right due to negative yawspeed?
@@ -266,6 +269,8 @@ void CHudKeyPressDisplay::Paint()
 }
 void CHudKeyPressDisplay::OnThink()
 {
+    MOM_PROF_SCOPE("CHudKeyPressDisplay::OnThink");
+
     const auto pPlayer = C_MomentumPlayer::GetLocalMomPlayer();
     if (pPlayer)
     {
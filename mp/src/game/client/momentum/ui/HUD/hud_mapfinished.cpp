@@ -16,6 +16,7 @@
 
 #include "util/mom_util.h"
 #include "c_mom_replay_entity.h"
+#include "mom_profiler.h"
 
 #include "tier0/memdbgon.h"
 
@@ -154,6 +155,8 @@ void CHudMapFinishedDialog::LevelShutdown()
 
 void CHudMapFinishedDialog::OnThink()
 {
+    MOM_PROF_SCOPE("CHudMapFinishedDialog::OnThink");
+
     BaseClass::OnThink();
 
     m_pPlayReplayButton->SetVisible(!m_bIsGhost);
@@ -448,6 +451,8 @@ void CHudMapFinishedDialog::SetCurrentPage(int pageNum)
 
 void CHudMapFinishedDialog::Paint() 
 {
+    MOM_PROF_SCOPE("CHudMapFinishedDialog::Paint");
+
     BaseClass::Paint();
 
     if (!mom_mapfinished_movement_enable.GetBool() || m_bIsGhost)
@@ -14,6 +14,7 @@
 #include "c_mom_replay_entity.h"
 #include "mom_shareddefs.h"
 #include "mom_map_cache.h"
+#include "mom_profiler.h"
 
 #include "tier0/memdbgon.h"
 
@@ -80,6 +81,8 @@ C_HudMapInfo::C_HudMapInfo(const char *pElementName): CHudElement(pElementName),
 
 void C_HudMapInfo::OnThink()
 {
+    MOM_PROF_SCOPE("C_HudMapInfo::OnThink");
+
     BaseClass::OnThink();
 
     m_pMapNameLabel->SetVisible(mom_hud_mapinfo_show_mapname.GetBool());
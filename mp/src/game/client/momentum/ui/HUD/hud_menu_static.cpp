@@ -11,6 +11,7 @@
 #include "vgui/ILocalize.h"
 #include "vgui/ISurface.h"
 #include "vgui_controls/AnimationController.h"
+#include "mom_profiler.h"
 
 #include "tier0/memdbgon.h"
 
@@ -56,6 +57,8 @@ void CHudMenuStatic::VidInit(void) { HideMenu(true); }
 
 void CHudMenuStatic::OnThink()
 {
+    MOM_PROF_SCOPE("CHudMenuStatic::OnThink");
+
     if (m_bMenuDisplayed)
     {
         if (m_nSelectedItem > 0)
@@ -114,6 +117,8 @@ void CHudMenuStatic::SelectMenuItem(int menu_item)
 
 void CHudMenuStatic::Paint()
 {
+    MOM_PROF_SCOPE("CHudMenuStatic::Paint");
+
     if (!m_bMenuDisplayed)
     {
         return;
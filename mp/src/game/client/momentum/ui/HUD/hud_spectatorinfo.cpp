@@ -6,6 +6,7 @@
 #include "vgui/ISurface.h"
 #include "steam/steam_api.h"
 #include "baseviewport.h"
+#include "mom_profiler.h"
 
 #include "tier0/memdbgon.h"
 
@@ -47,6 +48,8 @@ bool CHudSpectatorInfo::ShouldDraw()
 
 void CHudSpectatorInfo::Paint()
 {
+    MOM_PROF_SCOPE("CHudSpectatorInfo::Paint");
+
     char spectatorCountANSI[128];
     Q_snprintf(spectatorCountANSI, 128, "Spectators: %i", m_iSpecCount);
 
@@ -23,6 +23,7 @@
 #include "c_baseplayer.h"
 #include "movevars_shared.h"
 #include "run/run_compare.h"
+#include "mom_profiler.h"
 
 #include "tier0/memdbgon.h"
 
@@ -220,6 +221,8 @@ void CHudSpeedMeter::ApplySchemeSettings(IScheme *pScheme)
 
 void CHudSpeedMeter::OnThink()
 {
+    MOM_PROF_SCOPE("CHudSpeedMeter::OnThink");
+
     const auto pPlayer = C_MomentumPlayer::GetLocalMomPlayer();
     if (pPlayer)
     {
@@ -434,6 +437,8 @@ void CHudSpeedMeter::OnThink()
 
 void CHudSpeedMeter::Paint() 
 {
+    MOM_PROF_SCOPE("CHudSpeedMeter::Paint");
+
     int yIndent = 0;
     if (!mom_hud_speedometer.GetBool()) yIndent += m_defaultAbsSpeedoLabelHeight;
     if (!mom_hud_speedometer_horiz.GetBool()) yIndent += m_defaultHorizSpeedoLabelHeight;
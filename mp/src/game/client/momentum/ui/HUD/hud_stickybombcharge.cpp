@@ -15,6 +15,7 @@
 
 #include "mom_system_gamemode.h"
 #include "weapon/weapon_mom_stickybomblauncher.h"
+#include "mom_profiler.h"
 
 #include "tier0/memdbgon.h"
 
@@ -84,6 +85,8 @@ bool CHudStickyCharge::ShouldDraw()
 
 void CHudStickyCharge::OnThink()
 {
+    MOM_PROF_SCOPE("CHudStickyCharge::OnThink");
+
     if (!m_pLauncher)
         return;
 
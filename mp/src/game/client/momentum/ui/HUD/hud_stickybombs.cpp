@@ -8,6 +8,7 @@
 #include "iclientmode.h"
 #include "mom_system_gamemode.h"
 #include "weapon/weapon_mom_stickybomblauncher.h"
+#include "mom_profiler.h"
 
 #include "tier0/memdbgon.h"
 
@@ -57,6 +58,8 @@ bool CHudStickybombs::ShouldDraw()
 
 void CHudStickybombs::OnThink()
 {
+    MOM_PROF_SCOPE("CHudStickybombs::OnThink");
+
     C_MomentumPlayer *pPlayer = C_MomentumPlayer::GetLocalMomPlayer();
 
     if (!pPlayer)
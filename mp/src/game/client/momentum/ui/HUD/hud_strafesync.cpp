@@ -6,6 +6,7 @@
 #include "util/mom_util.h"
 #include "hud_fillablebar.h"
 #include "c_mom_player.h"
+#include "mom_profiler.h"
 
 #include "tier0/memdbgon.h"
 
@@ -109,6 +110,8 @@ CHudStrafeSyncDisplay::CHudStrafeSyncDisplay(const char *pElementName): CHudElem
 
 void CHudStrafeSyncDisplay::OnThink()
 {
+    MOM_PROF_SCOPE("CHudStrafeSyncDisplay::OnThink");
+
     const auto pPlayer = C_MomentumPlayer::GetLocalMomPlayer();
     if (!pPlayer)
         return;
@@ -173,6 +176,8 @@ void CHudStrafeSyncDisplay::OnThink()
 }
 void CHudStrafeSyncDisplay::Paint()
 {
+    MOM_PROF_SCOPE("CHudStrafeSyncDisplay::Paint");
+
     BaseClass::Paint();
 
     if (strafesync_type.GetInt() == 2)
@@ -239,11 +244,15 @@ CHudStrafeSyncBar::CHudStrafeSyncBar(const char *pElementName) : CHudElement(pEl
 
 void CHudStrafeSyncBar::Paint()
 {
+    MOM_PROF_SCOPE("CHudStrafeSyncBar::Paint");
+
     BaseClass::Paint(m_currentColor);
 }
 
 void CHudStrafeSyncBar::OnThink()
 {
+    MOM_PROF_SCOPE("CHudStrafeSyncBar::OnThink");
+
     const auto pPlayer = C_MomentumPlayer::GetLocalMomPlayer();
     if (!pPlayer)
         return;
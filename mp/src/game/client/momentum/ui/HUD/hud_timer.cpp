@@ -18,6 +18,7 @@
 #include "mom_shareddefs.h"
 #include "momentum/util/mom_util.h"
 #include "c_mom_replay_entity.h"
+#include "mom_profiler.h"
 
 #include "tier0/memdbgon.h"
 
@@ -166,6 +167,8 @@ void CHudTimer::SetToNoTimer()
 
 void CHudTimer::OnThink()
 {
+    MOM_PROF_SCOPE("CHudTimer::OnThink");
+
     m_pMainStatusLabel->SetFgColor(m_StatusColor);
 
     const auto pLocal = C_MomentumPlayer::GetLocalMomPlayer();
@@ -19,67 +19,6 @@
 
 using namespace vgui;
 
-// Sort functions
-static int __cdecl MapNameSortFunc(vgui::ListPanel *pPanel, const vgui::ListPanelItem &item1,
-                                   const vgui::ListPanelItem &item2)
-{
-    const char *string1 = item1.kv->GetString(KEYNAME_MAP_NAME);
-    const char *string2 = item2.kv->GetString(KEYNAME_MAP_NAME);
-    return Q_stricmp(string1, string2);
-}
-
-static int __cdecl MapPersonalBestSortFunc(vgui::ListPanel *pPanel, const vgui::ListPanelItem &item1,
-                                        const vgui::ListPanelItem &item2)
-{
-    const auto left = item1.kv->GetFloat(KEYNAME_MAP_PERSONAL_BEST_SORT);
-    const auto right = item2.kv->GetFloat(KEYNAME_MAP_PERSONAL_BEST_SORT);
-    if (left < right)
-        return -1;
-    if (right < left)
-        return 1;
-    return 0;
-}
-
-static int __cdecl MapWorldRecordSortFunc(vgui::ListPanel *pPanel, const vgui::ListPanelItem &item1,
-                                          const vgui::ListPanelItem &item2)
-{
-    const auto left = item1.kv->GetFloat(KEYNAME_MAP_WORLD_RECORD_SORT);
-    const auto right = item2.kv->GetFloat(KEYNAME_MAP_WORLD_RECORD_SORT);
-    if (left < right)
-        return -1;
-    if (right < left)
-        return 1;
-    return 0;
-}
-
-static int __cdecl MapLayoutSortFunc(vgui::ListPanel *pPanel, const vgui::ListPanelItem &item1,
-                                     const vgui::ListPanelItem &item2)
-{
-    const char *i1 = item1.kv->GetString(KEYNAME_MAP_LAYOUT);
-    const char *i2 = item2.kv->GetString(KEYNAME_MAP_LAYOUT);
-    return Q_stricmp(i1, i2);
-}
-
-static int __cdecl MapCreationDateSortFunc(vgui::ListPanel *pPanel, const vgui::ListPanelItem &item1,
-                                           const vgui::ListPanelItem &item2)
-{
-    const char *i1 = item1.kv->GetString(KEYNAME_MAP_CREATION_DATE_SORT);
-    const char *i2 = item2.kv->GetString(KEYNAME_MAP_CREATION_DATE_SORT);
-    return Q_stricmp(i1, i2);
-}
-
-static int __cdecl MapLastPlayedSortFunc(vgui::ListPanel *pPanel, const vgui::ListPanelItem &item1,
-                                         const vgui::ListPanelItem &item2)
-{
-    uint64 left = item1.kv->GetUint64(KEYNAME_MAP_LAST_PLAYED_SORT);
-    uint64 right = item2.kv->GetUint64(KEYNAME_MAP_LAST_PLAYED_SORT);
-    if (left < right)
-        return -1;
-    if (left == right)
-        return 0;
-    return 1;
-}
-
 //-----------------------------------------------------------------------------
 // Purpose: Constructor
 //-----------------------------------------------------------------------------
@@ -155,14 +94,7 @@ CBaseMapsPage::CBaseMapsPage(vgui::Panel *parent, const char *name) : PropertyPa
     m_pMapList->SetColumnTextAlignment(HEADER_WORLD_RECORD, Label::a_center);
     m_pMapList->SetColumnTextAlignment(HEADER_BEST_TIME, Label::a_center);
 
-    // Sort Functions
-    m_pMapList->SetSortFunc(HEADER_MAP_NAME, MapNameSortFunc);
-    m_pMapList->SetSortFunc(HEADER_WORLD_RECORD, MapWorldRecordSortFunc);
-    m_pMapList->SetSortFunc(HEADER_BEST_TIME, MapPersonalBestSortFunc);
-    m_pMapList->SetSortFunc(HEADER_MAP_LAYOUT, MapLayoutSortFunc);
-    m_pMapList->SetSortFunc(HEADER_DATE_CREATED, MapCreationDateSortFunc);
-    m_pMapList->SetSortFunc(HEADER_LAST_PLAYED, MapLastPlayedSortFunc);
-
+    // Sorting is done by the CMapListPanel itself, see CMapListPanel::CompareRows
     // disable sort for certain columns
     m_pMapList->SetColumnSortable(HEADER_MAP_IMAGE, false);
 
@@ -242,86 +174,24 @@ void CBaseMapsPage::ApplyFilters(MapFilters_t filters) { OnApplyFilters(filters)
 
 void CBaseMapsPage::OnApplyFilters(MapFilters_t filters)
 {
-    // loop through all the maps checking filters
-    FOR_EACH_MAP_FAST(m_mapMaps, i)
-    {
-        MapDisplay_t *pMap = &m_mapMaps[i];
-        // Now we can check the filters
-        if (!MapPassesFilters(pMap->m_pMap, filters))
-        {
-            m_pMapList->SetItemVisible(pMap->m_iListID, false);
-            pMap->m_bNeedsShown = true;
-        }
-        else if (pMap->m_bNeedsShown)
-        {
-            m_pMapList->SetItemVisible(pMap->m_iListID, true);
-            pMap->m_bNeedsShown = false;
-        }
-    }
+    // The list filters its own rows
+    m_pMapList->SetFilters(filters);
 
     UpdateStatus();
-    m_pMapList->SortList();
     InvalidateLayout();
     Repaint();
 }
 
-bool CBaseMapsPage::MapPassesFilters(MapData *pMap, MapFilters_t filters)
-{
-    if (!pMap)
-        return false;
-
-    // Needs to pass map name filter
-    // compare the first few characters of the filter
-    const char *szMapNameFilter = filters.m_szMapName;
-    int count = Q_strlen(szMapNameFilter);
-
-    // strstr returns null if the substring is not in the base string
-    if (count && !Q_strstr(pMap->m_szMapName, szMapNameFilter))
-        return false;
-
-    // Difficulty
-    int iDiffLowBound = filters.m_iDifficultyLow;
-    int iDiffHighBound = filters.m_iDifficultyHigh;
-    bool bPassesLower = true;
-    bool bPassesHigher = true;
-    if (iDiffLowBound)
-    {
-        bPassesLower = pMap->m_MainTrack.m_iDifficulty >= iDiffLowBound;
-    }
-    if (iDiffHighBound)
-    {
-        bPassesHigher = pMap->m_MainTrack.m_iDifficulty <= iDiffHighBound;
-    }
-    if (!(bPassesLower && bPassesHigher))
-        return false;
-
-    // Game mode (if it's a surf/bhop/etc map or not)
-    int iGameModeFilter = filters.m_iGameMode;
-    if (iGameModeFilter && iGameModeFilter != pMap->m_eType)
-        return false;
-
-    bool bHideCompleted = filters.m_bHideCompleted;
-    if (bHideCompleted && pMap->m_PersonalBest.m_bValid)
-        return false;
-
-    // Map layout (0 = all, 1 = show staged maps only, 2 = show linear maps only)
-    int iMapLayoutFilter = filters.m_iMapLayout;
-    if (iMapLayoutFilter && pMap->m_MainTrack.m_bIsLinear + 1 != iMapLayoutFilter)
-        return false;
-
-    return true;
-}
-
 //-----------------------------------------------------------------------------
 // Purpose: Resets UI map count
 //-----------------------------------------------------------------------------
 void CBaseMapsPage::UpdateStatus()
 {
-    if (m_pMapList->GetItemCount() > 0)
+    if (m_pMapList->GetPassingRowCount() > 0)
     {
         m_pMapList->SetColumnHeaderText(
             HEADER_MAP_NAME,
-            CConstructLocalizedString(g_pVGuiLocalize->Find("#MOM_MapSelector_MapCount"), m_pMapList->GetItemCount()));
+            CConstructLocalizedString(g_pVGuiLocalize->Find("#MOM_MapSelector_MapCount"), m_pMapList->GetPassingRowCount()));
     }
     else
     {
@@ -340,7 +210,6 @@ void CBaseMapsPage::AddMapToList(MapData *pData)
 
     MapDisplay_t map;
     map.m_pMap = pData;
-    map.m_bNeedsShown = true;
     m_mapMaps.Insert(pData->m_uID, map);
 
     // Add the map to the m_pMapList
@@ -358,13 +227,17 @@ void CBaseMapsPage::OnMapListDataUpdate(int mapID)
         if (m_pMapList->IsValidItemID(pMapDisplay->m_iListID))
         {
             m_pMapList->ApplyItemChanges(pMapDisplay->m_iListID);
+            m_pMapList->UpdateMapRow(pMapDisplay->m_iListID, pMapDisplay->m_pMap);
         }
         else
         {
             // Otherwise we need to add it
             MapListData *pData = MapSelectorDialog().GetMapListDataByID(mapID);
             if (pData)
+            {
                 pMapDisplay->m_iListID = m_pMapList->AddItem(pData->m_pKv, mapID, false, false, false);
+                m_pMapList->UpdateMapRow(pMapDisplay->m_iListID, pMapDisplay->m_pMap);
+            }
             else
                 MapSelectorDialog().CreateMapListData(pMapDisplay->m_pMap);
         }
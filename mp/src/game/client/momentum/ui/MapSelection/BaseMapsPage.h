@@ -77,7 +77,6 @@ public:
     virtual MapFilters_t GetFilters();
     void ApplyFilters(MapFilters_t filters) OVERRIDE;
     virtual void OnApplyFilters(MapFilters_t filters);
-    virtual bool MapPassesFilters(MapData *pData, MapFilters_t filters);
 
     // Called when the map selector has a map updated in its list
     MESSAGE_FUNC_INT(OnMapListDataUpdate, "MapListDataUpdate", id);
@@ -4,6 +4,7 @@
 #include "BaseMapsPage.h"
 #include "MapDownloadProgress.h"
 #include "MapSelectorDialog.h"
+#include "mom_map_cache.h"
 #include "fmtstr.h"
 
 #include "vgui_controls/ProgressBar.h"
@@ -13,6 +14,12 @@
 
 using namespace vgui;
 
+COMPILE_TIME_ASSERT(MAP_LIST_COLUMN_COUNT == HEADER_LAST_PLAYED + 1);
+
+// Sort state for SortOrderCompare
+static const CMapListPanel *s_pSortingList = nullptr;
+static int s_iSortingColumn = 0;
+
 //-----------------------------------------------------------------------------
 // Purpose: Constructor
 //-----------------------------------------------------------------------------
@@ -21,6 +28,16 @@ CMapListPanel::CMapListPanel(CBaseMapsPage *pOuter, const char *pName) : BaseCla
     m_pOuter = pOuter;
     SetRowHeight(GetScaledVal(28));
     SetRowHeightOnFontChange(false);
+
+    // We sort and filter the rows ourselves
+    SetIndexColumns(false);
+
+    SetDefLessFunc(m_mapRowsByMapID);
+    m_iPassingRows = 0;
+    m_bOrderDirty = false;
+    m_Filters.Reset();
+    for (int i = 0; i < MAP_LIST_COLUMN_COUNT; i++)
+        m_bSortOrderValid[i] = false;
 }
 
 //-----------------------------------------------------------------------------
@@ -46,19 +63,19 @@ void CMapListPanel::OnMouseReleased(MouseCode code)
         {
             int itemID = GetItemIDFromRow(row);
             uint32 mapID = GetItemUserData(itemID);
-            KeyValues *pMap = GetItem(itemID);
+            MapData *pMap = g_pMapCache->GetMapDataByID(mapID);
             if (pMap)
             {
                 if (col == HEADER_MAP_IN_LIBRARY)
                 {
-                    if (pMap->GetInt(KEYNAME_MAP_IN_LIBRARY) == INDX_MAP_IN_LIBRARY)
+                    if (pMap->m_bInLibrary)
                         MapSelectorDialog().OnRemoveMapFromLibrary(mapID);
                     else
                         MapSelectorDialog().OnAddMapToLibrary(mapID);
                 }
                 else if (col == HEADER_MAP_IN_FAVORITES)
                 {
-                    if (pMap->GetInt(KEYNAME_MAP_IN_FAVORITES) == INDX_MAP_IN_FAVORITES)
+                    if (pMap->m_bInFavorites)
                         MapSelectorDialog().OnRemoveMapFromFavorites(mapID);
                     else
                         MapSelectorDialog().OnAddMapToFavorites(mapID);
@@ -73,6 +90,9 @@ Panel* CMapListPanel::GetCellRenderer(int itemID, int column)
     // Find the itemID
     uint32 mapID = GetItemUserData(itemID);
 
+    // Only rows that get painted have their cells filled in
+    MapSelectorDialog().ApplyPendingMapListData(mapID);
+
     MapDownloadProgress *pOverridePanel = MapSelectorDialog().GetDownloadProgressPanel(mapID);
 
     if (pOverridePanel && column == HEADER_MAP_NAME)
@@ -106,4 +126,329 @@ void CMapListPanel::ApplySchemeSettings(IScheme* pScheme)
     BaseClass::ApplySchemeSettings(pScheme);
 
     SetRowHeight(GetScaledVal(28));
-}
\ No newline at end of file
+}
+
+void CMapListPanel::PerformLayout()
+{
+    if (m_bOrderDirty)
+        RebuildVisibleItems();
+
+    BaseClass::PerformLayout();
+}
+
+void CMapListPanel::RemoveItem(int itemID)
+{
+    const int row = FindRow(GetItemUserData(itemID));
+    if (row != -1)
+        RemoveRow(row);
+
+    BaseClass::RemoveItem(itemID);
+}
+
+void CMapListPanel::RemoveAll()
+{
+    m_vecRowItemIDs.RemoveAll();
+    m_vecRowMapIDs.RemoveAll();
+    m_vecRowNames.RemoveAll();
+    m_vecRowCreationDates.RemoveAll();
+    m_vecRowDifficulties.RemoveAll();
+    m_vecRowLayouts.RemoveAll();
+    m_vecRowInLibrary.RemoveAll();
+    m_vecRowInFavorites.RemoveAll();
+    m_vecRowPersonalBests.RemoveAll();
+    m_vecRowWorldRecords.RemoveAll();
+    m_vecRowLastPlayed.RemoveAll();
+    m_vecRowSearchSlots.RemoveAll();
+    m_vecRowPasses.RemoveAll();
+    m_vecRowChanged.RemoveAll();
+    m_vecChangedRows.RemoveAll();
+    m_vecFreeRows.RemoveAll();
+    m_mapRowsByMapID.RemoveAll();
+    m_iPassingRows = 0;
+
+    for (int i = 0; i < MAP_LIST_COLUMN_COUNT; i++)
+    {
+        m_vecSortOrders[i].RemoveAll();
+        m_bSortOrderValid[i] = false;
+    }
+
+    m_bOrderDirty = false;
+
+    BaseClass::RemoveAll();
+}
+
+void CMapListPanel::SortList()
+{
+    // Called when the sort column changes
+    RebuildVisibleItems();
+    InvalidateLayout();
+}
+
+void CMapListPanel::UpdateMapRow(int itemID, MapData *pData)
+{
+    int row = FindRow(pData->m_uID);
+    if (row == -1)
+    {
+        if (m_vecFreeRows.Count())
+        {
+            row = m_vecFreeRows.Tail();
+            m_vecFreeRows.RemoveMultipleFromTail(1);
+        }
+        else
+        {
+            row = m_vecRowItemIDs.AddToTail();
+            m_vecRowMapIDs.AddToTail();
+            m_vecRowNames.AddToTail();
+            m_vecRowCreationDates.AddToTail();
+            m_vecRowDifficulties.AddToTail();
+            m_vecRowLayouts.AddToTail();
+            m_vecRowInLibrary.AddToTail();
+            m_vecRowInFavorites.AddToTail();
+            m_vecRowPersonalBests.AddToTail();
+            m_vecRowWorldRecords.AddToTail();
+            m_vecRowLastPlayed.AddToTail();
+            m_vecRowSearchSlots.AddToTail(-1);
+            m_vecRowPasses.AddToTail(false);
+            m_vecRowChanged.AddToTail(false);
+        }
+
+        m_mapRowsByMapID.Insert(pData->m_uID, row);
+    }
+    else if (m_vecRowPasses[row])
+    {
+        m_iPassingRows--;
+    }
+
+    m_vecRowItemIDs[row] = itemID;
+    m_vecRowMapIDs[row] = pData->m_uID;
+    m_vecRowNames[row] = pData->m_szMapName;
+    m_vecRowCreationDates[row] = pData->m_Info.m_szCreationDate;
+    m_vecRowDifficulties[row] = pData->m_MainTrack.m_iDifficulty;
+    m_vecRowLayouts[row] = pData->m_MainTrack.m_bIsLinear ? INDX_MAP_IS_LINEAR : INDX_MAP_IS_STAGED;
+    m_vecRowInLibrary[row] = pData->m_bInLibrary ? INDX_MAP_IN_LIBRARY : INDX_MAP_NOT_IN_LIBRARY;
+    m_vecRowInFavorites[row] = pData->m_bInFavorites ? INDX_MAP_IN_FAVORITES : INDX_MAP_NOT_IN_FAVORITES;
+    m_vecRowPersonalBests[row] = pData->m_PersonalBest.m_bValid ? pData->m_PersonalBest.m_Run.m_fTime : 0.0f;
+    m_vecRowWorldRecords[row] = pData->m_WorldRecord.m_bValid ? pData->m_WorldRecord.m_Run.m_fTime : 0.0f;
+    m_vecRowLastPlayed[row] = pData->m_tLastPlayed;
+
+    m_vecRowSearchSlots[row] = g_pMapCache->GetSearchIndex()->GetMapSlot(pData->m_uID);
+    m_vecRowPasses[row] = g_pMapCache->GetSearchIndex()->SlotPassesFilters(m_vecRowSearchSlots[row], m_Filters);
+    if (m_vecRowPasses[row])
+        m_iPassingRows++;
+
+    MarkRowChanged(row);
+    InvalidateOrder();
+}
+
+void CMapListPanel::SetFilters(const MapFilters_t &filters)
+{
+    m_Filters = filters;
+
+    // The search index answers with a bitmap over its slots, the rows only need to look up their bit
+    CLargeVarBitVec matches;
+    g_pMapCache->GetSearchIndex()->FindMaps(m_Filters, matches);
+
+    m_iPassingRows = 0;
+    FOR_EACH_VEC(m_vecRowItemIDs, row)
+    {
+        const int slot = m_vecRowSearchSlots[row];
+        m_vecRowPasses[row] = m_vecRowItemIDs[row] != -1 && slot >= 0 && slot < matches.GetNumBits() && matches.IsBitSet(slot);
+        if (m_vecRowPasses[row])
+            m_iPassingRows++;
+    }
+
+    RebuildVisibleItems();
+    InvalidateLayout();
+}
+
+int CMapListPanel::FindRow(uint32 mapID)
+{
+    const auto indx = m_mapRowsByMapID.Find(mapID);
+    return m_mapRowsByMapID.IsValidIndex(indx) ? m_mapRowsByMapID[indx] : -1;
+}
+
+void CMapListPanel::RemoveRow(int row)
+{
+    MarkRowChanged(row);
+
+    if (m_vecRowPasses[row])
+        m_iPassingRows--;
+
+    m_mapRowsByMapID.Remove(m_vecRowMapIDs[row]);
+    m_vecRowItemIDs[row] = -1;
+    m_vecRowPasses[row] = false;
+    m_vecRowNames[row] = nullptr;
+    m_vecRowCreationDates[row] = nullptr;
+    m_vecFreeRows.AddToTail(row);
+
+    InvalidateOrder();
+}
+
+void CMapListPanel::InvalidateOrder()
+{
+    m_bOrderDirty = true;
+    InvalidateLayout();
+}
+
+void CMapListPanel::BuildSortOrder(int column)
+{
+    CUtlVector<int> &order = m_vecSortOrders[column];
+    order.RemoveAll();
+    order.EnsureCapacity(m_vecRowItemIDs.Count());
+
+    FOR_EACH_VEC(m_vecRowItemIDs, row)
+    {
+        if (m_vecRowItemIDs[row] != -1)
+            order.AddToTail(row);
+    }
+
+    s_pSortingList = this;
+    s_iSortingColumn = column;
+    order.Sort(SortOrderCompare);
+    s_pSortingList = nullptr;
+
+    m_bSortOrderValid[column] = true;
+}
+
+void CMapListPanel::MarkRowChanged(int row)
+{
+    if (!m_vecRowChanged[row])
+    {
+        m_vecRowChanged[row] = true;
+        m_vecChangedRows.AddToTail(row);
+    }
+}
+
+void CMapListPanel::FlushChangedRows()
+{
+    if (m_vecChangedRows.IsEmpty())
+        return;
+
+    // The changed rows that are still there, to be merged back in
+    CUtlVector<int> vecInserted;
+    vecInserted.EnsureCapacity(m_vecChangedRows.Count());
+    FOR_EACH_VEC(m_vecChangedRows, i)
+    {
+        if (m_vecRowItemIDs[m_vecChangedRows[i]] != -1)
+            vecInserted.AddToTail(m_vecChangedRows[i]);
+    }
+
+    // One pass over each permutation: drop the changed rows from where they were, and merge them in sorted
+    CUtlVector<int> vecMerged;
+    for (int column = 0; column < MAP_LIST_COLUMN_COUNT; column++)
+    {
+        if (!m_bSortOrderValid[column])
+            continue;
+
+        s_pSortingList = this;
+        s_iSortingColumn = column;
+        vecInserted.Sort(SortOrderCompare);
+        s_pSortingList = nullptr;
+
+        CUtlVector<int> &order = m_vecSortOrders[column];
+        vecMerged.RemoveAll();
+        vecMerged.EnsureCapacity(order.Count() + vecInserted.Count());
+
+        int next = 0;
+        FOR_EACH_VEC(order, i)
+        {
+            const int row = order[i];
+            if (m_vecRowChanged[row])
+                continue;
+
+            while (next < vecInserted.Count() && CompareRows(column, vecInserted[next], row) < 0)
+                vecMerged.AddToTail(vecInserted[next++]);
+
+            vecMerged.AddToTail(row);
+        }
+
+        while (next < vecInserted.Count())
+            vecMerged.AddToTail(vecInserted[next++]);
+
+        order.Swap(vecMerged);
+    }
+
+    FOR_EACH_VEC(m_vecChangedRows, i)
+    {
+        m_vecRowChanged[m_vecChangedRows[i]] = false;
+    }
+    m_vecChangedRows.RemoveAll();
+}
+
+int CMapListPanel::CompareRows(int column, int row1, int row2) const
+{
+    int result = 0;
+    switch (column)
+    {
+    case HEADER_MAP_IN_LIBRARY:
+        result = m_vecRowInLibrary[row1] - m_vecRowInLibrary[row2];
+        break;
+    case HEADER_MAP_IN_FAVORITES:
+        result = m_vecRowInFavorites[row1] - m_vecRowInFavorites[row2];
+        break;
+    case HEADER_MAP_LAYOUT:
+        result = m_vecRowLayouts[row1] - m_vecRowLayouts[row2];
+        break;
+    case HEADER_DIFFICULTY:
+        result = m_vecRowDifficulties[row1] - m_vecRowDifficulties[row2];
+        break;
+    case HEADER_WORLD_RECORD:
+        result = (m_vecRowWorldRecords[row1] > m_vecRowWorldRecords[row2]) - (m_vecRowWorldRecords[row1] < m_vecRowWorldRecords[row2]);
+        break;
+    case HEADER_BEST_TIME:
+        result = (m_vecRowPersonalBests[row1] > m_vecRowPersonalBests[row2]) - (m_vecRowPersonalBests[row1] < m_vecRowPersonalBests[row2]);
+        break;
+    case HEADER_DATE_CREATED:
+        result = Q_stricmp(m_vecRowCreationDates[row1], m_vecRowCreationDates[row2]);
+        break;
+    case HEADER_LAST_PLAYED:
+        result = (m_vecRowLastPlayed[row1] > m_vecRowLastPlayed[row2]) - (m_vecRowLastPlayed[row1] < m_vecRowLastPlayed[row2]);
+        break;
+    default:
+        break;
+    }
+
+    if (result)
+        return result;
+
+    // Ties (and the name column) go by name, then ID to keep the order stable
+    result = Q_stricmp(m_vecRowNames[row1], m_vecRowNames[row2]);
+    if (result)
+        return result;
+
+    return (m_vecRowMapIDs[row1] > m_vecRowMapIDs[row2]) - (m_vecRowMapIDs[row1] < m_vecRowMapIDs[row2]);
+}
+
+int __cdecl CMapListPanel::SortOrderCompare(const int *pRow1, const int *pRow2)
+{
+    return s_pSortingList->CompareRows(s_iSortingColumn, *pRow1, *pRow2);
+}
+
+void CMapListPanel::RebuildVisibleItems()
+{
+    m_bOrderDirty = false;
+
+    FlushChangedRows();
+
+    int column, secondaryColumn;
+    bool bAscending;
+    GetSortColumnEx(column, secondaryColumn, bAscending);
+    if (column < 0 || column >= MAP_LIST_COLUMN_COUNT)
+        column = HEADER_MAP_NAME;
+
+    if (!m_bSortOrderValid[column])
+        BuildSortOrder(column);
+
+    const CUtlVector<int> &order = m_vecSortOrders[column];
+
+    CUtlVector<int> vecItems;
+    vecItems.EnsureCapacity(m_iPassingRows);
+    for (int i = 0; i < order.Count(); i++)
+    {
+        const int row = order[bAscending ? i : order.Count() - 1 - i];
+        if (m_vecRowPasses[row])
+            vecItems.AddToTail(m_vecRowItemIDs[row]);
+    }
+
+    SetVisibleItems(vecItems);
+}
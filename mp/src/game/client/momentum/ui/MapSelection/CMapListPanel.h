@@ -1,14 +1,21 @@
 #pragma once
 
 #include "vgui_controls/ListPanel.h"
+#include "IMapList.h"
 
 struct MapDisplay_t;
+struct MapData;
 class CBaseMapsPage;
 class MapDownloadProgress;
 
+#define MAP_LIST_COLUMN_COUNT 10 // Must match the HEADERS enum
+
 //-----------------------------------------------------------------------------
 // Purpose: Acts like a regular ListPanel but forwards enter key presses
 // to its outer control.
+// The rows are not sorted or filtered by the ListPanel: the values that matter for that are kept in one array
+// per column, with a sort permutation cached per column. Sorting only walks these arrays, filtering is done by
+// the search index of the map cache, and the cell contents of a row are only filled in once the row gets painted.
 //-----------------------------------------------------------------------------
 class CMapListPanel : public vgui::ListPanel
 {
@@ -23,7 +30,63 @@ public:
     Panel* GetCellRenderer(int itemID, int column) OVERRIDE;
 
     void ApplySchemeSettings(vgui::IScheme *pScheme) OVERRIDE;
+    void PerformLayout() OVERRIDE;
+
+    // ListPanel, kept in sync with the row store
+    void RemoveItem(int itemID) OVERRIDE;
+    void RemoveAll() OVERRIDE;
+    void SortList() OVERRIDE;
+
+    // Adds or refreshes the row of the map, called after the item for it was added or changed
+    void UpdateMapRow(int itemID, MapData *pData);
+    void SetFilters(const MapFilters_t &filters);
+    // Rows passing the filters, GetItemCount only catches up once the rows are laid out again
+    int GetPassingRowCount() const { return m_iPassingRows; }
 
 private:
+    // Row store
+    int FindRow(uint32 mapID);
+    void RemoveRow(int row);
+
+    // Sort permutations
+    void InvalidateOrder();
+    void BuildSortOrder(int column);
+    void MarkRowChanged(int row);
+    void FlushChangedRows();
+    int CompareRows(int column, int row1, int row2) const;
+    static int __cdecl SortOrderCompare(const int *pRow1, const int *pRow2);
+
+    // Fills in the ListPanel rows in the current sort order
+    void RebuildVisibleItems();
+
     CBaseMapsPage *m_pOuter;
-};
\ No newline at end of file
+
+    // Column store, indexed by row. Removed rows are kept as holes (item ID of -1) to be reused.
+    CUtlVector<int> m_vecRowItemIDs;
+    CUtlVector<uint32> m_vecRowMapIDs;
+    CUtlVector<const char *> m_vecRowNames;
+    CUtlVector<const char *> m_vecRowCreationDates; // ISO dates, sort as strings
+    CUtlVector<uint8> m_vecRowDifficulties;
+    CUtlVector<uint8> m_vecRowLayouts;
+    CUtlVector<uint8> m_vecRowInLibrary;
+    CUtlVector<uint8> m_vecRowInFavorites;
+    CUtlVector<float> m_vecRowPersonalBests;
+    CUtlVector<float> m_vecRowWorldRecords;
+    CUtlVector<uint64> m_vecRowLastPlayed;
+    CUtlVector<int> m_vecRowSearchSlots; // Slot of the map in the search index of the map cache
+    CUtlVector<uint8> m_vecRowPasses; // Result of the current filters
+    CUtlVector<uint8> m_vecRowChanged; // Added, changed or removed since the sort permutations were last updated
+
+    CUtlVector<int> m_vecFreeRows;
+    CUtlMap<uint32, int> m_mapRowsByMapID;
+    int m_iPassingRows;
+
+    // Rows ordered by each column (ascending, ties by map name), built the first time the column is sorted by.
+    // Changed rows are moved in all of them at once (FlushChangedRows), before the visible items are rebuilt.
+    CUtlVector<int> m_vecSortOrders[MAP_LIST_COLUMN_COUNT];
+    CUtlVector<int> m_vecChangedRows;
+    bool m_bSortOrderValid[MAP_LIST_COLUMN_COUNT];
+
+    MapFilters_t m_Filters;
+    bool m_bOrderDirty;
+};
@@ -13,13 +13,12 @@ struct MapDisplay_t
     MapDisplay_t()
     {
         m_iListID = -1;
-        m_bNeedsShown = true;
         m_bNeedsUpdate = true;
         m_pMap = nullptr;
     }
     MapData *m_pMap;      // the map struct, containing the information for the map
     int m_iListID;        // the VGUI2 list panel index for displaying this server
-    bool m_bNeedsShown, m_bNeedsUpdate;
+    bool m_bNeedsUpdate;
 };
 
 // Used by map filter panel
@@ -37,6 +37,8 @@ void CMapContextMenu::ShowMenu(MapData *pMapData)
             }
             else if (g_pMapCache->IsMapQueuedToDownload(pMapData->m_uID))
             {
+                AddMenuItem("PrioritizeDownload", "#MOM_MapSelector_PrioritizeDownload",
+                            new KeyValues("PrioritizeDownload", "id", pMapData->m_uID), m_pParent);
                 AddMenuItem("RemoveFromQueue", "#MOM_MapSelector_RemoveFromQueue",
                             new KeyValues("RemoveFromQueue", "id", pMapData->m_uID), m_pParent);
             }
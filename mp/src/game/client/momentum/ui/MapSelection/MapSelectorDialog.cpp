@@ -32,7 +32,7 @@ CMapSelectorDialog &MapSelectorDialog()
     return *s_MapDlg;
 }
 
-MapListData::MapListData(): m_pMapData(nullptr), m_pKv(nullptr), m_iThumbnailImageIndx(INDX_MAP_THUMBNAIL_UNKNOWN), m_pImage(nullptr)
+MapListData::MapListData(): m_pMapData(nullptr), m_pKv(nullptr), m_iPendingUpdates(0), m_iThumbnailImageIndx(INDX_MAP_THUMBNAIL_UNKNOWN), m_pImage(nullptr)
 {
 }
 
@@ -271,11 +271,39 @@ void CMapSelectorDialog::UpdateMapListData(uint32 uMapID, bool bMain, bool bInfo
         return;
     }
 
+    // The cells get filled in once the row is painted, the map lists only need the MapData to sort and filter
     MapListData *pMap = m_mapMapListData[indx];
+    if (bMain)
+        pMap->m_iPendingUpdates |= MAP_LIST_UPDATE_MAIN;
+    if (bInfo)
+        pMap->m_iPendingUpdates |= MAP_LIST_UPDATE_INFO;
+    if (bPB)
+        pMap->m_iPendingUpdates |= MAP_LIST_UPDATE_PB;
+    if (bWR)
+        pMap->m_iPendingUpdates |= MAP_LIST_UPDATE_WR;
+    if (bThumbnail)
+        pMap->m_iPendingUpdates |= MAP_LIST_UPDATE_THUMBNAIL;
+
+    PostActionSignal(new KeyValues("MapListDataUpdate", "id", uMapID));
+}
+
+void CMapSelectorDialog::ApplyPendingMapListData(uint32 uMapID)
+{
+    const auto indx = m_mapMapListData.Find(uMapID);
+    if (!m_mapMapListData.IsValidIndex(indx))
+        return;
+
+    MapListData *pMap = m_mapMapListData[indx];
+    if (!pMap->m_iPendingUpdates)
+        return;
+
+    const int iUpdates = pMap->m_iPendingUpdates;
+    pMap->m_iPendingUpdates = 0;
+
     MapData *pMapData = pMap->m_pMapData;
     KeyValues *pDataKv = pMap->m_pKv;
 
-    if (bMain)
+    if (iUpdates & MAP_LIST_UPDATE_MAIN)
     {
         pDataKv->SetString(KEYNAME_MAP_NAME, pMapData->m_szMapName);
         pDataKv->SetInt(KEYNAME_MAP_ID, pMapData->m_uID);
@@ -316,7 +344,7 @@ void CMapSelectorDialog::UpdateMapListData(uint32 uMapID, bool bMain, bool bInfo
         }
     }
 
-    if (bInfo)
+    if (iUpdates & MAP_LIST_UPDATE_INFO)
     {
         pDataKv->SetInt(KEYNAME_MAP_DIFFICULTY, pMapData->m_MainTrack.m_iDifficulty);
         pDataKv->SetInt(KEYNAME_MAP_LAYOUT, pMapData->m_MainTrack.m_bIsLinear ? INDX_MAP_IS_LINEAR : INDX_MAP_IS_STAGED);
@@ -332,7 +360,7 @@ void CMapSelectorDialog::UpdateMapListData(uint32 uMapID, bool bMain, bool bInfo
         }
     }
 
-    if (bPB)
+    if (iUpdates & MAP_LIST_UPDATE_PB)
     {
         if (pMapData->m_PersonalBest.m_bValid)
         {
@@ -349,7 +377,7 @@ void CMapSelectorDialog::UpdateMapListData(uint32 uMapID, bool bMain, bool bInfo
         }
     }
 
-    if (bWR)
+    if (iUpdates & MAP_LIST_UPDATE_WR)
     {
         if (pMapData->m_WorldRecord.m_bValid)
         {
@@ -366,7 +394,7 @@ void CMapSelectorDialog::UpdateMapListData(uint32 uMapID, bool bMain, bool bInfo
         }
     }
 
-    if (bThumbnail)
+    if (iUpdates & MAP_LIST_UPDATE_THUMBNAIL)
     {
         // Remove the old image if there
         if (pMap->m_pImage)
@@ -376,6 +404,8 @@ void CMapSelectorDialog::UpdateMapListData(uint32 uMapID, bool bMain, bool bInfo
         }
 
         URLImage *pImage = new URLImage(m_pImageList->GetImage(INDX_MAP_THUMBNAIL_UNKNOWN));
+        // Sized before loading so it gets decoded straight to a small thumbnail
+        pImage->SetSize(GetScaledVal(50), GetScaledVal(28));
         if (pImage->LoadFromURL(pMapData->m_Thumbnail.m_szURLSmall))
         {
             pMap->m_pImage = pImage;
@@ -398,8 +428,6 @@ void CMapSelectorDialog::UpdateMapListData(uint32 uMapID, bool bMain, bool bInfo
     }
 
     pDataKv->SetInt(KEYNAME_MAP_IMAGE, pMap->m_iThumbnailImageIndx);
-
-    PostActionSignal(new KeyValues("MapListDataUpdate", "id", pMapData->m_uID));
 }
 
 MapListData* CMapSelectorDialog::GetMapListDataByID(uint32 uMapID)
@@ -534,6 +562,11 @@ void CMapSelectorDialog::OnRemoveFromQueue(int id)
     g_pMapCache->RemoveMapFromDownloadQueue(id);
 }
 
+void CMapSelectorDialog::OnPrioritizeDownload(int id)
+{
+    g_pMapCache->PrioritizeDownload(id);
+}
+
 void CMapSelectorDialog::OnCancelMapDownload(int id)
 {
     if (ConVarRef("mom_map_download_cancel_confirm").GetBool())
@@ -14,10 +14,21 @@ class IMapList;
 class MapFilterPanel;
 class MapDownloadProgress;
 
+// Parts of a MapListData that changed since its row was last painted
+enum MapListDataUpdate_t
+{
+    MAP_LIST_UPDATE_MAIN = 1 << 0,
+    MAP_LIST_UPDATE_INFO = 1 << 1,
+    MAP_LIST_UPDATE_PB = 1 << 2,
+    MAP_LIST_UPDATE_WR = 1 << 3,
+    MAP_LIST_UPDATE_THUMBNAIL = 1 << 4,
+};
+
 struct MapListData
 {
     MapData *m_pMapData;
-    KeyValues *m_pKv;
+    KeyValues *m_pKv; // Cell data of the row, only filled in once the row gets painted
+    int m_iPendingUpdates; // MapListDataUpdate_t flags not applied to m_pKv yet
     int m_iThumbnailImageIndx;
     vgui::IImage *m_pImage;
 
@@ -90,6 +101,8 @@ class CMapSelectorDialog : public vgui::Frame
     void OnMapDataUpdated(KeyValues *pKv);
     void CreateMapListData(MapData *pData);
     void UpdateMapListData(uint32 uMapID, bool bMain, bool bInfo, bool bPB, bool bWR, bool bThumbnail);
+    // Fills in the cells of the map's row, called by the map lists when the row gets painted
+    void ApplyPendingMapListData(uint32 uMapID);
     MapListData *GetMapListDataByID(uint32 uMapID);
 
     // Callbacks for download
@@ -111,6 +124,7 @@ class CMapSelectorDialog : public vgui::Frame
     // Called when user wants to download/cancel download
     MESSAGE_FUNC_INT(OnStartMapDownload, "DownloadMap", id);
     MESSAGE_FUNC_INT(OnRemoveFromQueue, "RemoveFromQueue", id);
+    MESSAGE_FUNC_INT(OnPrioritizeDownload, "PrioritizeDownload", id);
     MESSAGE_FUNC_INT(OnCancelMapDownload, "CancelDownload", id);
     MESSAGE_FUNC_INT(OnConfirmCancelMapDownload, "ConfirmCancelDownload", id);
     MESSAGE_FUNC_INT(OnRejectCancelMapDownload, "RejectCancelDownload", id);
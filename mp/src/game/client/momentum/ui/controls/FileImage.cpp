@@ -1,6 +1,7 @@
 #include "cbase.h"
 
 #include "FileImage.h"
+#include "ImageCache.h"
 
 #include "filesystem.h"
 #include "vgui_controls/Controls.h"
@@ -19,7 +20,8 @@
 using namespace vgui;
 
 FileImage::FileImage(IImage *pDefaultImage /* = nullptr*/): m_iX(0), m_iY(0), m_iImageWide(0), 
-    m_iDesiredWide(0), m_iImageTall(0), m_iDesiredTall(0), m_iRotation(0), m_iTextureID(-1), m_pDefaultImage(pDefaultImage)
+    m_iDesiredWide(0), m_iImageTall(0), m_iDesiredTall(0), m_iRotation(0), m_iTextureID(-1), m_pDefaultImage(pDefaultImage),
+    m_bAsyncLoad(false), m_iDecodeJob(-1), m_bReloadOnPaint(false), m_hCacheEntry(IMAGE_CACHE_INVALID_ENTRY)
 {
     m_DrawColor = Color(255, 255, 255, 255);
     m_szFileName[0] = '\0';
@@ -33,6 +35,7 @@ FileImage::FileImage(const char *pFileName, const char *pPathID, IImage *pDefaul
 
 FileImage::~FileImage()
 {
+    CancelDecode();
     DestroyTexture();
 }
 
@@ -46,6 +49,13 @@ bool FileImage::LoadFromFile(const char* pFileName, const char* pPathID /* = "GA
 
 bool FileImage::LoadFromFileInternal()
 {
+    if (m_bAsyncLoad)
+    {
+        CancelDecode();
+        m_iDecodeJob = g_pImageCache->QueueFile(m_szFileName, m_szPathID, CImageCache::GetSizeBucket(m_iDesiredWide, m_iDesiredTall));
+        return true;
+    }
+
     CUtlBuffer fileBuf;
     if (!g_pFullFileSystem->ReadFile(m_szFileName, m_szPathID, fileBuf))
         return false;
@@ -70,6 +80,60 @@ bool FileImage::LoadFromUtlBuffer(CUtlBuffer &buf)
     return true;
 }
 
+void FileImage::LoadFromUtlBufferAsync(CUtlBuffer &buf, const char *pCacheKey)
+{
+    CancelDecode();
+    m_iDecodeJob = g_pImageCache->QueueBuffer(buf, pCacheKey, CImageCache::GetSizeBucket(m_iDesiredWide, m_iDesiredTall));
+}
+
+bool FileImage::LoadFromCache(const char *pCacheKey)
+{
+    CancelDecode();
+    m_iDecodeJob = g_pImageCache->QueueCached(pCacheKey, CImageCache::GetSizeBucket(m_iDesiredWide, m_iDesiredTall));
+    return m_iDecodeJob != -1;
+}
+
+void FileImage::CancelDecode()
+{
+    if (m_iDecodeJob != -1)
+    {
+        g_pImageCache->CancelJob(m_iDecodeJob);
+        m_iDecodeJob = -1;
+    }
+}
+
+void FileImage::UpdateDecode()
+{
+    if (m_iDecodeJob == -1)
+        return;
+
+    // We're being painted, so get decoded before the rows that are scrolled out of view
+    g_pImageCache->TouchJob(m_iDecodeJob);
+
+    uint8 *pData = nullptr;
+    int wide, tall;
+    const ImageJobState_t state = g_pImageCache->PollJob(m_iDecodeJob, &pData, wide, tall);
+    if (state == IMAGE_JOB_PENDING)
+        return;
+
+    m_iDecodeJob = -1;
+    if (state == IMAGE_JOB_DONE)
+    {
+        LoadFromRGBA(pData, wide, tall);
+        delete[] pData;
+    }
+    else
+    {
+        OnDecodeFailed();
+    }
+}
+
+void FileImage::ReleaseTexture()
+{
+    DestroyTexture();
+    m_bReloadOnPaint = true;
+}
+
 void FileImage::LoadFromRGBA(const uint8* pData, int wide, int tall)
 {
     // Clear up any previous texture
@@ -78,7 +142,10 @@ void FileImage::LoadFromRGBA(const uint8* pData, int wide, int tall)
     m_iTextureID = surface()->CreateNewTextureID(true);
     // Image data gets memcpy'd over in this function...
     surface()->DrawSetTextureRGBAEx(m_iTextureID, pData, wide, tall, IMAGE_FORMAT_RGBA8888);
-    
+
+    if (CanReload())
+        g_pImageCache->OnTextureCreated(this, wide * tall * 4, m_hCacheEntry);
+
     m_iImageWide = wide;
     m_iImageTall = tall;
 
@@ -90,8 +157,20 @@ void FileImage::LoadFromRGBA(const uint8* pData, int wide, int tall)
 
 void FileImage::Paint()
 {
+    // Textures are only (re)uploaded once they are needed on screen
+    if (m_bReloadOnPaint)
+    {
+        m_bReloadOnPaint = false;
+        Evict();
+    }
+
+    UpdateDecode();
+
     if (m_iTextureID != -1)
     {
+        if (m_hCacheEntry != IMAGE_CACHE_INVALID_ENTRY)
+            g_pImageCache->OnTexturePainted(m_hCacheEntry);
+
         surface()->DrawSetColor(m_DrawColor);
         surface()->DrawSetTexture(m_iTextureID);
 
@@ -163,6 +242,8 @@ bool FileImage::Evict()
 
 void FileImage::DestroyTexture()
 {
+    g_pImageCache->OnTextureDestroyed(m_hCacheEntry);
+
     if (surface() && m_iTextureID > -1)
     {
         surface()->DestroyTextureID(m_iTextureID);
@@ -171,8 +252,9 @@ void FileImage::DestroyTexture()
 }
 
 URLImage::URLImage(IImage *pDefaultImage/* = nullptr*/, bool bDrawProgress /* = false*/) : FileImage(pDefaultImage), 
-        m_hRequest(INVALID_HTTPREQUEST_HANDLE), m_bDrawProgressBar(bDrawProgress)
+        m_hRequest(INVALID_HTTPREQUEST_HANDLE), m_bLoadingFromCache(false), m_bDrawProgressBar(bDrawProgress)
 {
+    SetAsyncLoad(true);
     m_szURL[0] = '\0';
     m_fProgress = 0.0f;
     m_uTotalSize = 0;
@@ -184,9 +266,17 @@ URLImage::URLImage(const char* pURL, IImage* pDefault, bool bDrawProgress) : URL
 }
 
 URLImage::~URLImage()
+{
+    CancelDownload();
+}
+
+void URLImage::CancelDownload()
 {
     if (m_hRequest != INVALID_HTTPREQUEST_HANDLE)
+    {
         g_pAPIRequests->CancelDownload(m_hRequest);
+        m_hRequest = INVALID_HTTPREQUEST_HANDLE;
+    }
 }
 
 bool URLImage::LoadFromURL(const char* pURL)
@@ -196,8 +286,15 @@ bool URLImage::LoadFromURL(const char* pURL)
     return LoadFromURLInternal();
 }
 
-bool URLImage::LoadFromURLInternal()
+bool URLImage::LoadFromURLInternal(bool bUseCache /* = true*/)
 {
+    CancelDownload();
+
+    // Skip the download if we have a thumbnail of it already
+    m_bLoadingFromCache = bUseCache && LoadFromCache(m_szURL);
+    if (m_bLoadingFromCache)
+        return true;
+
     m_fProgress = 0.0f;
     m_uTotalSize = 0;
     m_hRequest = g_pAPIRequests->DownloadFile(m_szURL,
@@ -234,6 +331,15 @@ bool URLImage::Evict()
     return false;
 }
 
+void URLImage::OnDecodeFailed()
+{
+    // Broken cache entry, get the real thing instead
+    if (m_bLoadingFromCache)
+        LoadFromURLInternal(false);
+    else
+        DevWarning("Could not decode URLImage %s!\n", m_szURL);
+}
+
 void URLImage::OnFileStreamSize(KeyValues* pKv)
 {
     m_uTotalSize = pKv->GetUint64("size");
@@ -258,7 +364,7 @@ void URLImage::OnFileStreamEnd(KeyValues* pKv)
         CUtlBuffer *pBuf = static_cast<CUtlBuffer*>(pKv->GetPtr("buf"));
         if (pBuf)
         {
-            LoadFromUtlBuffer(*pBuf);
+            LoadFromUtlBufferAsync(*pBuf, m_szURL);
         }
     }
 }
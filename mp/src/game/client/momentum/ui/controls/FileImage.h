@@ -7,7 +7,8 @@ namespace vgui
     // A class to load (almost) any type of image from disk to be used on panels and ImageLists.
     // Uses STB image to parse JPG/PNG/GIF(non-animated)/TGA/BMP, functions very similarly to BitmapImage
     // but allows for more types of images.
-    // Use LoadFromFile to load an image.
+    // Use LoadFromFile to load an image. With SetAsyncLoad, the image is decoded by the CImageCache worker
+    // instead and only uploaded once it gets painted.
     class FileImage : public IImage
     {
     public:
@@ -21,6 +22,13 @@ namespace vgui
         bool LoadFromUtlBuffer(CUtlBuffer &buf);
         void LoadFromRGBA(const uint8 *pData, int wide, int tall);
 
+        /// Decode on the image cache worker and downscale to the size set through SetSize (if any).
+        /// Set this before loading anything.
+        void SetAsyncLoad(bool bAsync) { m_bAsyncLoad = bAsync; }
+
+        /// Drops the texture, it gets reloaded through Evict the next time the image is painted
+        void ReleaseTexture();
+
         // Call to Paint the image
         // Image will draw within the current panel context at the specified position
         void Paint() OVERRIDE;
@@ -52,12 +60,26 @@ namespace vgui
         HTexture GetID() OVERRIDE { return (HTexture) 0; }
 
     protected:
+        // Hands the encoded image to the image cache worker, pCacheKey identifies it in the thumbnail cache
+        void LoadFromUtlBufferAsync(CUtlBuffer &buf, const char *pCacheKey);
+        // Picks up the image from the thumbnail cache if it is there, returns false if not
+        bool LoadFromCache(const char *pCacheKey);
+        void CancelDecode();
+        virtual void OnDecodeFailed() {}
+        // Whether Evict can bring the texture back
+        virtual bool CanReload() { return m_szFileName[0] != '\0'; }
+
         Color m_DrawColor;
         int m_iX, m_iY, m_iImageWide, m_iDesiredWide, m_iImageTall, m_iDesiredTall, m_iRotation, m_iTextureID;
         IImage *m_pDefaultImage;
+        bool m_bAsyncLoad;
     private:
         bool LoadFromFileInternal();
+        void UpdateDecode();
         void DestroyTexture();
+        int m_iDecodeJob;
+        bool m_bReloadOnPaint;
+        unsigned short m_hCacheEntry; // Our entry in the image cache texture LRU
         char m_szFileName[MAX_PATH];
         char m_szPathID[16];
     };
@@ -83,14 +105,18 @@ namespace vgui
         void Paint() OVERRIDE;
         bool Evict() OVERRIDE;
     protected:
+        bool CanReload() OVERRIDE { return m_szURL[0] != '\0'; }
+        void OnDecodeFailed() OVERRIDE;
         void OnFileStreamSize(KeyValues *pKv);
         void OnFileStreamProgress(KeyValues *pKv);
         void OnFileStreamEnd(KeyValues *pKv);
 
     private:
-        bool LoadFromURLInternal();
+        bool LoadFromURLInternal(bool bUseCache = true);
+        void CancelDownload();
         char m_szURL[256];
         uint64 m_hRequest;
+        bool m_bLoadingFromCache;
         bool m_bDrawProgressBar;
         float m_fProgress;
         uint64 m_uTotalSize;
@@ -0,0 +1,557 @@
+#include "cbase.h"
+
+#include <ctime>
+
+#include "ImageCache.h"
+#include "FileImage.h"
+
+#include "filesystem.h"
+#include "checksum_crc.h"
+
+#include "stb/image/stb_image.h"
+
+#include "tier0/memdbgon.h"
+
+#define THUMBNAIL_CACHE_PATH "cache/thumbnails"
+#define THUMBNAIL_CACHE_EXT ".rgba"
+#define THUMBNAIL_MAGIC MAKEID('M', 'O', 'T', 'C')
+#define THUMBNAIL_VERSION 2
+
+static const int s_iSizeBuckets[] = { 64, 128, 256, 512, 1024, 2048 };
+
+static MAKE_TOGGLE_CONVAR(mom_image_cache_disk, "1", FCVAR_ARCHIVE,
+                          "Stores downscaled map thumbnails in cache/thumbnails so they do not need to be decoded again.\n");
+static MAKE_CONVAR(mom_image_cache_disk_size, "256", FCVAR_ARCHIVE,
+                   "Megabytes of thumbnails kept in cache/thumbnails before the least recently used ones are deleted.\n", 16, 8192);
+static MAKE_CONVAR(mom_image_texture_budget, "96", FCVAR_ARCHIVE,
+                   "Megabytes of UI image textures to keep around before the least recently drawn ones are released.\n", 16, 1024);
+
+CImageCache::CImageCache() : CAutoGameSystem("CImageCache"), m_hThread(nullptr), m_bShutdown(false),
+    m_iNextJobID(0), m_iNextPriority(0), m_iDiskBytes(0), m_bDiskScanned(false), m_iTextureBytes(0)
+{
+}
+
+bool CImageCache::Init()
+{
+    g_pFullFileSystem->CreateDirHierarchy(THUMBNAIL_CACHE_PATH, "MOD");
+    return true;
+}
+
+void CImageCache::Shutdown()
+{
+    if (m_hThread)
+    {
+        m_bShutdown = true;
+        m_JobEvent.Set();
+        ThreadJoin(m_hThread);
+        ReleaseThreadHandle(m_hThread);
+        m_hThread = nullptr;
+    }
+
+    FOR_EACH_VEC(m_vecJobs, i)
+    {
+        FreeJob(m_vecJobs[i]);
+    }
+    m_vecJobs.RemoveAll();
+}
+
+int CImageCache::GetSizeBucket(int wide, int tall)
+{
+    const int iLargest = max(wide, tall);
+    if (iLargest <= 0)
+        return IMAGE_CACHE_FULL_SIZE;
+
+    for (int i = 0; i < ARRAYSIZE(s_iSizeBuckets); i++)
+    {
+        if (iLargest <= s_iSizeBuckets[i])
+            return s_iSizeBuckets[i];
+    }
+
+    return IMAGE_CACHE_FULL_SIZE;
+}
+
+int CImageCache::QueueFile(const char *pFileName, const char *pPathID, int iBucket)
+{
+    ImageJob_t *pJob = CreateJob(JOB_FILE, iBucket);
+    Q_strncpy(pJob->m_szPath, pFileName, sizeof(pJob->m_szPath));
+    Q_strncpy(pJob->m_szPathID, pPathID, sizeof(pJob->m_szPathID));
+    QueueJob(pJob);
+    return pJob->m_iID;
+}
+
+int CImageCache::QueueBuffer(const CUtlBuffer &buf, const char *pCacheKey, int iBucket)
+{
+    ImageJob_t *pJob = CreateJob(JOB_BUFFER, iBucket);
+    Q_strncpy(pJob->m_szCacheKey, pCacheKey ? pCacheKey : "", sizeof(pJob->m_szCacheKey));
+    pJob->m_bufEncoded.Put(buf.Base(), buf.TellPut());
+    QueueJob(pJob);
+    return pJob->m_iID;
+}
+
+int CImageCache::QueueCached(const char *pCacheKey, int iBucket)
+{
+    if (!mom_image_cache_disk.GetBool() || iBucket == IMAGE_CACHE_FULL_SIZE || iBucket > IMAGE_CACHE_MAX_DISK_BUCKET)
+        return -1;
+
+    char szCacheFile[MAX_PATH];
+    GetCacheFileName(pCacheKey, iBucket, szCacheFile, sizeof(szCacheFile));
+    if (!g_pFullFileSystem->FileExists(szCacheFile, "MOD"))
+        return -1;
+
+    ImageJob_t *pJob = CreateJob(JOB_CACHED, iBucket);
+    Q_strncpy(pJob->m_szCacheKey, pCacheKey, sizeof(pJob->m_szCacheKey));
+    QueueJob(pJob);
+    return pJob->m_iID;
+}
+
+void CImageCache::TouchJob(int iJob)
+{
+    AUTO_LOCK(m_Mutex);
+    FOR_EACH_VEC(m_vecJobs, i)
+    {
+        if (m_vecJobs[i]->m_iID == iJob)
+        {
+            m_vecJobs[i]->m_iPriority = ++m_iNextPriority;
+            return;
+        }
+    }
+}
+
+ImageJobState_t CImageCache::PollJob(int iJob, uint8 **ppData, int &wide, int &tall)
+{
+    AUTO_LOCK(m_Mutex);
+    FOR_EACH_VEC(m_vecJobs, i)
+    {
+        ImageJob_t *pJob = m_vecJobs[i];
+        if (pJob->m_iID != iJob)
+            continue;
+
+        const ImageJobState_t state = pJob->m_eState;
+        if (state == IMAGE_JOB_PENDING)
+            return state;
+
+        if (state == IMAGE_JOB_DONE)
+        {
+            *ppData = pJob->m_pData;
+            wide = pJob->m_iWide;
+            tall = pJob->m_iTall;
+            pJob->m_pData = nullptr;
+        }
+
+        m_vecJobs.Remove(i);
+        FreeJob(pJob);
+        return state;
+    }
+
+    return IMAGE_JOB_FAILED;
+}
+
+void CImageCache::CancelJob(int iJob)
+{
+    AUTO_LOCK(m_Mutex);
+    FOR_EACH_VEC(m_vecJobs, i)
+    {
+        ImageJob_t *pJob = m_vecJobs[i];
+        if (pJob->m_iID != iJob)
+            continue;
+
+        if (pJob->m_bRunning)
+        {
+            // The worker cleans it up once it is done
+            pJob->m_bCancelled = true;
+        }
+        else
+        {
+            m_vecJobs.Remove(i);
+            FreeJob(pJob);
+        }
+        return;
+    }
+}
+
+void CImageCache::OnTextureCreated(vgui::FileImage *pImage, int iBytes, unsigned short &hEntry)
+{
+    if (hEntry == IMAGE_CACHE_INVALID_ENTRY)
+        hEntry = m_listTextures.AddToTail();
+
+    TextureEntry_t &entry = m_listTextures[hEntry];
+    entry.m_pImage = pImage;
+    entry.m_iBytes = iBytes;
+    entry.m_iLastPaintFrame = gpGlobals->framecount;
+    m_iTextureBytes += iBytes;
+
+    EvictTextures();
+}
+
+void CImageCache::OnTexturePainted(unsigned short hEntry)
+{
+    TextureEntry_t &entry = m_listTextures[hEntry];
+    if (entry.m_iLastPaintFrame == gpGlobals->framecount)
+        return;
+
+    entry.m_iLastPaintFrame = gpGlobals->framecount;
+    m_listTextures.Unlink(hEntry);
+    m_listTextures.LinkToTail(hEntry);
+}
+
+void CImageCache::OnTextureDestroyed(unsigned short &hEntry)
+{
+    if (hEntry == IMAGE_CACHE_INVALID_ENTRY)
+        return;
+
+    m_iTextureBytes -= m_listTextures[hEntry].m_iBytes;
+    m_listTextures.Remove(hEntry);
+    hEntry = IMAGE_CACHE_INVALID_ENTRY;
+}
+
+void CImageCache::EvictTextures()
+{
+    const int iBudget = mom_image_texture_budget.GetInt() * 1024 * 1024;
+    while (m_iTextureBytes > iBudget && m_listTextures.Count())
+    {
+        // The list is in paint order, so once the oldest one is still being drawn all of them are
+        const TextureEntry_t &oldest = m_listTextures[m_listTextures.Head()];
+        if (oldest.m_iLastPaintFrame >= gpGlobals->framecount - 1)
+            break;
+
+        // Removes the entry through OnTextureDestroyed
+        oldest.m_pImage->ReleaseTexture();
+    }
+}
+
+CImageCache::ImageJob_t *CImageCache::CreateJob(JobType_t type, int iBucket)
+{
+    ImageJob_t *pJob = new ImageJob_t;
+    pJob->m_eType = type;
+    pJob->m_eState = IMAGE_JOB_PENDING;
+    pJob->m_bRunning = false;
+    pJob->m_bCancelled = false;
+    pJob->m_iBucket = iBucket;
+    pJob->m_szPath[0] = '\0';
+    pJob->m_szPathID[0] = '\0';
+    pJob->m_szCacheKey[0] = '\0';
+    pJob->m_pData = nullptr;
+    pJob->m_iWide = pJob->m_iTall = 0;
+    return pJob;
+}
+
+void CImageCache::QueueJob(ImageJob_t *pJob)
+{
+    if (!m_hThread)
+    {
+        m_bShutdown = false;
+        m_hThread = CreateSimpleThread(&CImageCache::WorkerThread, this);
+    }
+
+    {
+        AUTO_LOCK(m_Mutex);
+        pJob->m_iID = m_iNextJobID++;
+        pJob->m_iPriority = ++m_iNextPriority;
+        m_vecJobs.AddToTail(pJob);
+    }
+
+    m_JobEvent.Set();
+}
+
+void CImageCache::FreeJob(ImageJob_t *pJob)
+{
+    delete[] pJob->m_pData;
+    delete pJob;
+}
+
+unsigned CImageCache::WorkerThread(void *pParam)
+{
+    static_cast<CImageCache *>(pParam)->WorkerLoop();
+    return 0;
+}
+
+void CImageCache::WorkerLoop()
+{
+    while (!m_bShutdown)
+    {
+        ImageJob_t *pJob = NextJob();
+        if (!pJob)
+        {
+            m_JobEvent.Wait(250);
+            continue;
+        }
+
+        const bool bSuccess = ProcessJob(pJob);
+
+        AUTO_LOCK(m_Mutex);
+        pJob->m_bRunning = false;
+        pJob->m_bufEncoded.Purge();
+        if (pJob->m_bCancelled)
+        {
+            m_vecJobs.FindAndRemove(pJob);
+            FreeJob(pJob);
+        }
+        else
+        {
+            pJob->m_eState = bSuccess ? IMAGE_JOB_DONE : IMAGE_JOB_FAILED;
+        }
+    }
+}
+
+CImageCache::ImageJob_t *CImageCache::NextJob()
+{
+    AUTO_LOCK(m_Mutex);
+
+    // Newest request first; TouchJob keeps bumping the images that are on screen
+    ImageJob_t *pBest = nullptr;
+    FOR_EACH_VEC(m_vecJobs, i)
+    {
+        ImageJob_t *pJob = m_vecJobs[i];
+        if (pJob->m_eState != IMAGE_JOB_PENDING || pJob->m_bRunning)
+            continue;
+
+        if (!pBest || pJob->m_iPriority > pBest->m_iPriority)
+            pBest = pJob;
+    }
+
+    if (pBest)
+        pBest->m_bRunning = true;
+
+    return pBest;
+}
+
+bool CImageCache::ProcessJob(ImageJob_t *pJob)
+{
+    const bool bUseDiskCache = mom_image_cache_disk.GetBool() && pJob->m_iBucket != IMAGE_CACHE_FULL_SIZE &&
+                               pJob->m_iBucket <= IMAGE_CACHE_MAX_DISK_BUCKET;
+
+    switch (pJob->m_eType)
+    {
+    case JOB_CACHED:
+        return ReadCachedImage(pJob);
+    case JOB_FILE:
+        {
+            // Local files can change, so their cache entry is tied to the modification time
+            const long iFileTime = g_pFullFileSystem->GetFileTime(pJob->m_szPath, pJob->m_szPathID);
+            Q_snprintf(pJob->m_szCacheKey, sizeof(pJob->m_szCacheKey), "%s:%s:%ld", pJob->m_szPathID, pJob->m_szPath, iFileTime);
+
+            if (bUseDiskCache && ReadCachedImage(pJob))
+                return true;
+
+            if (!g_pFullFileSystem->ReadFile(pJob->m_szPath, pJob->m_szPathID, pJob->m_bufEncoded))
+                return false;
+        }
+        break;
+    case JOB_BUFFER:
+        break;
+    default:
+        return false;
+    }
+
+    if (!DecodeImage(pJob, static_cast<const uint8 *>(pJob->m_bufEncoded.Base()), pJob->m_bufEncoded.TellPut()))
+        return false;
+
+    if (bUseDiskCache && pJob->m_szCacheKey[0])
+        WriteCachedImage(pJob);
+
+    return true;
+}
+
+bool CImageCache::DecodeImage(ImageJob_t *pJob, const uint8 *pEncoded, int iSize)
+{
+    int w, h, channels;
+    stbi_uc *pDecoded = stbi_load_from_memory(pEncoded, iSize, &w, &h, &channels, STBI_rgb_alpha);
+    if (!pDecoded)
+        return false;
+
+    const int iLargest = max(w, h);
+    if (pJob->m_iBucket == IMAGE_CACHE_FULL_SIZE || iLargest <= pJob->m_iBucket)
+    {
+        pJob->m_pData = new uint8[w * h * 4];
+        V_memcpy(pJob->m_pData, pDecoded, w * h * 4);
+        pJob->m_iWide = w;
+        pJob->m_iTall = h;
+    }
+    else
+    {
+        // Box filter down to the bucket, keeping the aspect ratio
+        const int dw = max(1, w * pJob->m_iBucket / iLargest);
+        const int dh = max(1, h * pJob->m_iBucket / iLargest);
+        pJob->m_pData = new uint8[dw * dh * 4];
+        pJob->m_iWide = dw;
+        pJob->m_iTall = dh;
+
+        for (int dy = 0; dy < dh; dy++)
+        {
+            const int sy0 = dy * h / dh;
+            const int sy1 = max(sy0 + 1, (dy + 1) * h / dh);
+            for (int dx = 0; dx < dw; dx++)
+            {
+                const int sx0 = dx * w / dw;
+                const int sx1 = max(sx0 + 1, (dx + 1) * w / dw);
+
+                unsigned int sum[4] = { 0, 0, 0, 0 };
+                for (int sy = sy0; sy < sy1; sy++)
+                {
+                    const stbi_uc *pRow = pDecoded + (sy * w + sx0) * 4;
+                    for (int sx = sx0; sx < sx1; sx++, pRow += 4)
+                    {
+                        sum[0] += pRow[0];
+                        sum[1] += pRow[1];
+                        sum[2] += pRow[2];
+                        sum[3] += pRow[3];
+                    }
+                }
+
+                const unsigned int count = (sy1 - sy0) * (sx1 - sx0);
+                uint8 *pOut = pJob->m_pData + (dy * dw + dx) * 4;
+                for (int c = 0; c < 4; c++)
+                    pOut[c] = sum[c] / count;
+            }
+        }
+    }
+
+    stbi_image_free(pDecoded);
+    return true;
+}
+
+bool CImageCache::ReadCachedImage(ImageJob_t *pJob)
+{
+    char szCacheFile[MAX_PATH];
+    GetCacheFileName(pJob->m_szCacheKey, pJob->m_iBucket, szCacheFile, sizeof(szCacheFile));
+
+    CUtlBuffer buf;
+    if (!g_pFullFileSystem->ReadFile(szCacheFile, "MOD", buf))
+        return false;
+
+    ScanDiskCache();
+
+    const uint32 magic = buf.GetUnsignedInt();
+    const uint16 version = buf.GetUnsignedShort();
+    char szKey[sizeof(pJob->m_szCacheKey)];
+    buf.GetString(szKey, sizeof(szKey));
+    const int wide = buf.GetShort();
+    const int tall = buf.GetShort();
+    const int iBytes = wide * tall * 4;
+    if (magic != THUMBNAIL_MAGIC || version != THUMBNAIL_VERSION || wide <= 0 || tall <= 0 || buf.GetBytesRemaining() != iBytes)
+    {
+        // Outdated or broken, it gets rewritten by whoever decodes the image next
+        g_pFullFileSystem->RemoveFile(szCacheFile, "MOD");
+        const int indx = m_dictDiskEntries.Find(szCacheFile);
+        if (indx != m_dictDiskEntries.InvalidIndex())
+        {
+            m_iDiskBytes -= m_dictDiskEntries[indx].m_iBytes;
+            m_dictDiskEntries.RemoveAt(indx);
+        }
+        return false;
+    }
+
+    // Another key with the same file name, the image gets decoded and takes the file over
+    if (Q_strcmp(szKey, pJob->m_szCacheKey))
+        return false;
+
+    const int indx = m_dictDiskEntries.Find(szCacheFile);
+    if (indx != m_dictDiskEntries.InvalidIndex())
+        m_dictDiskEntries[indx].m_iLastUsed = time(nullptr);
+
+    pJob->m_pData = new uint8[iBytes];
+    buf.Get(pJob->m_pData, iBytes);
+    pJob->m_iWide = wide;
+    pJob->m_iTall = tall;
+    return true;
+}
+
+void CImageCache::WriteCachedImage(ImageJob_t *pJob)
+{
+    char szCacheFile[MAX_PATH];
+    GetCacheFileName(pJob->m_szCacheKey, pJob->m_iBucket, szCacheFile, sizeof(szCacheFile));
+
+    // The full key is stored so that keys sharing a file name are told apart
+    const int iBytes = pJob->m_iWide * pJob->m_iTall * 4;
+    CUtlBuffer buf(0, iBytes + Q_strlen(pJob->m_szCacheKey) + 13);
+    buf.PutUnsignedInt(THUMBNAIL_MAGIC);
+    buf.PutUnsignedShort(THUMBNAIL_VERSION);
+    buf.PutString(pJob->m_szCacheKey);
+    buf.PutShort(pJob->m_iWide);
+    buf.PutShort(pJob->m_iTall);
+    buf.Put(pJob->m_pData, iBytes);
+
+    if (!g_pFullFileSystem->WriteFile(szCacheFile, "MOD", buf))
+    {
+        DevWarning("Could not write thumbnail cache file %s!\n", szCacheFile);
+        return;
+    }
+
+    ScanDiskCache();
+
+    int indx = m_dictDiskEntries.Find(szCacheFile);
+    if (indx == m_dictDiskEntries.InvalidIndex())
+        indx = m_dictDiskEntries.Insert(szCacheFile);
+    else
+        m_iDiskBytes -= m_dictDiskEntries[indx].m_iBytes;
+
+    m_dictDiskEntries[indx].m_iBytes = buf.TellPut();
+    m_dictDiskEntries[indx].m_iLastUsed = time(nullptr);
+    m_iDiskBytes += buf.TellPut();
+
+    EvictDiskCache(szCacheFile);
+}
+
+void CImageCache::ScanDiskCache()
+{
+    if (m_bDiskScanned)
+        return;
+
+    m_bDiskScanned = true;
+
+    // The files from earlier sessions start out as used when they were written
+    FileFindHandle_t found;
+    const char *pFoundFile = g_pFullFileSystem->FindFirstEx(THUMBNAIL_CACHE_PATH "/*" THUMBNAIL_CACHE_EXT, "MOD", &found);
+    while (pFoundFile)
+    {
+        char szCacheFile[MAX_PATH];
+        Q_snprintf(szCacheFile, sizeof(szCacheFile), THUMBNAIL_CACHE_PATH "/%s", pFoundFile);
+
+        if (m_dictDiskEntries.Find(szCacheFile) == m_dictDiskEntries.InvalidIndex())
+        {
+            DiskEntry_t entry;
+            entry.m_iBytes = g_pFullFileSystem->Size(szCacheFile, "MOD");
+            entry.m_iLastUsed = g_pFullFileSystem->GetFileTime(szCacheFile, "MOD");
+            m_dictDiskEntries.Insert(szCacheFile, entry);
+            m_iDiskBytes += entry.m_iBytes;
+        }
+
+        pFoundFile = g_pFullFileSystem->FindNext(found);
+    }
+    g_pFullFileSystem->FindClose(found);
+
+    EvictDiskCache(nullptr);
+}
+
+void CImageCache::EvictDiskCache(const char *pKeepFile)
+{
+    const int64 iBudget = static_cast<int64>(mom_image_cache_disk_size.GetInt()) * 1024 * 1024;
+    while (m_iDiskBytes > iBudget)
+    {
+        int iOldest = m_dictDiskEntries.InvalidIndex();
+        FOR_EACH_DICT_FAST(m_dictDiskEntries, i)
+        {
+            if (pKeepFile && FStrEq(m_dictDiskEntries.GetElementName(i), pKeepFile))
+                continue;
+
+            if (iOldest == m_dictDiskEntries.InvalidIndex() || m_dictDiskEntries[i].m_iLastUsed < m_dictDiskEntries[iOldest].m_iLastUsed)
+                iOldest = i;
+        }
+
+        if (iOldest == m_dictDiskEntries.InvalidIndex())
+            break;
+
+        g_pFullFileSystem->RemoveFile(m_dictDiskEntries.GetElementName(iOldest), "MOD");
+        m_iDiskBytes -= m_dictDiskEntries[iOldest].m_iBytes;
+        m_dictDiskEntries.RemoveAt(iOldest);
+    }
+}
+
+void CImageCache::GetCacheFileName(const char *pCacheKey, int iBucket, char *pOut, int outSize)
+{
+    const CRC32_t crc = CRC32_ProcessSingleBuffer(pCacheKey, Q_strlen(pCacheKey));
+    Q_snprintf(pOut, outSize, THUMBNAIL_CACHE_PATH "/%08x_%i" THUMBNAIL_CACHE_EXT, crc, iBucket);
+}
+
+static CImageCache s_ImageCache;
+CImageCache *g_pImageCache = &s_ImageCache;
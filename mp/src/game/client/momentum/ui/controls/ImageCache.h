@@ -0,0 +1,134 @@
+#pragma once
+
+#include "utldict.h"
+#include "utllinkedlist.h"
+
+namespace vgui
+{
+    class FileImage;
+}
+
+// Sizes (largest side, in pixels) images get downscaled to. Buckets up to IMAGE_CACHE_MAX_DISK_BUCKET
+// are also stored in the thumbnail cache on disk, anything bigger is decoded at full resolution.
+#define IMAGE_CACHE_MAX_DISK_BUCKET 512
+#define IMAGE_CACHE_FULL_SIZE 0
+#define IMAGE_CACHE_INVALID_ENTRY ((unsigned short)~0)
+
+enum ImageJobState_t
+{
+    IMAGE_JOB_PENDING = 0, // Queued or being decoded
+    IMAGE_JOB_DONE,
+    IMAGE_JOB_FAILED,
+};
+
+// Decodes images on a worker thread for FileImage/URLImage, so the map browser does not stall the UI on
+// stb_image. Decoded images are downscaled to a size bucket and stored in cache/thumbnails, which makes the
+// next load a plain read. The thumbnails on disk are kept under mom_image_cache_disk_size, the least recently used
+// ones get deleted first. The textures of the loaded images are tracked here too: once they take up more
+// than mom_image_texture_budget, the ones that were not painted the longest get dropped and are reloaded
+// the next time they get painted.
+class CImageCache : public CAutoGameSystem
+{
+public:
+    CImageCache();
+
+    // CAutoGameSystem
+    bool Init() OVERRIDE;
+    void Shutdown() OVERRIDE;
+
+    // The bucket to use for an image drawn at the given size, IMAGE_CACHE_FULL_SIZE if unknown or too large
+    static int GetSizeBucket(int wide, int tall);
+
+    // Queues a decode of an image file, returns the job ID
+    int QueueFile(const char *pFileName, const char *pPathID, int iBucket);
+    // Queues a decode of an encoded (PNG/JPG...) image in memory, pCacheKey identifies it in the disk cache.
+    int QueueBuffer(const CUtlBuffer &buf, const char *pCacheKey, int iBucket);
+    // Queues a read of the thumbnail cached for the key, returns -1 if there is none
+    int QueueCached(const char *pCacheKey, int iBucket);
+
+    // Moves the job to the front of the queue, called for the images that are being painted
+    void TouchJob(int iJob);
+    // Returns the state of the job. Once done, the RGBA data is handed over (free with delete[]) and the job is gone.
+    ImageJobState_t PollJob(int iJob, uint8 **ppData, int &wide, int &tall);
+    void CancelJob(int iJob);
+
+    // Texture LRU, maintained by the FileImages that can reload their texture
+    void OnTextureCreated(vgui::FileImage *pImage, int iBytes, unsigned short &hEntry);
+    void OnTexturePainted(unsigned short hEntry);
+    void OnTextureDestroyed(unsigned short &hEntry);
+
+private:
+    enum JobType_t
+    {
+        JOB_FILE = 0,
+        JOB_BUFFER,
+        JOB_CACHED,
+    };
+
+    struct ImageJob_t
+    {
+        int m_iID;
+        JobType_t m_eType;
+        ImageJobState_t m_eState;
+        bool m_bRunning;
+        bool m_bCancelled; // The owner is gone, the worker deletes the job when it is done with it
+        int m_iPriority;
+        int m_iBucket;
+        char m_szPath[MAX_PATH];
+        char m_szPathID[16];
+        char m_szCacheKey[MAX_PATH];
+        CUtlBuffer m_bufEncoded;
+        uint8 *m_pData;
+        int m_iWide, m_iTall;
+    };
+
+    struct DiskEntry_t
+    {
+        int m_iBytes;
+        long m_iLastUsed;
+    };
+
+    struct TextureEntry_t
+    {
+        vgui::FileImage *m_pImage;
+        int m_iBytes;
+        int m_iLastPaintFrame;
+    };
+
+    ImageJob_t *CreateJob(JobType_t type, int iBucket);
+    void QueueJob(ImageJob_t *pJob);
+    void FreeJob(ImageJob_t *pJob);
+    void EvictTextures();
+
+    // Worker thread
+    static unsigned WorkerThread(void *pParam);
+    void WorkerLoop();
+    ImageJob_t *NextJob();
+    bool ProcessJob(ImageJob_t *pJob);
+    bool DecodeImage(ImageJob_t *pJob, const uint8 *pEncoded, int iSize);
+    bool ReadCachedImage(ImageJob_t *pJob);
+    void WriteCachedImage(ImageJob_t *pJob);
+    void ScanDiskCache();
+    void EvictDiskCache(const char *pKeepFile);
+
+    static void GetCacheFileName(const char *pCacheKey, int iBucket, char *pOut, int outSize);
+
+    CThreadMutex m_Mutex;
+    CThreadEvent m_JobEvent;
+    ThreadHandle_t m_hThread;
+    volatile bool m_bShutdown;
+
+    CUtlVector<ImageJob_t *> m_vecJobs;
+    int m_iNextJobID;
+    int m_iNextPriority;
+
+    // Thumbnail files in the disk cache, only touched by the worker thread
+    CUtlDict<DiskEntry_t, int> m_dictDiskEntries;
+    int64 m_iDiskBytes;
+    bool m_bDiskScanned;
+
+    CUtlLinkedList<TextureEntry_t, unsigned short> m_listTextures; // Least recently painted first
+    int m_iTextureBytes;
+};
+
+extern CImageCache *g_pImageCache;
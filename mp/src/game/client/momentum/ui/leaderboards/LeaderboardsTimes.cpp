@@ -20,6 +20,7 @@
 #include "run/mom_replay_base.h"
 #include "mom_map_cache.h"
 #include "mom_api_requests.h"
+#include "mom_replay_cache.h"
 #include "run/mom_replay_factory.h"
 #include "filesystem.h"
 #include "fmtstr.h"
@@ -89,7 +90,7 @@ CLeaderboardsTimes::CLeaderboardsTimes(CClientTimesDisplay* pParent) : BaseClass
     m_pCurrentLeaderboards = m_pLocalLeaderboards;
 
     SetDefLessFunc(m_mapAvatarsToImageList);
-    SetDefLessFunc(m_mapReplayDownloads);
+    SetDefLessFunc(m_mapRaceDownloads);
 
     pPlayerBorder = nullptr;
     m_pImageList = nullptr;
@@ -103,6 +104,8 @@ CLeaderboardsTimes::~CLeaderboardsTimes()
 
     m_pCurrentLeaderboards = nullptr;
     m_mapAvatarsToImageList.RemoveAll();
+
+    UnpinRaceReplays();
 }
 
 void CLeaderboardsTimes::LevelInit()
@@ -804,49 +807,6 @@ void CLeaderboardsTimes::ParseTimesCallback(KeyValues* pKv, TimeType_t type)
         FillLeaderboards(false);
 }
 
-void CLeaderboardsTimes::OnReplayDownloadStart(KeyValues* pKvHeaders)
-{
-    // MOM_TODO: Make a progress bar here
-}
-
-void CLeaderboardsTimes::OnReplayDownloadProgress(KeyValues* pKvProgress)
-{
-    uint16 fileIndx = m_mapReplayDownloads.Find(pKvProgress->GetUint64("request"));
-    if (fileIndx != m_mapReplayDownloads.InvalidIndex())
-    {
-        // DevLog("Progress: %0.2f!\n", pKvProgress->GetFloat("percent"));
-
-        // MOM_TODO: update the progress bar here, but do not use the percent! Use the offset and size of the chunk!
-        // Percent seems to be cached, i.e. sends a lot of "100%" if Steam downloaded the file and is sending the chunks from cache to us
-    }
-}
-
-void CLeaderboardsTimes::OnReplayDownloadEnd(KeyValues* pKvEnd)
-{
-    uint16 fileIndx = m_mapReplayDownloads.Find(pKvEnd->GetUint64("request"));
-    if (fileIndx != m_mapReplayDownloads.InvalidIndex())
-    {
-        if (pKvEnd->GetBool("error"))
-        {
-            // MOM_TODO: Show some sort of error icon on the progress bar
-            Warning("Could not download replay! Error code: %i\n", pKvEnd->GetInt("code"));
-        }
-        else
-        {
-            // MOM_TODO: show success on the progress bar here
-            DevLog("Successfully downloaded the replay with ID: %lld\n", m_mapReplayDownloads[fileIndx]);
-
-            // Play it
-            CFmtStr command("mom_replay_play %s/%s-%lld%s\n", RECORDING_ONLINE_PATH, m_pParentPanel->MapName(), m_mapReplayDownloads[fileIndx], EXT_RECORDING_FILE);
-            engine->ClientCmd(command.Get());
-            m_pParentPanel->Close();
-        }
-
-        m_mapReplayDownloads.RemoveAt(fileIndx);
-    }
-}
-
-
 void CLeaderboardsTimes::OnCommand(const char* pCommand)
 {
     BaseClass::OnCommand(pCommand);
@@ -1034,6 +994,7 @@ void CLeaderboardsTimes::OnContextWatchOnlineReplay(KeyValues* data)
     DevLog("File URL: %s\n", pFileURL);
     DevLog("File name: %s\n", fileNameOnline.Get());
     DevLog("ID: %lld\n", replayID);
+    char cachedPath[MAX_PATH];
 
     // Check if we already have it
     if (g_pFullFileSystem->FileExists(filePathLocal.Get(), "MOD"))
@@ -1050,46 +1011,130 @@ void CLeaderboardsTimes::OnContextWatchOnlineReplay(KeyValues* data)
         engine->ClientCmd(command.Get());
         m_pParentPanel->Close();
     }
-    else
+    else if (g_pMomReplayCache->GetCachedReplay(pReplayHash, cachedPath, sizeof(cachedPath)))
     {
-        // Check if we're already downloading it
-        bool bFound = false;
-        unsigned short indx = m_mapReplayDownloads.FirstInorder();
-        while (indx != m_mapReplayDownloads.InvalidIndex())
-        {
-            if (m_mapReplayDownloads[indx] == replayID)
-            {
-                bFound = true;
-                break;
-            }
+        DevLog("Already downloaded the replay, no need to download again!\n");
+        CFmtStr command("mom_replay_play %s\n", cachedPath);
+        engine->ClientCmd(command.Get());
+        m_pParentPanel->Close();
+    }
+    else if (g_pMomReplayCache->IsDownloading(pReplayHash))
+    {
+        Log("Already downloading replay %lld!\n", replayID);
+    }
+    else if (replayID)
+    {
+        // It starts playing while it downloads
+        if (g_pMomReplayCache->DownloadReplay(pFileURL, pReplayHash, true, CallbackFunc()) != INVALID_HTTPREQUEST_HANDLE)
+            m_pParentPanel->Close();
+        else
+            Warning("Failed to try to download the replay %lld!\n", replayID);
+    }
+}
 
-            indx = m_mapReplayDownloads.NextInorder(indx);
+void CLeaderboardsTimes::OnContextRaceOnlineTimes(KeyValues *data)
+{
+    SectionedListPanel *pLeaderboard = static_cast<SectionedListPanel *>(data->GetPtr("leaderboard"));
+    if (!pLeaderboard || m_mapRaceDownloads.Count())
+        return;
+
+    m_vecRaceFiles.RemoveAll();
+    UnpinRaceReplays();
+
+    const char *pMapName = m_pParentPanel->MapName();
+    for (int i = 0; i <= pLeaderboard->GetHighestItemID(); i++)
+    {
+        if (!pLeaderboard->IsItemIDValid(i))
+            continue;
+
+        KeyValues *pItem = pLeaderboard->GetItemData(i);
+        const uint64 replayID = pItem->GetUint64("id");
+        const char *pReplayHash = pItem->GetString("hash");
+        CFmtStr fileNameLocal("%s-%s%s", pMapName, pReplayHash, EXT_RECORDING_FILE);
+        CFmtStr fileNameOnline("%s/%s-%lld%s", RECORDING_ONLINE_PATH, pMapName, replayID, EXT_RECORDING_FILE);
+        CFmtStr filePathOnline("%s/%s", RECORDING_PATH, fileNameOnline.Get());
+        char cachedPath[MAX_PATH];
+
+        if (g_pFullFileSystem->FileExists(CFmtStr("%s/%s", RECORDING_PATH, fileNameLocal.Get()).Get(), "MOD"))
+        {
+            m_vecRaceFiles.AddToTail(fileNameLocal.Get());
+        }
+        else if (MomUtil::FileExists(filePathOnline.Get(), pReplayHash, "MOD"))
+        {
+            m_vecRaceFiles.AddToTail(fileNameOnline.Get());
         }
-        if (bFound)
+        else if (g_pMomReplayCache->GetCachedReplay(pReplayHash, cachedPath, sizeof(cachedPath)))
         {
-            // Already downloading!
-            Log("Already downloading replay %lld!\n", replayID);
+            // The downloads of the other replays must not evict this one
+            g_pMomReplayCache->PinReplay(pReplayHash);
+            m_vecRaceHashes.AddToTail(pReplayHash);
+            m_vecRaceFiles.AddToTail(cachedPath);
         }
         else if (replayID)
         {
-            // We either don't have it, or it's outdated, so let's get the latest one!
-            auto handle = g_pAPIRequests->DownloadFile(
-                pFileURL, UtlMakeDelegate(this, &CLeaderboardsTimes::OnReplayDownloadStart),
-                UtlMakeDelegate(this, &CLeaderboardsTimes::OnReplayDownloadProgress),
-                UtlMakeDelegate(this, &CLeaderboardsTimes::OnReplayDownloadEnd),
-                filePathOnline.Get(),
-                "MOD",
-                true);
+            auto handle = g_pMomReplayCache->DownloadReplay(pItem->GetString("file"), pReplayHash, false,
+                                                            UtlMakeDelegate(this, &CLeaderboardsTimes::OnRaceDownloadEnd));
             if (handle != INVALID_HTTPREQUEST_HANDLE)
             {
-                m_mapReplayDownloads.Insert(handle, replayID);
+                g_pMomReplayCache->PinReplay(pReplayHash);
+                m_vecRaceHashes.AddToTail(pReplayHash);
+                m_mapRaceDownloads.Insert(handle, replayID);
             }
             else
-            {
                 Warning("Failed to try to download the replay %lld!\n", replayID);
-            }
         }
     }
+
+    // Otherwise it starts once the downloads are done
+    if (!m_mapRaceDownloads.Count())
+        StartRace();
+}
+
+void CLeaderboardsTimes::OnRaceDownloadEnd(KeyValues *pKvEnd)
+{
+    uint16 fileIndx = m_mapRaceDownloads.Find(pKvEnd->GetUint64("request"));
+    if (fileIndx == m_mapRaceDownloads.InvalidIndex())
+        return;
+
+    if (pKvEnd->GetBool("error"))
+    {
+        Warning("Could not download replay %lld for the race! Error code: %i\n", m_mapRaceDownloads[fileIndx], pKvEnd->GetInt("code"));
+    }
+    else
+    {
+        m_vecRaceFiles.AddToTail(pKvEnd->GetString("file"));
+    }
+
+    m_mapRaceDownloads.RemoveAt(fileIndx);
+
+    if (!m_mapRaceDownloads.Count())
+        StartRace();
+}
+
+void CLeaderboardsTimes::StartRace()
+{
+    if (m_vecRaceFiles.IsEmpty())
+        return;
+
+    // One replay per command, the whole list would not fit in one
+    FOR_EACH_VEC(m_vecRaceFiles, i)
+    {
+        engine->ClientCmd(CFmtStr("mom_race_add %s\n", m_vecRaceFiles[i].String()).Get());
+    }
+    engine->ClientCmd("mom_race_start\n");
+
+    m_vecRaceFiles.RemoveAll();
+    m_pParentPanel->Close();
+}
+
+void CLeaderboardsTimes::UnpinRaceReplays()
+{
+    FOR_EACH_VEC(m_vecRaceHashes, i)
+    {
+        g_pMomReplayCache->UnpinReplay(m_vecRaceHashes[i].String());
+    }
+
+    m_vecRaceHashes.RemoveAll();
 }
 
 void CLeaderboardsTimes::OnContextWatchReplay(const char* runName)
@@ -1146,6 +1191,10 @@ void CLeaderboardsTimes::OnItemContextMenu(KeyValues* pData)
             data->SetName("ContextWatchOnlineReplay");
             m_pLeaderboardReplayCMenu->AddMenuItem("WatchOnlineReplay", "#MOM_Leaderboards_WatchReplay", data, this);
 
+            KeyValues *pRace = new KeyValues("ContextRaceOnlineTimes");
+            pRace->SetPtr("leaderboard", pLeaderboard);
+            m_pLeaderboardReplayCMenu->AddMenuItem("RaceOnlineTimes", "#MOM_Leaderboards_RaceTimes", pRace, this);
+
             m_pLeaderboardReplayCMenu->ShowMenu();
         }
     }
@@ -57,7 +57,11 @@ class CLeaderboardsTimes : public vgui::EditablePanel
     void OnRunSaved();
     void OnPanelShow(bool bShow);
 
-    CUtlMap<HTTPRequestHandle, uint64> m_mapReplayDownloads;
+    // Race mode, replays still downloading and the ones ready to race (relative to the recordings folder)
+    CUtlMap<HTTPRequestHandle, uint64> m_mapRaceDownloads;
+    CUtlVector<CUtlString> m_vecRaceFiles;
+    // Hashes of the raced replays that come from the replay cache, pinned until the next race is set up
+    CUtlVector<CUtlString> m_vecRaceHashes;
 
     // Sets up the icons used in the leaderboard
     void SetupDefaultIcons();
@@ -100,9 +104,9 @@ class CLeaderboardsTimes : public vgui::EditablePanel
     void ParseTimesCallback(KeyValues *pKv, TimeType_t type);
 
     // Replay downloading
-    void OnReplayDownloadStart(KeyValues *pKv);
-    void OnReplayDownloadProgress(KeyValues *pKv);
-    void OnReplayDownloadEnd(KeyValues *pKv);
+    void OnRaceDownloadEnd(KeyValues *pKv);
+    void StartRace();
+    void UnpinRaceReplays();
 
 protected:
     void OnCommand(const char* command) OVERRIDE;
@@ -112,6 +116,7 @@ protected:
     MESSAGE_FUNC_CHARPTR(OnContextWatchReplay, "ContextWatchReplay", runName);
     MESSAGE_FUNC_INT_CHARPTR(OnContextDeleteReplay, "ContextDeleteReplay", itemID, runName);
     MESSAGE_FUNC_PARAMS(OnContextWatchOnlineReplay, "ContextWatchOnlineReplay", data);
+    MESSAGE_FUNC_PARAMS(OnContextRaceOnlineTimes, "ContextRaceOnlineTimes", data);
     MESSAGE_FUNC_INT_CHARPTR(OnConfirmDeleteReplay, "ConfirmDeleteReplay", itemID, file);
     MESSAGE_FUNC_UINT64(OnContextVisitProfile, "ContextVisitProfile", profile);
 
@@ -7,11 +7,13 @@
 // world light data from the BSP itself, before entities are initialised on map
 // load.
 //
-// To find the brightest light at a point, all world lights are iterated.
-// Lights whose radii do not encompass our sample point are quickly rejected,
-// as are lights which are not in our PVS, or visible from the sample point.
-// If the sky light is visible from the sample point, then it shall supersede
-// all other world lights.
+// On map load, every cluster gets the list of world lights in its PVS, ordered
+// by the brightest each light can possibly be. To find the brightest light at
+// a point, only the list of its cluster is walked, and the walk stops as soon
+// as no remaining light could beat the one already found. Lights whose radii
+// do not encompass our sample point are quickly rejected, as are lights which
+// are not visible from the sample point. If the sky light is visible from the
+// sample point, then it shall supersede all other world lights.
 //
 // Written: November 2011
 // Author: Saul Rennison
@@ -23,8 +25,18 @@
 #include "client_factorylist.h" // FactoryList_Retrieve
 #include "eiface.h"             // IVEngineServer
 #include "filesystem.h"
+#include "tier0/fasttimer.h"
 #include "worldlight.h"
 
+#include "tier0/memdbgon.h"
+
+// Cached results are reused until the querying entity moves this far (or into another cluster)
+#define WORLDLIGHT_CACHE_MOVE_DIST 128.0f
+// Most cached results kept at once, the least recently used one makes room for new keys
+#define WORLDLIGHT_CACHE_MAX_ENTRIES 512
+// The fallback grid has at most this many cells along each axis
+#define WORLDLIGHT_GRID_MAX_CELLS 32
+
 static IVEngineServer *g_pEngineServer = nullptr;
 
 //-----------------------------------------------------------------------------
@@ -93,6 +105,13 @@ CWorldLights::CWorldLights() : CAutoGameSystem("World lights")
 {
     m_nWorldLights = 0;
     m_pWorldLights = nullptr;
+    m_pLightMaxIntensitySqr = nullptr;
+    m_nClusters = 0;
+    m_vecGridMins.Init();
+    m_flGridCellSize = 1.0f;
+    m_nGridSize[0] = m_nGridSize[1] = m_nGridSize[2] = 0;
+
+    SetDefLessFunc(m_mapCache);
 }
 
 //-----------------------------------------------------------------------------
@@ -107,6 +126,25 @@ void CWorldLights::Clear()
         delete[] m_pWorldLights;
         m_pWorldLights = nullptr;
     }
+
+    if (m_pLightMaxIntensitySqr)
+    {
+        delete[] m_pLightMaxIntensitySqr;
+        m_pLightMaxIntensitySqr = nullptr;
+    }
+
+    m_vecSkyLights.Purge();
+
+    m_nClusters = 0;
+    m_vecClusterLightStart.Purge();
+    m_vecClusterLights.Purge();
+
+    m_nGridSize[0] = m_nGridSize[1] = m_nGridSize[2] = 0;
+    m_vecGridLightStart.Purge();
+    m_vecGridLights.Purge();
+    m_vecUnboundedLights.Purge();
+
+    m_mapCache.Purge();
 }
 
 //-----------------------------------------------------------------------------
@@ -170,123 +208,430 @@ void CWorldLights::LevelInitPreEntity()
     g_pFullFileSystem->Close(hFile);
 
     DevMsg("CWorldLights: load successful (%d lights at 0x%p)\n", m_nWorldLights, m_pWorldLights);
+
+    BuildLightLists();
 }
 
 //-----------------------------------------------------------------------------
-// Purpose: find the brightest light source at a point
+// Purpose: the brightest (squared) intensity a light can have at any point
 //-----------------------------------------------------------------------------
-bool CWorldLights::GetBrightestLightSource(const Vector &vecPosition, Vector &vecLightPos, Vector &vecLightBrightness)
+static float WorldLightMaxIntensitySqr(const dworldlight_t *wl)
 {
-    if (!m_nWorldLights || !m_pWorldLights)
-        return false;
+    const float flIntensitySqr = wl->intensity.LengthSqr();
 
-    // Default light position and brightness to zero
-    vecLightBrightness.Init();
-    vecLightPos.Init();
+    switch (wl->type)
+    {
+    case emit_surface:
+        return flIntensitySqr; // InvRSquared never goes above 1
 
-    // Find the size of the PVS for our current position
-    int nCluster = g_pEngineServer->GetClusterForOrigin(vecPosition);
-    int nPVSSize = g_pEngineServer->GetPVSForCluster(nCluster, 0, nullptr);
+    case emit_quakelight:
+        return flIntensitySqr * wl->linear_attn * wl->linear_attn;
 
-    // Get the PVS at our position
-    byte *pvs = new byte[nPVSSize];
-    g_pEngineServer->GetPVSForCluster(nCluster, nPVSSize, pvs);
+    case emit_point:
+    case emit_spotlight:
+        if (wl->constant_attn <= 0.0f)
+            return FLT_MAX;
+
+        return flIntensitySqr / (wl->constant_attn * wl->constant_attn);
+
+    default:
+        return flIntensitySqr;
+    }
+}
+
+struct LightSortEntry_t
+{
+    float m_flMaxIntensitySqr;
+    unsigned short m_iLight;
+};
+
+static int __cdecl LightSortFunc(const LightSortEntry_t *pLeft, const LightSortEntry_t *pRight)
+{
+    if (pLeft->m_flMaxIntensitySqr > pRight->m_flMaxIntensitySqr)
+        return -1;
+
+    return pLeft->m_flMaxIntensitySqr < pRight->m_flMaxIntensitySqr ? 1 : 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: build the per-cluster candidate lists and the fallback grid
+//-----------------------------------------------------------------------------
+void CWorldLights::BuildLightLists()
+{
+    if (!m_nWorldLights)
+        return;
+
+    CFastTimer timer;
+    timer.Start();
+
+    // Every list is filled in this order, so they all end up sorted by potential brightness
+    CUtlVector<LightSortEntry_t> sorted;
+    m_pLightMaxIntensitySqr = new float[m_nWorldLights];
 
-    // Iterate through all the worldlights
     for (int i = 0; i < m_nWorldLights; ++i)
     {
-        dworldlight_t *light = &m_pWorldLights[i];
+        const dworldlight_t *light = &m_pWorldLights[i];
+        m_pLightMaxIntensitySqr[i] = WorldLightMaxIntensitySqr(light);
 
-        // Skip skyambient
         if (light->type == emit_skyambient)
+            continue;
+
+        if (light->type == emit_skylight)
         {
-            // engine->Con_NPrintf(i, "%d: skyambient", i);
+            m_vecSkyLights.AddToTail(i);
             continue;
         }
 
-        // Handle sun
-        if (light->type == emit_skylight)
+        LightSortEntry_t entry = {m_pLightMaxIntensitySqr[i], static_cast<unsigned short>(i)};
+        sorted.AddToTail(entry);
+    }
+
+    // The lists store lights as shorts, maps with more lights than that walk all of them (FindBrightestLightInPVS)
+    if (m_nWorldLights > USHRT_MAX)
+    {
+        DevWarning("CWorldLights: %d lights are too many for the light lists, searching all of them instead\n", m_nWorldLights);
+        return;
+    }
+
+    sorted.Sort(LightSortFunc);
+
+    // Per-cluster lists: a light is a candidate for every cluster that has the light's cluster in its PVS
+    CUtlVector<int> lightClusters;
+    lightClusters.SetCount(m_nWorldLights);
+    FOR_EACH_VEC(sorted, i)
+    {
+        lightClusters[sorted[i].m_iLight] = g_pEngineServer->GetClusterForOrigin(m_pWorldLights[sorted[i].m_iLight].origin);
+    }
+
+    m_nClusters = g_pEngineServer->GetClusterCount();
+    m_vecClusterLightStart.SetCount(m_nClusters + 1);
+
+    CUtlVector<byte> pvs;
+    pvs.SetCount(max(1, g_pEngineServer->GetPVSForCluster(0, 0, nullptr)));
+
+    for (int nCluster = 0; nCluster < m_nClusters; ++nCluster)
+    {
+        m_vecClusterLightStart[nCluster] = m_vecClusterLights.Count();
+
+        g_pEngineServer->GetPVSForCluster(nCluster, pvs.Count(), pvs.Base());
+
+        FOR_EACH_VEC(sorted, i)
         {
-            // Calculate sun position
-            Vector vecAbsStart = vecPosition + Vector(0, 0, 30);
-            Vector vecAbsEnd = vecAbsStart - (light->normal * MAX_TRACE_LENGTH);
+            const int nLightCluster = lightClusters[sorted[i].m_iLight];
+            if (nLightCluster < 0 || (nLightCluster >> 3) >= pvs.Count())
+                continue;
+
+            if (pvs[nLightCluster >> 3] & (1 << (nLightCluster & 7)))
+                m_vecClusterLights.AddToTail(sorted[i].m_iLight);
+        }
+    }
 
-            trace_t tr;
-            UTIL_TraceLine(vecPosition, vecAbsEnd, MASK_OPAQUE, nullptr, COLLISION_GROUP_NONE, &tr);
+    m_vecClusterLightStart[m_nClusters] = m_vecClusterLights.Count();
+
+    // Grid for points outside of any cluster, covering the reach of every light with a radius
+    Vector vecMins(FLT_MAX, FLT_MAX, FLT_MAX), vecMaxs(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    FOR_EACH_VEC(sorted, i)
+    {
+        const dworldlight_t *light = &m_pWorldLights[sorted[i].m_iLight];
+        if (light->radius <= 0.0f)
+            continue;
+
+        const Vector vecRadius(light->radius, light->radius, light->radius);
+        VectorMin(vecMins, light->origin - vecRadius, vecMins);
+        VectorMax(vecMaxs, light->origin + vecRadius, vecMaxs);
+    }
 
-            // If we didn't hit anything then we have a problem
-            if (!tr.DidHit())
+    int nGridCells = 0;
+    if (vecMins.x <= vecMaxs.x)
+    {
+        const Vector vecExtents = vecMaxs - vecMins;
+        m_flGridCellSize = max(256.0f, max(vecExtents.x, max(vecExtents.y, vecExtents.z)) / WORLDLIGHT_GRID_MAX_CELLS);
+        m_vecGridMins = vecMins;
+        for (int axis = 0; axis < 3; ++axis)
+            m_nGridSize[axis] = max(1, static_cast<int>(ceilf(vecExtents[axis] / m_flGridCellSize)));
+
+        nGridCells = m_nGridSize[0] * m_nGridSize[1] * m_nGridSize[2];
+    }
+
+    // Two passes: count the lights of every cell, then fill them in
+    m_vecGridLightStart.SetCount(nGridCells + 1);
+    for (int nCell = 0; nCell <= nGridCells; ++nCell)
+        m_vecGridLightStart[nCell] = 0;
+
+    for (int nPass = 0; nPass < 2; ++nPass)
+    {
+        if (nPass == 1)
+        {
+            // Counts to offsets; each cell's offset is bumped while filling and restored afterwards
+            int nTotal = 0;
+            for (int nCell = 0; nCell < nGridCells; ++nCell)
             {
-                // engine->Con_NPrintf(i, "%d: skylight: couldn't touch sky", i);
-                continue;
+                const int nCount = m_vecGridLightStart[nCell];
+                m_vecGridLightStart[nCell] = nTotal;
+                nTotal += nCount;
             }
+            m_vecGridLightStart[nGridCells] = nTotal;
+            m_vecGridLights.SetCount(nTotal);
+        }
 
-            // If we did hit something, and it wasn't the skybox, then skip
-            // this worldlight
-            if (!(tr.surface.flags & SURF_SKY) && !(tr.surface.flags & SURF_SKY2D))
+        FOR_EACH_VEC(sorted, i)
+        {
+            const dworldlight_t *light = &m_pWorldLights[sorted[i].m_iLight];
+            if (light->radius <= 0.0f)
             {
-                // engine->Con_NPrintf(i, "%d: skylight: no sight to sun", i);
+                if (nPass == 0)
+                    m_vecUnboundedLights.AddToTail(sorted[i].m_iLight);
                 continue;
             }
 
-            // Act like we didn't find any valid worldlights, so the shadow
-            // manager uses the default shadow direction instead (should be the
-            // sun direction)
-
-            delete[] pvs;
+            int nMin[3], nMax[3];
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                nMin[axis] = clamp(static_cast<int>((light->origin[axis] - light->radius - m_vecGridMins[axis]) / m_flGridCellSize), 0, m_nGridSize[axis] - 1);
+                nMax[axis] = clamp(static_cast<int>((light->origin[axis] + light->radius - m_vecGridMins[axis]) / m_flGridCellSize), 0, m_nGridSize[axis] - 1);
+            }
 
-            return false;
+            for (int z = nMin[2]; z <= nMax[2]; ++z)
+            {
+                for (int y = nMin[1]; y <= nMax[1]; ++y)
+                {
+                    for (int x = nMin[0]; x <= nMax[0]; ++x)
+                    {
+                        const int nCell = (z * m_nGridSize[1] + y) * m_nGridSize[0] + x;
+                        if (nPass == 0)
+                            m_vecGridLightStart[nCell]++;
+                        else
+                            m_vecGridLights[m_vecGridLightStart[nCell]++] = sorted[i].m_iLight;
+                    }
+                }
+            }
         }
+    }
+
+    // Filling moved every offset to the start of the next cell
+    for (int nCell = nGridCells; nCell > 0; --nCell)
+        m_vecGridLightStart[nCell] = m_vecGridLightStart[nCell - 1];
+
+    if (nGridCells > 0)
+        m_vecGridLightStart[0] = 0;
+
+    timer.End();
+    DevMsg("CWorldLights: built light lists for %d clusters (%d entries) and %d grid cells (%d entries) in %.2f ms\n",
+           m_nClusters, m_vecClusterLights.Count(), nGridCells, m_vecGridLights.Count(), timer.GetDuration().GetMillisecondsF());
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: grid cell of a point, -1 if it is outside of the grid
+//-----------------------------------------------------------------------------
+int CWorldLights::GetGridCell(const Vector &vecPosition) const
+{
+    if (m_vecGridLightStart.Count() <= 1)
+        return -1;
+
+    int nCoord[3];
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        nCoord[axis] = static_cast<int>(floorf((vecPosition[axis] - m_vecGridMins[axis]) / m_flGridCellSize));
+        if (nCoord[axis] < 0 || nCoord[axis] >= m_nGridSize[axis])
+            return -1;
+    }
 
-        // Calculate square distance to this worldlight
-        Vector vecDelta = light->origin - vecPosition;
-        float flDistSqr = vecDelta.LengthSqr();
-        float flRadiusSqr = light->radius * light->radius;
+    return (nCoord[2] * m_nGridSize[1] + nCoord[1]) * m_nGridSize[0] + nCoord[0];
+}
 
-        // Skip lights that are out of our radius
-        if (flRadiusSqr > 0 && flDistSqr >= flRadiusSqr)
+//-----------------------------------------------------------------------------
+// Purpose: find the brightest light source at a point
+//-----------------------------------------------------------------------------
+bool CWorldLights::GetBrightestLightSource(const Vector &vecPosition, Vector &vecLightPos, Vector &vecLightBrightness, unsigned int iCacheKey)
+{
+    if (!m_nWorldLights || !m_pWorldLights)
+        return false;
+
+    const int nCluster = g_pEngineServer->GetClusterForOrigin(vecPosition);
+
+    unsigned short iCache = m_mapCache.InvalidIndex();
+    if (iCacheKey != WORLDLIGHT_NO_CACHE)
+    {
+        iCache = m_mapCache.Find(iCacheKey);
+        if (iCache != m_mapCache.InvalidIndex())
         {
-            // engine->Con_NPrintf(i, "%d: out-of-radius (dist: %d, radius: %d)", i, sqrt(flDistSqr), light->radius);
-            continue;
-        }
+            LightCache_t &cache = m_mapCache[iCache];
+            cache.m_nLastUsedFrame = gpGlobals->framecount;
 
-        // Is it out of our PVS?
-        if (!g_pEngineServer->CheckOriginInPVS(light->origin, pvs, nPVSSize))
+            if (cache.m_nCluster == nCluster &&
+                cache.m_vecPosition.DistToSqr(vecPosition) < WORLDLIGHT_CACHE_MOVE_DIST * WORLDLIGHT_CACHE_MOVE_DIST)
+            {
+                vecLightPos = cache.m_vecLightPos;
+                vecLightBrightness = cache.m_vecLightBrightness;
+                return cache.m_bFound;
+            }
+        }
+        else
         {
-            // engine->Con_NPrintf(i, "%d: out of PVS", i);
-            continue;
+            // Keys of entities that went away are never looked up again, they age out here
+            if (m_mapCache.Count() >= WORLDLIGHT_CACHE_MAX_ENTRIES)
+            {
+                unsigned short iOldest = m_mapCache.FirstInorder();
+                FOR_EACH_MAP_FAST(m_mapCache, i)
+                {
+                    if (m_mapCache[i].m_nLastUsedFrame < m_mapCache[iOldest].m_nLastUsedFrame)
+                        iOldest = i;
+                }
+
+                m_mapCache.RemoveAt(iOldest);
+            }
+
+            iCache = m_mapCache.Insert(iCacheKey);
+            m_mapCache[iCache].m_nLastUsedFrame = gpGlobals->framecount;
         }
+    }
 
-        // Calculate intensity at our position
-        float flRatio = Engine_WorldLightDistanceFalloff(light, vecDelta);
-        Vector vecIntensity = light->intensity * flRatio;
+    const bool bFound = FindBrightestLight(vecPosition, nCluster, vecLightPos, vecLightBrightness);
 
-        // Is this light more intense than the one we already found?
-        if (vecIntensity.LengthSqr() <= vecLightBrightness.LengthSqr())
-        {
-            // engine->Con_NPrintf(i, "%d: too dim", i);
-            continue;
-        }
+    if (iCache != m_mapCache.InvalidIndex())
+    {
+        LightCache_t &cache = m_mapCache[iCache];
+        cache.m_nCluster = nCluster;
+        cache.m_vecPosition = vecPosition;
+        cache.m_bFound = bFound;
+        cache.m_vecLightPos = vecLightPos;
+        cache.m_vecLightBrightness = vecLightBrightness;
+    }
 
-        // Can we see the light?
-        trace_t tr;
+    return bFound;
+}
+
+bool CWorldLights::FindBrightestLight(const Vector &vecPosition, int nCluster, Vector &vecLightPos, Vector &vecLightBrightness)
+{
+    // Default light position and brightness to zero
+    vecLightBrightness.Init();
+    vecLightPos.Init();
+
+    // Handle sun
+    FOR_EACH_VEC(m_vecSkyLights, i)
+    {
+        const dworldlight_t *light = &m_pWorldLights[m_vecSkyLights[i]];
+
+        // Calculate sun position
         Vector vecAbsStart = vecPosition + Vector(0, 0, 30);
-        UTIL_TraceLine(vecAbsStart, light->origin, MASK_OPAQUE, nullptr, COLLISION_GROUP_NONE, &tr);
+        Vector vecAbsEnd = vecAbsStart - (light->normal * MAX_TRACE_LENGTH);
 
-        if (tr.DidHit())
-        {
-            // engine->Con_NPrintf(i, "%d: trace failed", i);
+        trace_t tr;
+        UTIL_TraceLine(vecPosition, vecAbsEnd, MASK_OPAQUE, nullptr, COLLISION_GROUP_NONE, &tr);
+
+        // If we didn't hit anything then we have a problem
+        if (!tr.DidHit())
+            continue;
+
+        // If we did hit something, and it wasn't the skybox, then skip
+        // this worldlight
+        if (!(tr.surface.flags & SURF_SKY) && !(tr.surface.flags & SURF_SKY2D))
             continue;
+
+        // Act like we didn't find any valid worldlights, so the shadow
+        // manager uses the default shadow direction instead (should be the
+        // sun direction)
+        return false;
+    }
+
+    // No light lists were built for this map
+    if (m_vecClusterLightStart.IsEmpty())
+        return FindBrightestLightInPVS(vecPosition, nCluster, vecLightPos, vecLightBrightness);
+
+    if (nCluster >= 0 && nCluster < m_nClusters)
+    {
+        for (int i = m_vecClusterLightStart[nCluster]; i < m_vecClusterLightStart[nCluster + 1]; ++i)
+        {
+            const int iLight = m_vecClusterLights[i];
+            if (m_pLightMaxIntensitySqr[iLight] <= vecLightBrightness.LengthSqr())
+                break; // Nothing further down the list can be brighter
+
+            TestLight(iLight, vecPosition, vecLightPos, vecLightBrightness);
         }
+    }
+    else
+    {
+        // Not in any cluster, so there is no PVS to go by
+        const int nCell = GetGridCell(vecPosition);
+        if (nCell >= 0)
+        {
+            for (int i = m_vecGridLightStart[nCell]; i < m_vecGridLightStart[nCell + 1]; ++i)
+            {
+                const int iLight = m_vecGridLights[i];
+                if (m_pLightMaxIntensitySqr[iLight] <= vecLightBrightness.LengthSqr())
+                    break;
 
-        vecLightPos = light->origin;
-        vecLightBrightness = vecIntensity;
+                TestLight(iLight, vecPosition, vecLightPos, vecLightBrightness);
+            }
+        }
+
+        FOR_EACH_VEC(m_vecUnboundedLights, i)
+        {
+            const int iLight = m_vecUnboundedLights[i];
+            if (m_pLightMaxIntensitySqr[iLight] <= vecLightBrightness.LengthSqr())
+                break;
 
-        // engine->Con_NPrintf(i, "%d: set (%.2f)", i, vecIntensity.Length());
+            TestLight(iLight, vecPosition, vecLightPos, vecLightBrightness);
+        }
     }
 
-    delete[] pvs;
+    return !vecLightBrightness.IsZero();
+}
+
+bool CWorldLights::FindBrightestLightInPVS(const Vector &vecPosition, int nCluster, Vector &vecLightPos, Vector &vecLightBrightness)
+{
+    // Get the PVS at our position
+    const int nPVSSize = g_pEngineServer->GetPVSForCluster(nCluster, 0, nullptr);
+    CUtlVector<byte> pvs;
+    pvs.SetCount(nPVSSize);
+    g_pEngineServer->GetPVSForCluster(nCluster, nPVSSize, pvs.Base());
+
+    for (int i = 0; i < m_nWorldLights; ++i)
+    {
+        const dworldlight_t *light = &m_pWorldLights[i];
+
+        // The sky lights were handled already
+        if (light->type == emit_skyambient || light->type == emit_skylight)
+            continue;
+
+        if (!g_pEngineServer->CheckOriginInPVS(light->origin, pvs.Base(), nPVSSize))
+            continue;
+
+        TestLight(i, vecPosition, vecLightPos, vecLightBrightness);
+    }
 
-    // engine->Con_NPrintf(m_nWorldLights, "result: %d", !vecLightBrightness.IsZero());
     return !vecLightBrightness.IsZero();
-}
\ No newline at end of file
+}
+
+void CWorldLights::TestLight(int iLight, const Vector &vecPosition, Vector &vecLightPos, Vector &vecLightBrightness)
+{
+    const dworldlight_t *light = &m_pWorldLights[iLight];
+
+    // Calculate square distance to this worldlight
+    Vector vecDelta = light->origin - vecPosition;
+    float flDistSqr = vecDelta.LengthSqr();
+    float flRadiusSqr = light->radius * light->radius;
+
+    // Skip lights that are out of our radius
+    if (flRadiusSqr > 0 && flDistSqr >= flRadiusSqr)
+        return;
+
+    // Calculate intensity at our position
+    float flRatio = Engine_WorldLightDistanceFalloff(light, vecDelta);
+    Vector vecIntensity = light->intensity * flRatio;
+
+    // Is this light more intense than the one we already found?
+    if (vecIntensity.LengthSqr() <= vecLightBrightness.LengthSqr())
+        return;
+
+    // Can we see the light?
+    trace_t tr;
+    Vector vecAbsStart = vecPosition + Vector(0, 0, 30);
+    UTIL_TraceLine(vecAbsStart, light->origin, MASK_OPAQUE, nullptr, COLLISION_GROUP_NONE, &tr);
+
+    if (tr.DidHit())
+        return;
+
+    vecLightPos = light->origin;
+    vecLightBrightness = vecIntensity;
+}
@@ -11,9 +11,13 @@
 
 #include "igamesystem.h" // CAutoGameSystem
 
+#include "utlmap.h"
+
 class Vector;
 struct dworldlight_t;
 
+#define WORLDLIGHT_NO_CACHE 0xFFFFFFFF
+
 //-----------------------------------------------------------------------------
 // Purpose:
 //-----------------------------------------------------------------------------
@@ -24,9 +28,12 @@ class CWorldLights : public CAutoGameSystem
     ~CWorldLights() { Clear(); }
 
     //-------------------------------------------------------------------------
-    // Find the brightest light source at a point
+    // Find the brightest light source at a point. Queries made with a cache
+    // key (e.g. an entity handle) reuse the previous result for that key until
+    // it moves into another cluster, or moves far within the same one.
     //-------------------------------------------------------------------------
-    bool GetBrightestLightSource(const Vector &vecPosition, Vector &vecLightPos, Vector &vecLightBrightness);
+    bool GetBrightestLightSource(const Vector &vecPosition, Vector &vecLightPos, Vector &vecLightBrightness,
+                                 unsigned int iCacheKey = WORLDLIGHT_NO_CACHE);
 
     // CAutoGameSystem overrides
   public:
@@ -38,8 +45,46 @@ class CWorldLights : public CAutoGameSystem
   private:
     void Clear();
 
+    // Builds the per-cluster light lists and the grid from the loaded lights
+    void BuildLightLists();
+    bool FindBrightestLight(const Vector &vecPosition, int nCluster, Vector &vecLightPos, Vector &vecLightBrightness);
+    // Tests every light in the PVS, for maps too big for the light lists
+    bool FindBrightestLightInPVS(const Vector &vecPosition, int nCluster, Vector &vecLightPos, Vector &vecLightBrightness);
+    // Tests a single light, updating the brightest light found so far
+    void TestLight(int iLight, const Vector &vecPosition, Vector &vecLightPos, Vector &vecLightBrightness);
+    int GetGridCell(const Vector &vecPosition) const;
+
     int m_nWorldLights;
     dworldlight_t *m_pWorldLights;
+    float *m_pLightMaxIntensitySqr; // Brightest the light can ever be at any point, to stop searching early
+
+    CUtlVector<int> m_vecSkyLights;
+
+    // Candidate lights of every cluster (the lights in its PVS), brightest potential first.
+    // The lights of cluster i are m_vecClusterLights[m_vecClusterLightStart[i]] up to m_vecClusterLightStart[i + 1].
+    int m_nClusters;
+    CUtlVector<int> m_vecClusterLightStart;
+    CUtlVector<unsigned short> m_vecClusterLights;
+
+    // Fallback for points outside of any cluster: lights bucketed by the cells their radius reaches,
+    // plus the lights without a radius that reach everywhere. Stored and ordered like the cluster lists.
+    Vector m_vecGridMins;
+    float m_flGridCellSize;
+    int m_nGridSize[3];
+    CUtlVector<int> m_vecGridLightStart;
+    CUtlVector<unsigned short> m_vecGridLights;
+    CUtlVector<unsigned short> m_vecUnboundedLights;
+
+    struct LightCache_t
+    {
+        int m_nCluster;
+        Vector m_vecPosition;
+        bool m_bFound;
+        Vector m_vecLightPos;
+        Vector m_vecLightBrightness;
+        int m_nLastUsedFrame;
+    };
+    CUtlMap<unsigned int, LightCache_t> m_mapCache;
 };
 
 //-----------------------------------------------------------------------------
@@ -5,6 +5,7 @@
 #include "mom_lobby_system.h"
 #include "mom_player_shared.h"
 #include "mom_timer.h"
+#include "mom_profiler.h"
 
 #include "tier0/memdbgon.h"
 
@@ -95,6 +96,8 @@ void CMomentumGhostClient::LevelShutdownPreEntity()
 
 void CMomentumGhostClient::FrameUpdatePreEntityThink()
 {
+    MOM_PROF_SCOPE("CMomentumGhostClient::FrameUpdatePreEntityThink");
+
     g_pMomentumLobbySystem->SendAndReceiveP2PPackets();
 }
 
@@ -157,6 +160,12 @@ bool CMomentumGhostClient::SendSavelocReqPacket(CSteamID& target, SavelocReqPack
     return g_pMomentumLobbySystem->SendSavelocReqPacket(target, packet);
 }
 
+bool CMomentumGhostClient::SendReplayStreamPacket(CSteamID &target, ReplayStreamPacket *packet)
+{
+    // MOM_TODO: g_pMomentumServerSystem->SendReplayStreamPacket(target, packet);
+    return g_pMomentumLobbySystem->SendReplayStreamPacket(target, packet);
+}
+
 bool CMomentumGhostClient::IsInOnlineSession()
 {
     return g_pMomentumLobbySystem->LobbyValid(); /*MOM_TODO: || g_pMomentumServerSystem->ServerValid();*/
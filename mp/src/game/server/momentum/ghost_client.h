@@ -3,6 +3,7 @@
 class PositionPacket;
 class DecalPacket;
 class SavelocReqPacket;
+class ReplayStreamPacket;
 struct AppearanceData_t;
 class CMomentumOnlineGhostEntity;
 
@@ -30,6 +31,7 @@ public:
     void SetSpectatorTarget(CSteamID target, bool bStartedSpectating, bool bLeft = false);
     void SendDecalPacket(DecalPacket *packet);
     bool SendSavelocReqPacket(CSteamID &target, SavelocReqPacket *packet);
+    bool SendReplayStreamPacket(CSteamID &target, ReplayStreamPacket *packet);
 
     bool IsInOnlineSession();
 
@@ -5,6 +5,7 @@
 #include "mom_triggers.h"
 #include "mapzones_build.h"
 #include "fmtstr.h"
+#include "mom_profiler.h"
 
 #include "tier0/memdbgon.h"
 
@@ -114,6 +115,8 @@ void CMapZoneSystem::LevelShutdownPostEntity()
 
 void CMapZoneSystem::FrameUpdatePostEntityThink()
 {
+    MOM_PROF_SCOPE("CMapZoneSystem::FrameUpdatePostEntityThink");
+
     m_Editor.FrameUpdate();
 }
 
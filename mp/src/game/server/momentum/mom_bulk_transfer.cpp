@@ -0,0 +1,380 @@
+#include "cbase.h"
+
+#include "mom_bulk_transfer.h"
+
+#include "mom_modulecomms.h"
+#include "tier1/snappy.h"
+#include "mom_profiler.h"
+
+#include "tier0/memdbgon.h"
+
+static ConVar mom_bulk_transfer_window("mom_bulk_transfer_window", "16", FCVAR_ARCHIVE,
+                                       "Maximum amount of unacknowledged chunks a bulk transfer keeps in flight.\n", true, 2 * BULK_ACK_INTERVAL, true, 128);
+static ConVar mom_bulk_transfer_rate("mom_bulk_transfer_rate", "65536", FCVAR_ARCHIVE,
+                                     "Maximum bytes per second spent on bulk transfers (savelocs, etc).\n", true, BULK_CHUNK_SIZE, false, 0);
+static ConVar mom_bulk_transfer_timeout("mom_bulk_transfer_timeout", "15", FCVAR_ARCHIVE,
+                                        "Seconds without progress after which a bulk transfer is dropped.\n", true, 1, false, 0);
+
+static const char *s_pTransferTypeNames[BULK_TRANSFER_COUNT] = { "savelocs", "appearance", "replay" };
+
+CMomBulkTransferSystem::CMomBulkTransferSystem() : m_iNextTransferID(1), m_flSendBudget(0.0f)
+{
+}
+
+CMomBulkTransferSystem::~CMomBulkTransferSystem()
+{
+    m_vecOutgoing.PurgeAndDeleteElements();
+    m_vecIncoming.PurgeAndDeleteElements();
+}
+
+void CMomBulkTransferSystem::SetHandler(BulkTransferType_t type, TransferHandler_t handler)
+{
+    if (type < BULK_TRANSFER_FIRST || type > BULK_TRANSFER_LAST)
+        return;
+
+    m_Handlers[type] = handler;
+}
+
+bool CMomBulkTransferSystem::StartTransfer(const CSteamID &target, BulkTransferType_t type, const CUtlBuffer &data)
+{
+    if (type < BULK_TRANSFER_FIRST || type > BULK_TRANSFER_LAST || !target.IsValid())
+        return false;
+
+    const int iSize = data.TellPut();
+    if (iSize <= 0 || iSize > BULK_TRANSFER_MAX_SIZE)
+    {
+        Warning("Cannot send a bulk transfer of %i bytes!\n", iSize);
+        return false;
+    }
+
+    OutgoingTransfer_t *pTransfer = new OutgoingTransfer_t;
+    pTransfer->m_Target = target;
+    pTransfer->m_iTransferID = m_iNextTransferID++;
+    pTransfer->m_eType = type;
+
+    size_t compressedSize = 0;
+    pTransfer->m_bufCompressed.EnsureCapacity(snappy::MaxCompressedLength(iSize));
+    snappy::RawCompress(static_cast<const char *>(data.Base()), iSize,
+                        static_cast<char *>(pTransfer->m_bufCompressed.Base()), &compressedSize);
+    pTransfer->m_bufCompressed.SeekPut(CUtlBuffer::SEEK_HEAD, compressedSize);
+
+    pTransfer->m_iChunkCount = (compressedSize + BULK_CHUNK_SIZE - 1) / BULK_CHUNK_SIZE;
+    pTransfer->m_iNextChunk = 0;
+    pTransfer->m_iAckedChunks = 0;
+    pTransfer->m_flLastAckTime = Plat_FloatTime();
+
+    m_vecOutgoing.AddToTail(pTransfer);
+
+    DevLog("Started %s bulk transfer %u: %i bytes, %u compressed, %u chunks\n", s_pTransferTypeNames[type],
+           pTransfer->m_iTransferID, iSize, static_cast<uint32>(compressedSize), pTransfer->m_iChunkCount);
+
+    return true;
+}
+
+void CMomBulkTransferSystem::CancelTransfers(const CSteamID &member)
+{
+    const bool bAll = !member.IsValid();
+
+    FOR_EACH_VEC_BACK(m_vecOutgoing, i)
+    {
+        if (bAll || m_vecOutgoing[i]->m_Target == member)
+        {
+            delete m_vecOutgoing[i];
+            m_vecOutgoing.Remove(i);
+        }
+    }
+
+    FOR_EACH_VEC_BACK(m_vecIncoming, i)
+    {
+        if (bAll || m_vecIncoming[i]->m_Sender == member)
+        {
+            delete m_vecIncoming[i];
+            m_vecIncoming.Remove(i);
+        }
+    }
+}
+
+int CMomBulkTransferSystem::FindIncoming(const CSteamID &sender, uint32 transferID)
+{
+    FOR_EACH_VEC(m_vecIncoming, i)
+    {
+        if (m_vecIncoming[i]->m_iTransferID == transferID && m_vecIncoming[i]->m_Sender == sender)
+            return i;
+    }
+
+    return m_vecIncoming.InvalidIndex();
+}
+
+int CMomBulkTransferSystem::FindOutgoing(const CSteamID &target, uint32 transferID)
+{
+    FOR_EACH_VEC(m_vecOutgoing, i)
+    {
+        if (m_vecOutgoing[i]->m_iTransferID == transferID && m_vecOutgoing[i]->m_Target == target)
+            return i;
+    }
+
+    return m_vecOutgoing.InvalidIndex();
+}
+
+void CMomBulkTransferSystem::OnChunkPacket(BulkChunkPacket &packet, const CSteamID &from)
+{
+    if (packet.transfer_type == BULK_TRANSFER_INVALID)
+        return;
+
+    int index = FindIncoming(from, packet.transfer_id);
+    if (index == m_vecIncoming.InvalidIndex())
+    {
+        // Only the first chunk may start a transfer, anything else belongs to one we dropped already
+        if (packet.chunk_index != 0 || packet.compressed_size == 0 ||
+            packet.compressed_size > snappy::MaxCompressedLength(BULK_TRANSFER_MAX_SIZE))
+        {
+            SendAck(from, packet.transfer_id, 0, true);
+            return;
+        }
+
+        int iFromSender = 0;
+        FOR_EACH_VEC(m_vecIncoming, i)
+        {
+            if (m_vecIncoming[i]->m_Sender == from)
+                iFromSender++;
+        }
+
+        if (iFromSender >= BULK_TRANSFER_MAX_INCOMING)
+        {
+            DevWarning("Too many bulk transfers from %llu at once, cancelling %u!\n", from.ConvertToUint64(), packet.transfer_id);
+            SendAck(from, packet.transfer_id, 0, true);
+            return;
+        }
+
+        // The buffer grows as chunks come in, the claimed size is only trusted once that much has arrived
+        IncomingTransfer_t *pTransfer = new IncomingTransfer_t;
+        pTransfer->m_Sender = from;
+        pTransfer->m_iTransferID = packet.transfer_id;
+        pTransfer->m_eType = static_cast<BulkTransferType_t>(packet.transfer_type);
+        pTransfer->m_iCompressedSize = packet.compressed_size;
+        pTransfer->m_iChunkCount = (packet.compressed_size + BULK_CHUNK_SIZE - 1) / BULK_CHUNK_SIZE;
+        pTransfer->m_iReceivedChunks = 0;
+        index = m_vecIncoming.AddToTail(pTransfer);
+    }
+
+    IncomingTransfer_t *pTransfer = m_vecIncoming[index];
+
+    // Chunks are sent reliably, so they can only come in order
+    const uint32 expectedSize = pTransfer->m_iReceivedChunks + 1 == pTransfer->m_iChunkCount
+                                    ? pTransfer->m_iCompressedSize - pTransfer->m_iReceivedChunks * BULK_CHUNK_SIZE
+                                    : BULK_CHUNK_SIZE;
+    if (packet.chunk_index != pTransfer->m_iReceivedChunks || packet.compressed_size != pTransfer->m_iCompressedSize ||
+        static_cast<uint32>(packet.dataBuf.TellPut()) != expectedSize)
+    {
+        DevWarning("Bulk transfer %u is out of order, dropping it!\n", pTransfer->m_iTransferID);
+        SendAck(from, pTransfer->m_iTransferID, pTransfer->m_iReceivedChunks, true);
+        delete pTransfer;
+        m_vecIncoming.Remove(index);
+        return;
+    }
+
+    pTransfer->m_bufCompressed.Put(packet.dataBuf.Base(), packet.dataBuf.TellPut());
+    pTransfer->m_iReceivedChunks++;
+    pTransfer->m_flLastChunkTime = Plat_FloatTime();
+
+    const bool bDone = pTransfer->m_iReceivedChunks == pTransfer->m_iChunkCount;
+
+    if (bDone || pTransfer->m_iReceivedChunks % BULK_ACK_INTERVAL == 0)
+    {
+        SendAck(from, pTransfer->m_iTransferID, pTransfer->m_iReceivedChunks);
+        FireProgressEvent(from, pTransfer->m_eType, true, pTransfer->m_iReceivedChunks, pTransfer->m_iChunkCount);
+    }
+
+    if (bDone)
+        FinishIncoming(index);
+}
+
+void CMomBulkTransferSystem::FinishIncoming(int index)
+{
+    IncomingTransfer_t *pTransfer = m_vecIncoming[index];
+    m_vecIncoming.Remove(index);
+
+    const char *pCompressed = static_cast<const char *>(pTransfer->m_bufCompressed.Base());
+    const size_t compressedSize = pTransfer->m_bufCompressed.TellPut();
+
+    size_t uncompressedSize = 0;
+    if (!snappy::GetUncompressedLength(pCompressed, compressedSize, &uncompressedSize) ||
+        uncompressedSize == 0 || uncompressedSize > BULK_TRANSFER_MAX_SIZE)
+    {
+        Warning("Received an invalid bulk transfer!\n");
+        delete pTransfer;
+        return;
+    }
+
+    CUtlBuffer buf;
+    buf.SetBigEndian(false);
+    buf.EnsureCapacity(uncompressedSize);
+    if (snappy::RawUncompress(pCompressed, compressedSize, static_cast<char *>(buf.Base())))
+    {
+        buf.SeekPut(CUtlBuffer::SEEK_HEAD, uncompressedSize);
+
+        DevLog("Finished %s bulk transfer %u: %u bytes\n", s_pTransferTypeNames[pTransfer->m_eType],
+               pTransfer->m_iTransferID, static_cast<uint32>(uncompressedSize));
+
+        if (m_Handlers[pTransfer->m_eType].IsValid())
+            m_Handlers[pTransfer->m_eType](pTransfer->m_Sender, buf);
+        else
+            DevWarning("No handler for %s bulk transfers!\n", s_pTransferTypeNames[pTransfer->m_eType]);
+    }
+    else
+    {
+        Warning("Failed to decompress bulk transfer %u!\n", pTransfer->m_iTransferID);
+    }
+
+    delete pTransfer;
+}
+
+void CMomBulkTransferSystem::OnAckPacket(BulkAckPacket &packet, const CSteamID &from)
+{
+    const int index = FindOutgoing(from, packet.transfer_id);
+    if (index == m_vecOutgoing.InvalidIndex())
+        return;
+
+    OutgoingTransfer_t *pTransfer = m_vecOutgoing[index];
+
+    if (packet.cancel)
+    {
+        DevLog("Bulk transfer %u was cancelled by the receiver\n", pTransfer->m_iTransferID);
+        FireProgressEvent(from, pTransfer->m_eType, false, 0, 0);
+        delete pTransfer;
+        m_vecOutgoing.Remove(index);
+        return;
+    }
+
+    if (packet.chunks_received <= pTransfer->m_iAckedChunks || packet.chunks_received > pTransfer->m_iNextChunk)
+        return;
+
+    pTransfer->m_iAckedChunks = packet.chunks_received;
+    pTransfer->m_flLastAckTime = Plat_FloatTime();
+
+    FireProgressEvent(from, pTransfer->m_eType, false, pTransfer->m_iAckedChunks, pTransfer->m_iChunkCount);
+
+    if (pTransfer->m_iAckedChunks == pTransfer->m_iChunkCount)
+    {
+        delete pTransfer;
+        m_vecOutgoing.Remove(index);
+    }
+}
+
+void CMomBulkTransferSystem::Update()
+{
+    MOM_PROF_SCOPE("CMomBulkTransferSystem::Update");
+
+    const float flNow = Plat_FloatTime();
+    const float flTimeout = mom_bulk_transfer_timeout.GetFloat();
+
+    FOR_EACH_VEC_BACK(m_vecIncoming, i)
+    {
+        if (flNow - m_vecIncoming[i]->m_flLastChunkTime > flTimeout)
+        {
+            DevWarning("Bulk transfer %u from %llu timed out!\n", m_vecIncoming[i]->m_iTransferID, m_vecIncoming[i]->m_Sender.ConvertToUint64());
+            FireProgressEvent(m_vecIncoming[i]->m_Sender, m_vecIncoming[i]->m_eType, true, 0, 0);
+            delete m_vecIncoming[i];
+            m_vecIncoming.Remove(i);
+        }
+    }
+
+    FOR_EACH_VEC_BACK(m_vecOutgoing, i)
+    {
+        if (flNow - m_vecOutgoing[i]->m_flLastAckTime > flTimeout)
+        {
+            DevWarning("Bulk transfer %u to %llu timed out!\n", m_vecOutgoing[i]->m_iTransferID, m_vecOutgoing[i]->m_Target.ConvertToUint64());
+            FireProgressEvent(m_vecOutgoing[i]->m_Target, m_vecOutgoing[i]->m_eType, false, 0, 0);
+            delete m_vecOutgoing[i];
+            m_vecOutgoing.Remove(i);
+        }
+    }
+
+    if (m_vecOutgoing.IsEmpty())
+    {
+        m_flSendBudget = 0.0f;
+        return;
+    }
+
+    // Refill the budget, capped so an idle stretch doesn't turn into a burst
+    const float flRate = mom_bulk_transfer_rate.GetFloat();
+    m_flSendBudget = min(m_flSendBudget + flRate * gpGlobals->frametime, max(flRate * 0.1f, static_cast<float>(BULK_CHUNK_SIZE)));
+
+    // Round robin over the transfers so one big transfer can't hold up the others
+    const uint32 window = mom_bulk_transfer_window.GetInt();
+    bool bSentAny = true;
+    while (m_flSendBudget >= BULK_CHUNK_SIZE && bSentAny)
+    {
+        bSentAny = false;
+        FOR_EACH_VEC(m_vecOutgoing, i)
+        {
+            OutgoingTransfer_t *pTransfer = m_vecOutgoing[i];
+            if (pTransfer->m_iNextChunk >= pTransfer->m_iChunkCount || pTransfer->m_iNextChunk - pTransfer->m_iAckedChunks >= window)
+                continue;
+
+            const int iSent = SendNextChunk(pTransfer);
+            if (iSent > 0)
+            {
+                m_flSendBudget -= iSent;
+                bSentAny = true;
+            }
+
+            if (m_flSendBudget < BULK_CHUNK_SIZE)
+                break;
+        }
+    }
+}
+
+int CMomBulkTransferSystem::SendNextChunk(OutgoingTransfer_t *pTransfer)
+{
+    const uint32 offset = pTransfer->m_iNextChunk * BULK_CHUNK_SIZE;
+    const uint32 size = min(static_cast<uint32>(BULK_CHUNK_SIZE), static_cast<uint32>(pTransfer->m_bufCompressed.TellPut()) - offset);
+
+    BulkChunkPacket packet;
+    packet.transfer_id = pTransfer->m_iTransferID;
+    packet.transfer_type = pTransfer->m_eType;
+    packet.compressed_size = pTransfer->m_bufCompressed.TellPut();
+    packet.chunk_index = pTransfer->m_iNextChunk;
+    packet.dataBuf.Put(static_cast<const uint8 *>(pTransfer->m_bufCompressed.Base()) + offset, size);
+
+    if (!SendBulkPacket(&packet, pTransfer->m_Target))
+        return 0;
+
+    pTransfer->m_iNextChunk++;
+    return size;
+}
+
+void CMomBulkTransferSystem::SendAck(const CSteamID &target, uint32 transferID, uint32 chunksReceived, bool bCancel)
+{
+    BulkAckPacket ack;
+    ack.transfer_id = transferID;
+    ack.chunks_received = chunksReceived;
+    ack.cancel = bCancel;
+    SendBulkPacket(&ack, target);
+}
+
+bool CMomBulkTransferSystem::SendBulkPacket(MomentumPacket *pPacket, const CSteamID &target)
+{
+    CHECK_STEAM_API_B(SteamNetworking());
+
+    CUtlBuffer buf;
+    buf.SetBigEndian(false);
+    pPacket->Write(buf);
+
+    return SteamNetworking()->SendP2PPacket(target, buf.Base(), buf.TellPut(), k_EP2PSendReliable);
+}
+
+void CMomBulkTransferSystem::FireProgressEvent(const CSteamID &member, BulkTransferType_t type, bool bIncoming, uint32 done, uint32 total)
+{
+    // A total of 0 means the transfer failed
+    KeyValues *pKv = new KeyValues("bulk_transfer_progress");
+    pKv->SetString("type", s_pTransferTypeNames[type]);
+    pKv->SetUint64("member", member.ConvertToUint64());
+    pKv->SetBool("incoming", bIncoming);
+    pKv->SetInt("done", done);
+    pKv->SetInt("total", total);
+    g_pModuleComms->FireEvent(pKv);
+}
+
+static CMomBulkTransferSystem s_MomBulkTransfer;
+CMomBulkTransferSystem *g_pMomBulkTransfer = &s_MomBulkTransfer;
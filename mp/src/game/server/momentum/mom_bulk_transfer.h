@@ -0,0 +1,76 @@
+#pragma once
+
+#include "mom_ghostdefs.h"
+#include <utldelegate.h>
+
+// Moves payloads too big for a single P2P packet (savelocs, appearance, replays) between lobby members.
+// The payload is snappy-compressed and cut into BULK_CHUNK_SIZE chunks. Only a window of unacknowledged
+// chunks is kept in flight, and a byte budget per frame keeps a big transfer from starving the position packets.
+class CMomBulkTransferSystem
+{
+public:
+    typedef CUtlDelegate<void (const CSteamID &, CUtlBuffer &)> TransferHandler_t;
+
+    CMomBulkTransferSystem();
+    ~CMomBulkTransferSystem();
+
+    // Who gets the finished transfers of the given type. The buffer only lives for the duration of the call.
+    void SetHandler(BulkTransferType_t type, TransferHandler_t handler);
+
+    // Compresses and queues the data for the target, returns false if it could not be started
+    bool StartTransfer(const CSteamID &target, BulkTransferType_t type, const CUtlBuffer &data);
+    // Drops every transfer to and from the member, or all of them if the ID is invalid
+    void CancelTransfers(const CSteamID &member);
+
+    void OnChunkPacket(BulkChunkPacket &packet, const CSteamID &from);
+    void OnAckPacket(BulkAckPacket &packet, const CSteamID &from);
+
+    // Sends out the queued chunks and times out stalled transfers, called every frame by the lobby system
+    void Update();
+
+private:
+    struct OutgoingTransfer_t
+    {
+        CSteamID m_Target;
+        uint32 m_iTransferID;
+        BulkTransferType_t m_eType;
+        CUtlBuffer m_bufCompressed;
+        uint32 m_iChunkCount;
+        uint32 m_iNextChunk; // Next chunk to go out
+        uint32 m_iAckedChunks; // Chunks the target confirmed
+        float m_flLastAckTime;
+    };
+
+    struct IncomingTransfer_t
+    {
+        CSteamID m_Sender;
+        uint32 m_iTransferID;
+        BulkTransferType_t m_eType;
+        CUtlBuffer m_bufCompressed;
+        uint32 m_iCompressedSize;
+        uint32 m_iChunkCount;
+        uint32 m_iReceivedChunks;
+        float m_flLastChunkTime;
+    };
+
+    int FindIncoming(const CSteamID &sender, uint32 transferID);
+    int FindOutgoing(const CSteamID &target, uint32 transferID);
+
+    // Tries to send the next chunk of the transfer, returns the bytes sent or 0
+    int SendNextChunk(OutgoingTransfer_t *pTransfer);
+    void SendAck(const CSteamID &target, uint32 transferID, uint32 chunksReceived, bool bCancel = false);
+    void FinishIncoming(int index);
+    void FireProgressEvent(const CSteamID &member, BulkTransferType_t type, bool bIncoming, uint32 done, uint32 total);
+
+    bool SendBulkPacket(MomentumPacket *pPacket, const CSteamID &target);
+
+    TransferHandler_t m_Handlers[BULK_TRANSFER_COUNT];
+
+    CUtlVector<OutgoingTransfer_t*> m_vecOutgoing;
+    CUtlVector<IncomingTransfer_t*> m_vecIncoming;
+
+    uint32 m_iNextTransferID;
+    float m_flSendBudget; // Bytes we are still allowed to send, refilled every frame
+};
+
+extern CMomBulkTransferSystem *g_pMomBulkTransfer;
@@ -42,7 +42,6 @@ SendPropString(SENDINFO(m_szGhostName)),
 SendPropBool(SENDINFO(m_bSpectated)),
 SendPropInt(SENDINFO(m_fFlags), PLAYER_FLAG_BITS, SPROP_UNSIGNED|SPROP_CHANGES_OFTEN, SendProxy_CropFlagsToPlayerFlagBitsLength),
 SendPropDataTable(SENDINFO_DT(m_Data), &REFERENCE_SEND_TABLE(DT_MomRunEntityData)),
-SendPropDataTable(SENDINFO_DT(m_RunStats), &REFERENCE_SEND_TABLE(DT_MomRunStats)),
 END_SEND_TABLE();
 
 BEGIN_DATADESC(CMomentumGhostBaseEntity)
@@ -51,7 +51,7 @@ public:
     virtual bool GetBhopEnabled() const OVERRIDE;
     CNetworkVarEmbedded(CMomRunEntityData, m_Data);
     virtual CMomRunEntityData *GetRunEntData() OVERRIDE { return &m_Data; }
-    CNetworkVarEmbedded(CMomRunStats, m_RunStats);
+    CMomRunStats m_RunStats;
     virtual CMomRunStats *GetRunStats() OVERRIDE { return &m_RunStats; }
     virtual int GetEntIndex() OVERRIDE { return entindex(); }
 
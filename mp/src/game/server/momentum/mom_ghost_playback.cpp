@@ -0,0 +1,182 @@
+#include "cbase.h"
+
+#include "mom_ghost_playback.h"
+#include "mom_replay_entity.h"
+#include "mom_profiler.h"
+#include "run/mom_replay_base.h"
+
+#include "tier0/memdbgon.h"
+
+CMomGhostPlaybackSystem::CMomGhostPlaybackSystem(const char *pName) : CAutoGameSystemPerFrame(pName)
+{
+}
+
+void CMomGhostPlaybackSystem::LevelShutdownPreEntity()
+{
+    m_vecGhosts.PurgeAndDeleteElements();
+    m_vecPoseGhosts.Purge();
+    m_vecFirstPersonGhosts.Purge();
+}
+
+void CMomGhostPlaybackSystem::AddGhost(CMomentumReplayGhostEntity *pGhost)
+{
+    int index = FindGhost(pGhost);
+    if (index == -1)
+    {
+        index = m_vecGhosts.AddToTail(new Ghost_t);
+        m_vecGhosts[index]->m_hGhost = pGhost;
+    }
+
+    Ghost_t *pEntry = m_vecGhosts[index];
+    pEntry->m_iNextStepTick = gpGlobals->tickcount + 1;
+    pEntry->m_pWindowReplay = nullptr;
+    pEntry->m_iWindowStart = 0;
+    pEntry->m_vecOrigins.RemoveAll();
+    pEntry->m_vecAngles.RemoveAll();
+}
+
+void CMomGhostPlaybackSystem::RemoveGhost(CMomentumReplayGhostEntity *pGhost)
+{
+    // Only unlinked here, ghosts can end their run in the middle of the pass. The entry is freed by the next one.
+    const int index = FindGhost(pGhost);
+    if (index != -1)
+        m_vecGhosts[index]->m_hGhost = nullptr;
+}
+
+int CMomGhostPlaybackSystem::FindGhost(CMomentumReplayGhostEntity *pGhost) const
+{
+    FOR_EACH_VEC(m_vecGhosts, i)
+    {
+        if (m_vecGhosts[i]->m_hGhost.Get() == pGhost)
+            return i;
+    }
+
+    return -1;
+}
+
+void CMomGhostPlaybackSystem::LoadWindow(Ghost_t *pGhost, CMomReplayBase *pReplay, int iTick)
+{
+    const int iFrameCount = pReplay->GetFrameCount();
+    const int iStart = max(iTick - GHOST_PLAYBACK_WINDOW_BACK, 0);
+    const int iCount = min(iFrameCount - iStart, GHOST_PLAYBACK_WINDOW_FRAMES);
+
+    pGhost->m_pWindowReplay = pReplay;
+    pGhost->m_iWindowStart = iStart;
+    pGhost->m_vecOrigins.SetCount(max(iCount, 0));
+    pGhost->m_vecAngles.SetCount(max(iCount, 0));
+
+    for (int i = 0; i < iCount; i++)
+    {
+        // The window ends at the first missing frame, the ghost falls back to HandleGhost past it
+        CReplayFrame *pFrame = pReplay->GetFrame(iStart + i);
+        if (!pFrame)
+        {
+            pGhost->m_vecOrigins.SetCountNonDestructively(i);
+            pGhost->m_vecAngles.SetCountNonDestructively(i);
+            break;
+        }
+
+        pGhost->m_vecOrigins[i] = pFrame->PlayerOrigin();
+        pGhost->m_vecAngles[i] = pFrame->EyeAngles();
+    }
+}
+
+void CMomGhostPlaybackSystem::FrameUpdatePostEntityThink()
+{
+    MOM_PROF_SCOPE("CMomGhostPlaybackSystem::FrameUpdatePostEntityThink");
+
+    MOM_PROF_COUNTER("GhostPlayback::Ghosts", static_cast<float>(m_vecGhosts.Count()));
+
+    FOR_EACH_VEC_BACK(m_vecGhosts, i)
+    {
+        if (!m_vecGhosts[i]->m_hGhost.Get())
+        {
+            delete m_vecGhosts[i];
+            m_vecGhosts.Remove(i);
+        }
+    }
+
+    if (m_vecGhosts.IsEmpty())
+        return;
+
+    m_vecPoseGhosts.RemoveAll();
+    m_vecFirstPersonGhosts.RemoveAll();
+
+    // Advance the ghosts that are due, and sort them by what they need next
+    {
+        MOM_PROF_SCOPE("GhostPlayback::Step");
+
+        FOR_EACH_VEC(m_vecGhosts, i)
+        {
+            Ghost_t *pEntry = m_vecGhosts[i];
+            CMomentumReplayGhostEntity *pGhost = pEntry->m_hGhost.Get();
+            if (!pGhost || gpGlobals->tickcount < pEntry->m_iNextStepTick)
+                continue;
+
+            pEntry->m_iNextStepTick = gpGlobals->tickcount + pGhost->GetPlaybackStepTicks();
+
+            if (!pGhost->StepPlayback())
+                continue;
+
+            if (pGhost->GetCurrentSpectator())
+                m_vecFirstPersonGhosts.AddToTail(i);
+            else
+                m_vecPoseGhosts.AddToTail(i);
+        }
+    }
+
+    MOM_PROF_COUNTER("GhostPlayback::Posed", static_cast<float>(m_vecPoseGhosts.Count()));
+
+    // Refill the frame windows the ghosts stepped out of (seeking, or a stream that grew)
+    {
+        MOM_PROF_SCOPE("GhostPlayback::Load");
+
+        FOR_EACH_VEC(m_vecPoseGhosts, i)
+        {
+            Ghost_t *pEntry = m_vecGhosts[m_vecPoseGhosts[i]];
+            CMomentumReplayGhostEntity *pGhost = pEntry->m_hGhost.Get();
+            CMomReplayBase *pReplay = pGhost ? pGhost->GetPlaybackReplay() : nullptr;
+            if (!pReplay)
+                continue;
+
+            const int iTick = clamp<int>(pGhost->m_iCurrentTick, 0, pReplay->GetFrameCount() - 1);
+            const int iOffset = iTick - pEntry->m_iWindowStart;
+            if (pReplay != pEntry->m_pWindowReplay || iOffset < 0 || iOffset >= pEntry->m_vecOrigins.Count())
+                LoadWindow(pEntry, pReplay, iTick);
+        }
+    }
+
+    // Ghosts nobody spectates only need to be moved
+    {
+        MOM_PROF_SCOPE("GhostPlayback::Pose");
+
+        FOR_EACH_VEC(m_vecPoseGhosts, i)
+        {
+            Ghost_t *pEntry = m_vecGhosts[m_vecPoseGhosts[i]];
+            CMomentumReplayGhostEntity *pGhost = pEntry->m_hGhost.Get();
+            if (!pGhost)
+                continue;
+
+            const int iOffset = pGhost->m_iCurrentTick - pEntry->m_iWindowStart;
+            if (pGhost->GetPlaybackReplay() == pEntry->m_pWindowReplay && iOffset >= 0 && iOffset < pEntry->m_vecOrigins.Count())
+                pGhost->ApplyPose(pEntry->m_vecOrigins[iOffset], pEntry->m_vecAngles[iOffset]);
+            else
+                pGhost->HandleGhost();
+        }
+    }
+
+    // The spectated ones also drive the HUD: velocity, keypresses and stats
+    {
+        MOM_PROF_SCOPE("GhostPlayback::FirstPerson");
+
+        FOR_EACH_VEC(m_vecFirstPersonGhosts, i)
+        {
+            CMomentumReplayGhostEntity *pGhost = m_vecGhosts[m_vecFirstPersonGhosts[i]]->m_hGhost.Get();
+            if (pGhost)
+                pGhost->HandleGhostFirstPerson();
+        }
+    }
+}
+
+static CMomGhostPlaybackSystem s_MomGhostPlayback("MOMGhostPlaybackSystem");
+CMomGhostPlaybackSystem *g_pMomGhostPlayback = &s_MomGhostPlayback;
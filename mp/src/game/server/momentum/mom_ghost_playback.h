@@ -0,0 +1,52 @@
+#pragma once
+
+class CMomReplayBase;
+class CMomentumReplayGhostEntity;
+
+#define GHOST_PLAYBACK_WINDOW_FRAMES 512 // Frames of every ghost kept in the pose arrays
+#define GHOST_PLAYBACK_WINDOW_BACK 64 // Frames kept before the current one, for going backwards
+
+// Plays back every active replay ghost in one pass per frame, instead of every ghost thinking on its own.
+// The pass is done in stages (step, load, pose, first person), each one timed by the Momentum profiler.
+// Ghosts nobody spectates are only posed, from a window of their frames copied into plain origin/angle arrays;
+// the spectated ones still go through HandleGhostFirstPerson for the velocity, buttons and stats.
+class CMomGhostPlaybackSystem : public CAutoGameSystemPerFrame
+{
+public:
+    CMomGhostPlaybackSystem(const char *pName);
+
+    // CAutoGameSystemPerFrame
+    void LevelShutdownPreEntity() OVERRIDE;
+    void FrameUpdatePostEntityThink() OVERRIDE;
+
+    // The ghost is played back starting next tick, until it is removed
+    void AddGhost(CMomentumReplayGhostEntity *pGhost);
+    void RemoveGhost(CMomentumReplayGhostEntity *pGhost);
+
+    int GetGhostCount() const { return m_vecGhosts.Count(); }
+
+private:
+    struct Ghost_t
+    {
+        CHandle<CMomentumReplayGhostEntity> m_hGhost;
+        int m_iNextStepTick;
+
+        // Frames [m_iWindowStart, m_iWindowStart + Count()) of m_pWindowReplay. The ghost can be given another
+        // replay at any time, so this is only compared against and never dereferenced.
+        const CMomReplayBase *m_pWindowReplay;
+        int m_iWindowStart;
+        CUtlVector<Vector> m_vecOrigins;
+        CUtlVector<QAngle> m_vecAngles;
+    };
+
+    int FindGhost(CMomentumReplayGhostEntity *pGhost) const;
+    void LoadWindow(Ghost_t *pGhost, CMomReplayBase *pReplay, int iTick);
+
+    CUtlVector<Ghost_t *> m_vecGhosts;
+
+    // Filled by the step stage, indices into m_vecGhosts
+    CUtlVector<int> m_vecPoseGhosts;
+    CUtlVector<int> m_vecFirstPersonGhosts;
+};
+
+extern CMomGhostPlaybackSystem *g_pMomGhostPlayback;
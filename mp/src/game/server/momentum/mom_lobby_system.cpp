@@ -5,6 +5,8 @@
 #include "filesystem.h"
 #include "ghost_client.h"
 #include "mom_online_ghost.h"
+#include "mom_bulk_transfer.h"
+#include "mom_replay_stream.h"
 #include "mom_system_gamemode.h"
 #include "mom_system_saveloc.h"
 #include "mom_player_shared.h"
@@ -12,6 +14,7 @@
 #include "mom_timer.h"
 #include "fmtstr.h"
 #include "time.h"
+#include "mom_profiler.h"
 
 #include "tier0/memdbgon.h"
 
@@ -132,6 +135,11 @@ bool CMomentumLobbySystem::SendSavelocReqPacket(CSteamID& target, SavelocReqPack
     return LobbyValid() && SendPacket(p, &target, k_EP2PSendReliable);
 }
 
+bool CMomentumLobbySystem::SendReplayStreamPacket(CSteamID &target, ReplayStreamPacket *p)
+{
+    return LobbyValid() && SendPacket(p, &target, k_EP2PSendReliable);
+}
+
 void CMomentumLobbySystem::TeleportToLobbyMember(const char *pIDStr)
 {
     // Check a few things first
@@ -239,6 +247,9 @@ void CMomentumLobbySystem::LeaveLobby()
         SteamMatchmaking()->LeaveLobby(m_sLobbyID);
         // Clear the ghosts stored in our lobby system
         g_pMomentumGhostClient->ClearCurrentGhosts(true);
+        // Nobody is left to send to or receive from
+        g_pMomBulkTransfer->CancelTransfers(k_steamIDNil);
+        g_pMomReplayStream->Reset();
         // Clear out any rich presence 
         SteamFriends()->ClearRichPresence();
 
@@ -272,6 +283,8 @@ void CMomentumLobbySystem::HandleLobbyEnter(LobbyEnter_t* pEnter)
 
         FIRE_GAME_WIDE_EVENT("lobby_join");
 
+        g_pMomBulkTransfer->SetHandler(BULK_TRANSFER_SAVELOCS, UtlMakeDelegate(this, &CMomentumLobbySystem::OnSavelocTransfer));
+
         // Set our own data
         SteamMatchmaking()->SetLobbyMemberData(m_sLobbyID, LOBBY_DATA_MAP, gpGlobals->mapname.ToCStr());
 
@@ -483,6 +496,8 @@ void CMomentumLobbySystem::HandleLobbyChatUpdate(LobbyChatUpdate_t* pParam)
 
         // Check if they're a saveloc requester
         g_pMOMSavelocSystem->RequesterLeft(changedPerson.ConvertToUint64());
+        g_pMomBulkTransfer->CancelTransfers(changedPerson);
+        g_pMomReplayStream->MemberLeft(changedPerson);
 
         uint16 findMember = m_mapLobbyGhosts.Find(changedPerson.ConvertToUint64());
         if (findMember != m_mapLobbyGhosts.InvalidIndex())
@@ -619,6 +634,8 @@ void CMomentumLobbySystem::CheckToAdd(CSteamID *pID)
 
             // Remove them if they're a requester
             g_pMOMSavelocSystem->RequesterLeft(pID_int);
+            g_pMomBulkTransfer->CancelTransfers(*pID);
+            g_pMomReplayStream->MemberLeft(*pID);
 
             // "_____ just left your map."
             WriteLobbyMessage(LOBBY_UPDATE_MEMBER_LEAVE_MAP, pID_int);
@@ -686,6 +703,8 @@ bool CMomentumLobbySystem::TryJoinLobbyFromString(const char* pString)
 
 void CMomentumLobbySystem::SendAndReceiveP2PPackets()
 {
+    MOM_PROF_SCOPE("CMomentumLobbySystem::SendAndReceiveP2PPackets");
+
     if (m_mapLobbyGhosts.Count() == 0)
         return;
 
@@ -788,23 +807,19 @@ void CMomentumLobbySystem::SendAndReceiveP2PPackets()
                         SavelocReqPacket response;
                         response.stage = SAVELOC_REQ_STAGE_SAVELOC_ACK;
 
+                        // The savelocs can easily outgrow a single packet, so they go out as a bulk transfer
                         if (g_pMOMSavelocSystem->WriteRequestedSavelocs(&saveloc, &response, fromWho.ConvertToUint64()))
-                            SendPacket(&response, &fromWho, k_EP2PSendReliable);
+                        {
+                            CUtlBuffer payload;
+                            payload.SetBigEndian(false);
+                            response.Write(payload);
+                            g_pMomBulkTransfer->StartTransfer(fromWho, BULK_TRANSFER_SAVELOCS, payload);
+                        }
                     }
                     break;
                 case SAVELOC_REQ_STAGE_SAVELOC_ACK:
                     {
-                        if (g_pMOMSavelocSystem->ReadReceivedSavelocs(&saveloc, fromWho.ConvertToUint64()))
-                        {
-                            SavelocReqPacket response;
-                            response.stage = SAVELOC_REQ_STAGE_DONE;
-                            if (SendPacket(&response, &fromWho, k_EP2PSendReliable))
-                            {
-                                KeyValues *pKv = new KeyValues("req_savelocs");
-                                pKv->SetInt("stage", SAVELOC_REQ_STAGE_DONE);
-                                g_pModuleComms->FireEvent(pKv);
-                            }
-                        }
+                        HandleReceivedSavelocs(saveloc, fromWho);
                     }
                     break;
                 case SAVELOC_REQ_STAGE_DONE:
@@ -819,6 +834,24 @@ void CMomentumLobbySystem::SendAndReceiveP2PPackets()
                 }
             }
             break;
+        case PACKET_TYPE_BULK_CHUNK:
+            {
+                BulkChunkPacket chunk(buf);
+                g_pMomBulkTransfer->OnChunkPacket(chunk, fromWho);
+            }
+            break;
+        case PACKET_TYPE_BULK_ACK:
+            {
+                BulkAckPacket ack(buf);
+                g_pMomBulkTransfer->OnAckPacket(ack, fromWho);
+            }
+            break;
+        case PACKET_TYPE_REPLAY_STREAM:
+            {
+                ReplayStreamPacket stream(buf);
+                g_pMomReplayStream->OnStreamPacket(stream, fromWho);
+            }
+            break;
         default:
             break;
         }
@@ -827,6 +860,8 @@ void CMomentumLobbySystem::SendAndReceiveP2PPackets()
         delete[] bytes;
     }
 
+    g_pMomBulkTransfer->Update();
+
     if (m_flNextUpdateTime > 0.0f && gpGlobals->curtime > m_flNextUpdateTime)
     {
         PositionPacket frame;
@@ -837,6 +872,35 @@ void CMomentumLobbySystem::SendAndReceiveP2PPackets()
     }
 }
 
+// Bulk transfer handler for the SAVELOC_ACK stage
+void CMomentumLobbySystem::OnSavelocTransfer(const CSteamID &from, CUtlBuffer &data)
+{
+    if (data.GetUnsignedChar() != PACKET_TYPE_SAVELOC_REQ)
+        return;
+
+    SavelocReqPacket saveloc(data);
+    if (saveloc.stage == SAVELOC_REQ_STAGE_SAVELOC_ACK)
+    {
+        CSteamID sender(from);
+        HandleReceivedSavelocs(saveloc, sender);
+    }
+}
+
+void CMomentumLobbySystem::HandleReceivedSavelocs(SavelocReqPacket &packet, CSteamID &from)
+{
+    if (g_pMOMSavelocSystem->ReadReceivedSavelocs(&packet, from.ConvertToUint64()))
+    {
+        SavelocReqPacket response;
+        response.stage = SAVELOC_REQ_STAGE_DONE;
+        if (SendPacket(&response, &from, k_EP2PSendReliable))
+        {
+            KeyValues *pKv = new KeyValues("req_savelocs");
+            pKv->SetInt("stage", SAVELOC_REQ_STAGE_DONE);
+            g_pModuleComms->FireEvent(pKv);
+        }
+    }
+}
+
 void CMomentumLobbySystem::SetIsSpectating(bool bSpec)
 {
     CHECK_STEAM_API(SteamMatchmaking());
@@ -886,6 +950,8 @@ void CMomentumLobbySystem::SetSpectatorTarget(const CSteamID &ghostTarget, bool
     }
     
     SendSpectatorUpdatePacket(ghostTarget, type);
+
+    g_pMomReplayStream->OnSpectateTargetChanged(ghostTarget, type);
 }
 
 //Sends the spectator info update packet to all current ghosts
@@ -5,6 +5,7 @@
 class MomentumPacket;
 class DecalPacket;
 class SavelocReqPacket;
+class ReplayStreamPacket;
 struct AppearanceData_t;
 class CMomentumOnlineGhostEntity;
 
@@ -25,6 +26,7 @@ public:
     void SendChatMessage(char *pMessage); // Sent from the player, who is trying to say a message
     void ResetOtherAppearanceData(); // Sent when the player changes an override appearance cvar
     bool SendSavelocReqPacket(CSteamID& target, SavelocReqPacket *p);
+    bool SendReplayStreamPacket(CSteamID &target, ReplayStreamPacket *p);
     void TeleportToLobbyMember(const char *pIDStr);
 
     STEAM_CALLBACK(CMomentumLobbySystem, HandleLobbyEnter, LobbyEnter_t); // We entered this lobby (or failed to enter)
@@ -76,6 +78,10 @@ private:
     // Sends a packet to a specific person, or everybody (if pTarget is null)
     bool SendPacket(MomentumPacket *packet, CSteamID *pTarget = nullptr, EP2PSend sendType = k_EP2PSendUnreliable);
 
+    // Saveloc data of the SAVELOC_ACK stage, sent to us as a bulk transfer
+    void OnSavelocTransfer(const CSteamID &from, CUtlBuffer &data);
+    void HandleReceivedSavelocs(SavelocReqPacket &packet, CSteamID &from);
+
     void WriteLobbyMessage(LobbyMessageType_t type, uint64 id);
     void WriteSpecMessage(SpectateMessageType_t type, uint64 playerID, uint64 ghostID);
 
@@ -11,6 +11,7 @@
 #include "weapon/weapon_knife.h"
 #include "ghost_client.h"
 #include "mom_stickybomb.h"
+#include "mom_profiler.h"
 
 #include "tier0/memdbgon.h"
 
@@ -297,6 +298,8 @@ void CMomentumOnlineGhostEntity::CreateTrail()
 
 void CMomentumOnlineGhostEntity::Think()
 {
+    MOM_PROF_SCOPE("CMomentumOnlineGhostEntity::Think");
+
     BaseClass::Think();
     HandleGhost();
     if (m_pCurrentSpecPlayer)
@@ -133,7 +133,6 @@ SendPropFloat(SENDINFO(m_fDuckTimer)),
 SendPropArray3(SENDINFO_ARRAY3(m_iZoneCount), SendPropInt(SENDINFO_ARRAY(m_iZoneCount), 7, SPROP_UNSIGNED)),
 SendPropArray3(SENDINFO_ARRAY3(m_iLinearTracks), SendPropInt(SENDINFO_ARRAY(m_iLinearTracks), 1, SPROP_UNSIGNED)),
 SendPropDataTable(SENDINFO_DT(m_Data), &REFERENCE_SEND_TABLE(DT_MomRunEntityData)),
-SendPropDataTable(SENDINFO_DT(m_RunStats), &REFERENCE_SEND_TABLE(DT_MomRunStats)),
 END_SEND_TABLE();
 
 BEGIN_DATADESC(CMomentumPlayer)
@@ -1344,7 +1343,9 @@ bool CMomentumPlayer::SetObserverTarget(CBaseEntity *target)
         }
         else if (pGhostToSpectate->IsReplayGhost())
         {
-            m_sSpecTargetSteamID = CSteamID(uint64(1));
+            // Streamed replays stand in for the lobby member they come from
+            const auto pReplayEnt = static_cast<CMomentumReplayGhostEntity*>(target);
+            m_sSpecTargetSteamID = pReplayEnt->IsStreamGhost() ? pReplayEnt->GetStreamSource() : CSteamID(uint64(1));
         }
 
         g_pMomentumGhostClient->SetSpectatorTarget(m_sSpecTargetSteamID, pCurrentGhost == nullptr);
@@ -106,7 +106,7 @@ class CMomentumPlayer : public CBasePlayer, public CGameEventListener, public CM
     virtual void OnZoneExit(CTriggerZone* pTrigger) OVERRIDE;
     CNetworkVarEmbedded(CMomRunEntityData, m_Data);
     virtual CMomRunEntityData *GetRunEntData() OVERRIDE { return &m_Data;}
-    CNetworkVarEmbedded(CMomRunStats, m_RunStats);
+    CMomRunStats m_RunStats;
     virtual CMomRunStats *GetRunStats() OVERRIDE { return &m_RunStats; }
     virtual int GetEntIndex() OVERRIDE { return entindex(); }
 
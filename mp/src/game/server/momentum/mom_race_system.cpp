@@ -0,0 +1,240 @@
+#include "cbase.h"
+
+#include "mom_race_system.h"
+#include "mom_replay_entity.h"
+#include "run/mom_replay_factory.h"
+#include "util/baseautocompletefilelist.h"
+#include "util/mom_util.h"
+#include "filesystem.h"
+#include "vstdlib/jobthread.h"
+
+#include "tier0/memdbgon.h"
+
+static MAKE_CONVAR(mom_race_memory_budget, "32", FCVAR_ARCHIVE,
+                   "Megabytes of replay frames the race mode keeps in memory, the rest is read from the replay files when needed.\n",
+                   4, 1024);
+
+// Filled in by the loading jobs, one per queued replay
+struct RaceLoad_t
+{
+    char m_szFileName[MAX_PATH];
+    char m_szHash[41];
+    bool m_bByteSwapped;
+    CMomArenaReplay *m_pReplay;
+    const char *m_pError;
+};
+
+static void LoadRaceReplay(RaceLoad_t &load)
+{
+    CUtlBuffer reader;
+    if (!g_pFullFileSystem->ReadFile(load.m_szFileName, "MOD", reader))
+    {
+        load.m_pError = "file not found";
+        return;
+    }
+
+    const uint32 magic = reader.GetUnsignedInt();
+    if (magic != REPLAY_MAGIC_LE && magic != REPLAY_MAGIC_BE)
+    {
+        load.m_pError = "not a replay file";
+        return;
+    }
+
+    load.m_bByteSwapped = magic == REPLAY_MAGIC_BE;
+    reader.ActivateByteSwapping(load.m_bByteSwapped);
+
+    // The arena reads the frames straight from the file, only the one layout there is so far is known
+    if (reader.GetUnsignedChar() != 1)
+    {
+        load.m_pError = "unsupported replay version";
+        return;
+    }
+
+    MomUtil::GetSHA1Hash(reader, load.m_szHash, sizeof(load.m_szHash));
+    load.m_pReplay = new CMomArenaReplay(reader, reader.TellPut());
+}
+
+CMomRaceSystem::CMomRaceSystem(const char *pName) : CAutoGameSystem(pName)
+{
+}
+
+void CMomRaceSystem::LevelShutdownPostEntity()
+{
+    // The ghosts are gone with the level already
+    FOR_EACH_VEC(m_vecRacers, i)
+    {
+        delete m_vecRacers[i].m_pReplay;
+    }
+    m_vecRacers.Purge();
+    m_vecQueuedFiles.Purge();
+    m_Arena.RemoveAll();
+}
+
+void CMomRaceSystem::AddReplay(const char *pFileName)
+{
+    char fileName[MAX_PATH];
+    if (Q_strstr(pFileName, EXT_RECORDING_FILE))
+        Q_strncpy(fileName, pFileName, sizeof(fileName));
+    else
+        Q_snprintf(fileName, sizeof(fileName), "%s%s", pFileName, EXT_RECORDING_FILE);
+
+    m_vecQueuedFiles.AddToTail(fileName);
+}
+
+bool CMomRaceSystem::StartRace()
+{
+    StopRace();
+
+    if (m_vecQueuedFiles.IsEmpty())
+    {
+        Warning("There are no replays to race, add some with mom_race_add first!\n");
+        return false;
+    }
+
+    CUtlVector<RaceLoad_t> vecLoads;
+    vecLoads.SetCount(m_vecQueuedFiles.Count());
+    FOR_EACH_VEC(vecLoads, i)
+    {
+        RaceLoad_t &load = vecLoads[i];
+        V_ComposeFileName(RECORDING_PATH, m_vecQueuedFiles[i].String(), load.m_szFileName, sizeof(load.m_szFileName));
+        load.m_szHash[0] = '\0';
+        load.m_bByteSwapped = false;
+        load.m_pReplay = nullptr;
+        load.m_pError = nullptr;
+    }
+    m_vecQueuedFiles.RemoveAll();
+
+    ParallelProcess("CMomRaceSystem::LoadReplays", vecLoads.Base(), vecLoads.Count(), &LoadRaceReplay);
+
+    m_Arena.SetBudget(mom_race_memory_budget.GetInt() * 1024 * 1024);
+
+    int iMinStartTick = INT_MAX;
+    FOR_EACH_VEC(vecLoads, i)
+    {
+        const RaceLoad_t &load = vecLoads[i];
+        CMomArenaReplay *pReplay = load.m_pReplay;
+        if (!pReplay)
+        {
+            Warning("Could not load the replay %s for the race: %s!\n", load.m_szFileName, load.m_pError);
+            continue;
+        }
+
+        const char *pError = nullptr;
+        if (!FStrEq(pReplay->GetMapName(), gpGlobals->mapname.ToCStr()))
+            pError = "it was done on another map";
+        else if (!CloseEnough(pReplay->GetTickInterval(), gpGlobals->interval_per_tick, FLT_EPSILON))
+            pError = "its tickrate is not the current one";
+        else if (!pReplay->GetRunStats() || pReplay->GetFrameCount() <= 0)
+            pError = "it is empty";
+
+        if (pError)
+        {
+            Warning("Cannot race the replay %s, %s!\n", load.m_szFileName, pError);
+            delete pReplay;
+            continue;
+        }
+
+        pReplay->SetArenaSource(&m_Arena, m_Arena.AddSource(load.m_szHash, load.m_szFileName, "MOD", pReplay->GetFramesOffset(),
+                                                            pReplay->GetFrameCount(), load.m_bByteSwapped));
+
+        auto pGhost = static_cast<CMomentumReplayGhostEntity *>(CreateEntityByName("mom_replay_ghost"));
+        pGhost->LoadFromReplayBase(pReplay);
+        pGhost->StartRun(false);
+
+        Racer_t racer;
+        racer.m_pReplay = pReplay;
+        racer.m_hGhost = pGhost;
+        m_vecRacers.AddToTail(racer);
+
+        iMinStartTick = min(iMinStartTick, static_cast<int>(pReplay->GetStartTick()));
+    }
+
+    if (m_vecRacers.IsEmpty())
+        return false;
+
+    // Everybody starts their timer at the same time
+    FOR_EACH_VEC(m_vecRacers, i)
+    {
+        const Racer_t &racer = m_vecRacers[i];
+        racer.m_hGhost->GoToTick(static_cast<int>(racer.m_pReplay->GetStartTick()) - iMinStartTick);
+    }
+
+    Msg("Racing %i replays (%i different runs).\n", m_vecRacers.Count(), m_Arena.GetSourceCount());
+    return true;
+}
+
+void CMomRaceSystem::StopRace()
+{
+    FOR_EACH_VEC(m_vecRacers, i)
+    {
+        if (m_vecRacers[i].m_hGhost.Get())
+            m_vecRacers[i].m_hGhost->EndRun();
+
+        delete m_vecRacers[i].m_pReplay;
+    }
+    m_vecRacers.RemoveAll();
+    m_Arena.RemoveAll();
+}
+
+void CMomRaceSystem::OnTimerStarted()
+{
+    FOR_EACH_VEC(m_vecRacers, i)
+    {
+        const Racer_t &racer = m_vecRacers[i];
+        if (racer.m_hGhost.Get())
+            racer.m_hGhost->GoToTick(racer.m_pReplay->GetStartTick());
+    }
+}
+
+void CMomRaceSystem::PrintStatus()
+{
+    if (!IsRacing())
+    {
+        Msg("Not racing, %i replays queued.\n", m_vecQueuedFiles.Count());
+        return;
+    }
+
+    FOR_EACH_VEC(m_vecRacers, i)
+    {
+        const Racer_t &racer = m_vecRacers[i];
+        CMomentumReplayGhostEntity *pGhost = racer.m_hGhost.Get();
+        Msg("%-32s tick %6i/%-6i %s\n", racer.m_pReplay->GetPlayerName(), pGhost ? pGhost->m_iCurrentTick.Get() : -1,
+            racer.m_pReplay->GetFrameCount() - 1, pGhost ? "" : "(removed)");
+    }
+
+    m_Arena.PrintStatus();
+}
+
+static CMomRaceSystem s_MomRaceSystem("CMomRaceSystem");
+CMomRaceSystem *g_pMomRaceSystem = &s_MomRaceSystem;
+
+class CMomRaceCommands
+{
+  public:
+    static void AddReplays(const CCommand &args)
+    {
+        for (int i = 1; i < args.ArgC(); i++)
+            g_pMomRaceSystem->AddReplay(args[i]);
+    }
+
+    static void StartRace(const CCommand &args)
+    {
+        AddReplays(args);
+        g_pMomRaceSystem->StartRace();
+    }
+};
+
+CON_COMMAND_AUTOCOMPLETEFILE(mom_race_add, CMomRaceCommands::AddReplays,
+                             "Queues replays for the next race (mom_race_start).", RECORDING_PATH, EXT_RECORDING_FILE);
+CON_COMMAND_AUTOCOMPLETEFILE(mom_race_start, CMomRaceCommands::StartRace,
+                             "Starts racing the queued replays, and the ones given to it.", RECORDING_PATH, EXT_RECORDING_FILE);
+
+CON_COMMAND(mom_race_stop, "Removes the ghosts of the current race.")
+{
+    g_pMomRaceSystem->StopRace();
+}
+
+CON_COMMAND(mom_race_status, "Prints the ghosts of the current race and the memory used by their replays.")
+{
+    g_pMomRaceSystem->PrintStatus();
+}
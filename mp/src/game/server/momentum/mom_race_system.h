@@ -0,0 +1,44 @@
+#pragma once
+
+#include "mom_replay_arena.h"
+
+class CMomArenaReplay;
+class CMomentumReplayGhostEntity;
+
+// Races the local player against many replays at once (the top times of a map, for example).
+// The replays are loaded in parallel, keep only their header and stats in memory, and read their frames through one
+// shared arena with a memory budget (mom_race_memory_budget). The ghosts are played back by the ghost playback system,
+// and get lined up with each other when the race starts and whenever the player starts their timer.
+class CMomRaceSystem : public CAutoGameSystem
+{
+public:
+    CMomRaceSystem(const char *pName);
+
+    // CAutoGameSystem
+    void LevelShutdownPostEntity() OVERRIDE;
+
+    // Queues a replay file (relative to the recordings folder) for the next race
+    void AddReplay(const char *pFileName);
+    // Loads the queued replays and starts racing them, replacing the current race
+    bool StartRace();
+    void StopRace();
+    bool IsRacing() const { return !m_vecRacers.IsEmpty(); }
+
+    // Lines the ghosts up at the start of their timer
+    void OnTimerStarted();
+
+    void PrintStatus();
+
+private:
+    struct Racer_t
+    {
+        CMomArenaReplay *m_pReplay;
+        CHandle<CMomentumReplayGhostEntity> m_hGhost;
+    };
+
+    CUtlVector<CUtlString> m_vecQueuedFiles;
+    CUtlVector<Racer_t> m_vecRacers;
+    CReplayFrameArena m_Arena;
+};
+
+extern CMomRaceSystem *g_pMomRaceSystem;
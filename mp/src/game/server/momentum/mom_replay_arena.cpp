@@ -0,0 +1,358 @@
+#include "cbase.h"
+
+#include "mom_replay_arena.h"
+#include "filesystem.h"
+
+#include "tier0/memdbgon.h"
+
+#define CHUNK_BYTES (REPLAY_ARENA_CHUNK_FRAMES * static_cast<int>(sizeof(CReplayFrame)))
+
+CReplayFrameArena::CReplayFrameArena() : m_iBudgetBytes(32 * 1024 * 1024), m_iPeakBytes(0), m_iPageIns(0), m_iOverBudgetChunks(0)
+{
+}
+
+CReplayFrameArena::~CReplayFrameArena()
+{
+    RemoveAll();
+}
+
+int CReplayFrameArena::AddSource(const char *pHash, const char *pFileName, const char *pPathID, int iFramesOffset,
+                                 int iFrameCount, bool bByteSwapped)
+{
+    FOR_EACH_VEC(m_vecSources, i)
+    {
+        Source_t *pSource = m_vecSources[i];
+        if (pSource && FStrEq(pSource->m_szHash, pHash))
+        {
+            pSource->m_iRefCount++;
+            return i;
+        }
+    }
+
+    Source_t *pSource = new Source_t;
+    Q_strncpy(pSource->m_szHash, pHash, sizeof(pSource->m_szHash));
+    Q_strncpy(pSource->m_szFileName, pFileName, sizeof(pSource->m_szFileName));
+    Q_strncpy(pSource->m_szPathID, pPathID, sizeof(pSource->m_szPathID));
+    pSource->m_iFramesOffset = iFramesOffset;
+    pSource->m_iFrameCount = iFrameCount;
+    pSource->m_bByteSwapped = bByteSwapped;
+    pSource->m_iRefCount = 1;
+    pSource->m_hFile = FILESYSTEM_INVALID_HANDLE;
+
+    const int iChunks = (iFrameCount + REPLAY_ARENA_CHUNK_FRAMES - 1) / REPLAY_ARENA_CHUNK_FRAMES;
+    pSource->m_vecChunks.SetCount(iChunks);
+    FOR_EACH_VEC(pSource->m_vecChunks, i)
+    {
+        pSource->m_vecChunks[i] = -1;
+    }
+
+    // Reuse a released slot so the indices stay small
+    FOR_EACH_VEC(m_vecSources, i)
+    {
+        if (!m_vecSources[i])
+        {
+            m_vecSources[i] = pSource;
+            return i;
+        }
+    }
+
+    return m_vecSources.AddToTail(pSource);
+}
+
+void CReplayFrameArena::ReleaseSource(int iSource)
+{
+    if (!m_vecSources.IsValidIndex(iSource) || !m_vecSources[iSource])
+        return;
+
+    if (--m_vecSources[iSource]->m_iRefCount <= 0)
+        FreeSource(iSource);
+}
+
+void CReplayFrameArena::FreeSource(int iSource)
+{
+    Source_t *pSource = m_vecSources[iSource];
+
+    FOR_EACH_VEC(pSource->m_vecChunks, i)
+    {
+        const int iChunk = pSource->m_vecChunks[i];
+        if (iChunk != -1)
+            m_vecChunks[iChunk].m_iSource = -1;
+    }
+
+    if (pSource->m_hFile != FILESYSTEM_INVALID_HANDLE)
+        g_pFullFileSystem->Close(pSource->m_hFile);
+
+    delete pSource;
+    m_vecSources[iSource] = nullptr;
+}
+
+void CReplayFrameArena::RemoveAll()
+{
+    FOR_EACH_VEC(m_vecSources, i)
+    {
+        if (m_vecSources[i])
+            FreeSource(i);
+    }
+    m_vecSources.Purge();
+
+    FOR_EACH_VEC(m_vecChunks, i)
+    {
+        delete[] m_vecChunks[i].m_pFrames;
+    }
+    m_vecChunks.Purge();
+
+    m_iPeakBytes = 0;
+    m_iPageIns = 0;
+    m_iOverBudgetChunks = 0;
+}
+
+CReplayFrame *CReplayFrameArena::GetFrame(int iSource, int iFrame)
+{
+    if (!m_vecSources.IsValidIndex(iSource) || !m_vecSources[iSource])
+        return nullptr;
+
+    Source_t *pSource = m_vecSources[iSource];
+    if (iFrame < 0 || iFrame >= pSource->m_iFrameCount)
+        return nullptr;
+
+    const int iIndex = iFrame / REPLAY_ARENA_CHUNK_FRAMES;
+    int iChunk = pSource->m_vecChunks[iIndex];
+    if (iChunk == -1)
+    {
+        iChunk = LoadChunk(iSource, iIndex);
+        if (iChunk == -1)
+            return nullptr;
+    }
+
+    Chunk_t &chunk = m_vecChunks[iChunk];
+    chunk.m_iLastUsedTick = gpGlobals->tickcount;
+    return &chunk.m_pFrames[iFrame % REPLAY_ARENA_CHUNK_FRAMES];
+}
+
+int CReplayFrameArena::FindReusableChunk(bool bEvict) const
+{
+    // Free chunks first, then the least recently used one. Chunks used this tick are kept, frames handed out
+    // during the tick have to stay valid.
+    int iBest = -1;
+    FOR_EACH_VEC(m_vecChunks, i)
+    {
+        const Chunk_t &chunk = m_vecChunks[i];
+        if (chunk.m_iSource == -1)
+            return i;
+
+        if (bEvict && chunk.m_iLastUsedTick < gpGlobals->tickcount &&
+            (iBest == -1 || chunk.m_iLastUsedTick < m_vecChunks[iBest].m_iLastUsedTick))
+        {
+            iBest = i;
+        }
+    }
+
+    return iBest;
+}
+
+bool CReplayFrameArena::ReadChunk(Source_t *pSource, int iIndex, CUtlBuffer &reader)
+{
+    if (pSource->m_hFile == FILESYSTEM_INVALID_HANDLE)
+    {
+        pSource->m_hFile = g_pFullFileSystem->Open(pSource->m_szFileName, "rb", pSource->m_szPathID);
+        if (pSource->m_hFile == FILESYSTEM_INVALID_HANDLE)
+        {
+            Warning("Could not open replay %s to stream its frames!\n", pSource->m_szFileName);
+            return false;
+        }
+    }
+
+    const int iFirstFrame = iIndex * REPLAY_ARENA_CHUNK_FRAMES;
+    const int iFrames = min(pSource->m_iFrameCount - iFirstFrame, REPLAY_ARENA_CHUNK_FRAMES);
+
+    reader.Clear();
+    reader.EnsureCapacity(iFrames * REPLAY_FRAME_FILE_SIZE);
+    g_pFullFileSystem->Seek(pSource->m_hFile, pSource->m_iFramesOffset + iFirstFrame * REPLAY_FRAME_FILE_SIZE, FILESYSTEM_SEEK_HEAD);
+    const int iRead = g_pFullFileSystem->Read(reader.Base(), iFrames * REPLAY_FRAME_FILE_SIZE, pSource->m_hFile);
+    if (iRead != iFrames * REPLAY_FRAME_FILE_SIZE)
+    {
+        Warning("Could not read the frames %i-%i of replay %s!\n", iFirstFrame, iFirstFrame + iFrames - 1, pSource->m_szFileName);
+        return false;
+    }
+    reader.SeekPut(CUtlBuffer::SEEK_HEAD, iRead);
+    reader.ActivateByteSwapping(pSource->m_bByteSwapped);
+    return true;
+}
+
+int CReplayFrameArena::LoadChunk(int iSource, int iIndex)
+{
+    Source_t *pSource = m_vecSources[iSource];
+
+    CUtlBuffer reader;
+    if (!ReadChunk(pSource, iIndex, reader))
+        return -1;
+
+    const int iFrames = min(pSource->m_iFrameCount - iIndex * REPLAY_ARENA_CHUNK_FRAMES, REPLAY_ARENA_CHUNK_FRAMES);
+
+    const bool bOverBudget = (m_vecChunks.Count() + 1) * CHUNK_BYTES > m_iBudgetBytes;
+    int iChunk = FindReusableChunk(bOverBudget);
+    if (iChunk == -1)
+    {
+        if (bOverBudget)
+            m_iOverBudgetChunks++;
+
+        iChunk = m_vecChunks.AddToTail();
+        m_vecChunks[iChunk].m_pFrames = new CReplayFrame[REPLAY_ARENA_CHUNK_FRAMES];
+        m_iPeakBytes = max(m_iPeakBytes, GetResidentBytes());
+    }
+    else if (m_vecChunks[iChunk].m_iSource != -1)
+    {
+        // Evict what was there
+        const Chunk_t &old = m_vecChunks[iChunk];
+        if (m_vecSources[old.m_iSource])
+            m_vecSources[old.m_iSource]->m_vecChunks[old.m_iIndex] = -1;
+    }
+
+    Chunk_t &chunk = m_vecChunks[iChunk];
+    chunk.m_iSource = iSource;
+    chunk.m_iIndex = iIndex;
+    chunk.m_iLastUsedTick = gpGlobals->tickcount;
+
+    for (int i = 0; i < iFrames; i++)
+    {
+        chunk.m_pFrames[i] = CReplayFrame(reader);
+    }
+
+    pSource->m_vecChunks[iIndex] = iChunk;
+    m_iPageIns++;
+
+    return iChunk;
+}
+
+int CReplayFrameArena::SerializeFrames(int iSource, CUtlBuffer &writer)
+{
+    if (!m_vecSources.IsValidIndex(iSource) || !m_vecSources[iSource])
+        return 0;
+
+    // Paging every chunk in would keep them all for the tick (they were all used in it) and grow the arena to the
+    // whole replay, so the chunks that are not resident go through one scratch buffer and stay out of the arena
+    Source_t *pSource = m_vecSources[iSource];
+    CUtlBuffer reader;
+    int iWritten = 0;
+    FOR_EACH_VEC(pSource->m_vecChunks, iIndex)
+    {
+        const int iFrames = min(pSource->m_iFrameCount - iIndex * REPLAY_ARENA_CHUNK_FRAMES, REPLAY_ARENA_CHUNK_FRAMES);
+        const int iChunk = pSource->m_vecChunks[iIndex];
+        if (iChunk != -1)
+        {
+            CReplayFrame *pFrames = m_vecChunks[iChunk].m_pFrames;
+            for (int i = 0; i < iFrames; i++)
+                pFrames[i].Serialize(writer);
+        }
+        else
+        {
+            if (!ReadChunk(pSource, iIndex, reader))
+                break;
+
+            for (int i = 0; i < iFrames; i++)
+                CReplayFrame(reader).Serialize(writer);
+        }
+
+        iWritten += iFrames;
+    }
+
+    return iWritten;
+}
+
+int CReplayFrameArena::GetResidentBytes() const
+{
+    return m_vecChunks.Count() * CHUNK_BYTES;
+}
+
+int CReplayFrameArena::GetSourceCount() const
+{
+    int iCount = 0;
+    FOR_EACH_VEC(m_vecSources, i)
+    {
+        if (m_vecSources[i])
+            iCount++;
+    }
+
+    return iCount;
+}
+
+void CReplayFrameArena::PrintStatus() const
+{
+    int iFrames = 0, iResidentChunks = 0;
+    FOR_EACH_VEC(m_vecSources, i)
+    {
+        if (m_vecSources[i])
+            iFrames += m_vecSources[i]->m_iFrameCount;
+    }
+    FOR_EACH_VEC(m_vecChunks, i)
+    {
+        if (m_vecChunks[i].m_iSource != -1)
+            iResidentChunks++;
+    }
+
+    Msg("Replay frame arena: %i sources, %i frames (%.1f MB if fully loaded)\n", GetSourceCount(), iFrames,
+        iFrames * static_cast<float>(sizeof(CReplayFrame)) / (1024.0f * 1024.0f));
+    Msg("  %i/%i chunks in use, %.1f MB resident (peak %.1f MB, budget %.1f MB)\n", iResidentChunks,
+        m_vecChunks.Count(), GetResidentBytes() / (1024.0f * 1024.0f), m_iPeakBytes / (1024.0f * 1024.0f),
+        m_iBudgetBytes / (1024.0f * 1024.0f));
+    Msg("  %i chunks paged in, %i allocated over the budget\n", m_iPageIns, m_iOverBudgetChunks);
+}
+
+CMomArenaReplay::CMomArenaReplay(CUtlBuffer &reader, int iFileSize)
+    : CMomReplayBase(CReplayHeader(reader), false), m_pRunStats(nullptr), m_pArena(nullptr), m_iSource(-1)
+{
+    if (reader.GetUnsignedChar())
+        m_pRunStats = new CMomRunStats(reader);
+
+    m_iFrameCount = max(reader.GetInt(), 0);
+    m_iFramesOffset = reader.TellGet();
+
+    // Truncated files only play what they have
+    m_iFrameCount = min(m_iFrameCount, max(iFileSize - m_iFramesOffset, 0) / REPLAY_FRAME_FILE_SIZE);
+}
+
+CMomArenaReplay::~CMomArenaReplay()
+{
+    if (m_pArena)
+        m_pArena->ReleaseSource(m_iSource);
+
+    delete m_pRunStats;
+}
+
+void CMomArenaReplay::SetArenaSource(CReplayFrameArena *pArena, int iSource)
+{
+    m_pArena = pArena;
+    m_iSource = iSource;
+}
+
+CReplayFrame *CMomArenaReplay::GetFrame(int32 index)
+{
+    if (!m_pArena || index < 0 || index >= m_iFrameCount)
+        return nullptr;
+
+    return m_pArena->GetFrame(m_iSource, index);
+}
+
+CMomRunStats *CMomArenaReplay::CreateRunStats(uint8 zones)
+{
+    delete m_pRunStats;
+    m_pRunStats = new CMomRunStats(zones);
+    return m_pRunStats;
+}
+
+void CMomArenaReplay::Serialize(CUtlBuffer &writer)
+{
+    // Same layout as CMomReplayV1
+    m_rhHeader.Serialize(writer);
+
+    writer.PutUnsignedChar(m_pRunStats != nullptr);
+    if (m_pRunStats)
+        m_pRunStats->Serialize(writer);
+
+    writer.PutInt(m_iFrameCount);
+    const int iWritten = m_pArena ? m_pArena->SerializeFrames(m_iSource, writer) : 0;
+    for (int32 i = iWritten; i < m_iFrameCount; ++i)
+    {
+        CReplayFrame().Serialize(writer);
+    }
+}
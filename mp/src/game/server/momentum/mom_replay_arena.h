@@ -0,0 +1,100 @@
+#pragma once
+
+#include "run/mom_replay_base.h"
+
+#define REPLAY_ARENA_CHUNK_FRAMES 1024
+#define REPLAY_FRAME_FILE_SIZE 32 // Size of a serialized CReplayFrame
+
+// Shared pool for the frames of replays that are not kept fully in memory (race ghosts).
+// Every replay file is a source, files with the same hash are only added once and share their frames.
+// Frames are paged in from the file by chunks of REPLAY_ARENA_CHUNK_FRAMES, and the least recently used chunks are
+// reused once the resident frames go over the budget.
+class CReplayFrameArena
+{
+public:
+    CReplayFrameArena();
+    ~CReplayFrameArena();
+
+    // Returns the index of the source, or of the one already added with the same hash
+    int AddSource(const char *pHash, const char *pFileName, const char *pPathID, int iFramesOffset, int iFrameCount,
+                  bool bByteSwapped);
+    void ReleaseSource(int iSource);
+    void RemoveAll();
+
+    // Pages the chunk of the frame in if needed. The frame stays valid until the next tick.
+    CReplayFrame *GetFrame(int iSource, int iFrame);
+    // Writes all the frames of the source without paging anything in, chunks that are not resident are read into a
+    // scratch buffer instead. Returns how many frames were written.
+    int SerializeFrames(int iSource, CUtlBuffer &writer);
+
+    void SetBudget(int iBytes) { m_iBudgetBytes = iBytes; }
+    int GetResidentBytes() const;
+    int GetSourceCount() const;
+    void PrintStatus() const;
+
+private:
+    struct Source_t
+    {
+        char m_szHash[41];
+        char m_szFileName[MAX_PATH];
+        char m_szPathID[16];
+        int m_iFramesOffset;
+        int m_iFrameCount;
+        bool m_bByteSwapped;
+        int m_iRefCount;
+        FileHandle_t m_hFile;
+        CUtlVector<int> m_vecChunks; // Arena chunk of every chunk of the source, -1 if not resident
+    };
+
+    struct Chunk_t
+    {
+        int m_iSource; // -1 if free
+        int m_iIndex;
+        int m_iLastUsedTick;
+        CReplayFrame *m_pFrames;
+    };
+
+    bool ReadChunk(Source_t *pSource, int iIndex, CUtlBuffer &reader);
+    int LoadChunk(int iSource, int iIndex);
+    int FindReusableChunk(bool bEvict) const;
+    void FreeSource(int iSource);
+
+    CUtlVector<Source_t *> m_vecSources; // Released sources are null
+    CUtlVector<Chunk_t> m_vecChunks;
+
+    int m_iBudgetBytes;
+    int m_iPeakBytes;
+    int m_iPageIns;
+    int m_iOverBudgetChunks;
+};
+
+// A replay whose frames are left in its file and read through a frame arena. It can only be played back.
+class CMomArenaReplay : public CMomReplayBase
+{
+public:
+    // Reads the header and the run stats, and where the frames are in the file
+    CMomArenaReplay(CUtlBuffer &reader, int iFileSize);
+    ~CMomArenaReplay() OVERRIDE;
+
+    void SetArenaSource(CReplayFrameArena *pArena, int iSource);
+    int GetArenaSource() const { return m_iSource; }
+    int GetFramesOffset() const { return m_iFramesOffset; }
+
+    uint8 GetVersion() OVERRIDE { return 1; }
+    CMomRunStats *GetRunStats() OVERRIDE { return m_pRunStats; }
+    int32 GetFrameCount() OVERRIDE { return m_iFrameCount; }
+    CReplayFrame *GetFrame(int32 index) OVERRIDE;
+    void AddFrame(const CReplayFrame &frame) OVERRIDE { Assert(false); }
+    bool SetFrame(int32 index, const CReplayFrame &frame) OVERRIDE { return false; }
+    CMomRunStats *CreateRunStats(uint8 zones) OVERRIDE;
+    void RemoveFrames(int num) OVERRIDE { Assert(false); }
+
+    void Serialize(CUtlBuffer &writer) OVERRIDE;
+
+private:
+    CMomRunStats *m_pRunStats;
+    CReplayFrameArena *m_pArena;
+    int m_iSource;
+    int m_iFramesOffset;
+    int m_iFrameCount;
+};
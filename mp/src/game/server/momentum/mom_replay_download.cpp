@@ -0,0 +1,214 @@
+#include "cbase.h"
+
+#include "mom_replay_download.h"
+#include "mom_modulecomms.h"
+#include "mom_replay_arena.h"
+#include "mom_replay_entity.h"
+#include "mom_replay_system.h"
+#include "run/mom_replay_factory.h"
+
+#include "tier0/memdbgon.h"
+
+static MAKE_CONVAR(mom_replay_download_preroll, "2", FCVAR_ARCHIVE,
+                   "Seconds of a downloading replay that have to be there before its playback starts.\n", 0.0f, 30.0f);
+
+CMomReplayDownloadSystem::CMomReplayDownloadSystem(const char *pName) : CAutoGameSystem(pName),
+    m_pReplay(nullptr), m_bByteSwapped(false), m_iNextFrameOffset(0), m_iFrameCount(0), m_bStarted(false)
+{
+    m_szHash[0] = '\0';
+}
+
+void CMomReplayDownloadSystem::PostInit()
+{
+    g_pModuleComms->ListenForEvent("replay_download_start", UtlMakeDelegate(this, &CMomReplayDownloadSystem::OnDownloadStart));
+    g_pModuleComms->ListenForEvent("replay_download_size", UtlMakeDelegate(this, &CMomReplayDownloadSystem::OnDownloadSize));
+    g_pModuleComms->ListenForEvent("replay_download_data", UtlMakeDelegate(this, &CMomReplayDownloadSystem::OnDownloadData));
+    g_pModuleComms->ListenForEvent("replay_download_end", UtlMakeDelegate(this, &CMomReplayDownloadSystem::OnDownloadEnd));
+}
+
+void CMomReplayDownloadSystem::LevelShutdownPreEntity()
+{
+    // The replay system unloads the playback with the level, the rest of the download is ignored
+    Reset();
+}
+
+void CMomReplayDownloadSystem::Reset()
+{
+    if (m_pReplay && !m_bStarted)
+        delete m_pReplay;
+
+    m_pReplay = nullptr;
+    m_szHash[0] = '\0';
+    m_Buffer.Purge();
+    m_bByteSwapped = false;
+    m_iNextFrameOffset = 0;
+    m_iFrameCount = 0;
+    m_bStarted = false;
+}
+
+bool CMomReplayDownloadSystem::IsOurPlayback()
+{
+    return m_pReplay && g_ReplaySystem.GetPlaybackReplay() == m_pReplay;
+}
+
+void CMomReplayDownloadSystem::OnDownloadStart(KeyValues *pKv)
+{
+    Reset();
+    Q_strncpy(m_szHash, pKv->GetString("hash"), sizeof(m_szHash));
+}
+
+void CMomReplayDownloadSystem::OnDownloadSize(KeyValues *pKv)
+{
+    if (!m_szHash[0] || !FStrEq(m_szHash, pKv->GetString("hash")))
+        return;
+
+    const uint64 uSize = pKv->GetUint64("size");
+    if (uSize > static_cast<uint64>(m_Buffer.TellPut()) && uSize < INT_MAX)
+        m_Buffer.EnsureCapacity(static_cast<int>(uSize));
+}
+
+void CMomReplayDownloadSystem::OnDownloadData(KeyValues *pKv)
+{
+    if (!m_szHash[0] || !FStrEq(m_szHash, pKv->GetString("hash")))
+        return;
+
+    const void *pData = pKv->GetPtr("data");
+    const int iSize = pKv->GetInt("size");
+    if (!pData || pKv->GetInt("offset") != m_Buffer.TellPut())
+    {
+        Warning("Lost track of the replay download %s, play it again once it finished downloading.\n", m_szHash);
+        if (m_bStarted && IsOurPlayback())
+            g_ReplaySystem.StopPlayback();
+        Reset();
+        return;
+    }
+
+    m_Buffer.Put(pData, iSize);
+
+    if (!m_pReplay && !ParseHeader())
+    {
+        Reset();
+        return;
+    }
+
+    if (!m_pReplay)
+        return;
+
+    ParseFrames();
+
+    if (m_bStarted)
+    {
+        // Somebody started another replay in the meantime
+        if (!IsOurPlayback())
+        {
+            m_pReplay = nullptr;
+            Reset();
+            return;
+        }
+
+        if (m_pReplay->GetRunEntity())
+            m_pReplay->GetRunEntity()->OnStreamFramesAdded();
+    }
+    else if (m_pReplay->GetFrameCount() >= TIME_TO_TICKS(mom_replay_download_preroll.GetFloat()))
+    {
+        StartPlayback();
+    }
+}
+
+void CMomReplayDownloadSystem::OnDownloadEnd(KeyValues *pKv)
+{
+    if (!m_szHash[0] || !FStrEq(m_szHash, pKv->GetString("hash")))
+        return;
+
+    if (pKv->GetBool("error"))
+    {
+        // Never play back a replay that did not check out
+        if (m_bStarted && IsOurPlayback())
+            g_ReplaySystem.StopPlayback();
+    }
+    else if (m_pReplay && !m_bStarted && m_pReplay->GetFrameCount() > 0)
+    {
+        StartPlayback();
+    }
+
+    if (m_bStarted)
+        m_pReplay = nullptr;
+
+    Reset();
+}
+
+bool CMomReplayDownloadSystem::ParseHeader()
+{
+    // Wait for the whole header, it is parsed from the start every time until then
+    CUtlBuffer reader(m_Buffer.Base(), m_Buffer.TellPut(), CUtlBuffer::READ_ONLY);
+    if (reader.TellPut() < sizeof(uint32) + sizeof(uint8))
+        return true;
+
+    const uint32 magic = reader.GetUnsignedInt();
+    if (magic != REPLAY_MAGIC_LE && magic != REPLAY_MAGIC_BE)
+    {
+        Warning("The replay download %s is not a replay file!\n", m_szHash);
+        return false;
+    }
+
+    m_bByteSwapped = magic == REPLAY_MAGIC_BE;
+    reader.ActivateByteSwapping(m_bByteSwapped);
+
+    CMomReplayBase *pReplay = g_ReplayFactory.CreateReplay(reader.GetUnsignedChar(), reader, false);
+    if (!pReplay)
+        return false;
+
+    const int iFrameCount = reader.GetInt();
+    if (!reader.IsValid())
+    {
+        delete pReplay;
+        return true;
+    }
+
+    const char *pError = nullptr;
+    if (!FStrEq(pReplay->GetMapName(), gpGlobals->mapname.ToCStr()))
+        pError = "it was done on another map";
+    else if (!CloseEnough(pReplay->GetTickInterval(), gpGlobals->interval_per_tick, FLT_EPSILON))
+        pError = "its tickrate is not the current one";
+    else if (!pReplay->GetRunStats() || iFrameCount <= 0)
+        pError = "it is empty";
+
+    if (pError)
+    {
+        Warning("Cannot play the replay %s, %s!\n", m_szHash, pError);
+        delete pReplay;
+        return false;
+    }
+
+    pReplay->SetRunHash(m_szHash);
+    m_pReplay = pReplay;
+    m_iFrameCount = iFrameCount;
+    m_iNextFrameOffset = reader.TellGet();
+    return true;
+}
+
+void CMomReplayDownloadSystem::ParseFrames()
+{
+    const int iAvailable = m_Buffer.TellPut() - m_iNextFrameOffset;
+    const int iFrames = min(iAvailable / REPLAY_FRAME_FILE_SIZE, m_iFrameCount - m_pReplay->GetFrameCount());
+    if (iFrames <= 0)
+        return;
+
+    CUtlBuffer reader(static_cast<const char *>(m_Buffer.Base()) + m_iNextFrameOffset, iFrames * REPLAY_FRAME_FILE_SIZE,
+                      CUtlBuffer::READ_ONLY);
+    reader.ActivateByteSwapping(m_bByteSwapped);
+
+    for (int i = 0; i < iFrames; i++)
+        m_pReplay->AddFrame(CReplayFrame(reader));
+
+    m_iNextFrameOffset += iFrames * REPLAY_FRAME_FILE_SIZE;
+}
+
+void CMomReplayDownloadSystem::StartPlayback()
+{
+    g_ReplaySystem.StartStreamedPlayback(m_pReplay);
+    m_bStarted = true;
+}
+
+static CMomReplayDownloadSystem s_MomReplayDownload("CMomReplayDownloadSystem");
+CMomReplayDownloadSystem *g_pMomReplayDownload = &s_MomReplayDownload;
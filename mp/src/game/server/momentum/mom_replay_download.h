@@ -0,0 +1,38 @@
+#pragma once
+
+class CMomReplayBase;
+
+// Plays back a replay while the client is still downloading it (see CMomReplayCache).
+// The client hands every downloaded chunk over through module comms, the replay is parsed as the chunks come in and
+// the playback starts as soon as the header and mom_replay_download_preroll seconds of frames are there.
+class CMomReplayDownloadSystem : public CAutoGameSystem
+{
+public:
+    CMomReplayDownloadSystem(const char *pName);
+
+    // CAutoGameSystem
+    void PostInit() OVERRIDE;
+    void LevelShutdownPreEntity() OVERRIDE;
+
+private:
+    void OnDownloadStart(KeyValues *pKv);
+    void OnDownloadSize(KeyValues *pKv);
+    void OnDownloadData(KeyValues *pKv);
+    void OnDownloadEnd(KeyValues *pKv);
+
+    bool ParseHeader();
+    void ParseFrames();
+    void StartPlayback();
+    bool IsOurPlayback();
+    void Reset();
+
+    char m_szHash[41];
+    CUtlBuffer m_Buffer; // Everything downloaded so far
+    CMomReplayBase *m_pReplay; // Owned by the replay system once the playback started
+    bool m_bByteSwapped;
+    int m_iNextFrameOffset; // Where the first frame that was not parsed yet starts
+    int m_iFrameCount; // Frames the header says there are
+    bool m_bStarted;
+};
+
+extern CMomReplayDownloadSystem *g_pMomReplayDownload;
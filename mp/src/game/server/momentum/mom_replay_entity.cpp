@@ -9,6 +9,7 @@
 #include "run/mom_replay_base.h"
 #include "in_buttons.h"
 #include "mom_replay_system.h"
+#include "mom_ghost_playback.h"
 
 #include "tier0/memdbgon.h"
 
@@ -31,7 +32,7 @@ END_DATADESC();
 CMomentumReplayGhostEntity::CMomentumReplayGhostEntity()
     : m_bIsActive(false), m_bReplayFirstPerson(false), m_pPlaybackReplay(nullptr), m_bHasJumped(false),
       m_flLastSyncVelocity(0), m_nStrafeTicks(0), m_nPerfectSyncTicks(0), m_nAccelTicks(0), m_nOldReplayButtons(0),
-      m_vecLastVel(vec3_origin), m_cvarMapFinMoveEnable("mom_mapfinished_movement_enable")
+      m_vecLastVel(vec3_origin), m_cvarMapFinMoveEnable("mom_mapfinished_movement_enable"), m_sStreamSource(k_steamIDNil)
 {
     m_RunStats.Init();
     m_bIsPaused = false;
@@ -41,7 +42,7 @@ CMomentumReplayGhostEntity::CMomentumReplayGhostEntity()
     ListenForGameEvent("mapfinished_panel_closed");
 }
 
-CMomentumReplayGhostEntity::~CMomentumReplayGhostEntity() {}
+CMomentumReplayGhostEntity::~CMomentumReplayGhostEntity() { g_pMomGhostPlayback->RemoveGhost(this); }
 
 void CMomentumReplayGhostEntity::Precache(void) { BaseClass::Precache(); }
 
@@ -125,7 +126,7 @@ void CMomentumReplayGhostEntity::StartRun(bool firstPerson)
 
         m_Data.m_iCurrentTrack = m_pPlaybackReplay->GetTrackNumber();
 
-        SetNextThink(gpGlobals->curtime + gpGlobals->interval_per_tick);
+        g_pMomGhostPlayback->AddGhost(this);
     }
     else
     {
@@ -165,19 +166,34 @@ void CMomentumReplayGhostEntity::LoadFromReplayBase(CMomReplayBase *pReplay)
     m_Data.m_flTickRate = m_pPlaybackReplay->GetTickInterval();
     m_Data.m_iStartTick = m_pPlaybackReplay->GetStartTick();
 
+    // A streamed run only knows where its timer started once it is finished
+    if (IsStreamGhost())
+        m_Data.m_iStartTick = -1;
+
     m_pPlaybackReplay->SetRunEntity(this);
 }
 
-void CMomentumReplayGhostEntity::Think()
+void CMomentumReplayGhostEntity::OnStreamFramesAdded()
 {
-    BaseClass::Think();
+    if (m_bIsActive && m_pPlaybackReplay)
+        m_iTotalTicks = m_pPlaybackReplay->GetFrameCount() - 1;
+}
+
+void CMomentumReplayGhostEntity::PauseStreamPlayback()
+{
+    // Unlike EndRun this keeps the entity around, so whoever spectates it stays on it
+    m_bIsActive = false;
+    g_pMomGhostPlayback->RemoveGhost(this);
+}
 
+bool CMomentumReplayGhostEntity::StepPlayback()
+{
     if (!m_bIsActive)
-        return;
+        return false;
 
     if (!m_pPlaybackReplay)
     {
-        return;
+        return false;
     }
 
     if (m_iCurrentTick == m_Data.m_iStartTick)
@@ -309,24 +325,23 @@ void CMomentumReplayGhostEntity::Think()
             }
         }
 
-        if (m_pCurrentSpecPlayer)
-            HandleGhostFirstPerson();
-        else
-            HandleGhost();
+        return true;
     }
 
+    return false;
+}
+
+int CMomentumReplayGhostEntity::GetPlaybackStepTicks() const
+{
+    const float fTimeScale = mom_replay_timescale.GetFloat();
     if (fTimeScale < 1.0f)
-    {
-        SetNextThink(gpGlobals->curtime + gpGlobals->interval_per_tick * (1.0f / fTimeScale));
-    }
-    else
-    {
-        SetNextThink(gpGlobals->curtime + gpGlobals->interval_per_tick);
-    }
+        return max(TIME_TO_TICKS(gpGlobals->interval_per_tick * (1.0f / fTimeScale)), 1);
+
+    return 1;
 }
 
 //-----------------------------------------------------------------------------
-// Purpose: called by the think function, moves and handles the ghost if we're spectating it
+// Purpose: called by the ghost playback system, moves and handles the ghost if we're spectating it
 //-----------------------------------------------------------------------------
 void CMomentumReplayGhostEntity::HandleGhostFirstPerson()
 {
@@ -462,10 +477,17 @@ void CMomentumReplayGhostEntity::HandleGhost()
 
     }
 
-    SetAbsOrigin(currentStep->PlayerOrigin());
-    SetAbsAngles(QAngle(currentStep->EyeAngles().x /
-                        GHOST_PITCH_REDUCTION_VALUE, // we divide x angle (pitch) by 10 so the ghost doesn't look really stupid
-                        currentStep->EyeAngles().y, currentStep->EyeAngles().z));
+    if (!currentStep)
+        return;
+
+    ApplyPose(currentStep->PlayerOrigin(), currentStep->EyeAngles());
+}
+
+void CMomentumReplayGhostEntity::ApplyPose(const Vector &origin, const QAngle &eyeAngles)
+{
+    SetAbsOrigin(origin);
+    SetAbsAngles(QAngle(eyeAngles.x / GHOST_PITCH_REDUCTION_VALUE, // we divide x angle (pitch) by 10 so the ghost doesn't look really stupid
+                        eyeAngles.y, eyeAngles.z));
 
     // remove the nodraw effects
     UnHideGhost();
@@ -545,7 +567,7 @@ void CMomentumReplayGhostEntity::GoToTick(int tick)
                 eyes.x /= GHOST_PITCH_REDUCTION_VALUE;
             Teleport(&origin, &eyes, nullptr);
             PhysicsCheckForEntityUntouch();
-            // Entity will get full update next Think
+            // Entity will get full update next playback step
         }
     }
 }
@@ -553,6 +575,7 @@ void CMomentumReplayGhostEntity::GoToTick(int tick)
 void CMomentumReplayGhostEntity::EndRun()
 {
     m_bIsActive = false;
+    g_pMomGhostPlayback->RemoveGhost(this);
 
     // Make everybody stop spectating me. Goes backwards since players remove themselves.
     if (m_pCurrentSpecPlayer && m_pCurrentSpecPlayer->GetGhostEnt() == this)
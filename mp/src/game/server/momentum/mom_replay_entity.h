@@ -25,6 +25,14 @@ class CMomentumReplayGhostEntity : public CMomentumGhostBaseEntity, public CGame
     void StartRun(bool firstPerson = false);
     void EndRun();
 
+    // Called by the ghost playback system (CMomGhostPlaybackSystem). Advances the replay, returns true if the ghost
+    // has to be moved to its new tick.
+    bool StepPlayback();
+    // Ticks until the next step, more than one when the replay is slowed down
+    int GetPlaybackStepTicks() const;
+    // Moves the ghost to a frame when nobody spectates it, the pitch gets reduced
+    void ApplyPose(const Vector &origin, const QAngle &eyeAngles);
+
     void SetGhostAngles(QAngle angles);
     void DetermineGhostVisibility();
 
@@ -35,12 +43,23 @@ class CMomentumReplayGhostEntity : public CMomentumGhostBaseEntity, public CGame
 
     void GoToTick(int tick);
 
+    CMomReplayBase *GetPlaybackReplay() const { return m_pPlaybackReplay; }
+
     CReplayFrame* GetCurrentStep();
     CReplayFrame *GetNextStep();
     CReplayFrame *GetPreviousStep();
 
     bool IsReplayEnt() { return true; }
 
+    // Set when this ghost plays a replay being streamed from a lobby member (see CMomReplayStreamSystem)
+    void SetStreamSource(const CSteamID &source) { m_sStreamSource = source; }
+    const CSteamID &GetStreamSource() const { return m_sStreamSource; }
+    bool IsStreamGhost() const { return m_sStreamSource.IsValid(); }
+    // The streamed replay grew, lets playback continue into the new frames
+    void OnStreamFramesAdded();
+    // The stream source restarted, holds the ghost where it is until StartRun picks up the new recording
+    void PauseStreamPlayback();
+
 
     RUN_ENT_TYPE GetEntType() OVERRIDE { return RUN_ENT_REPLAY; }
     virtual void OnZoneEnter(CTriggerZone *pTrigger) OVERRIDE;
@@ -54,7 +73,6 @@ class CMomentumReplayGhostEntity : public CMomentumGhostBaseEntity, public CGame
     void AppearanceModelColorChanged(const AppearanceData_t &newApp) override;
 
   protected:
-    void Think() OVERRIDE;
     void Spawn() OVERRIDE;
     void Precache() OVERRIDE;
     void FireGameEvent(IGameEvent *pEvent) OVERRIDE;
@@ -76,4 +94,6 @@ class CMomentumReplayGhostEntity : public CMomentumGhostBaseEntity, public CGame
     Vector m_vecLastVel;
 
     ConVarRef m_cvarMapFinMoveEnable;
+
+    CSteamID m_sStreamSource;
 };
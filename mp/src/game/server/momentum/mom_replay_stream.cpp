@@ -0,0 +1,621 @@
+#include "cbase.h"
+
+#include "mom_replay_stream.h"
+
+#include "filesystem.h"
+#include "fmtstr.h"
+#include "ghost_client.h"
+#include "mom_bulk_transfer.h"
+#include "mom_player_shared.h"
+#include "mom_replay_entity.h"
+#include "mom_replay_system.h"
+#include "mom_timer.h"
+#include "run/mom_replay_base.h"
+#include "run/mom_replay_factory.h"
+#include "util/mom_util.h"
+#include "steam/steam_api.h"
+#include "tier1/snappy.h"
+#include "mom_profiler.h"
+
+#include "tier0/memdbgon.h"
+
+// Frames per live block, about a quarter of a second at 66 tick
+#define REPLAY_STREAM_BLOCK_FRAMES 16
+// Most frames one live block carries. A spectator that is further behind (the backlog transfer could not be
+// started) catches up one such block per frame instead of getting everything in a single reliable packet.
+#define REPLAY_STREAM_MAX_BLOCK_FRAMES 128
+
+static MAKE_TOGGLE_CONVAR(mom_replay_stream_spectate, "0", FCVAR_ARCHIVE,
+                          "If 1, spectating a lobby member plays back their replay recording as it is streamed to you, "
+                          "instead of their position updates.\n");
+static MAKE_CONVAR(mom_replay_stream_delay, "0.5", FCVAR_ARCHIVE,
+                   "Seconds the streamed replay playback stays behind the runner.\n", 0.1f, 5.0f);
+
+CMomReplayStreamSystem::CMomReplayStreamSystem(const char *pName) : CAutoGameSystemPerFrame(pName),
+    m_iRecordingGeneration(0), m_StreamSource(k_steamIDNil), m_iStreamGeneration(0), m_pStreamReplay(nullptr),
+    m_pCompleteReplay(nullptr), m_bStreamComplete(false), m_bGhostStarted(false)
+{
+    SetDefLessFunc(m_mapPendingBlocks);
+}
+
+CMomReplayStreamSystem::~CMomReplayStreamSystem()
+{
+    m_mapPendingBlocks.PurgeAndDeleteElements();
+
+    if (m_pStreamReplay)
+        delete m_pStreamReplay;
+
+    if (m_pCompleteReplay)
+        delete m_pCompleteReplay;
+}
+
+void CMomReplayStreamSystem::PostInit()
+{
+    g_pMomBulkTransfer->SetHandler(BULK_TRANSFER_REPLAY, UtlMakeDelegate(this, &CMomReplayStreamSystem::OnBacklogTransfer));
+}
+
+void CMomReplayStreamSystem::LevelShutdownPreEntity()
+{
+    // Spectators re-request the stream once they see us on the new map
+    Reset();
+}
+
+void CMomReplayStreamSystem::Reset()
+{
+    m_vecSubscribers.RemoveAll();
+
+    StopStream(true);
+}
+
+void CMomReplayStreamSystem::FrameUpdatePostEntityThink()
+{
+    MOM_PROF_SCOPE("CMomReplayStreamSystem::FrameUpdatePostEntityThink");
+
+    if (m_vecSubscribers.IsEmpty() || !g_ReplaySystem.IsRecording())
+        return;
+
+    CMomReplayBase *pRecording = g_ReplaySystem.GetRecordingReplay();
+    if (!pRecording)
+        return;
+
+    const uint32 frameCount = pRecording->GetFrameCount();
+    FOR_EACH_VEC(m_vecSubscribers, i)
+    {
+        if (frameCount - m_vecSubscribers[i].m_iFramesSent >= REPLAY_STREAM_BLOCK_FRAMES)
+            SendFrames(m_vecSubscribers[i], pRecording, 1);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Runner side
+
+int CMomReplayStreamSystem::FindSubscriber(const CSteamID &id)
+{
+    FOR_EACH_VEC(m_vecSubscribers, i)
+    {
+        if (m_vecSubscribers[i].m_ID == id)
+            return i;
+    }
+
+    return m_vecSubscribers.InvalidIndex();
+}
+
+void CMomReplayStreamSystem::AddSubscriber(const CSteamID &id)
+{
+    int index = FindSubscriber(id);
+    if (index == m_vecSubscribers.InvalidIndex())
+    {
+        index = m_vecSubscribers.AddToTail();
+        m_vecSubscribers[index].m_ID = id;
+    }
+
+    m_vecSubscribers[index].m_iFramesSent = 0;
+
+    DevLog("%s subscribed to our replay stream\n", SteamFriends() ? SteamFriends()->GetFriendPersonaName(id) : "Somebody");
+
+    // Nothing to send until we start recording, OnRecordingStarted takes care of the header then
+    if (g_ReplaySystem.IsRecording())
+    {
+        SendHeader(id);
+        SendBacklog(m_vecSubscribers[index]);
+    }
+}
+
+void CMomReplayStreamSystem::OnRecordingStarted()
+{
+    m_iRecordingGeneration++;
+
+    FOR_EACH_VEC(m_vecSubscribers, i)
+    {
+        m_vecSubscribers[i].m_iFramesSent = 0;
+        SendHeader(m_vecSubscribers[i].m_ID);
+    }
+}
+
+void CMomReplayStreamSystem::SendHeader(const CSteamID &target)
+{
+    const auto pPlayer = CMomentumPlayer::GetLocalPlayer();
+    if (!pPlayer)
+        return;
+
+    CReplayHeader header;
+    Q_strncpy(header.m_szMapName, gpGlobals->mapname.ToCStr(), sizeof(header.m_szMapName));
+    Q_strncpy(header.m_szMapHash, g_ReplaySystem.GetMapHash(), sizeof(header.m_szMapHash));
+    Q_strncpy(header.m_szPlayerName, pPlayer->GetPlayerName(), sizeof(header.m_szPlayerName));
+    header.m_ulSteamID = SteamUser() ? SteamUser()->GetSteamID().ConvertToUint64() : 0;
+    header.m_fTickInterval = gpGlobals->interval_per_tick;
+    header.m_iRunFlags = pPlayer->m_Data.m_iRunFlags;
+    header.m_iRunDate = 0;
+    header.m_iStartTick = 0;
+    header.m_iStopTick = 0;
+    header.m_iTrackNumber = g_pMomentumTimer->GetTrackNumber();
+    header.m_iZoneNumber = 0;
+
+    ReplayStreamPacket packet;
+    packet.stream_type = REPLAY_STREAM_HEADER;
+    packet.generation = m_iRecordingGeneration;
+    header.Serialize(packet.dataBuf);
+    packet.dataBuf.PutUnsignedChar(pPlayer->m_RunStats.GetTotalZones());
+
+    SendStreamPacket(target, packet);
+}
+
+void CMomReplayStreamSystem::SendBacklog(Subscriber_t &subscriber)
+{
+    CMomReplayBase *pRecording = g_ReplaySystem.GetRecordingReplay();
+    if (!pRecording || pRecording->GetFrameCount() == 0)
+        return;
+
+    // Everything recorded so far goes as one bulk transfer, the live blocks follow it
+    ReplayStreamPacket packet;
+    packet.stream_type = REPLAY_STREAM_BLOCK;
+    packet.generation = m_iRecordingGeneration;
+    if (!WriteFrameBlock(pRecording, 0, pRecording->GetFrameCount(), packet))
+        return;
+
+    CUtlBuffer payload;
+    payload.SetBigEndian(false);
+    packet.Write(payload);
+
+    // Otherwise the backlog goes out as capped live blocks, see SendFrames
+    if (g_pMomBulkTransfer->StartTransfer(subscriber.m_ID, BULK_TRANSFER_REPLAY, payload))
+        subscriber.m_iFramesSent = packet.frame_count;
+}
+
+void CMomReplayStreamSystem::FlushFrames()
+{
+    CMomReplayBase *pRecording = g_ReplaySystem.GetRecordingReplay();
+    if (!pRecording)
+        return;
+
+    FOR_EACH_VEC(m_vecSubscribers, i)
+    {
+        SendFrames(m_vecSubscribers[i], pRecording, UINT_MAX);
+    }
+}
+
+void CMomReplayStreamSystem::SendFrames(Subscriber_t &subscriber, CMomReplayBase *pRecording, uint32 maxBlocks)
+{
+    const uint32 frameCount = pRecording->GetFrameCount();
+    for (uint32 block = 0; block < maxBlocks && subscriber.m_iFramesSent < frameCount; block++)
+    {
+        const uint32 count = min(frameCount - subscriber.m_iFramesSent, static_cast<uint32>(REPLAY_STREAM_MAX_BLOCK_FRAMES));
+
+        ReplayStreamPacket packet;
+        packet.stream_type = REPLAY_STREAM_BLOCK;
+        packet.generation = m_iRecordingGeneration;
+        if (!WriteFrameBlock(pRecording, subscriber.m_iFramesSent, count, packet) || !SendStreamPacket(subscriber.m_ID, packet))
+            return;
+
+        subscriber.m_iFramesSent += count;
+    }
+}
+
+void CMomReplayStreamSystem::OnRecordingFinished(CMomReplayBase *pReplay, int iTrimmedFrames)
+{
+    if (m_vecSubscribers.IsEmpty() || !pReplay)
+        return;
+
+    // The spectators have the untrimmed frames, they trim their copy the same way
+    CReplayHeader header;
+    Q_strncpy(header.m_szMapName, pReplay->GetMapName(), sizeof(header.m_szMapName));
+    Q_strncpy(header.m_szMapHash, pReplay->GetMapHash(), sizeof(header.m_szMapHash));
+    Q_strncpy(header.m_szPlayerName, pReplay->GetPlayerName(), sizeof(header.m_szPlayerName));
+    header.m_ulSteamID = pReplay->GetPlayerSteamID();
+    header.m_fTickInterval = pReplay->GetTickInterval();
+    header.m_iRunFlags = pReplay->GetRunFlags();
+    header.m_iRunDate = pReplay->GetRunDate();
+    header.m_iStartTick = pReplay->GetStartTick();
+    header.m_iStopTick = pReplay->GetStopTick();
+    header.m_iTrackNumber = pReplay->GetTrackNumber();
+    header.m_iZoneNumber = pReplay->GetZoneNumber();
+
+    ReplayStreamPacket packet;
+    packet.stream_type = REPLAY_STREAM_END;
+    packet.generation = m_iRecordingGeneration;
+    header.Serialize(packet.dataBuf);
+    packet.dataBuf.PutInt(iTrimmedFrames);
+    packet.dataBuf.PutUnsignedChar(pReplay->GetRunStats() != nullptr);
+    if (pReplay->GetRunStats())
+        pReplay->GetRunStats()->Serialize(packet.dataBuf);
+
+    FOR_EACH_VEC(m_vecSubscribers, i)
+    {
+        SendStreamPacket(m_vecSubscribers[i].m_ID, packet);
+    }
+}
+
+bool CMomReplayStreamSystem::WriteFrameBlock(CMomReplayBase *pReplay, uint32 firstFrame, uint32 count, ReplayStreamPacket &packet)
+{
+    CUtlBuffer frames;
+    frames.SetBigEndian(false);
+    for (uint32 i = 0; i < count; i++)
+    {
+        CReplayFrame *pFrame = pReplay->GetFrame(firstFrame + i);
+        if (!pFrame)
+            return false;
+
+        pFrame->Serialize(frames);
+    }
+
+    size_t compressedSize = 0;
+    packet.dataBuf.Purge();
+    packet.dataBuf.EnsureCapacity(snappy::MaxCompressedLength(frames.TellPut()));
+    snappy::RawCompress(static_cast<const char *>(frames.Base()), frames.TellPut(),
+                        static_cast<char *>(packet.dataBuf.Base()), &compressedSize);
+    packet.dataBuf.SeekPut(CUtlBuffer::SEEK_HEAD, compressedSize);
+
+    packet.first_frame = firstFrame;
+    packet.frame_count = count;
+    return true;
+}
+
+bool CMomReplayStreamSystem::SendStreamPacket(const CSteamID &target, ReplayStreamPacket &packet)
+{
+    CSteamID targetID(target);
+    return g_pMomentumGhostClient->SendReplayStreamPacket(targetID, &packet);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Spectator side
+
+void CMomReplayStreamSystem::OnSpectateTargetChanged(const CSteamID &target, SpectateMessageType_t type)
+{
+    if (type == SPEC_UPDATE_STOP || type == SPEC_UPDATE_LEAVE)
+    {
+        StopStream(true);
+        return;
+    }
+
+    // Switching over to our own stream ghost reports its source as the target
+    if (target == m_StreamSource)
+        return;
+
+    StopStream(true);
+
+    if (mom_replay_stream_spectate.GetBool() && target.IsValid())
+        RequestStream(target);
+}
+
+void CMomReplayStreamSystem::RequestStream(const CSteamID &source)
+{
+    m_StreamSource = source;
+    m_iStreamGeneration = 0;
+    m_bStreamComplete = false;
+
+    ReplayStreamPacket packet;
+    packet.stream_type = REPLAY_STREAM_REQUEST;
+    SendStreamPacket(source, packet);
+}
+
+void CMomReplayStreamSystem::StopStream(bool bNotifySource)
+{
+    if (!m_StreamSource.IsValid())
+        return;
+
+    if (bNotifySource)
+    {
+        ReplayStreamPacket packet;
+        packet.stream_type = REPLAY_STREAM_STOP;
+        SendStreamPacket(m_StreamSource, packet);
+    }
+
+    m_StreamSource = k_steamIDNil;
+
+    if (m_hGhost.Get())
+        m_hGhost->EndRun();
+
+    m_hGhost.Term();
+    m_bGhostStarted = false;
+
+    m_mapPendingBlocks.PurgeAndDeleteElements();
+
+    if (m_pStreamReplay)
+    {
+        delete m_pStreamReplay;
+        m_pStreamReplay = nullptr;
+    }
+}
+
+void CMomReplayStreamSystem::MemberLeft(const CSteamID &member)
+{
+    const int index = FindSubscriber(member);
+    if (index != m_vecSubscribers.InvalidIndex())
+        m_vecSubscribers.Remove(index);
+
+    if (member == m_StreamSource)
+        StopStream(false);
+}
+
+void CMomReplayStreamSystem::OnStreamPacket(ReplayStreamPacket &packet, const CSteamID &from)
+{
+    switch (packet.stream_type)
+    {
+    case REPLAY_STREAM_REQUEST:
+        AddSubscriber(from);
+        break;
+    case REPLAY_STREAM_STOP:
+        {
+            const int index = FindSubscriber(from);
+            if (index != m_vecSubscribers.InvalidIndex())
+                m_vecSubscribers.Remove(index);
+        }
+        break;
+    case REPLAY_STREAM_HEADER:
+    case REPLAY_STREAM_BLOCK:
+    case REPLAY_STREAM_END:
+        if (from != m_StreamSource)
+            break;
+
+        if (packet.stream_type == REPLAY_STREAM_HEADER)
+            HandleHeader(packet);
+        else if (packet.generation != m_iStreamGeneration || !m_pStreamReplay)
+            DevLog(2, "Dropping replay stream packet of an old recording\n");
+        else if (packet.stream_type == REPLAY_STREAM_BLOCK)
+            HandleBlock(packet);
+        else
+            HandleEnd(packet);
+        break;
+    case REPLAY_STREAM_INVALID:
+    default:
+        DevWarning(2, "Invalid replay stream packet!\n");
+        break;
+    }
+}
+
+void CMomReplayStreamSystem::OnBacklogTransfer(const CSteamID &from, CUtlBuffer &data)
+{
+    if (data.GetUnsignedChar() != PACKET_TYPE_REPLAY_STREAM)
+        return;
+
+    ReplayStreamPacket packet(data);
+    if (packet.stream_type == REPLAY_STREAM_BLOCK)
+        OnStreamPacket(packet, from);
+}
+
+void CMomReplayStreamSystem::HandleHeader(ReplayStreamPacket &packet)
+{
+    CReplayHeader header(packet.dataBuf);
+    const uint8 zones = packet.dataBuf.GetUnsignedChar();
+    if (!packet.dataBuf.IsValid())
+        return;
+
+    m_mapPendingBlocks.PurgeAndDeleteElements();
+
+    // The ghost can't play the empty recording, it waits for UpdateGhost to start it again
+    if (m_hGhost.Get())
+        m_hGhost->PauseStreamPlayback();
+
+    m_bGhostStarted = false;
+
+    if (m_pStreamReplay)
+        delete m_pStreamReplay;
+
+    m_pStreamReplay = g_ReplayFactory.CreateEmptyReplay(0);
+    m_pStreamReplay->SetMapName(header.m_szMapName);
+    m_pStreamReplay->SetMapHash(header.m_szMapHash);
+    m_pStreamReplay->SetPlayerName(header.m_szPlayerName);
+    m_pStreamReplay->SetPlayerSteamID(header.m_ulSteamID);
+    m_pStreamReplay->SetTickInterval(header.m_fTickInterval);
+    m_pStreamReplay->SetRunFlags(header.m_iRunFlags);
+    m_pStreamReplay->SetTrackNumber(header.m_iTrackNumber);
+    m_pStreamReplay->SetZoneNumber(header.m_iZoneNumber);
+    m_pStreamReplay->CreateRunStats(zones);
+
+    m_iStreamGeneration = packet.generation;
+    m_bStreamComplete = false;
+
+    // Keep spectating the same ghost through restarts, it picks up the new recording once enough of it arrived
+    if (!m_hGhost.Get())
+    {
+        m_hGhost = static_cast<CMomentumReplayGhostEntity *>(CreateEntityByName("mom_replay_ghost"));
+        if (m_hGhost.Get())
+            m_hGhost->SetStreamSource(m_StreamSource);
+    }
+
+    if (m_hGhost.Get())
+        m_hGhost->LoadFromReplayBase(m_pStreamReplay);
+}
+
+void CMomReplayStreamSystem::HandleBlock(ReplayStreamPacket &packet)
+{
+    const uint32 frameCount = m_pStreamReplay->GetFrameCount();
+    if (packet.first_frame + packet.frame_count <= frameCount)
+        return;
+
+    if (packet.first_frame > frameCount)
+    {
+        // The backlog is still on its way, hold on to this one
+        if (m_mapPendingBlocks.Find(packet.first_frame) == m_mapPendingBlocks.InvalidIndex())
+        {
+            ReplayStreamPacket *pCopy = new ReplayStreamPacket;
+            pCopy->stream_type = packet.stream_type;
+            pCopy->generation = packet.generation;
+            pCopy->first_frame = packet.first_frame;
+            pCopy->frame_count = packet.frame_count;
+            pCopy->dataBuf.Put(packet.dataBuf.Base(), packet.dataBuf.TellPut());
+            m_mapPendingBlocks.Insert(packet.first_frame, pCopy);
+        }
+        return;
+    }
+
+    if (!ReadFrameBlock(packet))
+        return;
+
+    // Apply whatever was waiting on this block
+    unsigned short index = m_mapPendingBlocks.FirstInorder();
+    while (index != m_mapPendingBlocks.InvalidIndex())
+    {
+        ReplayStreamPacket *pPending = m_mapPendingBlocks[index];
+        if (pPending->first_frame > static_cast<uint32>(m_pStreamReplay->GetFrameCount()))
+            break;
+
+        ReadFrameBlock(*pPending);
+        delete pPending;
+        m_mapPendingBlocks.RemoveAt(index);
+        index = m_mapPendingBlocks.FirstInorder();
+    }
+
+    UpdateGhost();
+}
+
+bool CMomReplayStreamSystem::ReadFrameBlock(ReplayStreamPacket &packet)
+{
+    const char *pCompressed = static_cast<const char *>(packet.dataBuf.Base());
+    const size_t compressedSize = packet.dataBuf.TellPut();
+
+    size_t uncompressedSize = 0;
+    if (!snappy::GetUncompressedLength(pCompressed, compressedSize, &uncompressedSize) ||
+        uncompressedSize > BULK_TRANSFER_MAX_SIZE)
+    {
+        Warning("Received an invalid replay stream block!\n");
+        return false;
+    }
+
+    CUtlBuffer frames;
+    frames.SetBigEndian(false);
+    frames.EnsureCapacity(uncompressedSize);
+    if (!snappy::RawUncompress(pCompressed, compressedSize, static_cast<char *>(frames.Base())))
+    {
+        Warning("Failed to decompress a replay stream block!\n");
+        return false;
+    }
+    frames.SeekPut(CUtlBuffer::SEEK_HEAD, uncompressedSize);
+
+    // Blocks may overlap what we have when the backlog and the live blocks cross paths
+    const uint32 frameCount = m_pStreamReplay->GetFrameCount();
+    for (uint32 i = 0; i < packet.frame_count; i++)
+    {
+        CReplayFrame frame(frames);
+        if (!frames.IsValid())
+            return false;
+
+        if (packet.first_frame + i >= frameCount)
+            m_pStreamReplay->AddFrame(frame);
+    }
+
+    return true;
+}
+
+void CMomReplayStreamSystem::UpdateGhost()
+{
+    CMomentumReplayGhostEntity *pGhost = m_hGhost.Get();
+    if (!pGhost)
+        return;
+
+    const int frameCount = m_pStreamReplay->GetFrameCount();
+    const int delayTicks = static_cast<int>(mom_replay_stream_delay.GetFloat() / gpGlobals->interval_per_tick);
+
+    if (m_bGhostStarted)
+    {
+        pGhost->OnStreamFramesAdded();
+    }
+    else if (frameCount > delayTicks || (m_bStreamComplete && frameCount > 0))
+    {
+        // Start right behind the runner rather than at the start of the recording
+        pGhost->StartRun(true);
+        pGhost->GoToTick(max(0, frameCount - 1 - delayTicks));
+        m_bGhostStarted = true;
+    }
+}
+
+void CMomReplayStreamSystem::HandleEnd(ReplayStreamPacket &packet)
+{
+    CReplayHeader header(packet.dataBuf);
+    const int iTrimmedFrames = packet.dataBuf.GetInt();
+    CMomRunStats *pStats = packet.dataBuf.GetUnsignedChar() ? new CMomRunStats(packet.dataBuf) : nullptr;
+
+    if (!packet.dataBuf.IsValid() || iTrimmedFrames < 0 || iTrimmedFrames >= m_pStreamReplay->GetFrameCount())
+    {
+        Warning("Received an invalid replay stream ending!\n");
+        if (pStats)
+            delete pStats;
+        return;
+    }
+
+    m_bStreamComplete = true;
+    UpdateGhost();
+
+    // Build the replay exactly like the runner stored it
+    if (m_pCompleteReplay)
+        delete m_pCompleteReplay;
+
+    m_pCompleteReplay = g_ReplayFactory.CreateEmptyReplay(0);
+    m_pCompleteReplay->SetMapName(header.m_szMapName);
+    m_pCompleteReplay->SetMapHash(header.m_szMapHash);
+    m_pCompleteReplay->SetPlayerName(header.m_szPlayerName);
+    m_pCompleteReplay->SetPlayerSteamID(header.m_ulSteamID);
+    m_pCompleteReplay->SetTickInterval(header.m_fTickInterval);
+    m_pCompleteReplay->SetRunFlags(header.m_iRunFlags);
+    m_pCompleteReplay->SetRunDate(header.m_iRunDate);
+    m_pCompleteReplay->SetStartTick(header.m_iStartTick);
+    m_pCompleteReplay->SetStopTick(header.m_iStopTick);
+    m_pCompleteReplay->SetTrackNumber(header.m_iTrackNumber);
+    m_pCompleteReplay->SetZoneNumber(header.m_iZoneNumber);
+
+    for (int i = iTrimmedFrames; i < m_pStreamReplay->GetFrameCount(); i++)
+        m_pCompleteReplay->AddFrame(*m_pStreamReplay->GetFrame(i));
+
+    if (pStats)
+    {
+        m_pCompleteReplay->CreateRunStats(pStats->GetTotalZones())->FullyCopyFrom(*pStats);
+        delete pStats;
+    }
+
+    Msg("%s finished their run, use mom_replay_stream_save to keep the replay.\n", header.m_szPlayerName);
+}
+
+bool CMomReplayStreamSystem::SaveReceivedReplay(char *pPathOut, size_t outSize)
+{
+    if (!m_pCompleteReplay)
+        return false;
+
+    CUtlBuffer buf;
+    buf.PutUnsignedInt(REPLAY_MAGIC_LE);
+    buf.PutUnsignedChar(m_pCompleteReplay->GetVersion());
+    m_pCompleteReplay->Serialize(buf);
+
+    char hash[41];
+    if (!MomUtil::GetSHA1Hash(buf, hash, sizeof(hash)))
+        return false;
+
+    m_pCompleteReplay->SetRunHash(hash);
+
+    CFmtStr path("%s/%s", RECORDING_PATH, RECORDING_ONLINE_PATH);
+    CFmtStr fileName("%s-%s%s", m_pCompleteReplay->GetMapName(), hash, EXT_RECORDING_FILE);
+    V_ComposeFileName(path.Get(), fileName.Get(), pPathOut, outSize);
+
+    return g_pFullFileSystem->WriteFile(pPathOut, "MOD", buf);
+}
+
+CON_COMMAND(mom_replay_stream_save, "Saves the last run streamed to you while spectating as a replay file.\n")
+{
+    char path[MAX_PATH];
+    if (g_pMomReplayStream->SaveReceivedReplay(path, sizeof(path)))
+        Msg("Saved the streamed replay to %s\n", path);
+    else
+        Warning("There is no completely streamed run to save!\n");
+}
+
+static CMomReplayStreamSystem s_MomReplayStream("MOMReplayStreamSystem");
+CMomReplayStreamSystem *g_pMomReplayStream = &s_MomReplayStream;
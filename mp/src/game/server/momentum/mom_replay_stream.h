@@ -0,0 +1,78 @@
+#pragma once
+
+#include "mom_ghostdefs.h"
+
+class CMomReplayBase;
+class CMomentumReplayGhostEntity;
+
+// Streams the replay recording of the local player to the lobby members spectating them, and plays the stream
+// of whoever we spectate on a replay ghost. Spectators get every recorded tick instead of the interpolated
+// position packets, at the cost of a small delay (mom_replay_stream_delay).
+class CMomReplayStreamSystem : public CAutoGameSystemPerFrame
+{
+public:
+    CMomReplayStreamSystem(const char *pName);
+    ~CMomReplayStreamSystem();
+
+    // CAutoGameSystemPerFrame
+    void PostInit() OVERRIDE;
+    void LevelShutdownPreEntity() OVERRIDE;
+    void FrameUpdatePostEntityThink() OVERRIDE;
+
+    // Runner side, called by the replay system
+    void OnRecordingStarted();
+    void OnRecordingFinished(CMomReplayBase *pReplay, int iTrimmedFrames);
+    // Sends every recorded frame that was not streamed yet
+    void FlushFrames();
+
+    // Spectator side, called by the lobby system when our spectate target changes
+    void OnSpectateTargetChanged(const CSteamID &target, SpectateMessageType_t type);
+    // Stores the last completely streamed run as a replay file
+    bool SaveReceivedReplay(char *pPathOut, size_t outSize);
+
+    void OnStreamPacket(ReplayStreamPacket &packet, const CSteamID &from);
+    void MemberLeft(const CSteamID &member);
+    // Stops streaming to and from everybody
+    void Reset();
+
+private:
+    struct Subscriber_t
+    {
+        CSteamID m_ID;
+        uint32 m_iFramesSent;
+    };
+
+    // Runner
+    int FindSubscriber(const CSteamID &id);
+    void AddSubscriber(const CSteamID &id);
+    void SendHeader(const CSteamID &target);
+    void SendBacklog(Subscriber_t &subscriber);
+    // Sends the frames the subscriber is missing as live blocks, at most maxBlocks of them
+    void SendFrames(Subscriber_t &subscriber, CMomReplayBase *pRecording, uint32 maxBlocks);
+    bool WriteFrameBlock(CMomReplayBase *pReplay, uint32 firstFrame, uint32 count, ReplayStreamPacket &packet);
+    bool SendStreamPacket(const CSteamID &target, ReplayStreamPacket &packet);
+
+    // Spectator
+    void RequestStream(const CSteamID &source);
+    void StopStream(bool bNotifySource);
+    void OnBacklogTransfer(const CSteamID &from, CUtlBuffer &data);
+    void HandleHeader(ReplayStreamPacket &packet);
+    void HandleBlock(ReplayStreamPacket &packet);
+    void HandleEnd(ReplayStreamPacket &packet);
+    bool ReadFrameBlock(ReplayStreamPacket &packet);
+    void UpdateGhost();
+
+    CUtlVector<Subscriber_t> m_vecSubscribers;
+    uint32 m_iRecordingGeneration; // Bumped every time we start recording
+
+    CSteamID m_StreamSource; // Who we are receiving a stream from
+    uint32 m_iStreamGeneration;
+    CMomReplayBase *m_pStreamReplay; // The recording being streamed to us
+    CMomReplayBase *m_pCompleteReplay; // Trimmed copy of the last recording that was streamed completely
+    bool m_bStreamComplete;
+    CUtlMap<uint32, ReplayStreamPacket *> m_mapPendingBlocks; // Blocks that arrived ahead of the backlog, by first frame
+    CHandle<CMomentumReplayGhostEntity> m_hGhost;
+    bool m_bGhostStarted;
+};
+
+extern CMomReplayStreamSystem *g_pMomReplayStream;
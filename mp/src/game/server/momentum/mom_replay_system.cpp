@@ -5,6 +5,7 @@
 #include "mom_player_shared.h"
 #include "mom_replay_entity.h"
 #include "mom_replay_system.h"
+#include "mom_replay_stream.h"
 #include "run/mom_replay_base.h"
 #include "util/baseautocompletefilelist.h"
 #include "fmtstr.h"
@@ -12,6 +13,7 @@
 #include "run/mom_replay_factory.h"
 #include "util/mom_util.h"
 #include "filesystem.h"
+#include "mom_profiler.h"
 
 #include "tier0/memdbgon.h"
 
@@ -44,6 +46,8 @@ CMomentumReplaySystem::~CMomentumReplaySystem()
 
 void CMomentumReplaySystem::FrameUpdatePostEntityThink()
 {
+    MOM_PROF_SCOPE("CMomentumReplaySystem::FrameUpdatePostEntityThink");
+
     if (m_bRecording)
         UpdateRecordingParams();
 }
@@ -85,6 +89,8 @@ void CMomentumReplaySystem::BeginRecording()
     m_bRecording = true;
     m_iStartRecordingTick = gpGlobals->tickcount;
     m_pRecordingReplay = g_ReplayFactory.CreateEmptyReplay(0);
+
+    g_pMomReplayStream->OnRecordingStarted();
 }
 
 void CMomentumReplaySystem::CancelRecording()
@@ -139,10 +145,16 @@ void CMomentumReplaySystem::FinishRecording()
     m_bShouldStopRec = false;
     m_bRecording = false;
 
+    // Spectators get the untrimmed recording, and trim it themselves
+    g_pMomReplayStream->FlushFrames();
+    const int iUntrimmedFrames = m_pRecordingReplay->GetFrameCount();
+
     TrimReplay();
 
     SetReplayHeaderAndStats();
 
+    g_pMomReplayStream->OnRecordingFinished(m_pRecordingReplay, iUntrimmedFrames - m_pRecordingReplay->GetFrameCount());
+
     char newRecordingPath[MAX_PATH];
     if (StoreReplay(newRecordingPath, MAX_PATH))
     {
@@ -352,6 +364,16 @@ void CMomentumReplaySystem::LoadReplayGhost()
     pGhost->LoadFromReplayBase(m_pPlaybackReplay);
 }
 
+void CMomentumReplaySystem::StartStreamedPlayback(CMomReplayBase *pReplay)
+{
+    StopPlayback();
+    UnloadPlayback();
+
+    m_pPlaybackReplay = pReplay;
+    LoadReplayGhost();
+    StartPlayback(true);
+}
+
 void CMomentumReplaySystem::StopPlayback()
 {
     if (!m_bPlayingBack)
@@ -34,6 +34,8 @@ public:
     CMomReplayBase *LoadPlayback(const char *pFileName, bool bFullLoad = true, const char *pPathID = "MOD");
     void UnloadPlayback(bool shutdown = false);
     void LoadReplayGhost();
+    // Plays back a replay that is still being filled in (downloaded), the replay system owns it from now on
+    void StartStreamedPlayback(CMomReplayBase *pReplay);
     void StartPlayback(bool firstperson);
     void StopPlayback();
 
@@ -42,6 +44,7 @@ public:
     CMomReplayBase *GetRecordingReplay() { return m_pRecordingReplay; }
     const CMomReplayBase *GetPlaybackReplay() const { return m_pPlaybackReplay; }
     CMomReplayBase *GetPlaybackReplay() { return m_pPlaybackReplay; }
+    const char *GetMapHash() const { return m_szMapHash; }
 
     //CMomRunStats *SavedRunStats() { return &m_SavedRunStats; }
 
@@ -13,6 +13,21 @@
 #include "tier0/memdbgon.h"
 
 #define SAVELOC_FILE_NAME "savedlocs.txt"
+#define SAVELOC_STORE_PATH "savelocs"
+#define EXT_SAVELOC_STORE ".msl"
+
+#define SAVELOC_STORE_MAGIC 0x4C534F4D // "MOSL"
+#define SAVELOC_STORE_VERSION 1
+// Compact once the store holds this many records more than live savelocs
+#define SAVELOC_STORE_COMPACT_SLACK 256
+
+enum SavelocRecordType_t
+{
+    SAVELOC_RECORD_ADD = 0,    // uint32 size, followed by SavedLocation_t::Write data
+    SAVELOC_RECORD_REMOVE,     // int index
+    SAVELOC_RECORD_REMOVE_ALL,
+    SAVELOC_RECORD_CURRENT,    // int index
+};
 
 MAKE_TOGGLE_CONVAR(mom_saveloc_save_between_sessions, "1", FCVAR_ARCHIVE, "Defines if savelocs should be saved between sessions of the same map.\n");
 
@@ -108,112 +123,308 @@ bool SavedLocation_t::Write(CUtlBuffer &mem)
     return write->WriteAsBinary(mem);
 }
 
-CMOMSaveLocSystem::CMOMSaveLocSystem(const char* pName): CAutoGameSystem(pName)
+CSavelocStore::CSavelocStore() : m_hFile(FILESYSTEM_INVALID_HANDLE), m_iRecordCount(0)
 {
-    m_pSavedLocsKV = new KeyValues(pName);
-    m_iRequesting = 0;
-    m_iCurrentSavelocIndx = -1;
-    m_bUsingSavelocMenu = false;
+    m_szPath[0] = '\0';
 }
 
-CMOMSaveLocSystem::~CMOMSaveLocSystem()
+CSavelocStore::~CSavelocStore()
 {
-    if (m_pSavedLocsKV)
-        m_pSavedLocsKV->deleteThis();
-    m_pSavedLocsKV = nullptr;
+    Close();
 }
 
-void CMOMSaveLocSystem::PostInit()
+void CSavelocStore::GetStorePath(const char *pMapName, char *pOut, int outSize)
 {
-    g_pModuleComms->ListenForEvent("req_savelocs", UtlMakeDelegate(this, &CMOMSaveLocSystem::OnSavelocRequestEvent));
+    Q_snprintf(pOut, outSize, "%s/%s%s", SAVELOC_STORE_PATH, pMapName, EXT_SAVELOC_STORE);
 }
 
-void CMOMSaveLocSystem::LevelInitPreEntity()
+int CSavelocStore::Open(const char *pMapName, CUtlVector<SavedLocation_t*> &vecOut)
 {
-    // We don't check mom_savelocs_save_between_sessions because we want to be able to load savelocs from friends
-    DevLog("Loading savelocs from %s ...\n", SAVELOC_FILE_NAME);
+    Close();
+
+    GetStorePath(pMapName, m_szPath, sizeof(m_szPath));
 
-    if (m_pSavedLocsKV)
+    int iCurrent = -1;
+    bool bNeedsRewrite = false;
+
+    CUtlBuffer buf;
+    if (filesystem->ReadFile(m_szPath, "MOD", buf))
     {
-        //Remove the past loaded stuff
-        m_pSavedLocsKV->Clear();
-
-        // Note: This loading is going to contain all of the other maps' savelocs as well!
-        // Note: We are not in PostInit because if players edit their savelocs file (add
-        // savelocs from a friend or something), then we want to reload on map load again,
-        // and not force the player to restart the mod every time.
-        if (m_pSavedLocsKV->LoadFromFile(filesystem, SAVELOC_FILE_NAME, "MOD"))
+        if (buf.GetUnsignedInt() != SAVELOC_STORE_MAGIC || buf.GetUnsignedChar() != SAVELOC_STORE_VERSION)
         {
-            DevLog("Loaded savelocs from %s!\n", SAVELOC_FILE_NAME);
-
-            if (!m_pSavedLocsKV->IsEmpty())
+            Warning("Saveloc store %s is invalid, starting over!\n", m_szPath);
+            bNeedsRewrite = true;
+        }
+        else
+        {
+            // Replay the records to get the savelocs as they were when we last played
+            while (buf.GetBytesRemaining() > 0)
             {
-                KeyValues *kvMapSavelocs = m_pSavedLocsKV->FindKey(gpGlobals->mapname.ToCStr());
-                if (kvMapSavelocs && !kvMapSavelocs->IsEmpty())
-                {
-                    m_iCurrentSavelocIndx = kvMapSavelocs->GetInt("cur");
+                const auto type = buf.GetUnsignedChar();
+                if (!buf.IsValid())
+                    break;
 
-                    KeyValues *kvCPs = kvMapSavelocs->FindKey("cps");
-                    if (!kvCPs) return;
-                    FOR_EACH_SUBKEY(kvCPs, kvCheckpoint)
+                ++m_iRecordCount;
+
+                if (type == SAVELOC_RECORD_ADD)
+                {
+                    const auto size = buf.GetUnsignedInt();
+                    if (!buf.IsValid() || size > static_cast<uint32>(buf.GetBytesRemaining()))
                     {
-                        SavedLocation_t *c = new SavedLocation_t();
-                        c->Load(kvCheckpoint);
-                        m_rcSavelocs.AddToTail(c);
+                        // Most likely a record cut short by a crash, everything before it is still good
+                        bNeedsRewrite = true;
+                        break;
                     }
 
-                    // Fire the initial event
-                    FireUpdateEvent();
+                    CUtlBuffer record(buf.PeekGet(), size, CUtlBuffer::READ_ONLY);
+                    buf.SeekGet(CUtlBuffer::SEEK_CURRENT, size);
+
+                    const auto pSaveloc = new SavedLocation_t;
+                    if (pSaveloc->Read(record))
+                        vecOut.AddToTail(pSaveloc);
+                    else
+                        delete pSaveloc;
+                }
+                else if (type == SAVELOC_RECORD_REMOVE)
+                {
+                    const auto index = buf.GetInt();
+                    if (vecOut.IsValidIndex(index))
+                        vecOut.PurgeAndDeleteElement(index);
+                }
+                else if (type == SAVELOC_RECORD_REMOVE_ALL)
+                {
+                    vecOut.PurgeAndDeleteElements();
+                }
+                else if (type == SAVELOC_RECORD_CURRENT)
+                {
+                    iCurrent = buf.GetInt();
+                }
+                else
+                {
+                    Warning("Unknown record type %i in saveloc store %s!\n", type, m_szPath);
+                    bNeedsRewrite = true;
+                    break;
                 }
             }
         }
     }
+
+    iCurrent = vecOut.IsValidIndex(iCurrent) ? iCurrent : vecOut.Count() - 1;
+
+    // Maps without a store don't get one until there's something to put in it, see Compact
+    if (bNeedsRewrite || ShouldCompact(vecOut.Count()))
+        Compact(vecOut, iCurrent);
+    else if (m_iRecordCount > 0)
+        m_hFile = filesystem->Open(m_szPath, "ab", "MOD");
+
+    return iCurrent;
 }
 
-void CMOMSaveLocSystem::LevelShutdownPreEntity()
+void CSavelocStore::Close()
 {
-    if (CMomentumPlayer::GetLocalPlayer() && m_pSavedLocsKV && mom_saveloc_save_between_sessions.GetBool())
+    if (m_hFile != FILESYSTEM_INVALID_HANDLE)
     {
-        DevLog("Saving map %s savelocs to %s ...\n", gpGlobals->mapname.ToCStr(), SAVELOC_FILE_NAME);
-        // Make the KV to save into and save into it
-        KeyValues *pKvMapSavelocs = new KeyValues(gpGlobals->mapname.ToCStr());
-        // Set the current index
-        pKvMapSavelocs->SetInt("cur", m_iCurrentSavelocIndx);
-
-        // Add all your savelocs
-        KeyValues *kvCPs = new KeyValues("cps");
-        FOR_EACH_VEC(m_rcSavelocs, i)
-        {
-            char szCheckpointNum[10]; // 999 million savelocs is pretty generous
-            Q_snprintf(szCheckpointNum, sizeof(szCheckpointNum), "%09i", i); // %09 because '\0' is the last (10)
-            KeyValues *kvCP = new KeyValues(szCheckpointNum);
-            m_rcSavelocs[i]->Save(kvCP);
-            kvCPs->AddSubKey(kvCP);
-        }
+        filesystem->Close(m_hFile);
+        m_hFile = FILESYSTEM_INVALID_HANDLE;
+    }
+
+    m_iRecordCount = 0;
+}
+
+void CSavelocStore::AppendRecord(CUtlBuffer &record)
+{
+    if (!IsOpen())
+        return;
+
+    filesystem->Write(record.Base(), record.TellPut(), m_hFile);
+    filesystem->Flush(m_hFile);
+    ++m_iRecordCount;
+}
+
+void CSavelocStore::AppendAdd(SavedLocation_t *pSaveloc)
+{
+    CUtlBuffer saveloc;
+    if (!pSaveloc->Write(saveloc))
+        return;
+
+    CUtlBuffer record;
+    record.PutUnsignedChar(SAVELOC_RECORD_ADD);
+    record.PutUnsignedInt(saveloc.TellPut());
+    record.Put(saveloc.Base(), saveloc.TellPut());
+    AppendRecord(record);
+}
+
+void CSavelocStore::AppendRemove(int index)
+{
+    CUtlBuffer record;
+    record.PutUnsignedChar(SAVELOC_RECORD_REMOVE);
+    record.PutInt(index);
+    AppendRecord(record);
+}
+
+void CSavelocStore::AppendRemoveAll()
+{
+    CUtlBuffer record;
+    record.PutUnsignedChar(SAVELOC_RECORD_REMOVE_ALL);
+    AppendRecord(record);
+}
+
+void CSavelocStore::AppendCurrent(int index)
+{
+    CUtlBuffer record;
+    record.PutUnsignedChar(SAVELOC_RECORD_CURRENT);
+    record.PutInt(index);
+    AppendRecord(record);
+}
+
+bool CSavelocStore::ShouldCompact(int iLiveCount) const
+{
+    return m_iRecordCount > iLiveCount + SAVELOC_STORE_COMPACT_SLACK;
+}
+
+bool CSavelocStore::WriteStoreFile(const char *pPath, const CUtlVector<SavedLocation_t*> &vecSavelocs, int iCurrent)
+{
+    CUtlBuffer buf;
+    buf.PutUnsignedInt(SAVELOC_STORE_MAGIC);
+    buf.PutUnsignedChar(SAVELOC_STORE_VERSION);
+
+    FOR_EACH_VEC(vecSavelocs, i)
+    {
+        CUtlBuffer saveloc;
+        if (!vecSavelocs[i]->Write(saveloc))
+            continue;
+
+        buf.PutUnsignedChar(SAVELOC_RECORD_ADD);
+        buf.PutUnsignedInt(saveloc.TellPut());
+        buf.Put(saveloc.Base(), saveloc.TellPut());
+    }
+
+    buf.PutUnsignedChar(SAVELOC_RECORD_CURRENT);
+    buf.PutInt(iCurrent);
+
+    // Write to the side first so a crash mid-write doesn't lose the old store
+    CFmtStr tempPath("%s.tmp", pPath);
+    if (!filesystem->WriteFile(tempPath.Get(), "MOD", buf))
+        return false;
+
+    filesystem->RemoveFile(pPath, "MOD");
+    return filesystem->RenameFile(tempPath.Get(), pPath, "MOD");
+}
+
+void CSavelocStore::Compact(const CUtlVector<SavedLocation_t*> &vecSavelocs, int iCurrent)
+{
+    if (!m_szPath[0])
+        return;
+
+    Close();
+
+    if (WriteStoreFile(m_szPath, vecSavelocs, iCurrent))
+        m_iRecordCount = vecSavelocs.Count() + 1;
+    else
+        Warning("Failed to write saveloc store %s!\n", m_szPath);
 
-        // Save them into the keyvalues
-        pKvMapSavelocs->AddSubKey(kvCPs);
-       
-        // Remove the map if it already exists in there
-        KeyValues *pExisting = m_pSavedLocsKV->FindKey(gpGlobals->mapname.ToCStr());
-        if (pExisting)
+    m_hFile = filesystem->Open(m_szPath, "ab", "MOD");
+}
+
+void CSavelocStore::ImportLegacyFile()
+{
+    if (!filesystem->FileExists(SAVELOC_FILE_NAME, "MOD"))
+        return;
+
+    KeyValuesAD pKvLegacy("Savelocs");
+    if (!pKvLegacy->LoadFromFile(filesystem, SAVELOC_FILE_NAME, "MOD"))
+        return;
+
+    DevLog("Importing legacy savelocs from %s ...\n", SAVELOC_FILE_NAME);
+
+    int iImported = 0;
+    FOR_EACH_SUBKEY(pKvLegacy, pKvMap)
+    {
+        char szPath[MAX_PATH];
+        GetStorePath(pKvMap->GetName(), szPath, sizeof(szPath));
+
+        // Never clobber a store that already exists
+        if (filesystem->FileExists(szPath, "MOD"))
+            continue;
+
+        CUtlVector<SavedLocation_t*> vecSavelocs;
+        KeyValues *pKvCPs = pKvMap->FindKey("cps");
+        if (pKvCPs)
         {
-            m_pSavedLocsKV->RemoveSubKey(pExisting);
-            pExisting->deleteThis();
+            FOR_EACH_SUBKEY(pKvCPs, pKvCheckpoint)
+            {
+                const auto pSaveloc = new SavedLocation_t;
+                pSaveloc->Load(pKvCheckpoint);
+                vecSavelocs.AddToTail(pSaveloc);
+            }
         }
 
-        // Add the new one
-        m_pSavedLocsKV->AddSubKey(pKvMapSavelocs);
+        if (WriteStoreFile(szPath, vecSavelocs, pKvMap->GetInt("cur", -1)))
+            ++iImported;
 
-        // Save everything to file
-        if (m_pSavedLocsKV->SaveToFile(filesystem, SAVELOC_FILE_NAME, "MOD", true))
-            DevLog("Saved map %s savelocs to %s!\n", gpGlobals->mapname.ToCStr(), SAVELOC_FILE_NAME);
+        vecSavelocs.PurgeAndDeleteElements();
     }
 
+    // Keep the old file around, but make sure it's never imported again
+    CFmtStr importedName("%s.imported", SAVELOC_FILE_NAME);
+    filesystem->RenameFile(SAVELOC_FILE_NAME, importedName.Get(), "MOD");
+
+    DevLog("Imported the savelocs of %i maps from %s!\n", iImported, SAVELOC_FILE_NAME);
+}
+
+CMOMSaveLocSystem::CMOMSaveLocSystem(const char* pName): CAutoGameSystem(pName)
+{
+    m_iRequesting = 0;
+    m_iCurrentSavelocIndx = -1;
+    m_bUsingSavelocMenu = false;
+    m_bStoreInSync = false;
+}
+
+CMOMSaveLocSystem::~CMOMSaveLocSystem()
+{
+}
+
+void CMOMSaveLocSystem::PostInit()
+{
+    g_pModuleComms->ListenForEvent("req_savelocs", UtlMakeDelegate(this, &CMOMSaveLocSystem::OnSavelocRequestEvent));
+
+    filesystem->CreateDirHierarchy(SAVELOC_STORE_PATH, "MOD");
+}
+
+void CMOMSaveLocSystem::LevelInitPreEntity()
+{
+    // We don't check mom_savelocs_save_between_sessions because we want to be able to load savelocs from friends
+    // Note: We are not in PostInit because if players edit their savelocs (add savelocs from a friend
+    // or something), then we want to reload on map load again, and not force the player to restart the mod every time.
+    CSavelocStore::ImportLegacyFile();
+
+    DevLog("Loading savelocs for %s ...\n", gpGlobals->mapname.ToCStr());
+
+    m_iCurrentSavelocIndx = m_SavelocStore.Open(gpGlobals->mapname.ToCStr(), m_rcSavelocs);
+    m_bStoreInSync = true;
+
+    DevLog("Loaded %i savelocs for %s!\n", m_rcSavelocs.Count(), gpGlobals->mapname.ToCStr());
+
+    // Fire the initial event
+    if (!m_rcSavelocs.IsEmpty())
+        FireUpdateEvent();
+}
+
+void CMOMSaveLocSystem::LevelShutdownPreEntity()
+{
+    // Everything else was appended as it happened, only the menu position is left.
+    // Don't create a store just for that if there are no savelocs to go with it.
+    if ((m_SavelocStore.IsOpen() || !m_rcSavelocs.IsEmpty()) && ShouldPersist())
+        m_SavelocStore.AppendCurrent(m_iCurrentSavelocIndx);
+
+    m_SavelocStore.Close();
+
     // Remove all requesters if we had any
     m_vecRequesters.RemoveAll();
     m_bUsingSavelocMenu = false;
-    RemoveAllSavelocs();
+    m_rcSavelocs.PurgeAndDeleteElements();
+    m_iCurrentSavelocIndx = -1;
+    FireUpdateEvent();
 }
 
 void CMOMSaveLocSystem::OnSavelocRequestEvent(KeyValues* pKv)
@@ -325,12 +536,16 @@ bool CMOMSaveLocSystem::ReadReceivedSavelocs(SavelocReqPacket *input, const uint
 
     if (input->saveloc_count > 0)
     {
+        const bool bPersist = ShouldPersist();
         for (int i = 0; i < input->saveloc_count && input->dataBuf.IsValid(); i++)
         {
             auto newSavedLoc = new SavedLocation_t;
             if (newSavedLoc->Read(input->dataBuf))
             {
                 m_rcSavelocs.AddToTail(newSavedLoc);
+
+                if (bPersist)
+                    m_SavelocStore.AppendAdd(newSavedLoc);
             }
             else
             {
@@ -370,8 +585,14 @@ void CMOMSaveLocSystem::AddSaveloc(SavedLocation_t* saveloc)
     if (!saveloc)
         return;
 
+    const bool bPersist = ShouldPersist();
+
     auto priorCount = m_rcSavelocs.Count();
     m_rcSavelocs.AddToTail(saveloc);
+
+    if (bPersist)
+        m_SavelocStore.AppendAdd(saveloc);
+
     if (m_iCurrentSavelocIndx == priorCount - 1)
         ++m_iCurrentSavelocIndx;
     else
@@ -385,8 +606,17 @@ void CMOMSaveLocSystem::RemoveCurrentSaveloc()
     if (m_rcSavelocs.IsEmpty())
         return;
 
+    const bool bPersist = ShouldPersist();
+
     auto prevCount = m_rcSavelocs.Count();
     m_rcSavelocs.PurgeAndDeleteElement(m_iCurrentSavelocIndx);
+
+    if (bPersist)
+    {
+        m_SavelocStore.AppendRemove(m_iCurrentSavelocIndx);
+        CheckCompaction();
+    }
+
     // If there's one element left, we still need to decrease currentStep to -1
     if (m_iCurrentSavelocIndx == prevCount - 1)
         --m_iCurrentSavelocIndx;
@@ -398,9 +628,17 @@ void CMOMSaveLocSystem::RemoveCurrentSaveloc()
 
 void CMOMSaveLocSystem::RemoveAllSavelocs()
 {
+    const bool bPersist = ShouldPersist();
+
     m_rcSavelocs.PurgeAndDeleteElements();
     m_iCurrentSavelocIndx = -1;
 
+    if (bPersist)
+    {
+        m_SavelocStore.AppendRemoveAll();
+        CheckCompaction();
+    }
+
     FireUpdateEvent();
     UpdateRequesters();
 }
@@ -510,6 +748,32 @@ void CMOMSaveLocSystem::UpdateRequesters()
     }
 }
 
+bool CMOMSaveLocSystem::ShouldPersist()
+{
+    if (!mom_saveloc_save_between_sessions.GetBool())
+    {
+        // Whatever changes now won't be in the store
+        m_bStoreInSync = false;
+        return false;
+    }
+
+    // Persistence was turned back on (or there's no store yet), the records that follow
+    // are index based so the store has to hold exactly what we have before they're appended
+    if (!m_bStoreInSync || !m_SavelocStore.IsOpen())
+    {
+        m_SavelocStore.Compact(m_rcSavelocs, m_iCurrentSavelocIndx);
+        m_bStoreInSync = m_SavelocStore.IsOpen();
+    }
+
+    return m_SavelocStore.IsOpen();
+}
+
+void CMOMSaveLocSystem::CheckCompaction()
+{
+    if (m_SavelocStore.ShouldCompact(m_rcSavelocs.Count()))
+        m_SavelocStore.Compact(m_rcSavelocs, m_iCurrentSavelocIndx);
+}
+
 CON_COMMAND_F(mom_saveloc_create, "Creates a saveloc that saves a player's state.\n", FCVAR_CLIENTCMD_CAN_EXECUTE)
 {
     g_pMOMSavelocSystem->CreateAndSaveLocation();
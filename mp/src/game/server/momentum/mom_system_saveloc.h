@@ -1,6 +1,7 @@
 #pragma once
 
 #include "eventqueue.h"
+#include "filesystem.h"
 
 class CMomentumPlayer;
 class SavelocReqPacket;
@@ -36,6 +37,44 @@ struct SavedLocation_t
     bool Write(CUtlBuffer &mem);
 };
 
+// Per-map binary saveloc file, only ever opened for the current map.
+// While playing, changes are appended as records; the file is rewritten ("compacted") with only
+// the live savelocs once enough of its records are stale.
+class CSavelocStore
+{
+public:
+    CSavelocStore();
+    ~CSavelocStore();
+
+    // Opens the store of the given map, loading its savelocs into vecOut. A map without a store
+    // doesn't get one here, Compact creates it. Returns the stored current saveloc index.
+    int Open(const char *pMapName, CUtlVector<SavedLocation_t*> &vecOut);
+    void Close();
+    bool IsOpen() const { return m_hFile != FILESYSTEM_INVALID_HANDLE; }
+
+    void AppendAdd(SavedLocation_t *pSaveloc);
+    void AppendRemove(int index);
+    void AppendRemoveAll();
+    void AppendCurrent(int index);
+
+    // Are enough of the records stale that the file should be rewritten?
+    bool ShouldCompact(int iLiveCount) const;
+    // Rewrites the store with just the given savelocs
+    void Compact(const CUtlVector<SavedLocation_t*> &vecSavelocs, int iCurrent);
+
+    // Splits the old all-maps KeyValues saveloc file into per-map stores, if it still exists
+    static void ImportLegacyFile();
+
+private:
+    static void GetStorePath(const char *pMapName, char *pOut, int outSize);
+    static bool WriteStoreFile(const char *pPath, const CUtlVector<SavedLocation_t*> &vecSavelocs, int iCurrent);
+    void AppendRecord(CUtlBuffer &record);
+
+    char m_szPath[MAX_PATH];
+    FileHandle_t m_hFile;
+    int m_iRecordCount;
+};
+
 class CMOMSaveLocSystem : public CAutoGameSystem
 {
 public:
@@ -100,14 +139,17 @@ private:
     void CheckTimer(); // Check the timer to see if we should stop it
     void FireUpdateEvent() const; // Fire tan event to the UI when we change our saveloc vector in any way, or stop using the saveloc menu
     void UpdateRequesters(); // Update any requesters with the updated saveloc count
+    bool ShouldPersist(); // Should changes be written to the saveloc store? Call before changing m_rcSavelocs, it may rewrite the store
+    void CheckCompaction();
 
-    KeyValues *m_pSavedLocsKV;
+    CSavelocStore m_SavelocStore;
     CUtlVector<uint64> m_vecRequesters;
     uint64 m_iRequesting; // The Steam ID of the person we are requesting savelocs from, if any
 
     CUtlVector<SavedLocation_t*> m_rcSavelocs;
     int m_iCurrentSavelocIndx;
     bool m_bUsingSavelocMenu;
+    bool m_bStoreInSync; // Does the store hold m_rcSavelocs? Not once they changed while persistence was off
 };
 
 extern CMOMSaveLocSystem *g_pMOMSavelocSystem;
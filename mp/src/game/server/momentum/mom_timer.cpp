@@ -3,11 +3,13 @@
 #include "mom_timer.h"
 
 #include "mom_player_shared.h"
+#include "mom_race_system.h"
 #include "mom_replay_system.h"
 #include "mom_system_saveloc.h"
 #include "mom_system_gamemode.h"
 #include "mom_triggers.h"
 #include "movevars_shared.h"
+#include "mom_profiler.h"
 
 #include "tier0/memdbgon.h"
 
@@ -48,6 +50,8 @@ void CMomentumTimer::LevelShutdownPreEntity()
 
 void CMomentumTimer::FrameUpdatePreEntityThink()
 {
+    MOM_PROF_SCOPE("CMomentumTimer::FrameUpdatePreEntityThink");
+
     if (!m_bWasCheatsMsgShown)
     {
         static ConVarRef cheats("sv_cheats");
@@ -125,6 +129,9 @@ bool CMomentumTimer::Start(CMomentumPlayer *pPlayer)
     // Dispatch a start timer message for the local player
     DispatchTimerEventMessage(pPlayer, pPlayer->entindex(), TIMER_EVENT_STARTED);
 
+    // Race ghosts start with the player
+    g_pMomRaceSystem->OnTimerStarted();
+
     return true;
 }
 
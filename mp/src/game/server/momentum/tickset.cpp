@@ -83,20 +83,31 @@ const Tickrate TickSet::s_DefinedRates[] = {
 
 Tickrate TickSet::m_trCurrent = s_DefinedRates[TICKRATE_66];
 
+// Registered up front so they are resolved in the same pass as the engine patches
+#ifdef _WIN32
+static int s_iIntervalPerTickSig = CEngineBinary::RegisterSignature("interval_per_tick",
+    "\x8B\x0D\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\xFF\x00\xD9\x15\x00\x00\x00\x00\xDD\x05\x00\x00\x00\x00\xDB\xF1\xDD\x05",
+    "xx????????????x?xx????xx????xxxx", 18);
+#elif defined (__linux__)
+// mov ds:interval_per_tick, 3C75C28Fh         <-- float for 0.015
+static int s_iIntervalPerTickSig = CEngineBinary::RegisterSignature("interval_per_tick",
+    "\xC7\x05\x00\x00\x00\x00\x8F\xC2\x75\x3C\xE8", "xx????xxxxx", 2);
+#elif defined (OSX)
+static int s_iIntervalPerTickSig = CEngineBinary::RegisterSignature("interval_per_tick",
+    "\x8F\xC2\x75\x3C\x78\x00\x00\x0C\x6C\x00\x00\x00\x01\x00", "xxxxx??xx???xx");
+#endif
+
 bool TickSet::TickInit()
 {
 #ifdef _WIN32
-    const char *pattern = "\x8B\x0D\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\xFF\x00\xD9\x15\x00\x00\x00\x00\xDD\x05\x00\x00\x00\x00\xDB\xF1\xDD\x05";
-    auto addr = reinterpret_cast<uintptr_t>(CEngineBinary::FindPattern(pattern, "xx????????????x?xx????xx????xxxx", 18));
+    auto addr = CEngineBinary::GetSignatureAddress(s_iIntervalPerTickSig);
     if (addr)
         interval_per_tick = *reinterpret_cast<float**>(addr);
 
 #else //POSIX
 #ifdef __linux__
 
-    // mov ds:interval_per_tick, 3C75C28Fh         <-- float for 0.015
-    const char *pattern = "\xC7\x05\x00\x00\x00\x00\x8F\xC2\x75\x3C\xE8";
-    void* addr = CEngineBinary::FindPattern(pattern, "xx????xxxxx", 2);
+    void* addr = CEngineBinary::GetSignatureAddress(s_iIntervalPerTickSig);
     if (addr)
         interval_per_tick = *(float**)(addr); //MOM_TODO: fix pointer arithmetic on void pointer?
 
@@ -108,8 +119,7 @@ bool TickSet::TickInit()
     }
     else //valve updated engine, try to use search pattern...
     {
-        const char *pattern = "\x8F\xC2\x75\x3C\x78\x00\x00\x0C\x6C\x00\x00\x00\x01\x00";
-        auto addr = reinterpret_cast<uintptr_t>(CEngineBinary::FindPattern(pattern, "xxxxx??xx???xx"));
+        auto addr = CEngineBinary::GetSignatureAddress(s_iIntervalPerTickSig);
         if (addr)
         {
             interval_per_tick = reinterpret_cast<float*>(addr);
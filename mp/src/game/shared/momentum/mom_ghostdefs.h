@@ -9,6 +9,9 @@ enum PacketType
     PACKET_TYPE_DECAL,
     PACKET_TYPE_SPEC_UPDATE,
     PACKET_TYPE_SAVELOC_REQ,
+    PACKET_TYPE_BULK_CHUNK,
+    PACKET_TYPE_BULK_ACK,
+    PACKET_TYPE_REPLAY_STREAM,
 
     PACKET_TYPE_COUNT
 };
@@ -445,4 +448,160 @@ class SavelocReqPacket : public MomentumPacket
     }
 };
 
+// What the data of a bulk transfer is, so the receiver knows who to hand it to
+enum BulkTransferType_t
+{
+    BULK_TRANSFER_INVALID = -1,
+    BULK_TRANSFER_SAVELOCS = 0,     // A SavelocReqPacket of the SAVELOC_ACK stage
+    BULK_TRANSFER_APPEARANCE,
+    BULK_TRANSFER_REPLAY,           // A ReplayStreamPacket of the BLOCK type, the frames recorded before somebody subscribed
+
+    BULK_TRANSFER_FIRST = BULK_TRANSFER_SAVELOCS,
+    BULK_TRANSFER_LAST = BULK_TRANSFER_REPLAY,
+    BULK_TRANSFER_COUNT
+};
+
+// Compressed bytes per chunk, small enough to never get split up by Steam
+#define BULK_CHUNK_SIZE 1024
+// Largest (uncompressed) payload a receiver accepts
+#define BULK_TRANSFER_MAX_SIZE (32 * 1024 * 1024)
+// Unfinished transfers a receiver keeps from any one sender, further ones are cancelled
+#define BULK_TRANSFER_MAX_INCOMING BULK_TRANSFER_COUNT
+// The receiver acks every this many chunks (and the last one); senders keep at least twice this in flight
+#define BULK_ACK_INTERVAL 4
+
+// One piece of a snappy-compressed bulk transfer
+class BulkChunkPacket : public MomentumPacket
+{
+  public:
+    uint32 transfer_id;
+    int transfer_type;
+    uint32 compressed_size;   // Of the whole transfer
+    uint32 chunk_index;
+    CUtlBuffer dataBuf;
+
+    BulkChunkPacket() : transfer_id(0), transfer_type(BULK_TRANSFER_INVALID), compressed_size(0), chunk_index(0)
+    {
+        dataBuf.SetBigEndian(false);
+    }
+
+    BulkChunkPacket(CUtlBuffer &buf)
+    {
+        transfer_id = buf.GetUnsignedInt();
+
+        transfer_type = buf.GetUnsignedChar();
+        if (transfer_type < BULK_TRANSFER_FIRST || transfer_type > BULK_TRANSFER_LAST)
+            transfer_type = BULK_TRANSFER_INVALID;
+
+        compressed_size = buf.GetUnsignedInt();
+        chunk_index = buf.GetUnsignedInt();
+
+        const int iDataSize = buf.GetUnsignedShort();
+        dataBuf.SetBigEndian(false);
+        if (buf.IsValid() && iDataSize <= BULK_CHUNK_SIZE && iDataSize <= buf.GetBytesRemaining())
+            dataBuf.Put(buf.PeekGet(), iDataSize);
+        else
+            transfer_type = BULK_TRANSFER_INVALID;
+    }
+
+    PacketType GetType() const OVERRIDE { return PACKET_TYPE_BULK_CHUNK; }
+
+    void Write(CUtlBuffer &buf) OVERRIDE
+    {
+        MomentumPacket::Write(buf);
+        buf.PutUnsignedInt(transfer_id);
+        buf.PutUnsignedChar(transfer_type);
+        buf.PutUnsignedInt(compressed_size);
+        buf.PutUnsignedInt(chunk_index);
+        buf.PutUnsignedShort(dataBuf.TellPut());
+        buf.Put(dataBuf.Base(), dataBuf.TellPut());
+    }
+};
+
+// Receiver -> sender: how many chunks arrived so far, or that the transfer should stop
+class BulkAckPacket : public MomentumPacket
+{
+  public:
+    uint32 transfer_id;
+    uint32 chunks_received;
+    bool cancel;
+
+    BulkAckPacket() : transfer_id(0), chunks_received(0), cancel(false) {}
+
+    BulkAckPacket(CUtlBuffer &buf)
+    {
+        transfer_id = buf.GetUnsignedInt();
+        chunks_received = buf.GetUnsignedInt();
+        cancel = buf.GetUnsignedChar() != 0;
+    }
+
+    PacketType GetType() const OVERRIDE { return PACKET_TYPE_BULK_ACK; }
+
+    void Write(CUtlBuffer &buf) OVERRIDE
+    {
+        MomentumPacket::Write(buf);
+        buf.PutUnsignedInt(transfer_id);
+        buf.PutUnsignedInt(chunks_received);
+        buf.PutUnsignedChar(cancel);
+    }
+};
+
+enum ReplayStreamType_t
+{
+    REPLAY_STREAM_REQUEST = 0,  // Spectator -> runner: start streaming your recording to me
+    REPLAY_STREAM_STOP,         // Spectator -> runner: stop streaming to me
+    REPLAY_STREAM_HEADER,       // Runner -> spectator: a new recording started (CReplayHeader + zone count)
+    REPLAY_STREAM_BLOCK,        // Runner -> spectator: snappy-compressed frames, starting at first_frame
+    REPLAY_STREAM_END,          // Runner -> spectator: the recording was saved (CReplayHeader, trimmed frames, run stats)
+
+    REPLAY_STREAM_FIRST = REPLAY_STREAM_REQUEST,
+    REPLAY_STREAM_LAST = REPLAY_STREAM_END,
+    REPLAY_STREAM_INVALID = -1
+};
+
+// Streams the frames of a run being recorded to the lobby members spectating it
+class ReplayStreamPacket : public MomentumPacket
+{
+  public:
+    int stream_type;
+    uint32 generation;  // Which recording of the runner this is about, bumped on every new recording
+    uint32 first_frame; // BLOCK: index of the first frame in dataBuf
+    uint32 frame_count; // BLOCK: amount of frames in dataBuf
+    CUtlBuffer dataBuf;
+
+    ReplayStreamPacket() : stream_type(REPLAY_STREAM_INVALID), generation(0), first_frame(0), frame_count(0)
+    {
+        dataBuf.SetBigEndian(false);
+    }
+
+    ReplayStreamPacket(CUtlBuffer &buf)
+    {
+        stream_type = buf.GetUnsignedChar();
+        if (stream_type < REPLAY_STREAM_FIRST || stream_type > REPLAY_STREAM_LAST)
+            stream_type = REPLAY_STREAM_INVALID;
+
+        generation = buf.GetUnsignedInt();
+        first_frame = buf.GetUnsignedInt();
+        frame_count = buf.GetUnsignedInt();
+
+        dataBuf.SetBigEndian(false);
+        if (buf.IsValid())
+            dataBuf.Put(buf.PeekGet(), buf.GetBytesRemaining());
+        else
+            stream_type = REPLAY_STREAM_INVALID;
+    }
+
+    PacketType GetType() const OVERRIDE { return PACKET_TYPE_REPLAY_STREAM; }
+
+    void Write(CUtlBuffer &buf) OVERRIDE
+    {
+        MomentumPacket::Write(buf);
+        buf.PutUnsignedChar(stream_type);
+        buf.PutUnsignedInt(generation);
+        buf.PutUnsignedInt(first_frame);
+        buf.PutUnsignedInt(frame_count);
+        buf.Put(dataBuf.Base(), dataBuf.TellPut());
+    }
+};
+
 extern ConVar mm_updaterate;
\ No newline at end of file
@@ -0,0 +1,407 @@
+#include "cbase.h"
+
+#include "mom_profiler.h"
+#include "filesystem.h"
+
+#include "tier0/memdbgon.h"
+
+#define COUNTER_EVENT_DEPTH 0xFFFF
+
+#ifdef CLIENT_DLL
+#define PROF_COMMAND_NAME(name) "cl_" name
+#define PROF_TRACE_PID 2
+#else
+#define PROF_COMMAND_NAME(name) name
+#define PROF_TRACE_PID 1
+#endif
+
+static void OnProfilerEnableChanged(IConVar *pVar, const char *pOldValue, float flOldValue)
+{
+    ConVarRef var(pVar);
+    g_pMomProfiler->SetEnabled(var.GetBool());
+}
+
+static ConVar mom_prof_enable(PROF_COMMAND_NAME("mom_prof_enable"), "0", FCVAR_NONE,
+                              "Toggles timing the Momentum systems, see the mom_prof_ commands for the results.\n", true, 0, true, 1,
+                              OnProfilerEnableChanged);
+
+static void ProfReport(const CCommand &args)
+{
+    g_pMomProfiler->PrintReport();
+}
+
+static void ProfDump(const CCommand &args)
+{
+    if (args.ArgC() < 2)
+    {
+        Msg("Usage: %s <file.csv|file.json>\n", args[0]);
+        return;
+    }
+
+    if (g_pMomProfiler->Dump(args[1]))
+        Msg("Wrote the profiler history to %s\n", args[1]);
+}
+
+static void ProfStream(const CCommand &args)
+{
+    if (args.ArgC() < 2)
+    {
+        Msg("Usage: %s <file.json>\n", args[0]);
+        return;
+    }
+
+    if (g_pMomProfiler->StartStream(args[1]))
+        Msg("Streaming the profiler trace events to %s\n", args[1]);
+}
+
+static void ProfStreamStop(const CCommand &args)
+{
+    g_pMomProfiler->StopStream();
+}
+
+static ConCommand mom_prof_report(PROF_COMMAND_NAME("mom_prof_report"), ProfReport,
+                                  "Prints the average and percentile frame times of every profiled Momentum system.\n");
+static ConCommand mom_prof_dump(PROF_COMMAND_NAME("mom_prof_dump"), ProfDump,
+                                "Writes the profiled frames to a file: a .csv with one row per frame, "
+                                "or trace events (JSON) for trace viewers for any other extension.\n");
+static ConCommand mom_prof_stream(PROF_COMMAND_NAME("mom_prof_stream"), ProfStream,
+                                  "Keeps writing the trace events (JSON) of the profiled systems to a file, until mom_prof_stream_stop.\n");
+static ConCommand mom_prof_stream_stop(PROF_COMMAND_NAME("mom_prof_stream_stop"), ProfStreamStop,
+                                       "Stops mom_prof_stream.\n");
+
+static int __cdecl CompareFloats(const float *pA, const float *pB)
+{
+    return *pA < *pB ? -1 : (*pA > *pB ? 1 : 0);
+}
+
+// Value at the given percentile of the (sorted) values
+static float GetPercentile(const CUtlVector<float> &vecSorted, float flPercentile)
+{
+    if (vecSorted.IsEmpty())
+        return 0.0f;
+
+    return vecSorted[static_cast<int>(flPercentile * (vecSorted.Count() - 1) + 0.5f)];
+}
+
+CMomProfiler::CMomProfiler() : CAutoGameSystemPerFrame("CMomProfiler"), m_bEnabled(false), m_iDepth(0),
+    m_iScopeCount(0), m_iFrame(0), m_flLastFrameTime(0.0), m_pEvents(nullptr), m_iEventCount(0),
+    m_hStream(FILESYSTEM_INVALID_HANDLE), m_iStreamedEvents(0), m_bStreamedAny(false), m_flTraceStartTime(0.0)
+{
+    V_memset(m_pScopes, 0, sizeof(m_pScopes));
+    V_memset(m_flFrameHistoryUs, 0, sizeof(m_flFrameHistoryUs));
+}
+
+void CMomProfiler::Shutdown()
+{
+    StopStream();
+
+    m_bEnabled = false;
+
+    for (int i = 0; i < m_iScopeCount; i++)
+        delete m_pScopes[i];
+    m_iScopeCount = 0;
+
+    delete[] m_pEvents;
+    m_pEvents = nullptr;
+}
+
+#ifdef CLIENT_DLL
+void CMomProfiler::Update(float frametime)
+{
+    EndFrame();
+}
+#else
+void CMomProfiler::FrameUpdatePostEntityThink()
+{
+    EndFrame();
+}
+#endif
+
+void CMomProfiler::SetEnabled(bool bEnabled)
+{
+    if (m_bEnabled == bEnabled)
+        return;
+
+    if (bEnabled)
+    {
+        if (!m_pEvents)
+            m_pEvents = new Event_t[MOM_PROF_MAX_EVENTS];
+
+        // Start over, the old history would have a hole in it
+        for (int i = 0; i < m_iScopeCount; i++)
+        {
+            Scope_t *pScope = m_pScopes[i];
+            pScope->m_flFrameUs = 0.0f;
+            pScope->m_iFrameCalls = 0;
+            V_memset(pScope->m_flHistoryUs, 0, sizeof(pScope->m_flHistoryUs));
+            V_memset(pScope->m_iHistoryCalls, 0, sizeof(pScope->m_iHistoryCalls));
+        }
+
+        V_memset(m_flFrameHistoryUs, 0, sizeof(m_flFrameHistoryUs));
+        m_iFrame = 0;
+        m_iDepth = 0;
+        m_iEventCount = 0;
+        m_iStreamedEvents = 0;
+        m_flLastFrameTime = 0.0;
+        m_flTraceStartTime = Plat_FloatTime();
+    }
+    else
+    {
+        StopStream();
+    }
+
+    m_bEnabled = bEnabled;
+
+    if (mom_prof_enable.GetBool() != bEnabled)
+        mom_prof_enable.SetValue(bEnabled);
+}
+
+int CMomProfiler::RegisterScope(const char *pName)
+{
+    for (int i = 0; i < m_iScopeCount; i++)
+    {
+        if (!Q_strcmp(m_pScopes[i]->m_pName, pName))
+            return i;
+    }
+
+    if (m_iScopeCount == MOM_PROF_MAX_SCOPES)
+    {
+        Warning("Too many profiler scopes, not timing %s!\n", pName);
+        return -1;
+    }
+
+    Scope_t *pScope = new Scope_t;
+    V_memset(pScope, 0, sizeof(Scope_t));
+    pScope->m_pName = pName;
+
+    m_pScopes[m_iScopeCount] = pScope;
+    return m_iScopeCount++;
+}
+
+void CMomProfiler::ExitScope(int iScope, double flStartTime, float flDurationUs)
+{
+    m_iDepth = max(m_iDepth - 1, 0);
+
+    Scope_t *pScope = m_pScopes[iScope];
+    pScope->m_flFrameUs += flDurationUs;
+    pScope->m_iFrameCalls++;
+
+    Event_t &event = m_pEvents[m_iEventCount % MOM_PROF_MAX_EVENTS];
+    event.m_flStartTime = flStartTime;
+    event.m_flDurationUs = flDurationUs;
+    event.m_iScope = iScope;
+    event.m_iDepth = m_iDepth;
+    m_iEventCount++;
+}
+
+void CMomProfiler::SetCounter(int &iCounter, const char *pName, float flValue)
+{
+    if (!m_bEnabled || !ThreadInMainThread())
+        return;
+
+    if (iCounter == -1)
+    {
+        iCounter = RegisterScope(pName);
+        if (iCounter == -1)
+            return;
+
+        m_pScopes[iCounter]->m_bCounter = true;
+    }
+
+    Scope_t *pScope = m_pScopes[iCounter];
+    pScope->m_flFrameUs = flValue;
+    pScope->m_iFrameCalls = 1;
+
+    Event_t &event = m_pEvents[m_iEventCount % MOM_PROF_MAX_EVENTS];
+    event.m_flStartTime = Plat_FloatTime();
+    event.m_flDurationUs = flValue;
+    event.m_iScope = iCounter;
+    event.m_iDepth = COUNTER_EVENT_DEPTH;
+    m_iEventCount++;
+}
+
+void CMomProfiler::EndFrame()
+{
+    if (!m_bEnabled)
+        return;
+
+    const double flNow = Plat_FloatTime();
+    const int iSlot = m_iFrame % MOM_PROF_HISTORY_FRAMES;
+
+    m_flFrameHistoryUs[iSlot] = m_flLastFrameTime > 0.0 ? static_cast<float>((flNow - m_flLastFrameTime) * 1000000.0) : 0.0f;
+    m_flLastFrameTime = flNow;
+
+    for (int i = 0; i < m_iScopeCount; i++)
+    {
+        Scope_t *pScope = m_pScopes[i];
+        pScope->m_flHistoryUs[iSlot] = pScope->m_flFrameUs;
+        pScope->m_iHistoryCalls[iSlot] = static_cast<uint16>(min(pScope->m_iFrameCalls, 0xFFFF));
+        // Counters keep their value until they are set again
+        if (!pScope->m_bCounter)
+            pScope->m_flFrameUs = 0.0f;
+        pScope->m_iFrameCalls = 0;
+    }
+
+    m_iFrame++;
+
+    if (m_hStream != FILESYSTEM_INVALID_HANDLE)
+    {
+        // Events that got overwritten before we could write them are lost
+        if (m_iEventCount - m_iStreamedEvents > MOM_PROF_MAX_EVENTS)
+            m_iStreamedEvents = m_iEventCount - MOM_PROF_MAX_EVENTS;
+
+        for (; m_iStreamedEvents < m_iEventCount; m_iStreamedEvents++)
+        {
+            WriteTraceEvent(m_hStream, m_pEvents[m_iStreamedEvents % MOM_PROF_MAX_EVENTS], !m_bStreamedAny);
+            m_bStreamedAny = true;
+        }
+    }
+}
+
+void CMomProfiler::PrintReport()
+{
+    const int iFrames = min(m_iFrame, MOM_PROF_HISTORY_FRAMES);
+    if (!iFrames)
+    {
+        Msg("Nothing was profiled yet, enable %s first.\n", mom_prof_enable.GetName());
+        return;
+    }
+
+    Msg("Last %i frames (ms):\n", iFrames);
+    Msg("%-40s %8s %8s %8s %8s %8s %8s\n", "Scope", "Calls", "Avg", "50%", "95%", "99%", "Max");
+
+    CUtlVector<float> vecSorted;
+    vecSorted.EnsureCapacity(iFrames);
+
+    for (int i = -1; i < m_iScopeCount; i++)
+    {
+        // The first row is the whole frame
+        const float *pHistory = i == -1 ? m_flFrameHistoryUs : m_pScopes[i]->m_flHistoryUs;
+
+        vecSorted.RemoveAll();
+        float flTotal = 0.0f;
+        int iCalls = 0;
+        for (int j = 0; j < iFrames; j++)
+        {
+            vecSorted.AddToTail(pHistory[j]);
+            flTotal += pHistory[j];
+            if (i != -1)
+                iCalls += m_pScopes[i]->m_iHistoryCalls[j];
+        }
+        vecSorted.Sort(CompareFloats);
+
+        // Counters are values, not times
+        const float flScale = i != -1 && m_pScopes[i]->m_bCounter ? 1.0f : 1.0f / 1000.0f;
+        Msg("%-40s %8.1f %8.3f %8.3f %8.3f %8.3f %8.3f\n", i == -1 ? "Frame" : m_pScopes[i]->m_pName,
+            i == -1 ? 1.0f : static_cast<float>(iCalls) / iFrames, flTotal / iFrames * flScale,
+            GetPercentile(vecSorted, 0.5f) * flScale, GetPercentile(vecSorted, 0.95f) * flScale,
+            GetPercentile(vecSorted, 0.99f) * flScale, vecSorted.Tail() * flScale);
+    }
+}
+
+bool CMomProfiler::Dump(const char *pFileName)
+{
+    if (!m_iFrame)
+    {
+        Warning("Nothing was profiled yet, enable %s first.\n", mom_prof_enable.GetName());
+        return false;
+    }
+
+    const FileHandle_t hFile = g_pFullFileSystem->Open(pFileName, "w", "MOD");
+    if (hFile == FILESYSTEM_INVALID_HANDLE)
+    {
+        Warning("Could not open %s for writing!\n", pFileName);
+        return false;
+    }
+
+    const char *pExtension = V_GetFileExtension(pFileName);
+    const bool bResult = pExtension && !Q_stricmp(pExtension, "csv") ? DumpCSV(hFile) : DumpTrace(hFile);
+
+    g_pFullFileSystem->Close(hFile);
+    return bResult;
+}
+
+bool CMomProfiler::StartStream(const char *pFileName)
+{
+    StopStream();
+
+    m_hStream = g_pFullFileSystem->Open(pFileName, "w", "MOD");
+    if (m_hStream == FILESYSTEM_INVALID_HANDLE)
+    {
+        Warning("Could not open %s for writing!\n", pFileName);
+        return false;
+    }
+
+    SetEnabled(true);
+
+    // JSON array format, trace viewers accept it without the closing bracket if we never get to write it
+    g_pFullFileSystem->FPrintf(m_hStream, "[\n");
+    m_iStreamedEvents = m_iEventCount;
+    m_bStreamedAny = false;
+    return true;
+}
+
+void CMomProfiler::StopStream()
+{
+    if (m_hStream == FILESYSTEM_INVALID_HANDLE)
+        return;
+
+    g_pFullFileSystem->FPrintf(m_hStream, "\n]\n");
+    g_pFullFileSystem->Close(m_hStream);
+    m_hStream = FILESYSTEM_INVALID_HANDLE;
+}
+
+void CMomProfiler::WriteTraceEvent(FileHandle_t hFile, const Event_t &event, bool bFirst)
+{
+    const double flTimestamp = (event.m_flStartTime - m_flTraceStartTime) * 1000000.0;
+    if (event.m_iDepth == COUNTER_EVENT_DEPTH)
+    {
+        g_pFullFileSystem->FPrintf(hFile, "%s{\"name\":\"%s\",\"cat\":\"Momentum\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%i,\"args\":{\"value\":%g}}",
+                                   bFirst ? "" : ",\n", m_pScopes[event.m_iScope]->m_pName, flTimestamp, PROF_TRACE_PID,
+                                   event.m_flDurationUs);
+        return;
+    }
+
+    // Complete events, the viewers nest them by their times
+    g_pFullFileSystem->FPrintf(hFile, "%s{\"name\":\"%s\",\"cat\":\"Momentum\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%i,\"tid\":1}",
+                               bFirst ? "" : ",\n", m_pScopes[event.m_iScope]->m_pName,
+                               flTimestamp, event.m_flDurationUs, PROF_TRACE_PID);
+}
+
+bool CMomProfiler::DumpCSV(FileHandle_t hFile)
+{
+    g_pFullFileSystem->FPrintf(hFile, "frame,frame_ms");
+    for (int i = 0; i < m_iScopeCount; i++)
+        g_pFullFileSystem->FPrintf(hFile, ",%s", m_pScopes[i]->m_pName);
+    g_pFullFileSystem->FPrintf(hFile, "\n");
+
+    // Oldest frame first
+    for (int iFrame = max(0, m_iFrame - MOM_PROF_HISTORY_FRAMES); iFrame < m_iFrame; iFrame++)
+    {
+        const int iSlot = iFrame % MOM_PROF_HISTORY_FRAMES;
+        g_pFullFileSystem->FPrintf(hFile, "%i,%.4f", iFrame, m_flFrameHistoryUs[iSlot] / 1000.0f);
+        for (int i = 0; i < m_iScopeCount; i++)
+        {
+            const Scope_t *pScope = m_pScopes[i];
+            g_pFullFileSystem->FPrintf(hFile, ",%.4f", pScope->m_bCounter ? pScope->m_flHistoryUs[iSlot] : pScope->m_flHistoryUs[iSlot] / 1000.0f);
+        }
+        g_pFullFileSystem->FPrintf(hFile, "\n");
+    }
+
+    return true;
+}
+
+bool CMomProfiler::DumpTrace(FileHandle_t hFile)
+{
+    g_pFullFileSystem->FPrintf(hFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    const uint32 iFirst = m_iEventCount > MOM_PROF_MAX_EVENTS ? m_iEventCount - MOM_PROF_MAX_EVENTS : 0;
+    for (uint32 i = iFirst; i < m_iEventCount; i++)
+        WriteTraceEvent(hFile, m_pEvents[i % MOM_PROF_MAX_EVENTS], i == iFirst);
+
+    g_pFullFileSystem->FPrintf(hFile, "\n]}\n");
+    return true;
+}
+
+static CMomProfiler s_MomProfiler;
+CMomProfiler *g_pMomProfiler = &s_MomProfiler;
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "tier0/vprof.h"
+#include "tier0/fasttimer.h"
+
+#define VPROF_BUDGETGROUP_MOMENTUM _T("Momentum")
+
+#define MOM_PROF_HISTORY_FRAMES 512 // Frames kept for the reports and the CSV dumps
+#define MOM_PROF_MAX_EVENTS 65536 // Scope events kept for the trace dumps
+#define MOM_PROF_MAX_SCOPES 128
+
+// Times a Momentum subsystem. Also shows up in the VProf budget panel, under the Momentum group.
+// Only the main thread is profiled, the scope does nothing anywhere else.
+#define MOM_PROF_SCOPE(name)                                                                                           \
+    VPROF_BUDGET(name, VPROF_BUDGETGROUP_MOMENTUM);                                                                    \
+    static int s_iMomProfScope = -1;                                                                                   \
+    CMomProfScope momProfScope(s_iMomProfScope, name)
+
+// Records a value (entity count...) next to the times, shown as a counter track in the traces
+#define MOM_PROF_COUNTER(name, value)                                                                                  \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        static int s_iMomProfCounter = -1;                                                                             \
+        g_pMomProfiler->SetCounter(s_iMomProfCounter, name, value);                                                    \
+    } while (0)
+
+// Keeps the per frame time of every MOM_PROF_SCOPE in a ring buffer, for percentile reports and CSV/trace dumps.
+// Both the client and the server have their own, the client's commands are prefixed with "cl_".
+class CMomProfiler : public CAutoGameSystemPerFrame
+{
+public:
+    CMomProfiler();
+
+    // CAutoGameSystemPerFrame
+    void Shutdown() OVERRIDE;
+#ifdef CLIENT_DLL
+    void Update(float frametime) OVERRIDE;
+#else
+    void FrameUpdatePostEntityThink() OVERRIDE;
+#endif
+
+    bool IsEnabled() const { return m_bEnabled; }
+    void SetEnabled(bool bEnabled);
+
+    // Returns the index of the scope, scopes with the same name share it. pName has to outlive the profiler.
+    int RegisterScope(const char *pName);
+    void EnterScope() { m_iDepth++; }
+    void ExitScope(int iScope, double flStartTime, float flDurationUs);
+    void SetCounter(int &iCounter, const char *pName, float flValue);
+
+    void PrintReport();
+    // The format is picked from the extension: .csv for the frame history, anything else for trace events (JSON)
+    bool Dump(const char *pFileName);
+    // Writes the trace events to the file as they happen, until StopStream
+    bool StartStream(const char *pFileName);
+    void StopStream();
+
+private:
+    struct Scope_t
+    {
+        const char *m_pName;
+        bool m_bCounter; // Holds values instead of times
+        float m_flFrameUs; // Accumulated this frame, the last value for counters
+        int m_iFrameCalls;
+        float m_flHistoryUs[MOM_PROF_HISTORY_FRAMES];
+        uint16 m_iHistoryCalls[MOM_PROF_HISTORY_FRAMES];
+    };
+
+    struct Event_t
+    {
+        double m_flStartTime;
+        float m_flDurationUs;
+        uint16 m_iScope;
+        uint16 m_iDepth; // COUNTER_EVENT_DEPTH for counters, the value is in m_flDurationUs
+    };
+
+    void EndFrame();
+    void WriteTraceEvent(FileHandle_t hFile, const Event_t &event, bool bFirst);
+    bool DumpCSV(FileHandle_t hFile);
+    bool DumpTrace(FileHandle_t hFile);
+
+    bool m_bEnabled;
+    int m_iDepth;
+
+    Scope_t *m_pScopes[MOM_PROF_MAX_SCOPES];
+    int m_iScopeCount;
+
+    float m_flFrameHistoryUs[MOM_PROF_HISTORY_FRAMES];
+    int m_iFrame; // Frames recorded since the profiler got enabled
+    double m_flLastFrameTime;
+
+    Event_t *m_pEvents;
+    uint32 m_iEventCount; // Total, the ring index is this modulo MOM_PROF_MAX_EVENTS
+
+    FileHandle_t m_hStream;
+    uint32 m_iStreamedEvents;
+    bool m_bStreamedAny;
+    double m_flTraceStartTime;
+};
+
+extern CMomProfiler *g_pMomProfiler;
+
+class CMomProfScope
+{
+public:
+    CMomProfScope(int &iScope, const char *pName)
+    {
+        m_bActive = g_pMomProfiler->IsEnabled() && ThreadInMainThread();
+        if (!m_bActive)
+            return;
+
+        if (iScope == -1)
+            iScope = g_pMomProfiler->RegisterScope(pName);
+
+        m_iScope = iScope;
+        m_bActive = m_iScope != -1;
+        if (!m_bActive)
+            return;
+
+        g_pMomProfiler->EnterScope();
+        m_flStartTime = Plat_FloatTime();
+        m_Timer.Start();
+    }
+
+    ~CMomProfScope()
+    {
+        if (!m_bActive)
+            return;
+
+        m_Timer.End();
+        g_pMomProfiler->ExitScope(m_iScope, m_flStartTime, static_cast<float>(m_Timer.GetDuration().GetMicrosecondsF()));
+    }
+
+private:
+    bool m_bActive;
+    int m_iScope;
+    double m_flStartTime;
+    CFastTimer m_Timer;
+};
@@ -266,6 +266,7 @@ enum SpectateMessageType_t
 #define MAP_FOLDER "maps"
 #define RECORDING_PATH "replays"
 #define RECORDING_ONLINE_PATH "online"
+#define RECORDING_CACHE_PATH "cache" // Downloaded replays, by run hash (see CMomReplayCache)
 #define EXT_ZONE_FILE ".zon"
 #define EXT_RECORDING_FILE ".mrf"
 
@@ -53,4 +53,5 @@ void RegisterUserMessages(void)
     usermessages->Register("SpecUpdateMsg", 17);
 
     usermessages->Register("DamageIndicator", -1);
+    usermessages->Register("RunStatsDelta", -1);
 }
\ No newline at end of file
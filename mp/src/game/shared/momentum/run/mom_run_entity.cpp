@@ -17,6 +17,8 @@
 CMomRunEntity::CMomRunEntity()
 {
 #ifdef GAME_DLL
+    g_pRunStatsNetworker->AddRunEntity(this);
+
     if (g_pGameModeSystem->IsTF2BasedMode())
     {
         gEntList.AddListenerEntity(this);
@@ -27,6 +29,8 @@ CMomRunEntity::CMomRunEntity()
 CMomRunEntity::~CMomRunEntity()
 {
 #ifdef GAME_DLL
+    g_pRunStatsNetworker->RemoveRunEntity(this);
+
     if (g_pGameModeSystem->IsTF2BasedMode())
     {
         gEntList.RemoveListenerEntity(this);
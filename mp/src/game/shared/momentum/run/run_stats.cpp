@@ -1,62 +1,23 @@
 #include "cbase.h"
 #include "run_stats.h"
 #include "mom_player_shared.h"
-
-#include "tier0/memdbgon.h"
+#include "mom_run_entity.h"
 
 #ifdef CLIENT_DLL
-BEGIN_RECV_TABLE_NOBASE(C_MomRunStats, DT_MomRunStats)
-RecvPropInt(RECVINFO(m_iTotalZones), SPROP_UNSIGNED),
-//Keypress
-RecvPropArray3(RECVINFO_ARRAY(m_iZoneJumps), RecvPropInt(RECVINFO(m_iZoneJumps[0]), SPROP_UNSIGNED | SPROP_CHANGES_OFTEN)),
-RecvPropArray3(RECVINFO_ARRAY(m_iZoneStrafes), RecvPropInt(RECVINFO(m_iZoneStrafes[0]), SPROP_UNSIGNED | SPROP_CHANGES_OFTEN)),
-//Sync
-RecvPropArray3(RECVINFO_ARRAY(m_flZoneStrafeSyncAvg), RecvPropFloat(RECVINFO(m_flZoneStrafeSyncAvg[0]), SPROP_CHANGES_OFTEN)),
-RecvPropArray3(RECVINFO_ARRAY(m_flZoneStrafeSync2Avg), RecvPropFloat(RECVINFO(m_flZoneStrafeSync2Avg[0]), SPROP_CHANGES_OFTEN)),
-//Time
-RecvPropArray3(RECVINFO_ARRAY(m_iZoneEnterTick), RecvPropInt(RECVINFO(m_iZoneEnterTick[0]), SPROP_UNSIGNED)),
-RecvPropArray3(RECVINFO_ARRAY(m_iZoneTicks), RecvPropInt(RECVINFO(m_iZoneTicks[0]), SPROP_UNSIGNED)),
-//Velocity
-RecvPropArray3(RECVINFO_ARRAY(m_flZoneEnterSpeed3D), RecvPropFloat(RECVINFO(m_flZoneEnterSpeed3D[0]))),
-RecvPropArray3(RECVINFO_ARRAY(m_flZoneEnterSpeed2D), RecvPropFloat(RECVINFO(m_flZoneEnterSpeed2D[0]))),
-RecvPropArray3(RECVINFO_ARRAY(m_flZoneExitSpeed3D), RecvPropFloat(RECVINFO(m_flZoneExitSpeed3D[0]))),
-RecvPropArray3(RECVINFO_ARRAY(m_flZoneExitSpeed2D), RecvPropFloat(RECVINFO(m_flZoneExitSpeed2D[0]))),
-RecvPropArray3(RECVINFO_ARRAY(m_flZoneVelocityAvg3D), RecvPropFloat(RECVINFO(m_flZoneVelocityAvg3D[0]))),
-RecvPropArray3(RECVINFO_ARRAY(m_flZoneVelocityAvg2D), RecvPropFloat(RECVINFO(m_flZoneVelocityAvg2D[0]))),
-RecvPropArray3(RECVINFO_ARRAY(m_flZoneVelocityMax3D), RecvPropFloat(RECVINFO(m_flZoneVelocityMax3D[0]))),
-RecvPropArray3(RECVINFO_ARRAY(m_flZoneVelocityMax2D), RecvPropFloat(RECVINFO(m_flZoneVelocityMax2D[0]))),
-END_RECV_TABLE();
-#else
-BEGIN_SEND_TABLE_NOBASE(CMomRunStats, DT_MomRunStats)
-SendPropInt(SENDINFO(m_iTotalZones), 7, SPROP_UNSIGNED),
-//Keypress
-SendPropArray3(SENDINFO_ARRAY3(m_iZoneJumps), SendPropInt(SENDINFO_ARRAY(m_iZoneJumps), -1, SPROP_UNSIGNED | SPROP_CHANGES_OFTEN)),
-SendPropArray3(SENDINFO_ARRAY3(m_iZoneStrafes), SendPropInt(SENDINFO_ARRAY(m_iZoneStrafes), -1, SPROP_UNSIGNED | SPROP_CHANGES_OFTEN)),
-//Sync
-SendPropArray3(SENDINFO_ARRAY3(m_flZoneStrafeSyncAvg), SendPropFloat(SENDINFO_ARRAY(m_flZoneStrafeSyncAvg), -1, SPROP_CHANGES_OFTEN)),
-SendPropArray3(SENDINFO_ARRAY3(m_flZoneStrafeSync2Avg), SendPropFloat(SENDINFO_ARRAY(m_flZoneStrafeSync2Avg), -1, SPROP_CHANGES_OFTEN)),
-//Time
-SendPropArray3(SENDINFO_ARRAY3(m_iZoneEnterTick), SendPropInt(SENDINFO_ARRAY(m_iZoneEnterTick), -1, SPROP_UNSIGNED)),
-SendPropArray3(SENDINFO_ARRAY3(m_iZoneTicks), SendPropInt(SENDINFO_ARRAY(m_iZoneTicks), -1, SPROP_UNSIGNED)),
-//Velocity
-SendPropArray3(SENDINFO_ARRAY3(m_flZoneEnterSpeed3D), SendPropFloat(SENDINFO_ARRAY(m_flZoneEnterSpeed3D))),
-SendPropArray3(SENDINFO_ARRAY3(m_flZoneEnterSpeed2D), SendPropFloat(SENDINFO_ARRAY(m_flZoneEnterSpeed2D))),
-SendPropArray3(SENDINFO_ARRAY3(m_flZoneExitSpeed3D), SendPropFloat(SENDINFO_ARRAY(m_flZoneExitSpeed3D))),
-SendPropArray3(SENDINFO_ARRAY3(m_flZoneExitSpeed2D), SendPropFloat(SENDINFO_ARRAY(m_flZoneExitSpeed2D))),
-SendPropArray3(SENDINFO_ARRAY3(m_flZoneVelocityAvg3D), SendPropFloat(SENDINFO_ARRAY(m_flZoneVelocityAvg3D))),
-SendPropArray3(SENDINFO_ARRAY3(m_flZoneVelocityAvg2D), SendPropFloat(SENDINFO_ARRAY(m_flZoneVelocityAvg2D))),
-SendPropArray3(SENDINFO_ARRAY3(m_flZoneVelocityMax3D), SendPropFloat(SENDINFO_ARRAY(m_flZoneVelocityMax3D))),
-SendPropArray3(SENDINFO_ARRAY3(m_flZoneVelocityMax2D), SendPropFloat(SENDINFO_ARRAY(m_flZoneVelocityMax2D))),
-END_SEND_TABLE();
+#include "c_user_message_register.h"
 #endif
+#include "mom_profiler.h"
+
+#include "tier0/memdbgon.h"
 
-CMomRunStats::CMomRunStats(uint8 size /* = MAX_ZONES*/)
+CMomRunStats::CMomRunStats(uint8 size /* = MAX_ZONES*/) : m_iTotalZones(0)
 {
     Init(size);
 }
 
-CMomRunStats::CMomRunStats(CUtlBuffer &reader)
+CMomRunStats::CMomRunStats(CUtlBuffer &reader) : m_iTotalZones(0)
 {
+    Init();
     Deserialize(reader);
 }
 
@@ -68,20 +29,24 @@ void CMomRunStats::Init(uint8 size /* = MAX_ZONES*/)
 
     // initialize everything to 0
     // Note: We do m_iTotalZones + 1 because 0 is overall!
-    for (int i = 0; i < MAX_ZONES + 1; ++i)
-    {
-        SetZoneJumps(i, 0);
-        SetZoneStrafes(i, 0);
-        SetZoneStrafeSyncAvg(i, 0);
-        SetZoneStrafeSync2Avg(i, 0);
-        SetZoneEnterTick(i, 0);
-        SetZoneTicks(i, 0);
-
-        SetZoneEnterSpeed(i, 0.0f, 0.0f);
-        SetZoneVelocityMax(i, 0.0f, 0.0f);
-        SetZoneVelocityAvg(i, 0.0f, 0.0f);
-        SetZoneExitSpeed(i, 0.0f, 0.0f);
-    }
+    Q_memset(m_iZoneJumps, 0, sizeof(m_iZoneJumps));
+    Q_memset(m_iZoneStrafes, 0, sizeof(m_iZoneStrafes));
+    Q_memset(m_iZoneTicks, 0, sizeof(m_iZoneTicks));
+    Q_memset(m_iZoneEnterTick, 0, sizeof(m_iZoneEnterTick));
+    Q_memset(m_flZoneStrafeSyncAvg, 0, sizeof(m_flZoneStrafeSyncAvg));
+    Q_memset(m_flZoneStrafeSync2Avg, 0, sizeof(m_flZoneStrafeSync2Avg));
+    Q_memset(m_flZoneEnterSpeed3D, 0, sizeof(m_flZoneEnterSpeed3D));
+    Q_memset(m_flZoneEnterSpeed2D, 0, sizeof(m_flZoneEnterSpeed2D));
+    Q_memset(m_flZoneVelocityMax3D, 0, sizeof(m_flZoneVelocityMax3D));
+    Q_memset(m_flZoneVelocityMax2D, 0, sizeof(m_flZoneVelocityMax2D));
+    Q_memset(m_flZoneVelocityAvg3D, 0, sizeof(m_flZoneVelocityAvg3D));
+    Q_memset(m_flZoneVelocityAvg2D, 0, sizeof(m_flZoneVelocityAvg2D));
+    Q_memset(m_flZoneExitSpeed3D, 0, sizeof(m_flZoneExitSpeed3D));
+    Q_memset(m_flZoneExitSpeed2D, 0, sizeof(m_flZoneExitSpeed2D));
+
+#ifdef GAME_DLL
+    MarkFullUpdate();
+#endif
 }
 
 void CMomRunStats::FullyCopyFrom(const CMomRunStats &other)
@@ -104,6 +69,10 @@ void CMomRunStats::FullyCopyFrom(const CMomRunStats &other)
         SetZoneEnterSpeed(i, other.m_flZoneEnterSpeed3D[i], other.m_flZoneEnterSpeed2D[i]);
         SetZoneExitSpeed(i, other.m_flZoneExitSpeed3D[i], other.m_flZoneExitSpeed2D[i]);
     }
+
+#ifdef GAME_DLL
+    MarkFullUpdate();
+#endif
 }
 
 void CMomRunStats::Deserialize(CUtlBuffer &reader)
@@ -138,6 +107,10 @@ void CMomRunStats::Deserialize(CUtlBuffer &reader)
         vel2D = reader.GetFloat();
         SetZoneExitSpeed(i, vel3D, vel2D);
     }
+
+#ifdef GAME_DLL
+    MarkFullUpdate();
+#endif
 }
 
 void CMomRunStats::Serialize(CUtlBuffer &writer) 
@@ -220,78 +193,412 @@ float CMomRunStats::GetZoneVelocityAvg(int zone, bool vel2D)
                : (vel2D ? m_flZoneVelocityAvg2D[zone] : m_flZoneVelocityAvg3D[zone]);
 }
 
-void CMomRunStats::SetTotalZones(uint8 zones) { m_iTotalZones = clamp<uint8>(zones, 0, MAX_ZONES); }
+void CMomRunStats::SetTotalZones(uint8 zones)
+{
+    zones = clamp<uint8>(zones, 0, MAX_ZONES);
+    if (m_iTotalZones == zones)
+        return;
+
+    m_iTotalZones = zones;
+#ifdef GAME_DLL
+    MarkFullUpdate();
+#endif
+}
 void CMomRunStats::SetZoneJumps(int zone, uint32 value)
 {
     if (zone > m_iTotalZones)
         return;
 
-    m_iZoneJumps.Set(zone, value);
+    SetZoneField(m_iZoneJumps, RUNSTATS_JUMPS, zone, value);
 }
 void CMomRunStats::SetZoneStrafes(int zone, uint32 value)
 {
     if (zone > m_iTotalZones)
         return;
 
-    m_iZoneStrafes.Set(zone, value);
+    SetZoneField(m_iZoneStrafes, RUNSTATS_STRAFES, zone, value);
 }
 void CMomRunStats::SetZoneTicks(int zone, int value)
 {
     if (zone > m_iTotalZones)
         return;
 
-    m_iZoneTicks.Set(zone, value);
+    SetZoneField(m_iZoneTicks, RUNSTATS_TICKS, zone, static_cast<uint32>(value));
 }
 void CMomRunStats::SetZoneEnterTick(int zone, int value)
 {
     if (zone > m_iTotalZones)
         return;
 
-    m_iZoneEnterTick.Set(zone, value);
+    SetZoneField(m_iZoneEnterTick, RUNSTATS_ENTER_TICK, zone, static_cast<uint32>(value));
 }
 void CMomRunStats::SetZoneStrafeSyncAvg(int zone, float value)
 {
     if (zone > m_iTotalZones)
         return;
 
-    m_flZoneStrafeSyncAvg.Set(zone, value);
+    SetZoneField(m_flZoneStrafeSyncAvg, RUNSTATS_SYNC_AVG, zone, value);
 }
 void CMomRunStats::SetZoneStrafeSync2Avg(int zone, float value)
 {
     if (zone > m_iTotalZones)
         return;
 
-    m_flZoneStrafeSync2Avg.Set(zone, value);
+    SetZoneField(m_flZoneStrafeSync2Avg, RUNSTATS_SYNC2_AVG, zone, value);
 }
 void CMomRunStats::SetZoneEnterSpeed(int zone, float vert, float hor)
 {
     if (zone > m_iTotalZones)
         return;
 
-    m_flZoneEnterSpeed3D.Set(zone, vert);
-    m_flZoneEnterSpeed2D.Set(zone, hor);
+    SetZoneField(m_flZoneEnterSpeed3D, RUNSTATS_ENTER_SPEED_3D, zone, vert);
+    SetZoneField(m_flZoneEnterSpeed2D, RUNSTATS_ENTER_SPEED_2D, zone, hor);
 }
 void CMomRunStats::SetZoneVelocityMax(int zone, float vert, float hor)
 {
     if (zone > m_iTotalZones)
         return;
 
-    m_flZoneVelocityMax3D.Set(zone, vert);
-    m_flZoneVelocityMax2D.Set(zone, hor);
+    SetZoneField(m_flZoneVelocityMax3D, RUNSTATS_VELOCITY_MAX_3D, zone, vert);
+    SetZoneField(m_flZoneVelocityMax2D, RUNSTATS_VELOCITY_MAX_2D, zone, hor);
 }
 void CMomRunStats::SetZoneVelocityAvg(int zone, float vert, float hor)
 {
     if (zone > m_iTotalZones)
         return;
 
-    m_flZoneVelocityAvg3D.Set(zone, vert);
-    m_flZoneVelocityAvg2D.Set(zone, hor);
+    SetZoneField(m_flZoneVelocityAvg3D, RUNSTATS_VELOCITY_AVG_3D, zone, vert);
+    SetZoneField(m_flZoneVelocityAvg2D, RUNSTATS_VELOCITY_AVG_2D, zone, hor);
 }
 void CMomRunStats::SetZoneExitSpeed(int zone, float vert, float hor)
 {
     if (zone > m_iTotalZones)
         return;
 
-    m_flZoneExitSpeed3D.Set(zone, vert);
-    m_flZoneExitSpeed2D.Set(zone, hor);
-}
\ No newline at end of file
+    SetZoneField(m_flZoneExitSpeed3D, RUNSTATS_EXIT_SPEED_3D, zone, vert);
+    SetZoneField(m_flZoneExitSpeed2D, RUNSTATS_EXIT_SPEED_2D, zone, hor);
+}
+
+uint32 CMomRunStats::GetFieldBits(int field, int zone) const
+{
+    const void *pValue = nullptr;
+    switch (field)
+    {
+    case RUNSTATS_JUMPS:            pValue = &m_iZoneJumps[zone]; break;
+    case RUNSTATS_STRAFES:          pValue = &m_iZoneStrafes[zone]; break;
+    case RUNSTATS_TICKS:            pValue = &m_iZoneTicks[zone]; break;
+    case RUNSTATS_ENTER_TICK:       pValue = &m_iZoneEnterTick[zone]; break;
+    case RUNSTATS_SYNC_AVG:         pValue = &m_flZoneStrafeSyncAvg[zone]; break;
+    case RUNSTATS_SYNC2_AVG:        pValue = &m_flZoneStrafeSync2Avg[zone]; break;
+    case RUNSTATS_ENTER_SPEED_3D:   pValue = &m_flZoneEnterSpeed3D[zone]; break;
+    case RUNSTATS_ENTER_SPEED_2D:   pValue = &m_flZoneEnterSpeed2D[zone]; break;
+    case RUNSTATS_VELOCITY_MAX_3D:  pValue = &m_flZoneVelocityMax3D[zone]; break;
+    case RUNSTATS_VELOCITY_MAX_2D:  pValue = &m_flZoneVelocityMax2D[zone]; break;
+    case RUNSTATS_VELOCITY_AVG_3D:  pValue = &m_flZoneVelocityAvg3D[zone]; break;
+    case RUNSTATS_VELOCITY_AVG_2D:  pValue = &m_flZoneVelocityAvg2D[zone]; break;
+    case RUNSTATS_EXIT_SPEED_3D:    pValue = &m_flZoneExitSpeed3D[zone]; break;
+    case RUNSTATS_EXIT_SPEED_2D:    pValue = &m_flZoneExitSpeed2D[zone]; break;
+    default:
+        Assert(false);
+        return 0;
+    }
+
+    uint32 bits;
+    Q_memcpy(&bits, pValue, sizeof(bits));
+    return bits;
+}
+
+void CMomRunStats::SetFieldBits(int field, int zone, uint32 bits)
+{
+    void *pValue = nullptr;
+    switch (field)
+    {
+    case RUNSTATS_JUMPS:            pValue = &m_iZoneJumps[zone]; break;
+    case RUNSTATS_STRAFES:          pValue = &m_iZoneStrafes[zone]; break;
+    case RUNSTATS_TICKS:            pValue = &m_iZoneTicks[zone]; break;
+    case RUNSTATS_ENTER_TICK:       pValue = &m_iZoneEnterTick[zone]; break;
+    case RUNSTATS_SYNC_AVG:         pValue = &m_flZoneStrafeSyncAvg[zone]; break;
+    case RUNSTATS_SYNC2_AVG:        pValue = &m_flZoneStrafeSync2Avg[zone]; break;
+    case RUNSTATS_ENTER_SPEED_3D:   pValue = &m_flZoneEnterSpeed3D[zone]; break;
+    case RUNSTATS_ENTER_SPEED_2D:   pValue = &m_flZoneEnterSpeed2D[zone]; break;
+    case RUNSTATS_VELOCITY_MAX_3D:  pValue = &m_flZoneVelocityMax3D[zone]; break;
+    case RUNSTATS_VELOCITY_MAX_2D:  pValue = &m_flZoneVelocityMax2D[zone]; break;
+    case RUNSTATS_VELOCITY_AVG_3D:  pValue = &m_flZoneVelocityAvg3D[zone]; break;
+    case RUNSTATS_VELOCITY_AVG_2D:  pValue = &m_flZoneVelocityAvg2D[zone]; break;
+    case RUNSTATS_EXIT_SPEED_3D:    pValue = &m_flZoneExitSpeed3D[zone]; break;
+    case RUNSTATS_EXIT_SPEED_2D:    pValue = &m_flZoneExitSpeed2D[zone]; break;
+    default:
+        Assert(false);
+        return;
+    }
+
+    Q_memcpy(pValue, &bits, sizeof(bits));
+}
+
+// "RunStatsDelta" layout:
+//  short   entity index
+//  byte    flags (RUNSTATS_MSG_RESET: clear all stats before applying)
+//  byte    total zones
+//  byte    zone entry count
+//  per zone entry:
+//      byte    zone number
+//      word    RunStatsField_t bitmask
+//      long    raw value, for every bit set in the mask (in field order)
+#define RUNSTATS_MSG_RESET (1 << 0)
+#define RUNSTATS_MSG_HEADER_SIZE 5
+#define RUNSTATS_MSG_ZONE_HEADER_SIZE 3
+
+#ifdef GAME_DLL
+
+static ConVar mom_runstats_net_debug("mom_runstats_net_debug", "0", FCVAR_NONE,
+                                     "Prints the bytes per second used to network run stats, compared to "
+                                     "an estimate of the old per-array send table cost.\n");
+
+static int CountDirtyFields(uint16 mask)
+{
+    int count = 0;
+    for (; mask; mask &= mask - 1)
+        ++count;
+    return count;
+}
+
+void CMomRunStats::MarkFullUpdate()
+{
+    m_bResetPending = true;
+
+    // The client starts from zeroes, so only non-zero fields need to follow
+    for (int zone = 0; zone < MAX_ZONES + 1; ++zone)
+    {
+        m_iDirtyFields[zone] = 0;
+        if (zone > m_iTotalZones)
+            continue;
+
+        for (int field = 0; field < RUNSTATS_FIELD_COUNT; ++field)
+        {
+            if (GetFieldBits(field, zone))
+                m_iDirtyFields[zone] |= 1 << field;
+        }
+    }
+}
+
+bool CMomRunStats::HasPendingChanges() const
+{
+    if (m_bResetPending)
+        return true;
+
+    for (int zone = 0; zone < MAX_ZONES + 1; ++zone)
+    {
+        if (m_iDirtyFields[zone])
+            return true;
+    }
+
+    return false;
+}
+
+int CMomRunStats::SendPendingChanges(int iEntIndex, IRecipientFilter &filter, int &iChangedFields)
+{
+    int iBytesSent = 0;
+    iChangedFields = 0;
+
+    int iNextZone = 0;
+    while (true)
+    {
+        // Pack as many changed zones as will fit in one user message
+        int iZones[MAX_ZONES + 1];
+        int iZoneCount = 0;
+        int iMsgSize = RUNSTATS_MSG_HEADER_SIZE;
+        for (; iNextZone < MAX_ZONES + 1; ++iNextZone)
+        {
+            if (!m_iDirtyFields[iNextZone])
+                continue;
+
+            const int iZoneSize = RUNSTATS_MSG_ZONE_HEADER_SIZE + sizeof(uint32) * CountDirtyFields(m_iDirtyFields[iNextZone]);
+            if (iMsgSize + iZoneSize > MAX_USER_MSG_DATA)
+                break;
+
+            iZones[iZoneCount++] = iNextZone;
+            iMsgSize += iZoneSize;
+        }
+
+        if (!iZoneCount && !m_bResetPending)
+            break;
+
+        UserMessageBegin(filter, "RunStatsDelta");
+        WRITE_SHORT(iEntIndex);
+        WRITE_BYTE(m_bResetPending ? RUNSTATS_MSG_RESET : 0);
+        WRITE_BYTE(m_iTotalZones);
+        WRITE_BYTE(iZoneCount);
+        for (int i = 0; i < iZoneCount; ++i)
+        {
+            const int zone = iZones[i];
+            WRITE_BYTE(zone);
+            WRITE_WORD(m_iDirtyFields[zone]);
+            for (int field = 0; field < RUNSTATS_FIELD_COUNT; ++field)
+            {
+                if (m_iDirtyFields[zone] & (1 << field))
+                {
+                    WRITE_LONG(static_cast<int>(GetFieldBits(field, zone)));
+                    ++iChangedFields;
+                }
+            }
+
+            m_iDirtyFields[zone] = 0;
+        }
+        MessageEnd();
+
+        m_bResetPending = false;
+        iBytesSent += iMsgSize;
+    }
+
+    return iBytesSent;
+}
+
+CMomRunStatsNetworker::CMomRunStatsNetworker() : CAutoGameSystemPerFrame("CMomRunStatsNetworker"),
+    m_iBytesSent(0), m_iLegacyBitsEstimate(0), m_flNextReportTime(0.0f)
+{
+}
+
+void CMomRunStatsNetworker::LevelShutdownPostEntity()
+{
+    m_hRecipient = nullptr;
+}
+
+void CMomRunStatsNetworker::FrameUpdatePostEntityThink()
+{
+    MOM_PROF_SCOPE("CMomRunStatsNetworker::FrameUpdatePostEntityThink");
+
+    const auto pPlayer = CMomentumPlayer::GetLocalPlayer();
+    if (!pPlayer)
+        return;
+
+    // A new player (map change, reconnect) has no copy of anything yet
+    if (m_hRecipient.Get() != pPlayer)
+    {
+        m_hRecipient = pPlayer;
+        FOR_EACH_VEC(m_vecRunEntities, i)
+        {
+            m_vecRunEntities[i]->GetRunStats()->MarkFullUpdate();
+        }
+    }
+
+    CSingleUserRecipientFilter filter(pPlayer);
+    filter.MakeReliable();
+
+    FOR_EACH_VEC(m_vecRunEntities, i)
+    {
+        const auto pEntity = m_vecRunEntities[i];
+        const auto pStats = pEntity->GetRunStats();
+        if (!pStats->HasPendingChanges())
+            continue;
+
+        int iChangedFields;
+        m_iBytesSent += pStats->SendPendingChanges(pEntity->GetEntIndex(), filter, iChangedFields);
+        // Each changed CNetworkArray element used to cost its prop index (~8 bits) plus the 32 bit value
+        m_iLegacyBitsEstimate += iChangedFields * (8 + 32);
+    }
+
+    if (gpGlobals->curtime >= m_flNextReportTime)
+    {
+        if (mom_runstats_net_debug.GetBool())
+        {
+            Msg("Run stats networking: %i bytes/sec (send table estimate: %i bytes/sec)\n", m_iBytesSent,
+                   m_iLegacyBitsEstimate / 8);
+        }
+
+        m_iBytesSent = 0;
+        m_iLegacyBitsEstimate = 0;
+        m_flNextReportTime = gpGlobals->curtime + 1.0f;
+    }
+}
+
+void CMomRunStatsNetworker::AddRunEntity(CMomRunEntity *pEntity)
+{
+    if (!m_vecRunEntities.HasElement(pEntity))
+        m_vecRunEntities.AddToTail(pEntity);
+}
+
+void CMomRunStatsNetworker::RemoveRunEntity(CMomRunEntity *pEntity)
+{
+    m_vecRunEntities.FindAndFastRemove(pEntity);
+}
+
+static CMomRunStatsNetworker s_RunStatsNetworker;
+CMomRunStatsNetworker *g_pRunStatsNetworker = &s_RunStatsNetworker;
+
+#else
+
+void CMomRunStats::ReadDelta(bf_read &msg)
+{
+    const int iFlags = msg.ReadByte();
+    if (iFlags & RUNSTATS_MSG_RESET)
+        Init(msg.ReadByte());
+    else
+        SetTotalZones(msg.ReadByte());
+
+    const int iZoneCount = msg.ReadByte();
+    for (int i = 0; i < iZoneCount; ++i)
+    {
+        const int zone = msg.ReadByte();
+        const int mask = msg.ReadWord();
+        for (int field = 0; field < RUNSTATS_FIELD_COUNT; ++field)
+        {
+            if (!(mask & (1 << field)))
+                continue;
+
+            const uint32 bits = static_cast<uint32>(msg.ReadLong());
+            if (zone <= m_iTotalZones)
+                SetFieldBits(field, zone, bits);
+        }
+    }
+}
+
+CMomRunStatsReceiver::CMomRunStatsReceiver() : CAutoGameSystem("CMomRunStatsReceiver")
+{
+    SetDefLessFunc(m_mapPendingStats);
+}
+
+void CMomRunStatsReceiver::LevelShutdownPostEntity()
+{
+    m_mapPendingStats.PurgeAndDeleteElements();
+}
+
+void CMomRunStatsReceiver::OnRunStatsDelta(bf_read &msg)
+{
+    const int iEntIndex = msg.ReadShort();
+
+    const auto pEntity = dynamic_cast<CMomRunEntity*>(ClientEntityList().GetBaseEntity(iEntIndex));
+    if (pEntity)
+    {
+        pEntity->GetRunStats()->ReadDelta(msg);
+        return;
+    }
+
+    // The entity has not been created on our end yet, keep the stats until it is
+    auto index = m_mapPendingStats.Find(iEntIndex);
+    if (!m_mapPendingStats.IsValidIndex(index))
+        index = m_mapPendingStats.Insert(iEntIndex, new CMomRunStats);
+
+    m_mapPendingStats[index]->ReadDelta(msg);
+}
+
+void CMomRunStatsReceiver::ApplyPendingStats(int iEntIndex, CMomRunStats *pInto)
+{
+    const auto index = m_mapPendingStats.Find(iEntIndex);
+    if (!m_mapPendingStats.IsValidIndex(index))
+        return;
+
+    pInto->FullyCopyFrom(*m_mapPendingStats[index]);
+    delete m_mapPendingStats[index];
+    m_mapPendingStats.RemoveAt(index);
+}
+
+static CMomRunStatsReceiver s_RunStatsReceiver;
+CMomRunStatsReceiver *g_pRunStatsReceiver = &s_RunStatsReceiver;
+
+static void __MsgFunc_RunStatsDelta(bf_read &msg)
+{
+    g_pRunStatsReceiver->OnRunStatsDelta(msg);
+}
+USER_MESSAGE_REGISTER(RunStatsDelta);
+
+#endif
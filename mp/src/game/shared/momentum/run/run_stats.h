@@ -5,17 +5,39 @@
 
 #ifdef CLIENT_DLL
 #define CMomRunStats C_MomRunStats
-EXTERN_RECV_TABLE(DT_MomRunStats);
 #else
-EXTERN_SEND_TABLE(DT_MomRunStats);
+class CMomRunEntity;
 #endif
 
+// The per-zone fields of the run stats, in the order they are networked.
+// Each zone entry of a "RunStatsDelta" message carries a bitmask of these.
+enum RunStatsField_t
+{
+    RUNSTATS_JUMPS = 0,
+    RUNSTATS_STRAFES,
+    RUNSTATS_TICKS,
+    RUNSTATS_ENTER_TICK,
+    RUNSTATS_SYNC_AVG,
+    RUNSTATS_SYNC2_AVG,
+    RUNSTATS_ENTER_SPEED_3D,
+    RUNSTATS_ENTER_SPEED_2D,
+    RUNSTATS_VELOCITY_MAX_3D,
+    RUNSTATS_VELOCITY_MAX_2D,
+    RUNSTATS_VELOCITY_AVG_3D,
+    RUNSTATS_VELOCITY_AVG_2D,
+    RUNSTATS_EXIT_SPEED_3D,
+    RUNSTATS_EXIT_SPEED_2D,
+
+    RUNSTATS_FIELD_COUNT
+};
+
 // Run stats collected throughout a run of a track.
+// These are not part of any send table; the server sends only the changed zone entries to the client
+// through the "RunStatsDelta" user message (see CMomRunStatsNetworker).
 class CMomRunStats : public ISerializable
 {
 public:
     DECLARE_CLASS_NOBASE(CMomRunStats);
-    DECLARE_EMBEDDED_NETWORKVAR();
 
     // struct data;
     CMomRunStats(uint8 size = MAX_ZONES);
@@ -60,19 +82,101 @@ public:
     void SetZoneVelocityAvg(int zone, float vert, float hor);
     void SetZoneExitSpeed(int zone, float vert, float hor);
 
-    CNetworkVar(uint8, m_iTotalZones);
-    CNetworkArray(uint32, m_iZoneJumps, MAX_ZONES + 1);
-    CNetworkArray(uint32, m_iZoneStrafes, MAX_ZONES + 1);
-    CNetworkArray(uint32, m_iZoneTicks, MAX_ZONES + 1);
-    CNetworkArray(uint32, m_iZoneEnterTick, MAX_ZONES + 1);
-    CNetworkArray(float, m_flZoneStrafeSyncAvg, MAX_ZONES + 1);
-    CNetworkArray(float, m_flZoneStrafeSync2Avg, MAX_ZONES + 1);
-    CNetworkArray(float, m_flZoneEnterSpeed3D, MAX_ZONES + 1);
-    CNetworkArray(float, m_flZoneEnterSpeed2D, MAX_ZONES + 1);
-    CNetworkArray(float, m_flZoneVelocityMax3D, MAX_ZONES + 1);
-    CNetworkArray(float, m_flZoneVelocityMax2D, MAX_ZONES + 1);
-    CNetworkArray(float, m_flZoneVelocityAvg3D, MAX_ZONES + 1);
-    CNetworkArray(float, m_flZoneVelocityAvg2D, MAX_ZONES + 1);
-    CNetworkArray(float, m_flZoneExitSpeed3D, MAX_ZONES + 1);
-    CNetworkArray(float, m_flZoneExitSpeed2D, MAX_ZONES + 1);
-};
\ No newline at end of file
+#ifdef GAME_DLL
+    // Flags every non-zero field to be resent, and tells the client to clear its copy first
+    void MarkFullUpdate();
+    bool HasPendingChanges() const;
+    // Sends the changed zone entries as one or more "RunStatsDelta" messages and clears the dirty state.
+    // Returns the amount of message bytes written; iChangedFields receives the amount of fields sent.
+    int SendPendingChanges(int iEntIndex, IRecipientFilter &filter, int &iChangedFields);
+#else
+    // Applies a "RunStatsDelta" message body (everything after the entity index)
+    void ReadDelta(bf_read &msg);
+#endif
+
+    uint8 m_iTotalZones;
+    uint32 m_iZoneJumps[MAX_ZONES + 1];
+    uint32 m_iZoneStrafes[MAX_ZONES + 1];
+    uint32 m_iZoneTicks[MAX_ZONES + 1];
+    uint32 m_iZoneEnterTick[MAX_ZONES + 1];
+    float m_flZoneStrafeSyncAvg[MAX_ZONES + 1];
+    float m_flZoneStrafeSync2Avg[MAX_ZONES + 1];
+    float m_flZoneEnterSpeed3D[MAX_ZONES + 1];
+    float m_flZoneEnterSpeed2D[MAX_ZONES + 1];
+    float m_flZoneVelocityMax3D[MAX_ZONES + 1];
+    float m_flZoneVelocityMax2D[MAX_ZONES + 1];
+    float m_flZoneVelocityAvg3D[MAX_ZONES + 1];
+    float m_flZoneVelocityAvg2D[MAX_ZONES + 1];
+    float m_flZoneExitSpeed3D[MAX_ZONES + 1];
+    float m_flZoneExitSpeed2D[MAX_ZONES + 1];
+
+private:
+    // Raw 32 bits of the given field, used to (de)serialize the delta messages
+    uint32 GetFieldBits(int field, int zone) const;
+    void SetFieldBits(int field, int zone, uint32 bits);
+
+    template <class T>
+    void SetZoneField(T *pArray, RunStatsField_t field, int zone, T value)
+    {
+        if (pArray[zone] == value)
+            return;
+
+        pArray[zone] = value;
+#ifdef GAME_DLL
+        m_iDirtyFields[zone] |= 1 << field;
+#endif
+    }
+
+#ifdef GAME_DLL
+    uint16 m_iDirtyFields[MAX_ZONES + 1]; // Bitmask of RunStatsField_t changed since the last send, per zone
+    bool m_bResetPending; // Client should clear its copy before applying the next delta
+#endif
+};
+
+#ifdef GAME_DLL
+// Sends the run stats of every run entity to the local player, once per frame after all entities thought.
+// Only the changed zone entries are sent, packed into as few user messages as possible.
+class CMomRunStatsNetworker : public CAutoGameSystemPerFrame
+{
+public:
+    CMomRunStatsNetworker();
+
+    // CAutoGameSystemPerFrame
+    void LevelShutdownPostEntity() OVERRIDE;
+    void FrameUpdatePostEntityThink() OVERRIDE;
+
+    void AddRunEntity(CMomRunEntity *pEntity);
+    void RemoveRunEntity(CMomRunEntity *pEntity);
+
+private:
+    CUtlVector<CMomRunEntity*> m_vecRunEntities;
+    EHANDLE m_hRecipient; // Player the stats were last sent to, everything is resent when this changes
+
+    // mom_runstats_net_debug accounting
+    int m_iBytesSent;
+    int m_iLegacyBitsEstimate;
+    float m_flNextReportTime;
+};
+
+extern CMomRunStatsNetworker *g_pRunStatsNetworker;
+#else
+// Receives "RunStatsDelta" messages. Deltas for entities the client has not created yet are accumulated
+// here and handed over once the entity exists (see ApplyPendingStats).
+class CMomRunStatsReceiver : public CAutoGameSystem
+{
+public:
+    CMomRunStatsReceiver();
+
+    // CAutoGameSystem
+    void LevelShutdownPostEntity() OVERRIDE;
+
+    void OnRunStatsDelta(bf_read &msg);
+    // Called by run entities when they get created on the client
+    void ApplyPendingStats(int iEntIndex, CMomRunStats *pInto);
+
+private:
+    CUtlMap<int, CMomRunStats*> m_mapPendingStats;
+};
+
+extern CMomRunStatsReceiver *g_pRunStatsReceiver;
+#endif
@@ -16,9 +16,22 @@
 #define LALDIF(addr) ((uintptr_t)(addr) % getpagesize())
 #endif
 
+#if defined(_WIN32) || defined(__SSE2__)
+#include <emmintrin.h>
+#define SIGNATURE_SCAN_SSE2
+#endif
+
 #include "cbase.h"
 #include "util/os_utils.h"
 #include "engine_patch.h"
+#include "filesystem.h"
+#include "fasttimer.h"
+
+#define SIGNATURE_CACHE_FILE "engine_signatures.txt"
+// The module key hashes this much of the start of the engine (headers and the first code pages)
+#define SIGNATURE_KEY_BYTES (64 * 1024)
+// More distinct anchor bytes than this are cheaper to look up per byte than to compare per 16 bytes
+#define SIGNATURE_MAX_SIMD_ANCHORS 8
 
 // Engine Patch format:
 //==============================
@@ -98,6 +111,7 @@ CEngineBinary::CEngineBinary() : CAutoGameSystem("CEngineBinary")
 
 void* CEngineBinary::m_pModuleBase = nullptr;
 size_t CEngineBinary::m_iModuleSize = 0;
+bool CEngineBinary::m_bScanned = false;
 
 // Get the engine's base address and size
 bool CEngineBinary::Init()
@@ -122,6 +136,7 @@ bool CEngineBinary::Init()
 
 void CEngineBinary::PostInit()
 {
+    ScanSignatures();
     ApplyAllPatches();
 }
 
@@ -151,6 +166,351 @@ void* CEngineBinary::FindPattern(const char* pattern, const char* mask, size_t o
     return nullptr;
 }
 
+CUtlVector<EngineSignature_t> &CEngineBinary::GetSignatures()
+{
+    // Function-local so registering from other translation units' static initializers is safe
+    static CUtlVector<EngineSignature_t> s_vecSignatures;
+    return s_vecSignatures;
+}
+
+int CEngineBinary::RegisterSignature(const char *pName, const char *pPattern, const char *pMask, size_t offset)
+{
+    if (!pName || !pPattern || !pMask || !pMask[0])
+        return INVALID_SIGNATURE;
+
+    EngineSignature_t sig;
+    sig.m_pName = pName;
+    sig.m_pPattern = pPattern;
+    sig.m_pMask = pMask;
+    sig.m_iOffset = offset;
+    sig.m_iLength = strlen(pMask);
+    sig.m_pAddress = nullptr;
+    sig.m_bResolved = false;
+    sig.m_bPatched = false;
+
+    CRC32_Init(&sig.m_Crc);
+    CRC32_ProcessBuffer(&sig.m_Crc, pPattern, sig.m_iLength);
+    CRC32_ProcessBuffer(&sig.m_Crc, pMask, sig.m_iLength);
+    CRC32_Final(&sig.m_Crc);
+
+    // Anchor on a byte that has to match, preferring ones that aren't everywhere in x86 code
+    sig.m_iAnchor = sig.m_iLength;
+    for (size_t i = 0; i < sig.m_iLength; ++i)
+    {
+        if (pMask[i] != 'x')
+            continue;
+
+        const auto byte = static_cast<unsigned char>(pPattern[i]);
+        const bool bCommon = byte == 0x00 || byte == 0xFF || byte == 0xCC || byte == 0x90 || byte == 0x8B || byte == 0x89;
+        if (sig.m_iAnchor == sig.m_iLength || !bCommon)
+        {
+            sig.m_iAnchor = i;
+            if (!bCommon)
+                break;
+        }
+    }
+
+    // A mask without a single byte to match matches anything, it can't be scanned for
+    if (sig.m_iAnchor == sig.m_iLength)
+    {
+        Warning("Engine signature \"%s\" has no bytes to match!\n", pName);
+        return INVALID_SIGNATURE;
+    }
+
+    const int handle = GetSignatures().AddToTail(sig);
+
+    // Registered after the scan already happened, resolve it on next request
+    m_bScanned = false;
+
+    return handle;
+}
+
+void* CEngineBinary::GetSignatureAddress(int handle)
+{
+    auto &vecSignatures = GetSignatures();
+    if (!vecSignatures.IsValidIndex(handle))
+        return nullptr;
+
+    if (!m_bScanned)
+        ScanSignatures();
+
+    return vecSignatures[handle].m_pAddress;
+}
+
+#ifdef SIGNATURE_SCAN_SSE2
+static inline int LowestBitIndex(int bits)
+{
+#ifdef _WIN32
+    unsigned long index;
+    _BitScanForward(&index, bits);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(bits);
+#endif
+}
+#endif
+
+void CEngineBinary::ScanSignatures(bool bUseCache /* = true*/)
+{
+    if (!m_pModuleBase || !m_iModuleSize)
+        return;
+
+    m_bScanned = true;
+
+    auto &vecSignatures = GetSignatures();
+
+    CFastTimer timer;
+    timer.Start();
+
+    if (bUseCache)
+        LoadSignatureCache();
+
+    // Bucket the unresolved signatures by their anchor byte
+    int iBucketHead[256];
+    CUtlVector<int> vecBucketNext;
+    vecBucketNext.SetCount(vecSignatures.Count());
+    Q_memset(iBucketHead, -1, sizeof(iBucketHead));
+
+    int iUnresolved = 0, iCached = 0;
+    unsigned char anchors[256];
+    int iAnchorCount = 0;
+    FOR_EACH_VEC(vecSignatures, i)
+    {
+        const auto &sig = vecSignatures[i];
+        if (sig.m_bResolved)
+        {
+            ++iCached;
+            continue;
+        }
+
+        const auto anchor = static_cast<unsigned char>(sig.m_pPattern[sig.m_iAnchor]);
+        if (iBucketHead[anchor] == -1)
+            anchors[iAnchorCount++] = anchor;
+
+        vecBucketNext[i] = iBucketHead[anchor];
+        iBucketHead[anchor] = i;
+        ++iUnresolved;
+    }
+
+    if (!iUnresolved)
+    {
+        timer.End();
+        DevLog("Resolved %i engine signatures from cache in %.3f ms\n", vecSignatures.Count(), timer.GetDuration().GetMillisecondsF());
+        return;
+    }
+
+    const auto pBase = static_cast<const unsigned char*>(m_pModuleBase);
+    const size_t size = m_iModuleSize;
+
+    // Checks every signature anchored on the byte at pos, returns true when everything has been found
+    const auto CheckAnchor = [&](size_t pos) -> bool
+    {
+        for (int i = iBucketHead[pBase[pos]]; i != -1; i = vecBucketNext[i])
+        {
+            auto &sig = vecSignatures[i];
+            if (sig.m_bResolved || pos < sig.m_iAnchor)
+                continue;
+
+            // Anchors are found in ascending order, so the first match is the lowest address, same as FindPattern
+            const size_t start = pos - sig.m_iAnchor;
+            if (start + sig.m_iLength > size)
+                continue;
+
+            if (DataCompare(reinterpret_cast<const char*>(pBase + start), sig.m_pPattern, sig.m_pMask))
+            {
+                sig.m_pAddress = const_cast<unsigned char*>(pBase + start + sig.m_iOffset);
+                sig.m_bResolved = true;
+                --iUnresolved;
+            }
+        }
+
+        return iUnresolved == 0;
+    };
+
+    size_t pos = 0;
+    bool bDone = false;
+
+#ifdef SIGNATURE_SCAN_SSE2
+    if (iAnchorCount <= SIGNATURE_MAX_SIMD_ANCHORS)
+    {
+        __m128i vAnchors[SIGNATURE_MAX_SIMD_ANCHORS];
+        for (int i = 0; i < iAnchorCount; ++i)
+            vAnchors[i] = _mm_set1_epi8(static_cast<char>(anchors[i]));
+
+        for (; !bDone && pos + 16 <= size; pos += 16)
+        {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pBase + pos));
+
+            int hits = 0;
+            for (int i = 0; i < iAnchorCount; ++i)
+                hits |= _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, vAnchors[i]));
+
+            for (; hits && !bDone; hits &= hits - 1)
+                bDone = CheckAnchor(pos + LowestBitIndex(hits));
+        }
+    }
+#endif
+
+    // Tail of the module, or everything when there are too many distinct anchors for the SIMD path
+    for (; !bDone && pos < size; ++pos)
+    {
+        if (iBucketHead[pBase[pos]] != -1)
+            bDone = CheckAnchor(pos);
+    }
+
+    // Whatever is left wasn't in the engine, don't look for it again
+    FOR_EACH_VEC(vecSignatures, i)
+    {
+        vecSignatures[i].m_bResolved = true;
+    }
+
+    timer.End();
+    DevLog("Scanned the engine for %i signatures (%i cached) in %.3f ms\n", vecSignatures.Count(),
+           iCached, timer.GetDuration().GetMillisecondsF());
+
+    if (bUseCache)
+        SaveSignatureCache();
+}
+
+CRC32_t CEngineBinary::GetModuleKey()
+{
+    // The engine is never patched before the signatures are resolved, so its headers and first
+    // code pages identify the binary well enough. Cached addresses get verified anyway.
+    return CRC32_ProcessSingleBuffer(m_pModuleBase, static_cast<int>(Min<size_t>(m_iModuleSize, SIGNATURE_KEY_BYTES)));
+}
+
+bool CEngineBinary::LoadSignatureCache()
+{
+    KeyValuesAD pKvCache("EngineSignatures");
+    if (!pKvCache->LoadFromFile(filesystem, SIGNATURE_CACHE_FILE, "MOD"))
+        return false;
+
+    if (pKvCache->GetUint64("size") != m_iModuleSize || static_cast<CRC32_t>(pKvCache->GetInt("key")) != GetModuleKey())
+        return false;
+
+    const auto pBase = static_cast<unsigned char*>(m_pModuleBase);
+
+    bool bAnyLoaded = false;
+    auto &vecSignatures = GetSignatures();
+    FOR_EACH_VEC(vecSignatures, i)
+    {
+        auto &sig = vecSignatures[i];
+        if (sig.m_bResolved)
+            continue;
+
+        KeyValues *pKvSig = pKvCache->FindKey(sig.m_pName);
+        if (!pKvSig || static_cast<CRC32_t>(pKvSig->GetInt("crc")) != sig.m_Crc)
+            continue;
+
+        // -1 means the signature wasn't found in this binary last time either
+        const int64 rva = pKvSig->GetUint64("rva", static_cast<uint64>(-1));
+        if (rva < 0)
+        {
+            sig.m_pAddress = nullptr;
+            sig.m_bResolved = true;
+            bAnyLoaded = true;
+            continue;
+        }
+
+        // Make sure the cached location still holds the signature before trusting it
+        if (static_cast<size_t>(rva) + sig.m_iLength <= m_iModuleSize &&
+            DataCompare(reinterpret_cast<const char*>(pBase + rva), sig.m_pPattern, sig.m_pMask))
+        {
+            sig.m_pAddress = pBase + rva + sig.m_iOffset;
+            sig.m_bResolved = true;
+            bAnyLoaded = true;
+        }
+    }
+
+    return bAnyLoaded;
+}
+
+void CEngineBinary::SaveSignatureCache()
+{
+    KeyValuesAD pKvCache("EngineSignatures");
+    pKvCache->SetUint64("size", m_iModuleSize);
+    pKvCache->SetInt("key", static_cast<int>(GetModuleKey()));
+
+    auto &vecSignatures = GetSignatures();
+    FOR_EACH_VEC(vecSignatures, i)
+    {
+        const auto &sig = vecSignatures[i];
+
+        KeyValues *pKvSig = pKvCache->FindKey(sig.m_pName, true);
+        pKvSig->SetInt("crc", static_cast<int>(sig.m_Crc));
+
+        const int64 rva = sig.m_pAddress ? static_cast<char*>(sig.m_pAddress) - sig.m_iOffset - static_cast<char*>(m_pModuleBase) : -1;
+        pKvSig->SetUint64("rva", static_cast<uint64>(rva));
+    }
+
+    pKvCache->SaveToFile(filesystem, SIGNATURE_CACHE_FILE, "MOD");
+}
+
+CON_COMMAND_F(mom_engine_signature_benchmark, "Times resolving every registered engine signature with one FindPattern "
+              "scan each versus the batched scan. Optionally takes the amount of iterations.\n", FCVAR_NONE)
+{
+    auto &vecSignatures = CEngineBinary::GetSignatures();
+    if (vecSignatures.IsEmpty() || !CEngineBinary::GetModuleBase())
+        return;
+
+    const int iIterations = args.ArgC() > 1 ? Max(1, Q_atoi(args[1])) : 10;
+
+    CFastTimer linearTimer;
+    linearTimer.Start();
+    for (int iter = 0; iter < iIterations; ++iter)
+    {
+        FOR_EACH_VEC(vecSignatures, i)
+        {
+            CEngineBinary::FindPattern(vecSignatures[i].m_pPattern, vecSignatures[i].m_pMask, vecSignatures[i].m_iOffset);
+        }
+    }
+    linearTimer.End();
+
+    // Keep what's currently resolved, the benchmark shouldn't change any addresses
+    CUtlVector<EngineSignature_t> vecResolved;
+    vecResolved.AddVectorToTail(vecSignatures);
+
+    CFastTimer batchedTimer;
+    batchedTimer.Start();
+    for (int iter = 0; iter < iIterations; ++iter)
+    {
+        FOR_EACH_VEC(vecSignatures, i)
+        {
+            vecSignatures[i].m_bResolved = false;
+        }
+
+        CEngineBinary::ScanSignatures(false);
+    }
+    batchedTimer.End();
+
+    // Patched signatures were resolved before their bytes got overwritten, rescanning them now can't match
+    bool bMismatch = false;
+    int iPatched = 0;
+    FOR_EACH_VEC(vecSignatures, i)
+    {
+        if (vecResolved[i].m_bPatched)
+        {
+            ++iPatched;
+            continue;
+        }
+
+        bMismatch |= vecSignatures[i].m_pAddress != vecResolved[i].m_pAddress;
+    }
+
+    vecSignatures.RemoveAll();
+    vecSignatures.AddVectorToTail(vecResolved);
+
+    Msg("%i signatures, %i iterations:\n  FindPattern: %.3f ms per startup\n  Batched scan: %.3f ms per startup\n",
+        vecSignatures.Count(), iIterations, linearTimer.GetDuration().GetMillisecondsF() / iIterations,
+        batchedTimer.GetDuration().GetMillisecondsF() / iIterations);
+
+    if (iPatched)
+        Msg("  %i patched signatures were not compared against the startup results\n", iPatched);
+
+    if (bMismatch)
+        Warning("The batched scan found different addresses than the startup results!\n");
+}
+
 bool CEngineBinary::SetMemoryProtection(void* pAddress, size_t iLength, int iProtection)
 {
 #ifdef _WIN32
@@ -195,7 +555,7 @@ void CEnginePatch::ApplyPatch()
         return;
     }
 
-    void* addr = CEngineBinary::FindPattern(m_pSignature, m_pMask, m_iOffset);
+    void* addr = CEngineBinary::GetSignatureAddress(m_iSignature);
 
     if (addr)
     {
@@ -208,6 +568,8 @@ void CEnginePatch::ApplyPatch()
 
             CEngineBinary::SetMemoryProtection(pMemory, m_iLength, MEM_READ|MEM_EXEC);
 
+            CEngineBinary::GetSignatures()[m_iSignature].m_bPatched = true;
+
             DevLog("Engine patch \"%s\" applied successfully\n", m_sName);
         }
         else
@@ -230,6 +592,7 @@ CEnginePatch::CEnginePatch(const char* name, char* signature, char* mask, size_t
     m_iLength = 0;
     m_bImmediate = immediate;
     m_pPatch = nullptr;
+    m_iSignature = CEngineBinary::RegisterSignature(name, signature, mask, offset);
 }
 
 // Converting numeric types into bytes
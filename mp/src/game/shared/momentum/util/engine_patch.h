@@ -3,6 +3,25 @@
 //-----------------------------------------------------------------------------------
 #pragma once
 
+#include "checksum_crc.h"
+
+#define INVALID_SIGNATURE -1
+
+// A signature registered for the batched scan, see CEngineBinary::RegisterSignature
+struct EngineSignature_t
+{
+    const char *m_pName;
+    const char *m_pPattern;
+    const char *m_pMask;
+    size_t m_iOffset;
+    size_t m_iLength;
+    size_t m_iAnchor; // Index of the byte the scan looks for
+    CRC32_t m_Crc; // Of the pattern + mask, so changed signatures don't use stale cache entries
+    void *m_pAddress; // Match + offset, nullptr if not found (yet)
+    bool m_bResolved;
+    bool m_bPatched; // An engine patch has been written through this signature, its bytes may no longer match
+};
+
 class CEngineBinary : public CAutoGameSystem
 {
 public:
@@ -12,18 +31,36 @@ public:
     void PostInit() OVERRIDE;
 
     static inline bool DataCompare(const char*, const char*, const char*);
+    // Single linear scan for one pattern. Prefer RegisterSignature for anything found at startup.
     static void* FindPattern(const char*, const char*, size_t = 0);
 
+    // Registers a signature to be resolved by the batched scan. Can be called during static initialization.
+    // Returns a handle for GetSignatureAddress, the strings must outlive the engine binary.
+    static int RegisterSignature(const char *pName, const char *pPattern, const char *pMask, size_t offset = 0);
+    // Returns the address of the given signature's first match + offset, or nullptr if it wasn't found.
+    // The first call resolves every registered signature at once, from the cache or by scanning the engine.
+    static void* GetSignatureAddress(int handle);
+    // Resolves all unresolved signatures in a single pass over the engine module.
+    // With bUseCache, signatures found in the on-disk cache for this exact engine binary skip the scan.
+    static void ScanSignatures(bool bUseCache = true);
+
     static bool SetMemoryProtection(void*, size_t, int);
 
     static void* GetModuleBase() { return m_pModuleBase; }
     static size_t GetModuleSize() { return m_iModuleSize; }
 
+    static CUtlVector<EngineSignature_t> &GetSignatures();
+
 private:
     void ApplyAllPatches();
 
+    static CRC32_t GetModuleKey();
+    static bool LoadSignatureCache();
+    static void SaveSignatureCache();
+
     static void* m_pModuleBase;
     static size_t m_iModuleSize;
+    static bool m_bScanned;
 };
 
 enum PatchType
@@ -44,6 +81,7 @@ public:
 
 private:
     const char *m_sName;
+    int m_iSignature;
 
     char *m_pSignature;
     char *m_pMask;
@@ -35,7 +35,13 @@
 #include <fcntl.h>
 #ifdef _WIN32
 #include <io.h>
+#include "winlite.h"
+#else
+#include <unistd.h>
+#include <sys/mman.h>
 #endif
+#include <ctype.h>
+#include <errno.h>
 #include <math.h>
 #include <sys/stat.h>
 #include <stdlib.h>
@@ -45,6 +51,7 @@
 #include "mathlib/vector.h"
 #include "mathlib/vector4d.h"
 #include "tier1/strtools.h"
+#include "tier1/generichash.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -56,6 +63,9 @@
 CChunkHandlerMap::CChunkHandlerMap(void)
 {
 	m_pHandlers = NULL;
+	m_pszLastChunkName = NULL;
+	m_pfnLastHandler = NULL;
+	m_pLastData = NULL;
 }
 
 
@@ -90,6 +100,8 @@ void CChunkHandlerMap::AddHandler(const char *pszChunkName, ChunkHandler_t pfnHa
 	pNew->Handler.pData = pData;
 	pNew->pNext = NULL;
 
+	m_pszLastChunkName = NULL;
+
 	if (m_pHandlers == NULL)
 	{
 		m_pHandlers = pNew;
@@ -155,6 +167,689 @@ ChunkHandler_t CChunkHandlerMap::GetHandler(const char *pszChunkName, void **ppD
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Gets the handler for a chunk name interned by CChunkFileTokens.
+// Input  : pszChunkName - Name of chunk, compared by pointer to the last one.
+//			ppData - Receives the context data for the given chunk.
+//-----------------------------------------------------------------------------
+ChunkHandler_t CChunkHandlerMap::GetHandlerInterned(const char *pszChunkName, void **ppData)
+{
+	if (pszChunkName != m_pszLastChunkName)
+	{
+		m_pfnLastHandler = GetHandler(pszChunkName, &m_pLastData);
+		m_pszLastChunkName = pszChunkName;
+	}
+
+	*ppData = m_pLastData;
+	return(m_pfnLastHandler);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Constructor.
+//-----------------------------------------------------------------------------
+CChunkFileTokens::CChunkFileTokens(void)
+{
+	m_pView = NULL;
+	m_nViewSize = 0;
+	m_bMapped = false;
+#ifdef _WIN32
+	m_hMapping = NULL;
+#endif
+	m_nEndLine = 0;
+	m_nInterned = 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Destructor. Unmaps the file.
+//-----------------------------------------------------------------------------
+CChunkFileTokens::~CChunkFileTokens(void)
+{
+	Purge();
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Forgets the tokens and unmaps the file.
+//-----------------------------------------------------------------------------
+void CChunkFileTokens::Purge(void)
+{
+	m_Tokens.Purge();
+	for (int i = 0; i < m_CopiedText.Count(); i++)
+	{
+		delete [] m_CopiedText[i];
+	}
+	m_CopiedText.Purge();
+	m_InternTable.Purge();
+	UnmapFile();
+	m_nEndLine = 0;
+}
+
+
+const char *CChunkFileTokens::GetFileName(void) const
+{
+	return(m_FileName.Get());
+}
+
+
+int CChunkFileTokens::GetTokenCount(void) const
+{
+	return(m_Tokens.Count());
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Maps the file copy-on-write, so the tokens can be terminated in place
+//			without touching the file. Falls back to reading it into memory.
+// Output : Returns false if the file can't be opened.
+//-----------------------------------------------------------------------------
+bool CChunkFileTokens::MapFile(const char *pszFileName)
+{
+#ifdef _WIN32
+	HANDLE hFile = CreateFile(pszFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		errno = ENOENT;
+		return(false);
+	}
+
+	LARGE_INTEGER nSize;
+	if (GetFileSizeEx(hFile, &nSize) && (nSize.QuadPart > 0))
+	{
+		m_nViewSize = (size_t)nSize.QuadPart;
+		m_hMapping = CreateFileMapping(hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+		if (m_hMapping != NULL)
+		{
+			m_pView = (char *)MapViewOfFile(m_hMapping, FILE_MAP_COPY, 0, 0, 0);
+			if (m_pView == NULL)
+			{
+				CloseHandle(m_hMapping);
+				m_hMapping = NULL;
+			}
+		}
+	}
+
+	CloseHandle(hFile);
+#else
+	int hFile = open(pszFileName, O_RDONLY);
+	if (hFile < 0)
+	{
+		return(false);
+	}
+
+	struct stat fileStat;
+	if ((fstat(hFile, &fileStat) == 0) && (fileStat.st_size > 0))
+	{
+		m_nViewSize = (size_t)fileStat.st_size;
+		void *pView = mmap(NULL, m_nViewSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, hFile, 0);
+		if (pView != MAP_FAILED)
+		{
+			m_pView = (char *)pView;
+		}
+	}
+
+	close(hFile);
+#endif
+
+	if (m_pView != NULL)
+	{
+		m_bMapped = true;
+		return(true);
+	}
+
+	//
+	// Empty files can't be mapped, and some file systems can't map at all.
+	//
+	m_bMapped = false;
+	m_nViewSize = 0;
+
+	FILE *fp = fopen(pszFileName, "rb");
+	if (fp == NULL)
+	{
+		return(false);
+	}
+
+	fseek(fp, 0, SEEK_END);
+	long nSize = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if (nSize > 0)
+	{
+		m_pView = (char *)malloc(nSize);
+		m_nViewSize = fread(m_pView, 1, nSize, fp);
+	}
+
+	fclose(fp);
+	return(true);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+void CChunkFileTokens::UnmapFile(void)
+{
+	if (m_pView != NULL)
+	{
+		if (!m_bMapped)
+		{
+			free(m_pView);
+		}
+		else
+		{
+#ifdef _WIN32
+			UnmapViewOfFile(m_pView);
+			CloseHandle(m_hMapping);
+			m_hMapping = NULL;
+#else
+			munmap(m_pView, m_nViewSize);
+#endif
+		}
+	}
+
+	m_pView = NULL;
+	m_nViewSize = 0;
+	m_bMapped = false;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Skips whitespace and comments the way TokenReader does.
+// Output : Returns true if the whitespace contained the combine strings
+//			character '+', which is used to merge consecutive quoted strings.
+//-----------------------------------------------------------------------------
+static bool SkipWhiteSpace(const char *&pch, const char *pEnd, int &nLine)
+{
+	bool bCombineStrings = false;
+
+	while (pch < pEnd)
+	{
+		char ch = *pch;
+		if ((ch == ' ') || (ch == '\t') || (ch == '\r') || (ch == 0))
+		{
+			pch++;
+		}
+		else if (ch == '+')
+		{
+			bCombineStrings = true;
+			pch++;
+		}
+		else if (ch == '\n')
+		{
+			nLine++;
+			pch++;
+		}
+		else if (ch == '/')
+		{
+			//
+			// Comments run to the end of the line, a lone slash is dropped.
+			//
+			if ((pch + 1 < pEnd) && (pch[1] == '/'))
+			{
+				const char *pNewLine = (const char *)memchr(pch, '\n', pEnd - pch);
+				pch = pNewLine ? pNewLine + 1 : pEnd;
+				nLine++;
+			}
+			else
+			{
+				pch++;
+			}
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	return(bCombineStrings);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Maps the file and splits it into tokens, following the same rules
+//			as TokenReader. Tokenizing stops at the first token TokenReader would
+//			fail on, which is kept as the last token so reading fails at the same
+//			spot. CRLF line ends read the same as LF ones.
+// Input  : pszFileName - Path of file to tokenize.
+// Output : Returns ChunkFile_Ok or ChunkFile_OpenFail.
+//-----------------------------------------------------------------------------
+ChunkFileResult_t CChunkFileTokens::Tokenize(const char *pszFileName)
+{
+	Purge();
+	m_FileName = pszFileName;
+
+	if (!MapFile(pszFileName))
+	{
+		return(ChunkFile_OpenFail);
+	}
+
+	// Keys and values alternate inside a chunk, chunk names are followed by an open curly.
+	bool bNameNext = true;
+
+	// Identifiers and integers are terminated once the character after them has been looked at.
+	char *pszUnterminated = NULL;
+
+	const char *pch = m_pView;
+	const char *pEnd = m_pView + m_nViewSize;
+	int nLine = 1;
+
+	// VMFs run 12 to 14 bytes per token, the vector grows if there are more.
+	m_Tokens.EnsureCapacity((int)(m_nViewSize / 14));
+
+	while (true)
+	{
+		SkipWhiteSpace(pch, pEnd, nLine);
+		if (pch == pEnd)
+		{
+			break;
+		}
+
+		char ch = *pch;
+		if (pszUnterminated != NULL)
+		{
+			TerminateText(pszUnterminated, pch);
+			pszUnterminated = NULL;
+		}
+
+		Token_t &token = m_Tokens[m_Tokens.AddToTail()];
+		token.m_pszText = NULL;
+		token.m_nLine = nLine;
+		token.m_chOperator = 0;
+		token.m_bName = false;
+
+		switch (ch)
+		{
+			case '@':
+			case ',':
+			case '!':
+			case '+':
+			case '&':
+			case '*':
+			case '$':
+			case '.':
+			case '=':
+			case ':':
+			case '[':
+			case ']':
+			case '(':
+			case ')':
+			case '{':
+			case '}':
+			case '\\':
+			{
+				token.m_eType = OPERATOR;
+				token.m_chOperator = ch;
+				bNameNext = true;
+				pch++;
+				continue;
+			}
+		}
+
+		if (ch == '\"')
+		{
+			char *pszText = m_pView + (pch - m_pView) + 1;
+			token.m_pszText = pszText;
+			token.m_eType = STRING;
+			pch++;
+
+			//
+			// Most strings have nothing to unescape and stay where they are.
+			//
+			const char *pLimit = min(pEnd, pch + MAX_KEYVALUE_LEN - 1);
+			while ((pch < pLimit) && (*pch != '\"') && (*pch != '\\') && (*pch != '\r') && (*pch != '\n'))
+			{
+				pch++;
+			}
+
+			//
+			// Otherwise unescape it over itself, it never gets longer. Strings
+			// separated by the combine strings character are joined.
+			//
+			char *pszStore = pszText + (pch - pszText);
+			while (token.m_eType == STRING)
+			{
+				if (pch == pEnd)
+				{
+					token.m_eType = TOKENEOF;
+					break;
+				}
+
+				ch = *pch++;
+				if (ch == '\"')
+				{
+					if (SkipWhiteSpace(pch, pEnd, nLine) && (pch < pEnd) && (*pch == '\"'))
+					{
+						pch++;
+						continue;
+					}
+					break;
+				}
+
+				if (ch == '\r')
+				{
+					if ((pch < pEnd) && (*pch == '\n'))
+					{
+						// CRLF line end in a multi-line value, only the LF is kept.
+						continue;
+					}
+
+					// Newline encountered before closing quote -- unterminated string.
+					token.m_eType = TOKENSTRINGTOOLONG;
+					break;
+				}
+
+				if (ch == '\n')
+				{
+					nLine++;
+				}
+				else if (ch == '\\')
+				{
+					if ((pch == pEnd) || (*pch == '\"'))
+					{
+						continue;
+					}
+
+					if ((*pch == '\r') && (pch + 1 < pEnd) && (pch[1] == '\n'))
+					{
+						pch++;
+					}
+
+					ch = (*pch == 'n') ? '\n' : *pch;
+					pch++;
+				}
+
+				if (pszStore - pszText >= MAX_KEYVALUE_LEN - 1)
+				{
+					token.m_eType = TOKENSTRINGTOOLONG;
+					break;
+				}
+
+				*pszStore++ = ch;
+			}
+
+			if (token.m_eType != STRING)
+			{
+				token.m_pszText = NULL;
+				break;
+			}
+
+			*pszStore = '\0';
+
+			token.m_bName = bNameNext;
+			if (token.m_bName)
+			{
+				token.m_pszText = Intern(pszText, (int)(pszStore - pszText));
+			}
+		}
+		else if (isdigit((unsigned char)ch) || (ch == '-'))
+		{
+			//
+			// Integers consist of numbers with an optional leading minus sign, and
+			// no identifier characters are allowed contiguous with numbers.
+			//
+			token.m_pszText = pch++;
+			while ((pch < pEnd) && isdigit((unsigned char)*pch))
+			{
+				pch++;
+			}
+
+			token.m_eType = INTEGER;
+			if ((pch < pEnd) && ((*pch == '-') || isalpha((unsigned char)*pch) || (*pch == '_')))
+			{
+				token.m_eType = TOKENERROR;
+				token.m_pszText = NULL;
+				break;
+			}
+
+			pszUnterminated = m_pView + (pch - m_pView);
+		}
+		else if (isalnum((unsigned char)ch) || (ch == '_'))
+		{
+			//
+			// Identifiers consist of a consecutive string of alphanumeric
+			// characters and underscores, and are cut at the key value length.
+			//
+			token.m_pszText = pch;
+			while ((pch < pEnd) && (isalnum((unsigned char)*pch) || (*pch == '_')))
+			{
+				pch++;
+			}
+
+			token.m_eType = IDENT;
+			token.m_bName = bNameNext;
+			pszUnterminated = m_pView + (min(pch, token.m_pszText + MAX_KEYVALUE_LEN - 1) - m_pView);
+		}
+		else
+		{
+			token.m_eType = TOKENERROR;
+			break;
+		}
+
+		if ((token.m_eType == STRING) || (token.m_eType == IDENT))
+		{
+			bNameNext = !bNameNext;
+		}
+		else
+		{
+			bNameNext = true;
+		}
+	}
+
+	if (pszUnterminated != NULL)
+	{
+		TerminateText(pszUnterminated, pEnd);
+	}
+
+	m_nEndLine = nLine;
+	m_InternTable.Purge();
+
+	return(ChunkFile_Ok);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes a copy of the text with CRLF or LF line ends.
+//-----------------------------------------------------------------------------
+static bool WriteLineEnds(const char *pszFileName, const char *pText, size_t nSize, bool bCRLF)
+{
+	FILE *fp = fopen(pszFileName, "wb");
+	if (fp == NULL)
+	{
+		return(false);
+	}
+
+	for (size_t i = 0; i < nSize; i++)
+	{
+		if ((pText[i] == '\r') && (i + 1 < nSize) && (pText[i + 1] == '\n'))
+		{
+			continue;
+		}
+
+		if ((pText[i] == '\n') && bCRLF)
+		{
+			fputc('\r', fp);
+		}
+
+		fputc(pText[i], fp);
+	}
+
+	fclose(fp);
+	return(true);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Debug check that the file tokenizes the same as with TokenReader.
+//			The file is also tokenized with its line ends converted to LF and
+//			to CRLF, all three have to give TokenReader's tokens on the same
+//			lines. TokenReader reads the LF copy, as a text mode read would.
+// Input  : pszFileName - Path of file to check.
+// Output : Returns true if the tokens match.
+//-----------------------------------------------------------------------------
+bool CChunkFileTokens::CheckAgainstTokenReader(const char *pszFileName)
+{
+	CChunkFileTokens Tokens[3];
+	if (Tokens[0].Tokenize(pszFileName) != ChunkFile_Ok)
+	{
+		return(false);
+	}
+
+	CUtlString LFFileName = CUtlString(pszFileName) + ".lf.tmp";
+	CUtlString CRLFFileName = CUtlString(pszFileName) + ".crlf.tmp";
+
+	CChunkFileTokens Text;
+	bool bOk = Text.MapFile(pszFileName) &&
+		WriteLineEnds(LFFileName, Text.m_pView, Text.m_nViewSize, false) &&
+		WriteLineEnds(CRLFFileName, Text.m_pView, Text.m_nViewSize, true) &&
+		(Tokens[1].Tokenize(LFFileName) == ChunkFile_Ok) &&
+		(Tokens[2].Tokenize(CRLFFileName) == ChunkFile_Ok);
+	Text.UnmapFile();
+
+	TokenReader Reader;
+	if (bOk && Reader.Open(LFFileName))
+	{
+		static const char *s_pszLineEnds[3] = { "as is", "LF", "CRLF" };
+
+		for (int nToken = 0; bOk; nToken++)
+		{
+			char szToken[MAX_KEYVALUE_LEN];
+			szToken[0] = '\0';
+			trtoken_t eType = Reader.NextToken(szToken, sizeof(szToken));
+
+			for (int i = 0; i < 3; i++)
+			{
+				const Token_t *pToken = (nToken < Tokens[i].m_Tokens.Count()) ? &Tokens[i].m_Tokens[nToken] : NULL;
+				trtoken_t eOurType = pToken ? (trtoken_t)pToken->m_eType : TOKENEOF;
+				const char *pszOurText = "";
+				char szOperator[2] = { 0, 0 };
+				if (pToken && (eOurType == OPERATOR))
+				{
+					szOperator[0] = pToken->m_chOperator;
+					pszOurText = szOperator;
+				}
+				else if (pToken && pToken->m_pszText)
+				{
+					pszOurText = pToken->m_pszText;
+				}
+
+				bool bTextMatches = (eType < 0) || (Q_strncmp(szToken, pszOurText, MAX_KEYVALUE_LEN - 1) == 0);
+				bool bLineMatches = !pToken || (nToken >= Tokens[1].m_Tokens.Count()) || (pToken->m_nLine == Tokens[1].m_Tokens[nToken].m_nLine);
+				if ((eType != eOurType) || !bTextMatches || !bLineMatches)
+				{
+					Warning("%s, token %d (%s): read %d \"%s\" on line %d, TokenReader read %d \"%s\"\n", pszFileName, nToken, s_pszLineEnds[i],
+						eOurType, pszOurText, pToken ? pToken->m_nLine : Tokens[i].m_nEndLine, eType, szToken);
+					bOk = false;
+				}
+			}
+
+			if (eType < 0)
+			{
+				break;
+			}
+		}
+
+		Reader.Close();
+	}
+
+	remove(LFFileName);
+	remove(CRLFFileName);
+	return(bOk);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Terminates the text of the last token, an identifier or integer.
+// Input  : pszEnd - Character after the text.
+//			pNext - Where the next token starts, or the end of the file.
+//-----------------------------------------------------------------------------
+void CChunkFileTokens::TerminateText(char *pszEnd, const char *pNext)
+{
+	//
+	// Overwriting the character after the text is fine, unless it is the end
+	// of the file or the start of the next token ("name-1").
+	//
+	Token_t &token = m_Tokens.Tail();
+	int nLength = (int)(pszEnd - token.m_pszText);
+
+	if ((pszEnd < pNext) || ((pNext < m_pView + m_nViewSize) && !isdigit((unsigned char)*pNext) && (*pNext != '-')))
+	{
+		*pszEnd = '\0';
+	}
+	else
+	{
+		char *pszCopy = new char[nLength + 1];
+		memcpy(pszCopy, token.m_pszText, nLength);
+		pszCopy[nLength] = '\0';
+
+		m_CopiedText.AddToTail(pszCopy);
+		token.m_pszText = pszCopy;
+	}
+
+	if (token.m_bName)
+	{
+		token.m_pszText = Intern(token.m_pszText, nLength);
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the first name with the same text that was tokenized.
+// Input  : pszName - Terminated name.
+//			nLength - Its length.
+//-----------------------------------------------------------------------------
+const char *CChunkFileTokens::Intern(const char *pszName, int nLength)
+{
+	if (m_InternTable.Count() == 0)
+	{
+		m_InternTable.SetCount(256);
+		memset(m_InternTable.Base(), 0, m_InternTable.Count() * sizeof(const char *));
+		m_nInterned = 0;
+	}
+
+	int nMask = m_InternTable.Count() - 1;
+	int nSlot = HashString(pszName, nLength) & nMask;
+	while (m_InternTable[nSlot] != NULL)
+	{
+		const char *pszInterned = m_InternTable[nSlot];
+		if (!memcmp(pszInterned, pszName, nLength) && (pszInterned[nLength] == '\0'))
+		{
+			return(pszInterned);
+		}
+
+		nSlot = (nSlot + 1) & nMask;
+	}
+
+	m_InternTable[nSlot] = pszName;
+
+	//
+	// Keep the table at most half full.
+	//
+	if (++m_nInterned * 2 > m_InternTable.Count())
+	{
+		CUtlVector<const char *> oldTable;
+		oldTable.Swap(m_InternTable);
+		m_InternTable.SetCount(oldTable.Count() * 2);
+		memset(m_InternTable.Base(), 0, m_InternTable.Count() * sizeof(const char *));
+
+		nMask = m_InternTable.Count() - 1;
+		for (int i = 0; i < oldTable.Count(); i++)
+		{
+			if (oldTable[i] != NULL)
+			{
+				nSlot = HashString(oldTable[i]) & nMask;
+				while (m_InternTable[nSlot] != NULL)
+				{
+					nSlot = (nSlot + 1) & nMask;
+				}
+				m_InternTable[nSlot] = oldTable[i];
+			}
+		}
+	}
+
+	return(pszName);
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Constructor. Initializes data members.
 //-----------------------------------------------------------------------------
@@ -165,6 +860,11 @@ CChunkFile::CChunkFile(void)
 	m_szIndent[0] = '\0';
 	m_nHandlerStackDepth = 0;
 	m_DefaultChunkHandler = 0;
+	m_pTokens = NULL;
+	m_bOwnTokens = false;
+	m_nNextToken = 0;
+	m_nLine = 0;
+	m_szOperator[0] = '\0';
 }
 
 
@@ -173,10 +873,7 @@ CChunkFile::CChunkFile(void)
 //-----------------------------------------------------------------------------
 CChunkFile::~CChunkFile(void)
 {
-	if (m_hFile != NULL)
-	{
-		fclose(m_hFile);
-	}
+	Close();
 }
 
 
@@ -236,6 +933,13 @@ ChunkFileResult_t CChunkFile::Close(void)
 		m_hFile = NULL;
 	}
 
+	if (m_bOwnTokens)
+	{
+		delete m_pTokens;
+	}
+	m_pTokens = NULL;
+	m_bOwnTokens = false;
+
 	return(ChunkFile_Ok);
 }
 
@@ -297,7 +1001,9 @@ const char *CChunkFile::GetErrorText(ChunkFileResult_t eResult)
 		}
 	}
 
-	return(m_TokenReader.Error(szError));
+	static char szErrorBuf[MAX_KEYVALUE_LEN + 256];
+	Q_snprintf(szErrorBuf, sizeof( szErrorBuf ), "File %s, line %d: %s", m_pTokens ? m_pTokens->GetFileName() : "", m_nLine, szError);
+	return(szErrorBuf);
 }
 
 
@@ -341,7 +1047,7 @@ ChunkFileResult_t CChunkFile::HandleChunk(const char *szChunkName)
 		// If a chunk handler was found in the handler map...
 		//
 		void *pData;
-		ChunkHandler_t pfnHandler = pHandler->GetHandler(szChunkName, &pData);
+		ChunkHandler_t pfnHandler = pHandler->GetHandlerInterned(szChunkName, &pData);
 		if (pfnHandler != NULL)
 		{
 			// Dispatch this chunk to the handler.
@@ -362,10 +1068,10 @@ ChunkFileResult_t CChunkFile::HandleChunk(const char *szChunkName)
 			do
 			{
 				ChunkType_t eChunkType;
-				char szKey[MAX_KEYVALUE_LEN];
-				char szValue[MAX_KEYVALUE_LEN];
+				const char *pszKey;
+				const char *pszValue;
 
-				while ((eResult = ReadNext(szKey, szValue, sizeof(szValue), eChunkType)) == ChunkFile_Ok)
+				while ((eResult = ReadNextToken(&pszKey, &pszValue, eChunkType)) == ChunkFile_Ok)
 				{
 					if (eChunkType == ChunkType_Chunk)
 					{
@@ -402,16 +1108,15 @@ ChunkFileResult_t CChunkFile::Open(const char *pszFileName, ChunkFileOpenMode_t
 {
 	if (eMode == ChunkFile_Read)
 	{
-		// UNDONE: TokenReader encapsulates file - unify reading and writing to use the same file I/O.
-		// UNDONE: Support in-memory parsing.
-		if (m_TokenReader.Open(pszFileName))
-		{
-			m_nCurrentDepth = 0;
-		}
-		else
+		CChunkFileTokens *pTokens = new CChunkFileTokens;
+		if (pTokens->Tokenize(pszFileName) != ChunkFile_Ok)
 		{
+			delete pTokens;
 			return(ChunkFile_OpenFail);
-		}	
+		}
+
+		Open(pTokens);
+		m_bOwnTokens = true;
 	}
 	else if (eMode == ChunkFile_Write)
 	{
@@ -429,6 +1134,55 @@ ChunkFileResult_t CChunkFile::Open(const char *pszFileName, ChunkFileOpenMode_t
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Reads a file that was already tokenized, possibly on another thread.
+// Input  : pTokens - The tokens, which are not modified and may be read again.
+//-----------------------------------------------------------------------------
+ChunkFileResult_t CChunkFile::Open(const CChunkFileTokens *pTokens)
+{
+	Close();
+
+	m_pTokens = pTokens;
+	m_bOwnTokens = false;
+	m_nNextToken = 0;
+	m_nLine = 0;
+	m_nCurrentDepth = 0;
+
+	return(ChunkFile_Ok);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the next token of the file being read.
+// Input  : ppszToken - Receives the text of the token, valid as long as the tokens.
+//-----------------------------------------------------------------------------
+trtoken_t CChunkFile::NextToken(const char **ppszToken)
+{
+	if ((m_pTokens == NULL) || (m_nNextToken >= m_pTokens->m_Tokens.Count()))
+	{
+		m_nLine = m_pTokens ? m_pTokens->m_nEndLine : 0;
+		*ppszToken = "";
+		return(TOKENEOF);
+	}
+
+	const CChunkFileTokens::Token_t &token = m_pTokens->m_Tokens[m_nNextToken++];
+	m_nLine = token.m_nLine;
+
+	if (token.m_eType == OPERATOR)
+	{
+		m_szOperator[0] = token.m_chOperator;
+		m_szOperator[1] = '\0';
+		*ppszToken = m_szOperator;
+	}
+	else
+	{
+		*ppszToken = token.m_pszText ? token.m_pszText : "";
+	}
+
+	return((trtoken_t)token.m_eType);
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Removes the topmost set of chunk handlers.
 //-----------------------------------------------------------------------------
@@ -472,8 +1226,31 @@ void CChunkFile::PushHandlers(CChunkHandlerMap *pHandlerMap)
 //-----------------------------------------------------------------------------
 ChunkFileResult_t CChunkFile::ReadNext(char *szName, char *szValue, int nValueSize, ChunkType_t &eChunkType)
 {
-	// HACK: pass in buffer sizes?
-	trtoken_t eTokenType = m_TokenReader.NextToken(szName, MAX_KEYVALUE_LEN);
+	const char *pszName;
+	const char *pszValue;
+
+	ChunkFileResult_t eResult = ReadNextToken(&pszName, &pszValue, eChunkType);
+	if (eResult == ChunkFile_Ok)
+	{
+		Q_strncpy(szName, pszName, MAX_KEYVALUE_LEN);
+		Q_strncpy(szValue, pszValue, nValueSize);
+	}
+
+	return(eResult);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Same as ReadNext, without copying the name and value.
+// Input  : ppszName - Receives the name of key or chunk, interned.
+//			ppszValue - Receives the value of the key, or "" for a chunk.
+//			eChunkType - ChunkType_Key or ChunkType_Chunk.
+//-----------------------------------------------------------------------------
+ChunkFileResult_t CChunkFile::ReadNextToken(const char **ppszName, const char **ppszValue, ChunkType_t &eChunkType)
+{
+	const char *szName;
+	trtoken_t eTokenType = NextToken(&szName);
+	*ppszName = szName;
 
 	if (eTokenType != TOKENEOF)
 	{
@@ -482,13 +1259,13 @@ ChunkFileResult_t CChunkFile::ReadNext(char *szName, char *szValue, int nValueSi
 			case IDENT:
 			case STRING:
 			{
-				char szNext[MAX_KEYVALUE_LEN];
+				const char *szNext;
 				trtoken_t eNextTokenType;
 
 				//
 				// Read the next token to determine what we have.
 				//
-				eNextTokenType = m_TokenReader.NextToken(szNext, sizeof(szNext));
+				eNextTokenType = NextToken(&szNext);
 
 				switch (eNextTokenType)
 				{
@@ -499,7 +1276,7 @@ ChunkFileResult_t CChunkFile::ReadNext(char *szName, char *szValue, int nValueSi
 							// Beginning of new chunk.
 							m_nCurrentDepth++;
 							eChunkType = ChunkType_Chunk;
-							szValue[0] = '\0';
+							*ppszValue = "";
 							return(ChunkFile_Ok);
 						}
 						else
@@ -514,7 +1291,7 @@ ChunkFileResult_t CChunkFile::ReadNext(char *szName, char *szValue, int nValueSi
 					case IDENT:
 					{
 						// Key value pair.
-						Q_strncpy(szValue, szNext, nValueSize );
+						*ppszValue = szNext;
 						eChunkType = ChunkType_Key;
 						return(ChunkFile_Ok);
 					}
@@ -582,11 +1359,11 @@ ChunkFileResult_t CChunkFile::ReadChunk(KeyHandler_t pfnKeyHandler, void *pData)
 	ChunkFileResult_t eResult;
 	do
 	{
-		char szName[MAX_KEYVALUE_LEN];
-		char szValue[MAX_KEYVALUE_LEN];
+		const char *szName;
+		const char *szValue;
 		ChunkType_t eChunkType;
 
-		eResult = ReadNext(szName, szValue, sizeof(szValue), eChunkType);
+		eResult = ReadNextToken(&szName, &szValue, eChunkType);
 
 		if (eResult == ChunkFile_Ok)
 		{
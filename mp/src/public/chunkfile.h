@@ -14,6 +14,8 @@
 
 #include <stdio.h>
 #include "tokenreader.h"
+#include "tier1/utlvector.h"
+#include "tier1/utlstring.h"
 
 
 #define MAX_INDENT_DEPTH		80
@@ -104,6 +106,10 @@ class CChunkHandlerMap
 		void AddHandler(const char *pszChunkName, ChunkHandler_t pfnHandler, void *pData);
 		ChunkHandler_t GetHandler(const char *pszChunkName, void **pData);
 
+		// Same as GetHandler for names from CChunkFileTokens, which are interned: the same name
+		// twice in a row is the same pointer and skips the search.
+		ChunkHandler_t GetHandlerInterned(const char *pszChunkName, void **pData);
+
 		void SetErrorHandler(ChunkErrorHandler_t pfnHandler, void *pData);
 		ChunkErrorHandler_t GetErrorHandler(void **pData);
 
@@ -112,6 +118,68 @@ class CChunkHandlerMap
 		ChunkHandlerInfoNode_t *m_pHandlers;
 		ChunkErrorHandler_t m_pfnErrorHandler;
 		void *m_pErrorData;
+
+		const char *m_pszLastChunkName;
+		ChunkHandler_t m_pfnLastHandler;
+		void *m_pLastData;
+};
+
+
+//
+// A whole chunk file split into tokens in one pass. The file is mapped copy-on-write and
+// the tokens point straight into the view: strings are unescaped and terminated in place,
+// and names (chunk names and keys) are interned so every "side" or "plane" in the file is
+// the same pointer. Tokenize only touches this object, so independent files can be
+// tokenized on worker threads and read later through CChunkFile::Open.
+//
+class CChunkFileTokens
+{
+	public:
+
+		CChunkFileTokens(void);
+		~CChunkFileTokens(void);
+
+		ChunkFileResult_t Tokenize(const char *pszFileName);
+		void Purge(void);
+
+		static bool CheckAgainstTokenReader(const char *pszFileName);	// debug, see vbsp -checktokens
+
+		const char *GetFileName(void) const;
+		int GetTokenCount(void) const;
+
+	protected:
+
+		friend class CChunkFile;
+
+		struct Token_t
+		{
+			const char *m_pszText;		// NULL for operators, see m_chOperator
+			int m_nLine;
+			signed char m_eType;		// trtoken_t
+			char m_chOperator;
+			bool m_bName;
+		};
+
+		bool MapFile(const char *pszFileName);
+		void UnmapFile(void);
+		void TerminateText(char *pszEnd, const char *pNext);
+		const char *Intern(const char *pszName, int nLength);
+
+		CUtlString m_FileName;
+		CUtlVector<Token_t> m_Tokens;
+		int m_nEndLine;
+
+		char *m_pView;
+		size_t m_nViewSize;
+		bool m_bMapped;					// false if m_pView was read into memory instead
+#ifdef _WIN32
+		void *m_hMapping;
+#endif
+
+		CUtlVector<char *> m_CopiedText;	// identifiers that can't be terminated in place
+
+		CUtlVector<const char *> m_InternTable;	// open addressing, only while tokenizing
+		int m_nInterned;
 };
 
 
@@ -123,6 +191,7 @@ class CChunkFile
 		~CChunkFile(void);
 
 		ChunkFileResult_t Open(const char *pszFileName, ChunkFileOpenMode_t eMode);
+		ChunkFileResult_t Open(const CChunkFileTokens *pTokens);	// the tokens must outlive the reading
 		ChunkFileResult_t Close(void);
 		const char *GetErrorText(ChunkFileResult_t eResult);
 
@@ -178,7 +247,14 @@ class CChunkFile
 
 		void BuildIndentString(char *pszDest, int nDepth);
 
-		TokenReader m_TokenReader;
+		trtoken_t NextToken(const char **ppszToken);
+		ChunkFileResult_t ReadNextToken(const char **ppszName, const char **ppszValue, ChunkType_t &eChunkType);
+
+		const CChunkFileTokens *m_pTokens;
+		bool m_bOwnTokens;					// Open tokenized the file itself
+		int m_nNextToken;
+		int m_nLine;						// of the last token, for the error messages
+		char m_szOperator[2];
 
 		FILE *m_hFile;
 		char m_szErrorToken[80];
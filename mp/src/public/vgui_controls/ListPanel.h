@@ -147,6 +147,11 @@ public:
 	virtual void SetItemDisabled(int itemID, bool state );
 	bool IsItemVisible( int itemID );
 
+    // If false, items are not kept in the per-column sort trees, which makes adding and changing items cheap.
+    // SortList does nothing then, the owner orders (and filters) the rows through SetVisibleItems instead.
+    void SetIndexColumns(bool bIndex) { m_bIndexColumns = bIndex; }
+    bool IsIndexingColumns() const { return m_bIndexColumns; }
+
 	virtual void SetFont(HFont font);
 
 	// image handling
@@ -263,6 +268,10 @@ public:
     virtual void SetRowHeight(int newHeight) { m_iRowHeight = newHeight; }
     virtual int GetRowHeight() { return m_iRowHeight; }
 
+protected:
+    // Replaces the displayed rows (and their order) with the given item IDs, every other item becomes invisible
+    void SetVisibleItems(const CUtlVector<int> &items);
+
 private:
 	// Cleans up allocations associated with a particular item
 	void CleanupItem( FastSortListPanelItem *data );
@@ -344,6 +353,7 @@ private:
 	bool 			m_bDeleteImageListWhenDone : 1;
 	bool			m_bIgnoreDoubleClick : 1;
     bool            m_bCenterEmptyListText : 1;
+    bool            m_bIndexColumns : 1;
 
 	int				m_iHeaderHeight;
 	int 			m_iRowHeight;
@@ -0,0 +1,225 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Records the wall clock time, CPU time and peak memory of each
+//			compile phase and writes them out as JSON ("-phasetimes <file>").
+//
+//=============================================================================//
+
+#include "cmdlib.h"
+#include "phasetimes.h"
+#include "tier1/utlvector.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment( lib, "psapi.lib" )
+#elif defined( POSIX )
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+
+struct PhaseTime_t
+{
+	char m_szName[64];
+	int m_nRuns;
+	double m_flWallTime;
+	double m_flCPUTime;
+	double m_flPeakRSS;		// megabytes
+};
+
+static bool g_bPhaseTimesEnabled = false;
+static char g_szPhaseTimesTool[64];
+static char g_szPhaseTimesFile[MAX_PATH];
+static double g_flPhaseTimesStartWall;
+static double g_flPhaseTimesStartCPU;
+
+static CUtlVector<PhaseTime_t> g_PhaseTimes;
+static int g_iCurPhase = -1;
+static double g_flCurPhaseStartWall;
+static double g_flCurPhaseStartCPU;
+
+
+//-----------------------------------------------------------------------------
+// Purpose: User and kernel time of this process, and of the worker processes it
+//			has already waited on, in seconds.
+//-----------------------------------------------------------------------------
+static double GetProcessCPUTime()
+{
+#ifdef _WIN32
+	FILETIME creationTime, exitTime, kernelTime, userTime;
+	if ( !GetProcessTimes( GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime ) )
+		return 0;
+
+	ULARGE_INTEGER kernel, user;
+	kernel.LowPart = kernelTime.dwLowDateTime;
+	kernel.HighPart = kernelTime.dwHighDateTime;
+	user.LowPart = userTime.dwLowDateTime;
+	user.HighPart = userTime.dwHighDateTime;
+
+	// 100 nanosecond units
+	return (double)( kernel.QuadPart + user.QuadPart ) * 1e-7;
+#elif defined( POSIX )
+	double flTime = 0;
+	struct rusage usage;
+	if ( getrusage( RUSAGE_SELF, &usage ) == 0 )
+	{
+		flTime += usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6;
+		flTime += usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+	}
+	if ( getrusage( RUSAGE_CHILDREN, &usage ) == 0 )
+	{
+		flTime += usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6;
+		flTime += usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+	}
+	return flTime;
+#else
+	return 0;
+#endif
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Most memory this process had resident so far, in megabytes.
+//-----------------------------------------------------------------------------
+static double GetProcessPeakRSS()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if ( !GetProcessMemoryInfo( GetCurrentProcess(), &counters, sizeof( counters ) ) )
+		return 0;
+
+	return counters.PeakWorkingSetSize / ( 1024.0 * 1024.0 );
+#elif defined( POSIX )
+	struct rusage usage;
+	if ( getrusage( RUSAGE_SELF, &usage ) != 0 )
+		return 0;
+
+#ifdef OSX
+	// bytes
+	return usage.ru_maxrss / ( 1024.0 * 1024.0 );
+#else
+	// kilobytes
+	return usage.ru_maxrss / 1024.0;
+#endif
+#else
+	return 0;
+#endif
+}
+
+
+static void WritePhaseTime( FILE *fp, const char *pszName, int nRuns, double flWallTime, double flCPUTime, double flPeakRSS, bool bLast )
+{
+	fprintf( fp, "\t\t\"%s\": { \"runs\": %d, \"wall\": %.3f, \"cpu\": %.3f, \"peak_rss_mb\": %.1f }%s\n",
+		pszName, nRuns, flWallTime, flCPUTime, flPeakRSS, bLast ? "" : "," );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes everything recorded so far, called by CmdLib_Cleanup.
+//-----------------------------------------------------------------------------
+static void PhaseTimes_Write()
+{
+	if ( !g_bPhaseTimesEnabled )
+		return;
+
+	if ( g_iCurPhase != -1 )
+	{
+		PhaseTimes_End();
+	}
+
+	// Don't write it twice if the tool exits through another CmdLib_Cleanup
+	g_bPhaseTimesEnabled = false;
+
+	FILE *fp = fopen( g_szPhaseTimesFile, "w" );
+	if ( !fp )
+	{
+		Warning( "Can't write phase times to %s\n", g_szPhaseTimesFile );
+		return;
+	}
+
+	fprintf( fp, "{\n" );
+	fprintf( fp, "\t\"tool\": \"%s\",\n", g_szPhaseTimesTool );
+	fprintf( fp, "\t\"total\": { \"wall\": %.3f, \"cpu\": %.3f, \"peak_rss_mb\": %.1f },\n",
+		Plat_FloatTime() - g_flPhaseTimesStartWall, GetProcessCPUTime() - g_flPhaseTimesStartCPU, GetProcessPeakRSS() );
+	fprintf( fp, "\t\"phases\": {\n" );
+	for ( int i = 0; i < g_PhaseTimes.Count(); i++ )
+	{
+		const PhaseTime_t &phase = g_PhaseTimes[i];
+		WritePhaseTime( fp, phase.m_szName, phase.m_nRuns, phase.m_flWallTime, phase.m_flCPUTime, phase.m_flPeakRSS, i == g_PhaseTimes.Count() - 1 );
+	}
+	fprintf( fp, "\t}\n" );
+	fprintf( fp, "}\n" );
+
+	fclose( fp );
+}
+
+
+void PhaseTimes_Init( const char *pszToolName, const char *pszFileName )
+{
+	Q_strncpy( g_szPhaseTimesTool, pszToolName, sizeof( g_szPhaseTimesTool ) );
+	Q_strncpy( g_szPhaseTimesFile, pszFileName, sizeof( g_szPhaseTimesFile ) );
+
+	if ( !g_bPhaseTimesEnabled )
+	{
+		CmdLib_AtCleanup( PhaseTimes_Write );
+	}
+
+	g_bPhaseTimesEnabled = true;
+	g_flPhaseTimesStartWall = Plat_FloatTime();
+	g_flPhaseTimesStartCPU = GetProcessCPUTime();
+}
+
+
+bool PhaseTimes_Enabled()
+{
+	return g_bPhaseTimesEnabled;
+}
+
+
+void PhaseTimes_Begin( const char *pszPhase )
+{
+	if ( !g_bPhaseTimesEnabled )
+		return;
+
+	if ( g_iCurPhase != -1 )
+		Error( "PhaseTimes_Begin( %s ): %s hasn't ended.", pszPhase, g_PhaseTimes[g_iCurPhase].m_szName );
+
+	for ( int i = 0; i < g_PhaseTimes.Count(); i++ )
+	{
+		if ( !Q_stricmp( g_PhaseTimes[i].m_szName, pszPhase ) )
+		{
+			g_iCurPhase = i;
+			break;
+		}
+	}
+
+	if ( g_iCurPhase == -1 )
+	{
+		g_iCurPhase = g_PhaseTimes.AddToTail();
+		PhaseTime_t &phase = g_PhaseTimes[g_iCurPhase];
+		Q_strncpy( phase.m_szName, pszPhase, sizeof( phase.m_szName ) );
+		phase.m_nRuns = 0;
+		phase.m_flWallTime = 0;
+		phase.m_flCPUTime = 0;
+		phase.m_flPeakRSS = 0;
+	}
+
+	g_flCurPhaseStartWall = Plat_FloatTime();
+	g_flCurPhaseStartCPU = GetProcessCPUTime();
+}
+
+
+void PhaseTimes_End()
+{
+	if ( !g_bPhaseTimesEnabled || g_iCurPhase == -1 )
+		return;
+
+	PhaseTime_t &phase = g_PhaseTimes[g_iCurPhase];
+	phase.m_nRuns++;
+	phase.m_flWallTime += Plat_FloatTime() - g_flCurPhaseStartWall;
+	phase.m_flCPUTime += GetProcessCPUTime() - g_flCurPhaseStartCPU;
+	phase.m_flPeakRSS = MAX( phase.m_flPeakRSS, GetProcessPeakRSS() );
+
+	g_iCurPhase = -1;
+}
@@ -0,0 +1,34 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Records the wall clock time, CPU time and peak memory of each
+//			compile phase and writes them out as JSON ("-phasetimes <file>").
+//
+//=============================================================================//
+
+#ifndef PHASETIMES_H
+#define PHASETIMES_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+// Starts recording. The file is written by CmdLib_Cleanup, nothing is recorded until this is called.
+void PhaseTimes_Init( const char *pszToolName, const char *pszFileName );
+bool PhaseTimes_Enabled();
+
+// Phases don't nest. Running a phase again (like CSG for every brush model) adds to its totals.
+// The peak RSS is the process high-water mark when the phase ended.
+void PhaseTimes_Begin( const char *pszPhase );
+void PhaseTimes_End();
+
+
+// Times everything until the end of the enclosing scope as one phase.
+class CPhaseTimesScope
+{
+public:
+	CPhaseTimesScope( const char *pszPhase )	{ PhaseTimes_Begin( pszPhase ); }
+	~CPhaseTimesScope()							{ PhaseTimes_End(); }
+};
+
+
+#endif // PHASETIMES_H
@@ -232,7 +232,9 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, RunThreadsFn fn, void *pU
 	start = Plat_FloatTime();
 	dispatch = 0;
 	workcount = workcnt;
-	StartPacifier("");
+	// Without a pacifier of its own, the caller's one keeps going
+	if (showpacifier)
+		StartPacifier("");
 	pacifier = showpacifier;
 
 #ifdef _PROFILE
@@ -0,0 +1,275 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Hands DistributeWork style work units to worker processes forked
+//			on the local machine.
+//
+//=============================================================================//
+
+#include "cmdlib.h"
+#include "messbuf.h"
+#include "pacifier.h"
+#include "vmpi_local_distribute.h"
+
+#ifdef POSIX
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/wait.h>
+#endif
+
+
+// Work units sent ahead to each worker so it never waits on us.
+#define LOCAL_WORKER_WINDOW		2
+
+// How often the distributor callbacks get updated, in milliseconds.
+#define LOCAL_WORKER_UPDATE_MS	200
+
+
+int g_nLocalWorkers = 0;
+
+
+#ifdef POSIX
+
+struct LocalWorkResultHeader_t
+{
+	uint64 m_iWorkUnit;
+	int m_nBytes;
+};
+
+struct LocalWorker_t
+{
+	pid_t m_Pid;
+	int m_hWorkPipe;		// work unit indices to the worker, closed when there is nothing left
+	int m_hResultPipe;		// headers and results from the worker
+	int m_nOutstanding;
+};
+
+
+static bool ReadAll( int hFile, void *pData, int nBytes )
+{
+	char *pOut = (char *)pData;
+	while ( nBytes > 0 )
+	{
+		ssize_t nRead = read( hFile, pOut, nBytes );
+		if ( nRead < 0 && errno == EINTR )
+			continue;
+		if ( nRead <= 0 )
+			return false;
+		pOut += nRead;
+		nBytes -= nRead;
+	}
+	return true;
+}
+
+static bool WriteAll( int hFile, const void *pData, int nBytes )
+{
+	const char *pIn = (const char *)pData;
+	while ( nBytes > 0 )
+	{
+		ssize_t nWritten = write( hFile, pIn, nBytes );
+		if ( nWritten < 0 && errno == EINTR )
+			continue;
+		if ( nWritten <= 0 )
+			return false;
+		pIn += nWritten;
+		nBytes -= nWritten;
+	}
+	return true;
+}
+
+
+static void LocalWorkerMain( int hWorkPipe, int hResultPipe, ProcessWorkUnitFn processFn )
+{
+	// The master prints the progress
+	SuppressPacifier( true );
+
+	MessageBuffer mb;
+	uint64 iWorkUnit;
+	while ( ReadAll( hWorkPipe, &iWorkUnit, sizeof( iWorkUnit ) ) )
+	{
+		mb.clear();
+		processFn( 0, iWorkUnit, &mb );
+
+		LocalWorkResultHeader_t header;
+		header.m_iWorkUnit = iWorkUnit;
+		header.m_nBytes = mb.getLen();
+		if ( !WriteAll( hResultPipe, &header, sizeof( header ) ) || !WriteAll( hResultPipe, mb.data, header.m_nBytes ) )
+			break;
+	}
+
+	// Don't run the exit handlers of the master, or flush its buffers a second time
+	_exit( 0 );
+}
+
+
+static void CloseWorkPipe( LocalWorker_t &worker )
+{
+	if ( worker.m_hWorkPipe != -1 )
+	{
+		close( worker.m_hWorkPipe );
+		worker.m_hWorkPipe = -1;
+	}
+}
+
+
+double LocalDistributeWork( uint64 nWorkUnits, bool bShowPacifier, ProcessWorkUnitFn processFn, ReceiveWorkUnitFn receiveFn )
+{
+	double flStartTime = Plat_FloatTime();
+	if ( nWorkUnits == 0 )
+		return 0;
+
+	int nWorkers = (int)min( (uint64)g_nLocalWorkers, nWorkUnits );
+
+	if ( bShowPacifier )
+		StartPacifier( "" );
+
+	// A worker dying must not take us down with it while we write to it
+	void (*pOldSigPipe)( int ) = signal( SIGPIPE, SIG_IGN );
+
+	// Anything still buffered would be printed again by every worker
+	fflush( stdout );
+	fflush( stderr );
+
+	CUtlVector<LocalWorker_t> workers;
+	workers.SetCount( nWorkers );
+	for ( int iWorker = 0; iWorker < nWorkers; iWorker++ )
+	{
+		int workPipe[2], resultPipe[2];
+		if ( pipe( workPipe ) != 0 || pipe( resultPipe ) != 0 )
+			Error( "LocalDistributeWork: can't create the pipes for local worker %d.", iWorker );
+
+		pid_t pid = fork();
+		if ( pid < 0 )
+			Error( "LocalDistributeWork: can't fork local worker %d.", iWorker );
+
+		if ( pid == 0 )
+		{
+			// Only keep our own ends of our own pipes
+			for ( int i = 0; i < iWorker; i++ )
+			{
+				close( workers[i].m_hWorkPipe );
+				close( workers[i].m_hResultPipe );
+			}
+			close( workPipe[1] );
+			close( resultPipe[0] );
+			LocalWorkerMain( workPipe[0], resultPipe[1], processFn );
+		}
+
+		close( workPipe[0] );
+		close( resultPipe[1] );
+
+		LocalWorker_t &worker = workers[iWorker];
+		worker.m_Pid = pid;
+		worker.m_hWorkPipe = workPipe[1];
+		worker.m_hResultPipe = resultPipe[0];
+		worker.m_nOutstanding = 0;
+	}
+
+	CUtlVector<pollfd> pollFds;
+	pollFds.SetCount( nWorkers );
+
+	CUtlVector<char> resultData;
+	MessageBuffer mb;
+	uint64 iNextWorkUnit = 0;
+	uint64 nCompleted = 0;
+	bool bCancelled = false;
+
+	while ( nCompleted < nWorkUnits && !bCancelled )
+	{
+		// Keep everybody's window full, and let the workers go once there is nothing left to give them
+		for ( int iWorker = 0; iWorker < nWorkers; iWorker++ )
+		{
+			LocalWorker_t &worker = workers[iWorker];
+			while ( worker.m_hWorkPipe != -1 && worker.m_nOutstanding < LOCAL_WORKER_WINDOW && iNextWorkUnit < nWorkUnits )
+			{
+				if ( !WriteAll( worker.m_hWorkPipe, &iNextWorkUnit, sizeof( iNextWorkUnit ) ) )
+					Error( "LocalDistributeWork: local worker %d is gone.", iWorker );
+				++iNextWorkUnit;
+				++worker.m_nOutstanding;
+			}
+
+			if ( iNextWorkUnit == nWorkUnits && worker.m_nOutstanding == 0 )
+				CloseWorkPipe( worker );
+
+			pollFds[iWorker].fd = worker.m_nOutstanding ? worker.m_hResultPipe : -1;
+			pollFds[iWorker].events = POLLIN;
+			pollFds[iWorker].revents = 0;
+		}
+
+		int nReady = poll( pollFds.Base(), nWorkers, LOCAL_WORKER_UPDATE_MS );
+		if ( nReady < 0 && errno != EINTR )
+			Error( "LocalDistributeWork: poll failed (%s).", strerror( errno ) );
+
+		if ( g_pDistributeWorkCallbacks && g_pDistributeWorkCallbacks->Update() )
+			bCancelled = true;
+
+		for ( int iWorker = 0; nReady > 0 && iWorker < nWorkers; iWorker++ )
+		{
+			if ( !( pollFds[iWorker].revents & ( POLLIN | POLLHUP | POLLERR ) ) )
+				continue;
+
+			LocalWorker_t &worker = workers[iWorker];
+			LocalWorkResultHeader_t header;
+			if ( !ReadAll( worker.m_hResultPipe, &header, sizeof( header ) ) || header.m_nBytes < 0 || header.m_iWorkUnit >= nWorkUnits )
+				Error( "LocalDistributeWork: local worker %d exited in the middle of its work.", iWorker );
+
+			resultData.SetCount( header.m_nBytes );
+			if ( header.m_nBytes && !ReadAll( worker.m_hResultPipe, resultData.Base(), header.m_nBytes ) )
+				Error( "LocalDistributeWork: local worker %d exited in the middle of its results.", iWorker );
+
+			mb.clear();
+			mb.write( resultData.Base(), header.m_nBytes );
+			mb.setOffset( 0 );
+			receiveFn( header.m_iWorkUnit, &mb, iWorker );
+
+			--worker.m_nOutstanding;
+			++nCompleted;
+		}
+
+		UpdatePacifier( (float)nCompleted / nWorkUnits );
+	}
+
+	for ( int iWorker = 0; iWorker < nWorkers; iWorker++ )
+	{
+		LocalWorker_t &worker = workers[iWorker];
+		CloseWorkPipe( worker );
+		if ( bCancelled )
+			kill( worker.m_Pid, SIGTERM );
+
+		close( worker.m_hResultPipe );
+		while ( waitpid( worker.m_Pid, NULL, 0 ) < 0 && errno == EINTR )
+			;
+	}
+
+	signal( SIGPIPE, pOldSigPipe );
+
+	double flElapsed = Plat_FloatTime() - flStartTime;
+	if ( bShowPacifier )
+	{
+		EndPacifier( false );
+		printf( " (%d)\n", (int)flElapsed );
+	}
+
+	return flElapsed;
+}
+
+bool LocalWorkersEnabled()
+{
+	return g_nLocalWorkers > 0;
+}
+
+#else
+
+double LocalDistributeWork( uint64 nWorkUnits, bool bShowPacifier, ProcessWorkUnitFn processFn, ReceiveWorkUnitFn receiveFn )
+{
+	Error( "LocalDistributeWork: local worker processes are only supported on POSIX, use -mpi instead." );
+	return 0;
+}
+
+bool LocalWorkersEnabled()
+{
+	return false;
+}
+
+#endif
@@ -0,0 +1,38 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Hands DistributeWork style work units to worker processes forked
+//			on the local machine.
+//
+//=============================================================================//
+
+#ifndef VMPI_LOCAL_DISTRIBUTE_H
+#define VMPI_LOCAL_DISTRIBUTE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+#include "vmpi_distribute_work.h"
+
+
+// How many worker processes LocalDistributeWork forks ("-localworkers"), 0 to do the work on threads instead.
+extern int g_nLocalWorkers;
+
+// True if the work should go through LocalDistributeWork rather than RunThreadsOn.
+bool LocalWorkersEnabled();
+
+// Same contract as DistributeWork, without VMPI: the workers are forked from this process, so they see
+// everything it computed so far, run processFn for each of their work units and send the MessageBuffer it
+// filled back through a pipe. receiveFn is called here, in this process, as the results come in.
+// Each worker is a single thread with its own address space (and its own allocator).
+//
+// Returns time it took to finish the work.
+double LocalDistributeWork(
+	uint64 nWorkUnits,				// how many work units to dole out
+	bool bShowPacifier,				// starts and ends the pacifier, it is updated either way
+	ProcessWorkUnitFn processFn,	// called in the workers with iThread 0 and a valid pBuf
+	ReceiveWorkUnitFn receiveFn		// called in this process, iWorker is the index of the local worker
+	);
+
+
+#endif // VMPI_LOCAL_DISTRIBUTE_H
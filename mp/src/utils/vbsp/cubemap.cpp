@@ -18,6 +18,7 @@
 #include "materialsystem/imaterialsystem.h"
 #include "materialsystem/imaterial.h"
 #include "materialsystem/imaterialvar.h"
+#include "vstdlib/random.h"
 
 
 /*
@@ -865,43 +866,26 @@ void Cubemap_InitCubemapSideData( void )
 }
 
 //-----------------------------------------------------------------------------
+// Closest cubemap sample to a point, looking at the ones in front of the plane
+// through it first. Scans every sample, CCubemapSampleTree does the same faster.
 //-----------------------------------------------------------------------------
-int Cubemap_FindClosestCubemap( const Vector &entityOrigin, side_t *pSide )
+static int Cubemap_FindClosestCubemapLinear( const dcubemapsample_t *pSamples, int nSamples, const Vector &vecCenter, const Vector &vecNormal )
 {
-	if ( !pSide )
-		return -1;
-
-	// Return a valid (if random) cubemap if there's no winding
-	if ( !pSide->winding )
-		return 0;
-
-	// Calculate the center point.
-	Vector vecCenter;
-	vecCenter.Init();
-
-	for ( int iPoint = 0; iPoint < pSide->winding->numpoints; ++iPoint )
-	{
-		VectorAdd( vecCenter, pSide->winding->p[iPoint], vecCenter );
-	}
-	VectorScale( vecCenter, 1.0f / pSide->winding->numpoints, vecCenter );
-	vecCenter += entityOrigin;
-	plane_t *pPlane = &g_MainMap->mapplanes[pSide->planenum];
-
 	// Find the closest cubemap.
 	int iMinCubemap = -1;
 	float flMinDist = FLT_MAX;
 
 	// Look for cubemaps in front of the surface first.
-	for ( int iCubemap = 0; iCubemap < g_nCubemapSamples; ++iCubemap )
+	for ( int iCubemap = 0; iCubemap < nSamples; ++iCubemap )
 	{	
-		dcubemapsample_t *pSample = &g_CubemapSamples[iCubemap];
+		const dcubemapsample_t *pSample = &pSamples[iCubemap];
 		Vector vecSampleOrigin( static_cast<float>( pSample->origin[0] ),
 								static_cast<float>( pSample->origin[1] ),
 								static_cast<float>( pSample->origin[2] ) );
 		Vector vecDelta;
 		VectorSubtract( vecSampleOrigin, vecCenter, vecDelta );
 		float flDist = vecDelta.NormalizeInPlace();
-		float flDot = DotProduct( vecDelta, pPlane->normal );
+		float flDot = DotProduct( vecDelta, vecNormal );
 		if ( ( flDot >= 0.0f ) && ( flDist < flMinDist ) )
 		{
 			flMinDist = flDist;
@@ -912,9 +896,9 @@ int Cubemap_FindClosestCubemap( const Vector &entityOrigin, side_t *pSide )
 	// Didn't find anything in front search for closest.
 	if( iMinCubemap == -1 )
 	{
-		for ( int iCubemap = 0; iCubemap < g_nCubemapSamples; ++iCubemap )
+		for ( int iCubemap = 0; iCubemap < nSamples; ++iCubemap )
 		{	
-			dcubemapsample_t *pSample = &g_CubemapSamples[iCubemap];
+			const dcubemapsample_t *pSample = &pSamples[iCubemap];
 			Vector vecSampleOrigin( static_cast<float>( pSample->origin[0] ),
 				static_cast<float>( pSample->origin[1] ),
 				static_cast<float>( pSample->origin[2] ) );
@@ -933,6 +917,306 @@ int Cubemap_FindClosestCubemap( const Vector &entityOrigin, side_t *pSide )
 }
 
 
+//-----------------------------------------------------------------------------
+// KD-tree over the cubemap sample origins. Finds the same samples as
+// Cubemap_FindClosestCubemapLinear, ties included (the lowest index wins),
+// by only skipping the nodes that are farther than the closest sample so far
+// with some slack, or entirely behind the plane.
+//-----------------------------------------------------------------------------
+#define CUBEMAP_TREE_LEAF_SIZE		8
+
+class CCubemapSampleTree
+{
+public:
+	void Build( const dcubemapsample_t *pSamples, int nSamples );
+	int FindClosest( const Vector &vecCenter, const Vector &vecNormal ) const;
+
+private:
+	struct Node_t
+	{
+		Vector	m_vecMins;
+		Vector	m_vecMaxs;
+		int		m_nFirst;			// into m_Indices, leaves only
+		int		m_nCount;			// 0 for interior nodes
+		int		m_nChildren[2];
+	};
+
+	struct Query_t
+	{
+		Vector	m_vecCenter;
+		Vector	m_vecNormal;
+		bool	m_bInFront;
+		int		m_iBest;
+		float	m_flBestDist;
+	};
+
+	int BuildNode( int nFirst, int nCount );
+	void FindClosest_R( int nNode, Query_t &query ) const;
+
+	CUtlVector<Node_t>	m_Nodes;
+	CUtlVector<int>		m_Indices;
+	CUtlVector<Vector>	m_Origins;
+};
+
+static const CUtlVector<Vector> *s_pSortOrigins;
+static int s_nSortAxis;
+
+static int CompareCubemapSamples( const void *a, const void *b )
+{
+	float flA = (*s_pSortOrigins)[*(const int *)a][s_nSortAxis];
+	float flB = (*s_pSortOrigins)[*(const int *)b][s_nSortAxis];
+	return ( flA < flB ) ? -1 : ( ( flA > flB ) ? 1 : 0 );
+}
+
+void CCubemapSampleTree::Build( const dcubemapsample_t *pSamples, int nSamples )
+{
+	m_Nodes.RemoveAll();
+	m_Indices.SetCount( nSamples );
+	m_Origins.SetCount( nSamples );
+	for ( int i = 0; i < nSamples; ++i )
+	{
+		m_Indices[i] = i;
+		m_Origins[i].Init( static_cast<float>( pSamples[i].origin[0] ),
+						   static_cast<float>( pSamples[i].origin[1] ),
+						   static_cast<float>( pSamples[i].origin[2] ) );
+	}
+
+	if ( nSamples )
+	{
+		BuildNode( 0, nSamples );
+	}
+}
+
+int CCubemapSampleTree::BuildNode( int nFirst, int nCount )
+{
+	int nNode = m_Nodes.AddToTail();
+	Node_t node;
+	node.m_vecMins.Init( FLT_MAX, FLT_MAX, FLT_MAX );
+	node.m_vecMaxs.Init( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+	for ( int i = nFirst; i < nFirst + nCount; ++i )
+	{
+		VectorMin( node.m_vecMins, m_Origins[m_Indices[i]], node.m_vecMins );
+		VectorMax( node.m_vecMaxs, m_Origins[m_Indices[i]], node.m_vecMaxs );
+	}
+	node.m_nFirst = nFirst;
+	node.m_nCount = nCount;
+	node.m_nChildren[0] = node.m_nChildren[1] = -1;
+
+	if ( nCount > CUBEMAP_TREE_LEAF_SIZE )
+	{
+		// split the longest axis at the median
+		Vector vecSize = node.m_vecMaxs - node.m_vecMins;
+		s_nSortAxis = ( vecSize.x >= vecSize.y && vecSize.x >= vecSize.z ) ? 0 : ( ( vecSize.y >= vecSize.z ) ? 1 : 2 );
+		s_pSortOrigins = &m_Origins;
+		qsort( &m_Indices[nFirst], nCount, sizeof( int ), CompareCubemapSamples );
+
+		int nHalf = nCount / 2;
+		node.m_nCount = 0;
+		node.m_nChildren[0] = BuildNode( nFirst, nHalf );
+		node.m_nChildren[1] = BuildNode( nFirst + nHalf, nCount - nHalf );
+	}
+
+	m_Nodes[nNode] = node;
+	return nNode;
+}
+
+int CCubemapSampleTree::FindClosest( const Vector &vecCenter, const Vector &vecNormal ) const
+{
+	if ( !m_Nodes.Count() )
+		return -1;
+
+	Query_t query;
+	query.m_vecCenter = vecCenter;
+	query.m_vecNormal = vecNormal;
+	query.m_bInFront = true;
+	query.m_iBest = -1;
+	query.m_flBestDist = FLT_MAX;
+
+	// Look for cubemaps in front of the surface first.
+	FindClosest_R( 0, query );
+
+	// Didn't find anything in front search for closest.
+	if ( query.m_iBest == -1 )
+	{
+		query.m_bInFront = false;
+		FindClosest_R( 0, query );
+	}
+
+	return query.m_iBest;
+}
+
+void CCubemapSampleTree::FindClosest_R( int nNode, Query_t &query ) const
+{
+	const Node_t &node = m_Nodes[nNode];
+
+	// Skip the nodes that can't have anything closer, with slack for the rounding of the distances
+	Vector vecClosest;
+	VectorMax( node.m_vecMins, query.m_vecCenter, vecClosest );
+	VectorMin( node.m_vecMaxs, vecClosest, vecClosest );
+	if ( vecClosest.DistTo( query.m_vecCenter ) > query.m_flBestDist * 1.001f + 0.01f )
+		return;
+
+	// And the ones entirely behind the surface
+	if ( query.m_bInFront )
+	{
+		float flMaxDot = 0.0f;
+		for ( int i = 0; i < 3; ++i )
+		{
+			flMaxDot += MAX( query.m_vecNormal[i] * ( node.m_vecMins[i] - query.m_vecCenter[i] ),
+							 query.m_vecNormal[i] * ( node.m_vecMaxs[i] - query.m_vecCenter[i] ) );
+		}
+		if ( flMaxDot < -0.01f )
+			return;
+	}
+
+	if ( node.m_nCount )
+	{
+		// Same math as the linear search
+		for ( int i = node.m_nFirst; i < node.m_nFirst + node.m_nCount; ++i )
+		{
+			int iCubemap = m_Indices[i];
+			Vector vecDelta;
+			VectorSubtract( m_Origins[iCubemap], query.m_vecCenter, vecDelta );
+
+			float flDist;
+			if ( query.m_bInFront )
+			{
+				flDist = vecDelta.NormalizeInPlace();
+				if ( DotProduct( vecDelta, query.m_vecNormal ) < 0.0f )
+					continue;
+			}
+			else
+			{
+				flDist = vecDelta.Length();
+			}
+
+			if ( flDist < query.m_flBestDist || ( flDist == query.m_flBestDist && iCubemap < query.m_iBest ) )
+			{
+				query.m_flBestDist = flDist;
+				query.m_iBest = iCubemap;
+			}
+		}
+		return;
+	}
+
+	// Closer child first, so the other one is more likely to be skipped
+	const Node_t &child0 = m_Nodes[node.m_nChildren[0]];
+	const Node_t &child1 = m_Nodes[node.m_nChildren[1]];
+	Vector vecCenter0 = ( child0.m_vecMins + child0.m_vecMaxs ) * 0.5f;
+	Vector vecCenter1 = ( child1.m_vecMins + child1.m_vecMaxs ) * 0.5f;
+	int nFirst = ( vecCenter0.DistToSqr( query.m_vecCenter ) <= vecCenter1.DistToSqr( query.m_vecCenter ) ) ? 0 : 1;
+	FindClosest_R( node.m_nChildren[nFirst], query );
+	FindClosest_R( node.m_nChildren[1 - nFirst], query );
+}
+
+static CCubemapSampleTree s_CubemapSampleTree;
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+int Cubemap_FindClosestCubemap( const Vector &entityOrigin, side_t *pSide )
+{
+	if ( !pSide )
+		return -1;
+
+	// Return a valid (if random) cubemap if there's no winding
+	if ( !pSide->winding )
+		return 0;
+
+	// Calculate the center point.
+	Vector vecCenter;
+	vecCenter.Init();
+
+	for ( int iPoint = 0; iPoint < pSide->winding->numpoints; ++iPoint )
+	{
+		VectorAdd( vecCenter, pSide->winding->p[iPoint], vecCenter );
+	}
+	VectorScale( vecCenter, 1.0f / pSide->winding->numpoints, vecCenter );
+	vecCenter += entityOrigin;
+	plane_t *pPlane = &g_MainMap->mapplanes[pSide->planenum];
+
+	return s_CubemapSampleTree.FindClosest( vecCenter, pPlane->normal );
+}
+
+
+//-----------------------------------------------------------------------------
+// Times the linear and KD-tree searches on a synthetic map dense with cubemaps,
+// and checks they agree.
+//-----------------------------------------------------------------------------
+void Cubemap_RunSearchBenchmark( int nSamples, int nSides )
+{
+	const float flMapSize = 16384.0f;
+
+	CUniformRandomStream random;
+	random.SetSeed( 1 );
+
+	// Cubemaps all over the map
+	CUtlVector<dcubemapsample_t> samples;
+	samples.SetCount( nSamples );
+	for ( int i = 0; i < nSamples; ++i )
+	{
+		for ( int j = 0; j < 3; ++j )
+		{
+			samples[i].origin[j] = (int)random.RandomFloat( -flMapSize / 2, flMapSize / 2 );
+		}
+		samples[i].size = 0;
+	}
+
+	// Sides facing along the axes like most brush sides, some near the edges facing out with nothing in front
+	CUtlVector<Vector> centers, normals;
+	centers.SetCount( nSides );
+	normals.SetCount( nSides );
+	for ( int i = 0; i < nSides; ++i )
+	{
+		int nAxis = random.RandomInt( 0, 2 );
+		float flSign = random.RandomInt( 0, 1 ) ? 1.0f : -1.0f;
+		for ( int j = 0; j < 3; ++j )
+		{
+			centers[i][j] = random.RandomFloat( -flMapSize / 2, flMapSize / 2 );
+		}
+		if ( random.RandomInt( 0, 9 ) == 0 )
+		{
+			centers[i][nAxis] = flSign * flMapSize / 2;
+		}
+		normals[i].Init();
+		normals[i][nAxis] = flSign;
+	}
+
+	double flStart = Plat_FloatTime();
+	CUtlVector<int> linearResults;
+	linearResults.SetCount( nSides );
+	for ( int i = 0; i < nSides; ++i )
+	{
+		linearResults[i] = Cubemap_FindClosestCubemapLinear( samples.Base(), nSamples, centers[i], normals[i] );
+	}
+	double flLinearTime = Plat_FloatTime() - flStart;
+
+	flStart = Plat_FloatTime();
+	CCubemapSampleTree tree;
+	tree.Build( samples.Base(), nSamples );
+	double flBuildTime = Plat_FloatTime() - flStart;
+
+	flStart = Plat_FloatTime();
+	int nMismatches = 0;
+	for ( int i = 0; i < nSides; ++i )
+	{
+		if ( tree.FindClosest( centers[i], normals[i] ) != linearResults[i] )
+		{
+			++nMismatches;
+		}
+	}
+	double flTreeTime = Plat_FloatTime() - flStart;
+
+	Msg( "Cubemap search, %d cubemaps and %d sides:\n", nSamples, nSides );
+	Msg( "  linear  %.3f seconds\n", flLinearTime );
+	Msg( "  kd-tree %.3f seconds (%.3f seconds to build)\n", flTreeTime, flBuildTime );
+	if ( nMismatches )
+	{
+		Warning( "  %d sides got a different cubemap from the kd-tree!\n", nMismatches );
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // For every specular surface that wasn't referenced by some env_cubemap, call Cubemap_CreateTexInfo.
 //-----------------------------------------------------------------------------
@@ -941,6 +1225,8 @@ void Cubemap_AttachDefaultCubemapToSpecularSides( void )
 	Cubemap_ResetCubemapSideData();
 	Cubemap_InitCubemapSideData();
 
+	s_CubemapSampleTree.Build( g_CubemapSamples, g_nCubemapSamples );
+
 	// build a mapping from side to entity id so that we can get the entity origin
 	CUtlVector<int> sideToEntityIndex;
 	sideToEntityIndex.SetCount(g_MainMap->nummapbrushsides);
@@ -97,6 +97,58 @@ static CUtlVector<DetailObjectLump_t>		s_DetailObjectLump;
 static CUtlVector<DetailSpriteDictLump_t>	s_DetailSpriteDictLump;
 
 
+//-----------------------------------------------------------------------------
+// The faces are covered with details on several threads. Every face gets its
+// own random sequence, seeded with its hammer face id as before, and the
+// details are added to the lump in face order once all are placed, so the lump
+// comes out exactly as when the faces were done one after another.
+//-----------------------------------------------------------------------------
+
+// Same sequence as the CRT's srand()/rand() the details were placed with
+// (Windows CRT), without its per-process (or per-thread) state
+class CDetailRandom
+{
+public:
+	explicit CDetailRandom( int nSeed ) : m_nHold( (unsigned int)nSeed ) {}
+
+	// the next rand()
+	int Rand()
+	{
+		m_nHold = m_nHold * 214013 + 2531011;
+		return ( m_nHold >> 16 ) & VALVE_RAND_MAX;
+	}
+
+private:
+	unsigned int m_nHold;
+};
+
+// A detail placed on a face, waiting to go into the lump
+struct DetailPlacement_t
+{
+	DetailModel_t const	*m_pModel;
+	Vector				m_Origin;
+	QAngle				m_Angles;
+	int					m_nLeaf;
+};
+
+struct DetailFace_t
+{
+	int				m_nFace;
+	DetailObject_t	*m_pDetail;
+
+	// the placements, in the buffer of the thread that did the face
+	int				m_nThread;
+	int				m_nFirstPlacement;
+	int				m_nPlacements;
+};
+
+static CUtlVector<DetailFace_t>			s_DetailFaces;
+static CUtlVector<DetailPlacement_t>	s_ThreadPlacements[MAX_TOOL_THREADS+1];
+
+// Keeps the leaf walk of a whole face clear of planes the points are this close to
+#define DETAIL_LEAF_PLANE_EPSILON	0.1f
+
+
 //-----------------------------------------------------------------------------
 // Parses the key-value pairs in the detail.rad file
 //-----------------------------------------------------------------------------
@@ -316,7 +368,7 @@ void LoadEmitDetailObjectDictionary( const char* pGameDir )
 //-----------------------------------------------------------------------------
 // Selects a detail group
 //-----------------------------------------------------------------------------
-static int SelectGroup( const DetailObject_t& detail, float alpha )
+static int SelectGroup( const DetailObject_t& detail, float alpha, CDetailRandom &random )
 {
 	// Find the two groups whose alpha we're between...
 	int start, end;
@@ -342,7 +394,7 @@ static int SelectGroup( const DetailObject_t& detail, float alpha )
 	}
 
 	// Pick a number, any number...
-	float r = rand() / (float)VALVE_RAND_MAX;
+	float r = random.Rand() / (float)VALVE_RAND_MAX;
 
 	// When dist == 0, we *always* want start.
 	// When dist == 1, we *always* want end
@@ -354,10 +406,10 @@ static int SelectGroup( const DetailObject_t& detail, float alpha )
 //-----------------------------------------------------------------------------
 // Selects a detail object
 //-----------------------------------------------------------------------------
-static int SelectDetail( DetailObjectGroup_t const& group )
+static int SelectDetail( DetailObjectGroup_t const& group, CDetailRandom &random )
 {
 	// Pick a number, any number...
-	float r = rand() / (float)VALVE_RAND_MAX;
+	float r = random.Rand() / (float)VALVE_RAND_MAX;
 
 	// Look through the list of models + pick the one associated with this number
 	for ( int i = 0; i < group.m_Models.Count(); ++i )
@@ -406,11 +458,43 @@ static int AddDetailSpriteDictLump( const Vector2D *pPos, const Vector2D *pTex )
 
 
 //-----------------------------------------------------------------------------
-// Computes the leaf that the detail lies in
+// Finds the deepest node that holds all of the box, where the leaf walks of the
+// details inside it can start
 //-----------------------------------------------------------------------------
-static int ComputeDetailLeaf( const Vector& pt )
+static int FindDetailBoundsNode( const Vector& mins, const Vector& maxs )
 {
+	Vector center, extents;
+	VectorAdd( mins, maxs, center );
+	center *= 0.5f;
+	VectorSubtract( maxs, center, extents );
+
 	int node = 0;
+	while( node >= 0 )
+	{
+		dnode_t* pNode = &dnodes[node];
+		dplane_t* pPlane = &dplanes[pNode->planenum];
+
+		float flDist = DotProduct( center, pPlane->normal );
+		float flRadius = fabs( pPlane->normal.x * extents.x ) + fabs( pPlane->normal.y * extents.y ) + fabs( pPlane->normal.z * extents.z );
+
+		// Only when every point is clearly on one side, so the walk of each point would have gone the same way
+		if (flDist + flRadius < pPlane->dist - DETAIL_LEAF_PLANE_EPSILON)
+			node = pNode->children[1];
+		else if (flDist - flRadius > pPlane->dist + DETAIL_LEAF_PLANE_EPSILON)
+			node = pNode->children[0];
+		else
+			break;
+	}
+
+	return node;
+}
+
+
+//-----------------------------------------------------------------------------
+// Computes the leaf that the detail lies in
+//-----------------------------------------------------------------------------
+static int ComputeDetailLeaf( const Vector& pt, int node = 0 )
+{
 	while( node >= 0 )
 	{
 		dnode_t* pNode = &dnodes[node];
@@ -454,7 +538,7 @@ static bool IsModelValid( const char* pModelName )
 // Add a detail to the lump.
 //-----------------------------------------------------------------------------
 static int s_nDetailOverflow = 0;
-static void AddDetailToLump( const char* pModelName, const Vector& pt, const QAngle& angles, int nOrientation )
+static void AddDetailToLump( const char* pModelName, const Vector& pt, const QAngle& angles, int nOrientation, int nLeaf )
 {
 	Assert( pt.IsValid() && angles.IsValid() );
 
@@ -475,7 +559,7 @@ static void AddDetailToLump( const char* pModelName, const Vector& pt, const QAn
 	objectLump.m_DetailModel = AddDetailDictLump( pModelName ); 
 	VectorCopy( angles, objectLump.m_Angles );
 	VectorCopy( pt, objectLump.m_Origin );
-	objectLump.m_Leaf = ComputeDetailLeaf(pt);
+	objectLump.m_Leaf = nLeaf;
 	objectLump.m_Lighting.r = 255;
 	objectLump.m_Lighting.g = 255;
 	objectLump.m_Lighting.b = 255;
@@ -490,7 +574,7 @@ static void AddDetailToLump( const char* pModelName, const Vector& pt, const QAn
 //-----------------------------------------------------------------------------
 // Add a detail sprite to the lump.
 //-----------------------------------------------------------------------------
-static void AddDetailSpriteToLump( const Vector &vecOrigin, const QAngle &vecAngles, int nOrientation,
+static void AddDetailSpriteToLump( const Vector &vecOrigin, const QAngle &vecAngles, int nLeaf, int nOrientation,
 								  const Vector2D *pPos, const Vector2D *pTex, float flScale, int iType,
 									int iShapeAngle = 0, int iShapeSize = 0, int iSwayAmount = 0 )
 {
@@ -506,7 +590,7 @@ static void AddDetailSpriteToLump( const Vector &vecOrigin, const QAngle &vecAng
 	objectLump.m_DetailModel = AddDetailSpriteDictLump( pPos, pTex ); 
 	VectorCopy( vecAngles, objectLump.m_Angles );
 	VectorCopy( vecOrigin, objectLump.m_Origin );
-	objectLump.m_Leaf = ComputeDetailLeaf(vecOrigin);
+	objectLump.m_Leaf = nLeaf;
 	objectLump.m_Lighting.r = 255;
 	objectLump.m_Lighting.g = 255;
 	objectLump.m_Lighting.b = 255;
@@ -521,10 +605,11 @@ static void AddDetailSpriteToLump( const Vector &vecOrigin, const QAngle &vecAng
 	objectLump.m_SwayAmount = iSwayAmount;
 }
 
-static void AddDetailSpriteToLump( const Vector &vecOrigin, const QAngle &vecAngles, DetailModel_t const& model, float flScale )
+static void AddDetailSpriteToLump( const Vector &vecOrigin, const QAngle &vecAngles, int nLeaf, DetailModel_t const& model, float flScale )
 {
 	AddDetailSpriteToLump( vecOrigin,
 		vecAngles,
+		nLeaf,
 		model.m_Orientation,
 		model.m_Pos,
 		model.m_Tex,
@@ -542,7 +627,8 @@ static void AddDetailSpriteToLump( const Vector &vecOrigin, const QAngle &vecAng
 // (only when not in the debugger?)
 // Printing the values of normal at the bottom of the function fixes it as does
 // disabling global optimizations.
-static void PlaceDetail( DetailModel_t const& model, const Vector& pt, const Vector& normal )
+static void PlaceDetail( DetailModel_t const& model, const Vector& pt, const Vector& normal,
+						 CDetailRandom &random, CUtlVector<DetailPlacement_t> &placements )
 {
 	// But only place it on the surface if it meets the angle constraints...
 	float cosAngle = normal.z;
@@ -557,7 +643,7 @@ static void PlaceDetail( DetailModel_t const& model, const Vector& pt, const Vec
 		float probability = (cosAngle - model.m_MaxCosAngle) / 
 			(model.m_MinCosAngle - model.m_MaxCosAngle);
 
-		float t = rand() / (float)VALVE_RAND_MAX;
+		float t = random.Rand() / (float)VALVE_RAND_MAX;
 		if (t > probability)
 			return;
 	}
@@ -567,7 +653,7 @@ static void PlaceDetail( DetailModel_t const& model, const Vector& pt, const Vec
 	if (model.m_Flags & MODELFLAG_UPRIGHT)
 	{
 		// If it's upright, we just select a random yaw
-		angles.Init( 0, 360.0f * rand() / (float)VALVE_RAND_MAX, 0.0f );
+		angles.Init( 0, 360.0f * random.Rand() / (float)VALVE_RAND_MAX, 0.0f );
 	}
 	else
 	{
@@ -591,7 +677,7 @@ static void PlaceDetail( DetailModel_t const& model, const Vector& pt, const Vec
 		matrix.SetBasisVectors( xaxis, yaxis, zaxis );
 		matrix.SetTranslation( vec3_origin );
 
-		float rotAngle = 360.0f * rand() / (float)VALVE_RAND_MAX;
+		float rotAngle = 360.0f * random.Rand() / (float)VALVE_RAND_MAX;
 		VMatrix rot = SetupMatrixAxisRot( Vector( 0, 0, 1 ), rotAngle );
 		matrix = matrix * rot;
 
@@ -600,34 +686,20 @@ static void PlaceDetail( DetailModel_t const& model, const Vector& pt, const Vec
 
 	// FIXME: We may also want a purely random rotation too
 
-	// Insert an element into the object dictionary if it aint there...
-	switch ( model.m_Type )
-	{
-	case DETAIL_PROP_TYPE_MODEL:
-		AddDetailToLump( model.m_ModelName.String(), pt, angles, model.m_Orientation );
-		break;
-
-	// Sprites and procedural models made from sprites
-	case DETAIL_PROP_TYPE_SPRITE:
-	default:
-		{
-			float flScale = 1.0f;
-			if ( model.m_flRandomScaleStdDev != 0.0f ) 
-			{
-				flScale = fabs( RandomGaussianFloat( 1.0f, model.m_flRandomScaleStdDev ) );
-			}
-
-			AddDetailSpriteToLump( pt, angles, model, flScale );
-		}
-		break;
-	}
+	// The leaf and the sprite scale are filled in afterwards, see AddFacePlacementsToLump
+	int i = placements.AddToTail();
+	placements[i].m_pModel = &model;
+	placements[i].m_Origin = pt;
+	placements[i].m_Angles = angles;
+	placements[i].m_nLeaf = -1;
 }
 
 
 //-----------------------------------------------------------------------------
 // Places Detail Objects on a face
 //-----------------------------------------------------------------------------
-static void EmitDetailObjectsOnFace( dface_t* pFace, DetailObject_t& detail )
+static void EmitDetailObjectsOnFace( dface_t* pFace, DetailObject_t& detail,
+									 CDetailRandom &random, CUtlVector<DetailPlacement_t> &placements )
 {
 	if (pFace->numedges < 3)
 		return;
@@ -663,8 +735,8 @@ static void EmitDetailObjectsOnFace( dface_t* pFace, DetailObject_t& detail )
 		for (int s = 0; s < numSamples; ++s )
 		{
 			// Create a random sample...
-			float u = rand() / (float)VALVE_RAND_MAX;
-			float v = rand() / (float)VALVE_RAND_MAX;
+			float u = random.Rand() / (float)VALVE_RAND_MAX;
+			float v = random.Rand() / (float)VALVE_RAND_MAX;
 			if (v > 1.0f - u)
 			{
 				u = 1.0f - u;
@@ -676,10 +748,10 @@ static void EmitDetailObjectsOnFace( dface_t* pFace, DetailObject_t& detail )
 			float alpha = 1.0f;
 
 			// Select a group based on the alpha value
-			int group = SelectGroup( detail, alpha );
+			int group = SelectGroup( detail, alpha, random );
 
 			// Now that we've got a group, choose a detail
-			int model = SelectDetail( detail.m_Groups[group] );
+			int model = SelectDetail( detail.m_Groups[group], random );
 			if (model < 0)
 				continue;
 
@@ -689,7 +761,7 @@ static void EmitDetailObjectsOnFace( dface_t* pFace, DetailObject_t& detail )
 			VectorMA( pt, v, e2, pt );
 			VectorDivide( areaVec, -normalLength, normal );
 
-			PlaceDetail( detail.m_Groups[group].m_Models[model], pt, normal );
+			PlaceDetail( detail.m_Groups[group].m_Models[model], pt, normal, random, placements );
 		}
 	}
 }
@@ -732,7 +804,8 @@ static float ComputeDisplacementFaceArea( dface_t* pFace )
 // Places Detail Objects on a face
 //-----------------------------------------------------------------------------
 static void EmitDetailObjectsOnDisplacementFace( dface_t* pFace, 
-						DetailObject_t& detail, CCoreDispInfo& coreDispInfo )
+						DetailObject_t& detail, CCoreDispInfo& coreDispInfo,
+						CDetailRandom &random, CUtlVector<DetailPlacement_t> &placements )
 {
 	assert(pFace->numedges == 4);
 
@@ -749,8 +822,8 @@ static void EmitDetailObjectsOnDisplacementFace( dface_t* pFace,
 	for (int i = 0; i < numSamples; ++i )
 	{
 		// Create a random sample...
-		float u = rand() / (float)VALVE_RAND_MAX;
-		float v = rand() / (float)VALVE_RAND_MAX;
+		float u = random.Rand() / (float)VALVE_RAND_MAX;
+		float v = random.Rand() / (float)VALVE_RAND_MAX;
 
 		// Compute alpha
 		float alpha;
@@ -759,15 +832,15 @@ static void EmitDetailObjectsOnDisplacementFace( dface_t* pFace,
 		alpha /= 255.0f;
 
 		// Select a group based on the alpha value
-		int group = SelectGroup( detail, alpha );
+		int group = SelectGroup( detail, alpha, random );
 
 		// Now that we've got a group, choose a detail
-		int model = SelectDetail( detail.m_Groups[group] );
+		int model = SelectDetail( detail.m_Groups[group], random );
 		if (model < 0)
 			continue;
 
 		// Got a detail! Place it on the surface...
-		PlaceDetail( detail.m_Groups[group].m_Models[model], pt, normal );
+		PlaceDetail( detail.m_Groups[group].m_Models[model], pt, normal, random, placements );
 	}
 }
 
@@ -826,19 +899,108 @@ static void SetLumpData( )
 }
 
 
+//-----------------------------------------------------------------------------
+// Places the details on one face, runs on the worker threads
+//-----------------------------------------------------------------------------
+static void EmitDetailObjectsOnFaceThread( int iThread, int iDetailFace )
+{
+	DetailFace_t &detailFace = s_DetailFaces[iDetailFace];
+	dface_t* pFace = &dfaces[detailFace.m_nFace];
+	CUtlVector<DetailPlacement_t> &placements = s_ThreadPlacements[iThread];
+
+	detailFace.m_nThread = iThread;
+	detailFace.m_nFirstPlacement = placements.Count();
+
+	// Initialize the Random Number generators for detail prop placement based on the hammer Face num.
+	CDetailRandom random( dfaceids[detailFace.m_nFace].hammerfaceid );
+
+	if (pFace->dispinfo < 0)
+	{
+		EmitDetailObjectsOnFace( pFace, *detailFace.m_pDetail, random, placements );
+	}
+	else
+	{
+		// Get a CCoreDispInfo. All we need is the triangles and lightmap texture coordinates.
+		mapdispinfo_t *pMapDisp = &mapdispinfo[pFace->dispinfo];
+		CCoreDispInfo coreDispInfo;
+		DispMapToCoreDispInfo( pMapDisp, &coreDispInfo, NULL, NULL );
+
+		EmitDetailObjectsOnDisplacementFace( pFace, *detailFace.m_pDetail, coreDispInfo, random, placements );
+	}
+
+	detailFace.m_nPlacements = placements.Count() - detailFace.m_nFirstPlacement;
+	if ( !detailFace.m_nPlacements )
+		return;
+
+	// The details of a face are close together, so their leaf walks share the
+	// start and only go separate ways for the last few nodes
+	Vector mins, maxs;
+	ClearBounds( mins, maxs );
+	for ( int i = detailFace.m_nFirstPlacement; i < placements.Count(); ++i )
+	{
+		AddPointToBounds( placements[i].m_Origin, mins, maxs );
+	}
+
+	int node = FindDetailBoundsNode( mins, maxs );
+	for ( int i = detailFace.m_nFirstPlacement; i < placements.Count(); ++i )
+	{
+		placements[i].m_nLeaf = ComputeDetailLeaf( placements[i].m_Origin, node );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Adds the details placed on a face to the lump, in the order they were placed
+//-----------------------------------------------------------------------------
+static void AddFacePlacementsToLump( const DetailFace_t &detailFace )
+{
+	// The sprite scales come from the vstdlib stream, which was seeded per face along with rand().
+	// Its gaussian numbers come in pairs that can span faces, so they're drawn here in face order.
+	RandomSeed( dfaceids[detailFace.m_nFace].hammerfaceid );
+
+	if ( !detailFace.m_nPlacements )
+		return;
+
+	const DetailPlacement_t *pPlacement = &s_ThreadPlacements[detailFace.m_nThread][detailFace.m_nFirstPlacement];
+	for ( int i = 0; i < detailFace.m_nPlacements; ++i, ++pPlacement )
+	{
+		DetailModel_t const& model = *pPlacement->m_pModel;
+
+		// Insert an element into the object dictionary if it aint there...
+		switch ( model.m_Type )
+		{
+		case DETAIL_PROP_TYPE_MODEL:
+			AddDetailToLump( model.m_ModelName.String(), pPlacement->m_Origin, pPlacement->m_Angles, model.m_Orientation, pPlacement->m_nLeaf );
+			break;
+
+		// Sprites and procedural models made from sprites
+		case DETAIL_PROP_TYPE_SPRITE:
+		default:
+			{
+				float flScale = 1.0f;
+				if ( model.m_flRandomScaleStdDev != 0.0f ) 
+				{
+					flScale = fabs( RandomGaussianFloat( 1.0f, model.m_flRandomScaleStdDev ) );
+				}
+
+				AddDetailSpriteToLump( pPlacement->m_Origin, pPlacement->m_Angles, pPlacement->m_nLeaf, model, flScale );
+			}
+			break;
+		}
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Places Detail Objects in the level
 //-----------------------------------------------------------------------------
 void EmitDetailModels()
 {
-	StartPacifier("Placing detail props : ");
-
-	// Place stuff on each face
+	// Find the faces to place stuff on, the material lookups aren't thread safe
+	s_DetailFaces.RemoveAll();
 	dface_t* pFace = dfaces;
 	for (int j = 0; j < numfaces; ++j)
 	{
-		UpdatePacifier( (float)j / (float)numfaces );
-
 		// Get at the material associated with this face
 		texinfo_t* pTexInfo = &texinfo[pFace[j].texinfo];
 		dtexdata_t* pTexData = GetTexData( pTexInfo->texdata );
@@ -868,30 +1030,35 @@ void EmitDetailModels()
 			continue;
 		}
 
-		// Emit objects on a particular face
-		DetailObject_t& detail = s_DetailObjectDict[objectType];
-
-		// Initialize the Random Number generators for detail prop placement based on the hammer Face num.
-		int	detailpropseed = dfaceids[j].hammerfaceid;
 #ifdef WARNSEEDNUMBER
-		Warning( "[%d]\n",detailpropseed );
+		Warning( "[%d]\n", dfaceids[j].hammerfaceid );
 #endif
-		srand( detailpropseed );
-		RandomSeed( detailpropseed );
 
-		if (pFace[j].dispinfo < 0)
-		{
-			EmitDetailObjectsOnFace( &pFace[j], detail );
-		}
-		else
-		{
-			// Get a CCoreDispInfo. All we need is the triangles and lightmap texture coordinates.
-			mapdispinfo_t *pMapDisp = &mapdispinfo[pFace[j].dispinfo];
-			CCoreDispInfo coreDispInfo;
-			DispMapToCoreDispInfo( pMapDisp, &coreDispInfo, NULL, NULL );
+		// Emit objects on a particular face
+		int i = s_DetailFaces.AddToTail();
+		s_DetailFaces[i].m_nFace = j;
+		s_DetailFaces[i].m_pDetail = &s_DetailObjectDict[objectType];
+		s_DetailFaces[i].m_nThread = 0;
+		s_DetailFaces[i].m_nFirstPlacement = 0;
+		s_DetailFaces[i].m_nPlacements = 0;
+	}
 
-			EmitDetailObjectsOnDisplacementFace( &pFace[j], detail, coreDispInfo );
-		}
+	// vbsp runs single threaded otherwise
+	Msg( "Placing detail props : " );
+	int nThreads = numthreads;
+	numthreads = g_nMaxThreads;
+	RunThreadsOnIndividual( s_DetailFaces.Count(), true, EmitDetailObjectsOnFaceThread );
+	numthreads = nThreads;
+
+	for ( int i = 0; i < s_DetailFaces.Count(); ++i )
+	{
+		AddFacePlacementsToLump( s_DetailFaces[i] );
+	}
+
+	s_DetailFaces.Purge();
+	for ( int i = 0; i < ARRAYSIZE( s_ThreadPlacements ); ++i )
+	{
+		s_ThreadPlacements[i].Purge();
 	}
 
 	// Emit specifically specified detail props
@@ -909,7 +1076,7 @@ void EmitDetailModels()
 			char* pModelName = ValueForKey( &entities[i], "model" );
 			int nOrientation = IntForKey( &entities[i], "detailOrientation" );
 
-			AddDetailToLump( pModelName, origin, angles, nOrientation );
+			AddDetailToLump( pModelName, origin, angles, nOrientation, ComputeDetailLeaf( origin ) );
 
 			// strip this ent from the .bsp file
 			entities[i].epairs = 0;
@@ -934,15 +1101,13 @@ void EmitDetailModels()
 			tex[0] /= flTextureSize;
 			tex[1] /= flTextureSize;
 
-			AddDetailSpriteToLump( origin, angles, nOrientation, pos, tex, 1.0f, DETAIL_PROP_TYPE_SPRITE );
+			AddDetailSpriteToLump( origin, angles, ComputeDetailLeaf( origin ), nOrientation, pos, tex, 1.0f, DETAIL_PROP_TYPE_SPRITE );
 
 			// strip this ent from the .bsp file
 			entities[i].epairs = 0;
 			continue;
 		}
 	}
-
-	EndPacifier( true );
 }
 
 
@@ -9,6 +9,7 @@
 #include "map_shared.h"
 #include "disp_vbsp.h"
 #include "tier1/strtools.h"
+#include "tier1/utldict.h"
 #include "builddisp.h"
 #include "tier0/icommandline.h"
 #include "KeyValues.h"
@@ -2073,6 +2074,69 @@ bool CMapFile::DeterminePath( const char *pszBaseFileName, const char *pszInstan
 }
 
 
+// Instance files tokenized ahead of LoadMapFile, by full path. NULL if the file couldn't be read.
+static CUtlDict< CChunkFileTokens *, int > s_PrefetchedInstances;
+static CUtlVector< int > s_PendingInstances;
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Tokenizes one of the pending instance files.
+//-----------------------------------------------------------------------------
+static void TokenizeInstanceThread( int iThread, int iWorkItem )
+{
+	int nIndex = s_PendingInstances[ iWorkItem ];
+	CChunkFileTokens *pTokens = s_PrefetchedInstances[ nIndex ];
+
+	if ( pTokens->Tokenize( s_PrefetchedInstances.GetElementName( nIndex ) ) != ChunkFile_Ok )
+	{
+		delete pTokens;
+		s_PrefetchedInstances[ nIndex ] = NULL;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Tokenizes the instance files referenced by the entities from nFirstEntity
+//			on in parallel. Loading and merging them has to stay serial, as the
+//			chunk callbacks build the global map state.
+// Input  : nFirstEntity - first entity that hasn't been looked at yet
+//			pszFileName - the base file that referenced these instances
+//-----------------------------------------------------------------------------
+void CMapFile::PrefetchInstances( int nFirstEntity, const char *pszFileName )
+{
+	s_PendingInstances.RemoveAll();
+
+	for ( int i = nFirstEntity; i < num_entities; i++ )
+	{
+		if ( !entities[ i ].origin.IsValid() )
+			continue;
+
+		if ( strcmp( ValueForKey( &entities[ i ], "classname" ), "func_instance" ) )
+			continue;
+
+		char *pInstanceFile = ValueForKey( &entities[ i ], "file" );
+		char pPath[ MAX_PATH ];
+		if ( !pInstanceFile[ 0 ] || !DeterminePath( pszFileName, pInstanceFile, pPath ) )
+			continue;
+
+		// prefabs are usually placed many times, they only need to be read once
+		if ( s_PrefetchedInstances.Find( pPath ) != s_PrefetchedInstances.InvalidIndex() )
+			continue;
+
+		s_PendingInstances.AddToTail( s_PrefetchedInstances.Insert( pPath, new CChunkFileTokens ) );
+	}
+
+	if ( s_PendingInstances.Count() > 0 )
+	{
+		// vbsp runs single threaded otherwise
+		int nThreads = numthreads;
+		numthreads = g_nMaxThreads;
+		RunThreadsOnIndividual( s_PendingInstances.Count(), false, TokenizeInstanceThread );
+		numthreads = nThreads;
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: this function will check the main map for any func_instances.  It will
 //			also attempt to load in the gamedata file for instancing remapping help.
@@ -2123,8 +2187,17 @@ void CMapFile::CheckForInstances( const char *pszFileName )
 
 	// this list will grow as instances are merged onto it.  sub-instances are merged and 
 	// automatically done in this processing.
+	int nPrefetched = 0;
 	for ( int i = 0; i < num_entities; i++ )
 	{
+		// read the instances referenced by everything up to here, including the sub-instances
+		// appended by the previous batch, before merging them one by one
+		if ( i >= nPrefetched )
+		{
+			PrefetchInstances( i, pszFileName );
+			nPrefetched = num_entities;
+		}
+
         if (!entities[i].origin.IsValid())
             continue;
 
@@ -2160,6 +2233,9 @@ void CMapFile::CheckForInstances( const char *pszFileName )
 		}
 	}
 
+	s_PrefetchedInstances.PurgeAndDeleteElements();
+	s_PendingInstances.Purge();
+
 	g_LoadingMap = this;
 }
 
@@ -2673,8 +2749,21 @@ bool LoadMapFile( const char *pszFileName )
 		//
 		// Open the file.
 		//
+		if ( g_bCheckTokens && !CChunkFileTokens::CheckAgainstTokenReader( pszFileName ) )
+		{
+			Warning( "%s doesn't tokenize the same as with TokenReader\n", pszFileName );
+		}
+
 		CChunkFile File;
-		eResult = File.Open(pszFileName, ChunkFile_Read);
+		int nPrefetched = s_PrefetchedInstances.Find( pszFileName );
+		if ( ( nPrefetched != s_PrefetchedInstances.InvalidIndex() ) && ( s_PrefetchedInstances[ nPrefetched ] != NULL ) )
+		{
+			eResult = File.Open( s_PrefetchedInstances[ nPrefetched ] );
+		}
+		else
+		{
+			eResult = File.Open(pszFileName, ChunkFile_Read);
+		}
 
 		//
 		// Read the file.
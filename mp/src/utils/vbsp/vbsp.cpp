@@ -15,6 +15,7 @@
 #include "materialsystem/imaterialsystem.h"
 #include "map.h"
 #include "tools_minidump.h"
+#include "phasetimes.h"
 #include "materialsub.h"
 #include "loadcmdline.h"
 #include "byteswap_valve.h"
@@ -56,6 +57,7 @@ bool		g_NodrawTriggers = false;
 bool		g_DisableWaterLighting = false;
 bool		g_bAllowDetailCracks = false;
 bool		g_bNoVirtualMesh = false;
+bool		g_bCheckTokens = false;
 
 float		g_defaultLuxelSize = DEFAULT_LUXEL_SIZE;
 float		g_luxelScale = 1.0f;
@@ -63,6 +65,7 @@ float		g_minLuxelScale = 1.0f;
 bool		g_BumpAll = false;
 
 int			g_nDXLevel = 0; // default dxlevel if you don't specify it on the command-line.
+int			g_nMaxThreads = 1;	// threads ThreadSetDefault picked, for the passes that still run threaded
 CUtlVector<int> g_SkyAreas;
 char		outbase[32];
 
@@ -83,6 +86,7 @@ int			entity_num;
 
 
 node_t		*block_nodes[BLOCKS_SPACE+2][BLOCKS_SPACE+2];
+bspbrush_t	*block_brushes[BLOCKS_SPACE+2][BLOCKS_SPACE+2];	// chopped brushes of each block, until its tree is built
 
 //-----------------------------------------------------------------------------
 // Assign occluder areas (must happen *after* the world model is processed)
@@ -148,33 +152,70 @@ node_t	*BlockTree (int xl, int yl, int xh, int yh)
 
 /*
 ============
-ProcessBlock_Thread
+BlockBounds
 
 ============
 */
-int			brush_start, brush_end;
-void ProcessBlock_Thread (int threadnum, int blocknum)
+static void BlockBounds (int blocknum, int &xblock, int &yblock, Vector &mins, Vector &maxs)
 {
-	int		xblock, yblock;
-	Vector		mins, maxs;
-	bspbrush_t	*brushes;
-	tree_t		*tree;
-	node_t		*node;
-
 	yblock = block_yl + blocknum / (block_xh-block_xl+1);
 	xblock = block_xl + blocknum % (block_xh-block_xl+1);
 
-	qprintf ("############### block %2i,%2i ###############\n", xblock, yblock);
-
 	mins[0] = xblock*BLOCKS_SIZE;
 	mins[1] = yblock*BLOCKS_SIZE;
 	mins[2] = MIN_COORD_INTEGER;
 	maxs[0] = (xblock+1)*BLOCKS_SIZE;
 	maxs[1] = (yblock+1)*BLOCKS_SIZE;
 	maxs[2] = MAX_COORD_INTEGER;
+}
+
+/*
+============
+ChopBlock_Thread
+
+============
+*/
+int			brush_start, brush_end;
+void ChopBlock_Thread (int threadnum, int blocknum)
+{
+	int		xblock, yblock;
+	Vector		mins, maxs;
+	bspbrush_t	*brushes;
+
+	BlockBounds (blocknum, xblock, yblock, mins, maxs);
+
+	qprintf ("############### block %2i,%2i ###############\n", xblock, yblock);
 
 	// the makelist and chopbrushes could be cached between the passes...
 	brushes = MakeBspBrushList (brush_start, brush_end, mins, maxs, NO_DETAIL);
+	if (brushes)
+	{
+		FixupAreaportalWaterBrushes( brushes );
+		if (!nocsg)
+			brushes = ChopBrushes (brushes);
+	}
+
+	block_brushes[xblock+BLOCKX_OFFSET][yblock+BLOCKY_OFFSET] = brushes;
+}
+
+/*
+============
+BuildBlock_Thread
+
+============
+*/
+void BuildBlock_Thread (int threadnum, int blocknum)
+{
+	int		xblock, yblock;
+	Vector		mins, maxs;
+	bspbrush_t	*brushes;
+	tree_t		*tree;
+	node_t		*node;
+
+	BlockBounds (blocknum, xblock, yblock, mins, maxs);
+
+	brushes = block_brushes[xblock+BLOCKX_OFFSET][yblock+BLOCKY_OFFSET];
+	block_brushes[xblock+BLOCKX_OFFSET][yblock+BLOCKY_OFFSET] = NULL;
 	if (!brushes)
 	{
 		node = AllocNode ();
@@ -184,10 +225,6 @@ void ProcessBlock_Thread (int threadnum, int blocknum)
 		return;
 	}    
 
-	FixupAreaportalWaterBrushes( brushes );
-	if (!nocsg)
-		brushes = ChopBrushes (brushes);
-
 	tree = BrushBSP (brushes, mins, maxs);
 	
 	block_nodes[xblock+BLOCKX_OFFSET][yblock+BLOCKY_OFFSET] = tree->headnode;
@@ -257,8 +294,14 @@ void ProcessWorldModel (void)
 	{
 		qprintf ("--------------------------------------------\n");
 
-		RunThreadsOnIndividual ((block_xh-block_xl+1)*(block_yh-block_yl+1),
-			!verbose, ProcessBlock_Thread);
+		// chops the brushes of every block, then builds the tree of every block
+		int nBlocks = (block_xh-block_xl+1)*(block_yh-block_yl+1);
+		PhaseTimes_Begin( "csg" );
+		RunThreadsOnIndividual (nBlocks, !verbose, ChopBlock_Thread);
+		PhaseTimes_End();
+
+		PhaseTimes_Begin( "bsp" );
+		RunThreadsOnIndividual (nBlocks, !verbose, BuildBlock_Thread);
 
 		//
 		// build the division tree
@@ -278,12 +321,14 @@ void ProcessWorldModel (void)
 		tree->maxs[0] = (block_xh+1)*BLOCKS_SIZE;
 		tree->maxs[1] = (block_yh+1)*BLOCKS_SIZE;
 		tree->maxs[2] = g_MainMap->map_maxs[2] + 8;
+		PhaseTimes_End();
 
 		//
 		// perform the global operations
 		//
 
 		// make the portals/faces by traversing down to each empty leaf
+		PhaseTimes_Begin( "portals" );
 		MakeTreePortals (tree);
 
 		if (FloodEntities (tree))
@@ -305,6 +350,8 @@ void ProcessWorldModel (void)
 
 		// mark the brush sides that actually turned into faces
 		MarkVisibleSides (tree, brush_start, brush_end, NO_DETAIL);
+		PhaseTimes_End();
+
 		if (noopt || leaked)
 			break;
 		if (!optimize)
@@ -316,6 +363,7 @@ void ProcessWorldModel (void)
 		}
 	}
 
+	PhaseTimes_Begin( "faces" );
 	FloodAreas (tree);
 
 	RemoveAreaPortalBrushes_R( tree->headnode );
@@ -361,10 +409,13 @@ void ProcessWorldModel (void)
 	Msg("WriteBSP...\n");
 	WriteBSP (tree->headnode, pLeafFaceList);
 	Msg("done (%d)\n", (int)(Plat_FloatTime() - start) );
+	PhaseTimes_End();
 
 	if (!leaked)
 	{
+		PhaseTimes_Begin( "portals" );
 		WritePortalFile (tree);
+		PhaseTimes_End();
 	}
 
 	FreeTree( tree );
@@ -392,11 +443,17 @@ void ProcessSubModel( )
 
 	mins[0] = mins[1] = mins[2] = MIN_COORD_INTEGER;
 	maxs[0] = maxs[1] = maxs[2] = MAX_COORD_INTEGER;
+
+	PhaseTimes_Begin( "csg" );
 	list = MakeBspBrushList (start, end, mins, maxs, FULL_DETAIL);
 
 	if (!nocsg)
 		list = ChopBrushes (list);
+	PhaseTimes_End();
+
+	PhaseTimes_Begin( "bsp" );
 	tree = BrushBSP (list, mins, maxs);
+	PhaseTimes_End();
 	
 	// This would wind up crashing the engine because we'd have a negative leaf index in dmodel_t::headnode.
 	if ( tree->headnode->planenum == PLANENUM_LEAF )
@@ -406,18 +463,22 @@ void ProcessSubModel( )
 		Error( "bmodel %d has no head node (class '%s', targetname '%s')", entity_num, pClassName, pTargetName );
 	}
 
+	PhaseTimes_Begin( "portals" );
 	MakeTreePortals (tree);
+	PhaseTimes_End();
 	
 #if DEBUG_BRUSHMODEL
 	if ( entity_num == DEBUG_BRUSHMODEL )
 		WriteGLView( tree, "tree_all" );
 #endif
 
+	PhaseTimes_Begin( "faces" );
 	MarkVisibleSides (tree, start, end, FULL_DETAIL);
 	MakeFaces (tree->headnode);
 
 	FixTjuncs( tree->headnode, NULL );
 	WriteBSP( tree->headnode, NULL );
+	PhaseTimes_End();
 	
 #if DEBUG_BRUSHMODEL
 	if ( entity_num == DEBUG_BRUSHMODEL )
@@ -1119,6 +1180,10 @@ int RunVBSP( int argc, char **argv )
 		{
 			g_bNoVirtualMesh = true;
 		}
+		else if ( !Q_stricmp( argv[i], "-checktokens" ) )
+		{
+			g_bCheckTokens = true;
+		}
 		else if ( !Q_stricmp( argv[i], "-replacematerials" ) )
 		{
 			g_ReplaceMaterials = true;
@@ -1131,6 +1196,19 @@ int RunVBSP( int argc, char **argv )
 		{
 			EnableFullMinidumps( true );
 		}
+		else if ( !Q_stricmp( argv[i], "-phasetimes" ) && i < argc - 1 )
+		{
+			PhaseTimes_Init( "vbsp", argv[++i] );
+		}
+		else if ( !Q_stricmp( argv[i], "-cubemapbench" ) && i < argc - 2 )
+		{
+			int nSamples = atoi( argv[i+1] );
+			int nSides = atoi( argv[i+2] );
+			Cubemap_RunSearchBenchmark( MAX( nSamples, 1 ), MAX( nSides, 1 ) );
+			DeleteCmdLine( argc, argv );
+			CmdLib_Cleanup();
+			CmdLib_Exit( 0 );
+		}
 		else if ( !Q_stricmp( argv[i], "-embed" ) && i < argc - 1 )
 		{
 			V_MakeAbsolutePath( g_szEmbedDir, sizeof( g_szEmbedDir ), argv[++i], "." );
@@ -1227,6 +1305,12 @@ int RunVBSP( int argc, char **argv )
 				"  -virtualdispphysics : Use virtual (not precomputed) displacement collision models\n"
 				"  -replacematerials : Substitute materials according to materialsub.txt in content\\maps\n"
 				"  -FullMinidumps  : Write large minidumps on crash.\n"
+				"  -phasetimes <file> : Write the time and peak memory of each compile phase\n"
+				"                    to <file> as JSON.\n"
+				"  -cubemapbench <samples> <sides> : Time the cubemap assignment on a synthetic\n"
+				"                    map with that many cubemaps and surfaces, then exit.\n"
+				"  -checktokens    : Check that each map file tokenizes the same as with the old\n"
+				"                    reader, with LF and CRLF line ends.\n"
 				);
 			}
 
@@ -1268,6 +1352,7 @@ int RunVBSP( int argc, char **argv )
 	}
 
 	ThreadSetDefault ();
+	g_nMaxThreads = numthreads;
 	numthreads = 1;		// multiple threads aren't helping...
 
 	// Setup the logfile.
@@ -1383,7 +1468,10 @@ int RunVBSP( int argc, char **argv )
 			AddBufferToPak( GetPakFile(), "stale.txt", "stale", strlen( "stale" ) + 1, false );
 		}
 
+		PhaseTimes_Begin( "load_map" );
 		LoadMapFile (name);
+		PhaseTimes_End();
+
 		WorldVertexTransitionFixup();
 		if( ( g_nDXLevel == 0 ) || ( g_nDXLevel >= 70 ) )
 		{
@@ -170,6 +170,7 @@ extern float			g_luxelScale;
 extern float			g_minLuxelScale;
 extern bool				g_BumpAll;
 extern int				g_nDXLevel;
+extern int				g_nMaxThreads;
 
 int GetDispInfoEntityNum( mapdispinfo_t *pDisp );
 void ComputeBoundsNoSkybox( );
@@ -281,6 +282,7 @@ public:
 	static const char	*GetInstancePath( void ) { return m_InstancePath; }
 	static bool			DeterminePath( const char *pszBaseFileName, const char *pszInstanceFileName, char *pszOutFileName );
 
+	void				PrefetchInstances( int nFirstEntity, const char *pszFileName );
 	void				CheckForInstances( const char *pszFileName );
 	void				MergeInstance( entity_t *pInstanceEntity, CMapFile *Instance );
 	void				MergePlanes( entity_t *pInstanceEntity, CMapFile *Instance, Vector &InstanceOrigin, QAngle &InstanceAngle, matrix3x4_t &InstanceMatrix );
@@ -365,6 +367,7 @@ extern	bool		g_NodrawTriggers;
 extern	bool		g_DisableWaterLighting;
 extern	bool		g_bAllowDetailCracks;
 extern	bool		g_bNoVirtualMesh;
+extern	bool		g_bCheckTokens;
 extern	char		outbase[32];
 
 extern	char	source[1024];
@@ -615,6 +618,7 @@ void Cubemap_FixupBrushSidesMaterials( void );
 void Cubemap_AttachDefaultCubemapToSpecularSides( void );
 // Add skipped cubemaps that are referenced by the engine
 void Cubemap_AddUnreferencedCubemaps( void );
+void Cubemap_RunSearchBenchmark( int nSamples, int nSides );
 
 //=============================================================================
 // overlay.cpp
@@ -16,6 +16,8 @@
 #include "messbuf.h"
 #include "vmpi.h"
 #include "vmpi_distribute_work.h"
+#include "vmpi_local_distribute.h"
+#include "threads.h"
 
 static TableVector g_BoxDirections[6] = 
 {
@@ -27,6 +29,27 @@ static TableVector g_BoxDirections[6] =
 	{  0,  0, -1 }, 
 };
 
+// this stores each sample of the ambient lighting
+struct ambientsample_t
+{
+	Vector pos;
+	Vector cube[6];
+};
+
+// The emit_surface lights that go in the ambient cubes, found by ComputePerLeafAmbientLighting
+static CUtlVector<dworldlight_t *> s_AmbientCubeLights;
+
+// Rays from the samples are traced in streams of up to this many
+#define LEAF_AMBIENT_RAYS_PER_STREAM	512
+
+// Leaves a thread takes at a time, their samples are lit together
+#define LEAF_AMBIENT_LEAVES_PER_BATCH	16
+
+// Per thread, for the -verbose stats
+static int s_nLeafAmbientSamples[MAX_TOOL_THREADS+1];
+static int64 s_nLeafAmbientLightRays[MAX_TOOL_THREADS+1];
+static int64 s_nLeafAmbientSkyRays[MAX_TOOL_THREADS+1];
+
 
 
 static void ComputeAmbientFromSurface( dface_t *surfID, dworldlight_t* pSkylight, 
@@ -89,94 +112,208 @@ float Engine_WorldLightDistanceFalloff( const dworldlight_t *wl, const Vector& d
 }
 
 
-void AddEmitSurfaceLights( const Vector &vStart, Vector lightBoxColor[6] )
+static void AddEmitSurfaceLight( const dworldlight_t *wl, const Vector &vStart, float flFractionVisible, Vector lightBoxColor[6] )
 {
-	fltx4 fractionVisible;
-
-	FourVectors vStart4, wlOrigin4;
-	vStart4.DuplicateVector ( vStart );
+	Assert( wl->type == emit_surface );
 
-	for ( int iLight=0; iLight < *pNumworldlights; iLight++ )
-	{
-		dworldlight_t *wl = &dworldlights[iLight];
+	// Add this light's contribution.
+	Vector vDelta = wl->origin - vStart;
+	float flDistanceScale = Engine_WorldLightDistanceFalloff( wl, vDelta );
 
-		// Should this light even go in the ambient cubes?
-		if ( !( wl->flags & DWL_FLAGS_INAMBIENTCUBE ) )
-			continue;
+	Vector vDeltaNorm = vDelta;
+	VectorNormalize( vDeltaNorm );
+	float flAngleScale = Engine_WorldLightAngle( wl, wl->normal, vDeltaNorm, vDeltaNorm );
 
-		Assert( wl->type == emit_surface );
+	float ratio = flDistanceScale * flAngleScale * flFractionVisible;
+	if ( ratio == 0 )
+		return;
 
-		// Can this light see the point?
-		wlOrigin4.DuplicateVector ( wl->origin );
-		TestLine ( vStart4, wlOrigin4, &fractionVisible );
-		if ( !TestSignSIMD ( CmpGtSIMD ( fractionVisible, Four_Zeros ) ) )
-			continue;
+	for ( int i=0; i < 6; i++ )
+	{
+		float t = DotProduct( g_BoxDirections[i], vDeltaNorm );
+		if ( t > 0 )
+		{
+			lightBoxColor[i] += wl->intensity * (t * ratio);
+		}
+	}
+}
 
-		// Add this light's contribution.
-		Vector vDelta = wl->origin - vStart;
-		float flDistanceScale = Engine_WorldLightDistanceFalloff( wl, vDelta );
 
-		Vector vDeltaNorm = vDelta;
-		VectorNormalize( vDeltaNorm );
-		float flAngleScale = Engine_WorldLightAngle( wl, wl->normal, vDeltaNorm, vDeltaNorm );
+//-----------------------------------------------------------------------------
+// Adds the emit_surface lights that go in the ambient cubes to a leaf's samples.
+// The rays from every sample to every light go through one ray stream, which
+// traces them 4 at a time grouped by direction.
+//-----------------------------------------------------------------------------
+static void AddEmitSurfaceLights( int iThread, ambientsample_t *pSamples, int nSamples )
+{
+	int nLights = s_AmbientCubeLights.Count();
+	if ( !nLights )
+		return;
 
-		float ratio = flDistanceScale * flAngleScale * SubFloat ( fractionVisible, 0 );
-		if ( ratio == 0 )
-			continue;
+	s_nLeafAmbientLightRays[iThread] += (int64)nSamples * nLights;
 
-		for ( int i=0; i < 6; i++ )
+	if ( g_bTextureShadows )
+	{
+		// The stream can't run the texture shadow callback, so go through TestLine 4 lights at a time
+		for ( int iSample = 0; iSample < nSamples; iSample++ )
 		{
-			float t = DotProduct( g_BoxDirections[i], vDeltaNorm );
-			if ( t > 0 )
+			FourVectors vStart4;
+			vStart4.DuplicateVector( pSamples[iSample].pos );
+
+			for ( int iFirst = 0; iFirst < nLights; iFirst += 4 )
 			{
-				lightBoxColor[i] += wl->intensity * (t * ratio);
+				Vector vOrigins[4];
+				for ( int i = 0; i < 4; i++ )
+				{
+					vOrigins[i] = s_AmbientCubeLights[MIN( iFirst + i, nLights - 1 )]->origin;
+				}
+
+				FourVectors wlOrigin4;
+				wlOrigin4.LoadAndSwizzle( vOrigins[0], vOrigins[1], vOrigins[2], vOrigins[3] );
+
+				fltx4 fractionVisible;
+				TestLine( vStart4, wlOrigin4, &fractionVisible );
+
+				for ( int i = 0; i < 4 && iFirst + i < nLights; i++ )
+				{
+					float flFractionVisible = SubFloat( fractionVisible, i );
+					if ( flFractionVisible > 0 )
+					{
+						AddEmitSurfaceLight( s_AmbientCubeLights[iFirst + i], pSamples[iSample].pos, flFractionVisible, pSamples[iSample].cube );
+					}
+				}
 			}
 		}
-	}	
+		return;
+	}
+
+	RayTracingSingleResult results[LEAF_AMBIENT_RAYS_PER_STREAM];
+	RayStream stream;
+
+	// Rays are numbered sample by sample, and applied in that order so each cube adds up its lights in order
+	int nRays = nSamples * nLights;
+	for ( int nFirst = 0; nFirst < nRays; nFirst += LEAF_AMBIENT_RAYS_PER_STREAM )
+	{
+		int nCount = MIN( LEAF_AMBIENT_RAYS_PER_STREAM, nRays - nFirst );
+		for ( int i = 0; i < nCount; i++ )
+		{
+			int nRay = nFirst + i;
+			g_RtEnv.AddToRayStream( stream, pSamples[nRay / nLights].pos, s_AmbientCubeLights[nRay % nLights]->origin, &results[i] );
+		}
+		g_RtEnv.FinishRayStream( stream );
+
+		for ( int i = 0; i < nCount; i++ )
+		{
+			// Can this light see the point?
+			if ( results[i].HitID != -1 && results[i].HitDistance < results[i].ray_length )
+				continue;
+
+			int nRay = nFirst + i;
+			ambientsample_t &sample = pSamples[nRay / nLights];
+			AddEmitSurfaceLight( s_AmbientCubeLights[nRay % nLights], sample.pos, 1.0f, sample.cube );
+		}
+	}
 }
 
 
-void ComputeAmbientFromSphericalSamples( int iThread, const Vector &vStart, Vector lightBoxColor[6] )
+//-----------------------------------------------------------------------------
+// Figures out the color that rays shot out from each sample position hit, and
+// averages them into the sample's cube. Each direction is traced from all the
+// samples in a row through a ray stream. Rays that hit the sky first get the
+// sky ambient right away, the others still walk the tree to find the surface
+// and luxel they hit. Samples under water always walk, as the water surface
+// isn't in the ray tracing environment.
+//-----------------------------------------------------------------------------
+static void ComputeAmbientFromSphericalSamples( int iThread, ambientsample_t *pSamples, const bool *pbUnderWater, int nSamples )
 {
-	// Figure out the color that rays hit when shot out from this position.
-	Vector radcolor[NUMVERTEXNORMALS];
 	float tanTheta = tan(VERTEXNORMAL_CONE_INNER_ANGLE);
 
-	for ( int i = 0; i < NUMVERTEXNORMALS; i++ )
+	float flTotal[6];
+	for ( int j = 0; j < 6; j++ )
 	{
-		Vector vEnd = vStart + g_anorms[i] * (COORD_EXTENT * 1.74);
-
-		// Now that we've got a ray, see what surface we've hit
-		Vector lightStyleColors[MAX_LIGHTSTYLES];
-		lightStyleColors[0].Init();	// We only care about light style 0 here.
-		CalcRayAmbientLighting( iThread, vStart, vEnd, tanTheta, lightStyleColors );
-	
-		radcolor[i] = lightStyleColors[0];
+		flTotal[j] = 0;
+		for ( int i = 0; i < NUMVERTEXNORMALS; i++ )
+		{
+			float c = DotProduct( g_anorms[i], g_BoxDirections[j] );
+			if ( c > 0 )
+			{
+				flTotal[j] += c;
+			}
+		}
 	}
 
-	// accumulate samples into radiant box
-	for ( int j = 6; --j >= 0; )
+	for ( int iSample = 0; iSample < nSamples; iSample++ )
 	{
-		float t = 0;
+		for ( int j = 0; j < 6; j++ )
+		{
+			pSamples[iSample].cube[j].Init();
+		}
+	}
 
-		lightBoxColor[j].Init();
+	RayTracingSingleResult results[LEAF_AMBIENT_RAYS_PER_STREAM];
+	RayStream stream;
 
-		for (int i = 0; i < NUMVERTEXNORMALS; i++)
+	// Rays are numbered direction by direction, and applied in that order so each cube adds them up in order
+	int nRays = NUMVERTEXNORMALS * nSamples;
+	for ( int nFirst = 0; nFirst < nRays; nFirst += LEAF_AMBIENT_RAYS_PER_STREAM )
+	{
+		int nCount = MIN( LEAF_AMBIENT_RAYS_PER_STREAM, nRays - nFirst );
+		for ( int k = 0; k < nCount; k++ )
 		{
-			float c = DotProduct( g_anorms[i], g_BoxDirections[j] );
-			if (c > 0)
+			int nRay = nFirst + k;
+			results[k].HitID = -1;
+			if ( !pbUnderWater[nRay % nSamples] )
 			{
-				t += c;
-				lightBoxColor[j] += radcolor[i] * c;
+				const Vector &vStart = pSamples[nRay % nSamples].pos;
+				g_RtEnv.AddToRayStream( stream, vStart, vStart + g_anorms[nRay / nSamples] * (COORD_EXTENT * 1.74), &results[k] );
+			}
+		}
+		g_RtEnv.FinishRayStream( stream );
+
+		for ( int k = 0; k < nCount; k++ )
+		{
+			int nRay = nFirst + k;
+			int i = nRay / nSamples;
+			ambientsample_t &sample = pSamples[nRay % nSamples];
+
+			Vector lightStyleColors[MAX_LIGHTSTYLES];
+			lightStyleColors[0].Init();	// We only care about light style 0 here.
+
+			const RayTracingSingleResult &result = results[k];
+			if ( result.HitID != -1 && result.HitDistance < result.ray_length &&
+				 ( g_RtEnv.OptimizedTriangleList[result.HitID].m_Data.m_IntersectData.m_nTriangleID & TRACE_ID_SKY ) )
+			{
+				CalcSkyAmbientLighting( lightStyleColors );
+				s_nLeafAmbientSkyRays[iThread]++;
+			}
+			else
+			{
+				// Now that we've got a ray, see what surface we've hit
+				Vector vEnd = sample.pos + g_anorms[i] * (COORD_EXTENT * 1.74);
+				CalcRayAmbientLighting( iThread, sample.pos, vEnd, tanTheta, lightStyleColors );
+			}
+
+			// accumulate samples into radiant box
+			for ( int j = 0; j < 6; j++ )
+			{
+				float c = DotProduct( g_anorms[i], g_BoxDirections[j] );
+				if ( c > 0 )
+				{
+					sample.cube[j] += lightStyleColors[0] * c;
+				}
 			}
 		}
-		
-		lightBoxColor[j] *= 1/t;
 	}
 
-	// Now add direct light from the emit_surface lights. These go in the ambient cube because
-	// there are a ton of them and they are often so dim that they get filtered out by r_worldlightmin.
-	AddEmitSurfaceLights( vStart, lightBoxColor );
+	for ( int iSample = 0; iSample < nSamples; iSample++ )
+	{
+		for ( int j = 0; j < 6; j++ )
+		{
+			pSamples[iSample].cube[j] *= 1/flTotal[j];
+		}
+	}
+
+	s_nLeafAmbientSamples[iThread] += nSamples;
 }
 
 
@@ -302,13 +439,6 @@ void GetLeafBoundaryPlanes( CUtlVector<dplane_t> &list, int leafIndex )
 	}
 }
 
-// this stores each sample of the ambient lighting
-struct ambientsample_t
-{
-	Vector pos;
-	Vector cube[6];
-};
-
 // add the sample to the list.  If we exceed the maximum number of samples, the worst sample will
 // be discarded.  This has the effect of converging on the best samples when enough are added.
 void AddSampleToList( CUtlVector<ambientsample_t> &list, const Vector &samplePosition, Vector *pCube )
@@ -522,64 +652,105 @@ static byte Fixed8Fraction( float t, float tMin, float tMax )
 
 CUtlVector< CUtlVector<ambientsample_t> > g_LeafAmbientSamples;
 
-void ComputeAmbientForLeaf( int iThread, int leafID, CUtlVector<ambientsample_t> &list )
+// computes the samples of up to LEAF_AMBIENT_LEAVES_PER_BATCH leaves, all their
+// candidate samples are lit at once so their rays can be traced together
+void ComputeAmbientForLeaves( int iThread, const int *pLeafIDs, int nLeaves, CUtlVector<ambientsample_t> *pLists )
 {
+	Assert( nLeaves <= LEAF_AMBIENT_LEAVES_PER_BATCH );
+
 	CUtlVector<dplane_t> leafPlanes;
-	CLeafSampler sampler( iThread );
+	CUtlVector<ambientsample_t> candidates;
+	CUtlVector<bool> underWater;
+	int firstCandidate[LEAF_AMBIENT_LEAVES_PER_BATCH + 1];
 
-	GetLeafBoundaryPlanes( leafPlanes, leafID );
-	list.RemoveAll();
-	// this heuristic tries to generate at least one sample per volume (chosen to be similar to the size of a player) in the space
-	int xSize = (dleafs[leafID].maxs[0] - dleafs[leafID].mins[0]) / 32;
-	int ySize = (dleafs[leafID].maxs[1] - dleafs[leafID].mins[1]) / 32;
-	int zSize = (dleafs[leafID].maxs[2] - dleafs[leafID].mins[2]) / 64;
-	xSize = max(xSize,1);
-	ySize = max(xSize,1);
-	zSize = max(xSize,1);
-	// generate update 128 candidate samples, always at least one sample
-	int volumeCount = xSize * ySize * zSize;
-	if ( g_bFastAmbient )
-	{
-		// save compute time, only do one sample
-		volumeCount = 1;
-	}
-	int sampleCount = clamp( volumeCount, 1, 128 );
-	if ( dleafs[leafID].contents & CONTENTS_SOLID )
-	{
-		// don't generate any samples in solid leaves
-		// NOTE: We copy the nearest non-solid leaf sample pointers into this leaf at the end
-		return;
-	}
-	Vector cube[6];
-	for ( int i = 0; i < sampleCount; i++ )
+	for ( int iLeaf = 0; iLeaf < nLeaves; iLeaf++ )
 	{
-		// compute each candidate sample and add to the list
-		Vector samplePosition;
-		sampler.GenerateLeafSamplePosition( leafID, leafPlanes, samplePosition );
-		ComputeAmbientFromSphericalSamples( iThread, samplePosition, cube );
-		// note this will remove the least valuable sample once the limit is reached
-		AddSampleToList( list, samplePosition, cube );
+		int leafID = pLeafIDs[iLeaf];
+		firstCandidate[iLeaf] = candidates.Count();
+		pLists[iLeaf].RemoveAll();
+
+		// this heuristic tries to generate at least one sample per volume (chosen to be similar to the size of a player) in the space
+		int xSize = (dleafs[leafID].maxs[0] - dleafs[leafID].mins[0]) / 32;
+		int ySize = (dleafs[leafID].maxs[1] - dleafs[leafID].mins[1]) / 32;
+		int zSize = (dleafs[leafID].maxs[2] - dleafs[leafID].mins[2]) / 64;
+		xSize = max(xSize,1);
+		ySize = max(xSize,1);
+		zSize = max(xSize,1);
+		// generate update 128 candidate samples, always at least one sample
+		int volumeCount = xSize * ySize * zSize;
+		if ( g_bFastAmbient )
+		{
+			// save compute time, only do one sample
+			volumeCount = 1;
+		}
+		int sampleCount = clamp( volumeCount, 1, 128 );
+		if ( dleafs[leafID].contents & CONTENTS_SOLID )
+		{
+			// don't generate any samples in solid leaves
+			// NOTE: We copy the nearest non-solid leaf sample pointers into this leaf at the end
+			continue;
+		}
+
+		CLeafSampler sampler( iThread );
+		GetLeafBoundaryPlanes( leafPlanes, leafID );
+		int nFirst = candidates.AddMultipleToTail( sampleCount );
+		for ( int i = 0; i < sampleCount; i++ )
+		{
+			sampler.GenerateLeafSamplePosition( leafID, leafPlanes, candidates[nFirst + i].pos );
+			underWater.AddToTail( ( dleafs[leafID].contents & MASK_WATER ) != 0 );
+		}
 	}
+	firstCandidate[nLeaves] = candidates.Count();
+
+	if ( !candidates.Count() )
+		return;
+
+	ComputeAmbientFromSphericalSamples( iThread, candidates.Base(), underWater.Base(), candidates.Count() );
+
+	// Now add direct light from the emit_surface lights. These go in the ambient cube because
+	// there are a ton of them and they are often so dim that they get filtered out by r_worldlightmin.
+	AddEmitSurfaceLights( iThread, candidates.Base(), candidates.Count() );
+
+	for ( int iLeaf = 0; iLeaf < nLeaves; iLeaf++ )
+	{
+		for ( int i = firstCandidate[iLeaf]; i < firstCandidate[iLeaf + 1]; i++ )
+		{
+			// note this will remove the least valuable sample once the limit is reached
+			AddSampleToList( pLists[iLeaf], candidates[i].pos, candidates[i].cube );
+		}
 
-	// remove any samples that can be reconstructed with the remaining data
-	CompressAmbientSampleList( list );
+		// remove any samples that can be reconstructed with the remaining data
+		CompressAmbientSampleList( pLists[iLeaf] );
+	}
 }
 
 static void ThreadComputeLeafAmbient( int iThread, void *pUserData )
 {
-	CUtlVector<ambientsample_t> list;
+	CUtlVector<ambientsample_t> lists[LEAF_AMBIENT_LEAVES_PER_BATCH];
+	int leafIDs[LEAF_AMBIENT_LEAVES_PER_BATCH];
 	while (1)
 	{
-		int leafID = GetThreadWork ();
-		if (leafID == -1)
+		int nLeaves = 0;
+		while ( nLeaves < LEAF_AMBIENT_LEAVES_PER_BATCH )
+		{
+			int leafID = GetThreadWork ();
+			if (leafID == -1)
+				break;
+			leafIDs[nLeaves++] = leafID;
+		}
+		if ( !nLeaves )
 			break;
-		list.RemoveAll();
-		ComputeAmbientForLeaf(iThread, leafID, list);
-		// copy to the output array
-		g_LeafAmbientSamples[leafID].SetCount( list.Count() );
-		for ( int i = 0; i < list.Count(); i++ )
+
+		ComputeAmbientForLeaves( iThread, leafIDs, nLeaves, lists );
+		for ( int iLeaf = 0; iLeaf < nLeaves; iLeaf++ )
 		{
-			g_LeafAmbientSamples[leafID].Element(i) = list.Element(i);
+			// copy to the output array
+			CUtlVector<ambientsample_t> &list = lists[iLeaf];
+			g_LeafAmbientSamples[leafIDs[iLeaf]].SetCount( list.Count() );
+			for ( int i = 0; i < list.Count(); i++ )
+			{
+				g_LeafAmbientSamples[leafIDs[iLeaf]].Element(i) = list.Element(i);
+			}
 		}
 	}
 }
@@ -587,7 +758,8 @@ static void ThreadComputeLeafAmbient( int iThread, void *pUserData )
 void VMPI_ProcessLeafAmbient( int iThread, uint64 iLeaf, MessageBuffer *pBuf )
 {
 	CUtlVector<ambientsample_t> list;
-	ComputeAmbientForLeaf(iThread, (int)iLeaf, list);
+	int leafID = (int)iLeaf;
+	ComputeAmbientForLeaves( iThread, &leafID, 1, &list );
 
 	VMPI_SetCurrentStage( "EncodeLeafAmbientResults" );
 
@@ -622,6 +794,7 @@ void ComputePerLeafAmbientLighting()
 	// Figure out which lights should go in the per-leaf ambient cubes.
 	int nInAmbientCube = 0;
 	int nSurfaceLights = 0;
+	s_AmbientCubeLights.RemoveAll();
 	for ( int i=0; i < *pNumworldlights; i++ )
 	{
 		dworldlight_t *wl = &dworldlights[i];
@@ -635,7 +808,10 @@ void ComputePerLeafAmbientLighting()
 			++nSurfaceLights;
 
 		if ( wl->flags & DWL_FLAGS_INAMBIENTCUBE )
+		{
 			++nInAmbientCube;
+			s_AmbientCubeLights.AddToTail( wl );
+		}
 	}
 
 	Msg( "%d of %d (%d%% of) surface lights went in leaf ambient cubes.\n", nInAmbientCube, nSurfaceLights, nSurfaceLights ? ((nInAmbientCube*100) / nSurfaceLights) : 0 );
@@ -648,9 +824,29 @@ void ComputePerLeafAmbientLighting()
 		VMPI_SetCurrentStage( "ComputeLeafAmbientLighting" );
 		DistributeWork( numleafs, VMPI_DISTRIBUTEWORK_PACKETID, VMPI_ProcessLeafAmbient, VMPI_ReceiveLeafAmbientResults );
 	}
+	else if ( LocalWorkersEnabled() )
+	{
+		LocalDistributeWork( numleafs, true, VMPI_ProcessLeafAmbient, VMPI_ReceiveLeafAmbientResults );
+	}
 	else
 	{
+		memset( s_nLeafAmbientSamples, 0, sizeof( s_nLeafAmbientSamples ) );
+		memset( s_nLeafAmbientLightRays, 0, sizeof( s_nLeafAmbientLightRays ) );
+		memset( s_nLeafAmbientSkyRays, 0, sizeof( s_nLeafAmbientSkyRays ) );
+		double flStartTime = Plat_FloatTime();
+
 		RunThreadsOn(numleafs, true, ThreadComputeLeafAmbient);
+
+		int nSamples = 0;
+		int64 nLightRays = 0;
+		int64 nSkyRays = 0;
+		for ( int i = 0; i <= MAX_TOOL_THREADS; i++ )
+		{
+			nSamples += s_nLeafAmbientSamples[i];
+			nLightRays += s_nLeafAmbientLightRays[i];
+			nSkyRays += s_nLeafAmbientSkyRays[i];
+		}
+		qprintf( "Leaf ambient: %d samples, %.1f million rays to surface lights, %.1f million rays to the sky, %.2fs\n", nSamples, nLightRays / 1000000.0, nSkyRays / 1000000.0, Plat_FloatTime() - flStartTime );
 	}
 
 	// now write out the data
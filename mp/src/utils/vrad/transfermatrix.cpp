@@ -0,0 +1,518 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Compressed storage of the patch to patch transfers used by the
+//			radiosity bounces.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "vrad.h"
+#include "transfermatrix.h"
+#include "mathlib/ssemath.h"
+#include "tier0/memalloc.h"
+
+#ifdef _WIN32
+#define fseek64 _fseeki64
+#else
+#define fseek64 fseeko
+#endif
+
+extern CUtlVector<Vector> emitlight;
+extern CUtlVector<bumplights_t> addlight;
+
+void GatherLight( int threadnum, void *pUserData );
+
+CTransferMatrix g_TransferMatrix;
+
+int g_nTransferMemoryMB = 0;
+bool g_bValidateTransfers = false;
+
+
+CTransferMatrix::CTransferMatrix()
+{
+	m_pShoot = NULL;
+	m_nTransfers = 0;
+	m_nResidentBytes = 0;
+	m_nBudget = 0;
+	m_nRowBytes = 0;
+	m_szScratchFile[0] = 0;
+	m_szRowFile[0] = 0;
+	m_pRowFile = NULL;
+	m_nRowFileSize = 0;
+	memset( m_pScratchFiles, 0, sizeof( m_pScratchFiles ) );
+}
+
+CTransferMatrix::~CTransferMatrix()
+{
+	Shutdown();
+}
+
+void CTransferMatrix::Init( int nPatches, int nMemoryBudgetMB, const char *pScratchFile )
+{
+	Shutdown();
+
+	m_Rows.SetCount( nPatches );
+	memset( m_Rows.Base(), 0, nPatches * sizeof( Row_t ) );
+
+	m_nBudget = (int64)nMemoryBudgetMB * 1024 * 1024;
+	Q_strncpy( m_szScratchFile, pScratchFile, sizeof( m_szScratchFile ) );
+	V_snprintf( m_szRowFile, sizeof( m_szRowFile ), "%s.rows", pScratchFile );
+}
+
+static int CompareTransfers( const void *a, const void *b )
+{
+	return ( (const transfer_t *)a )->patch - ( (const transfer_t *)b )->patch;
+}
+
+void CTransferMatrix::SetRow( int ndxPatch, const transfer_t *pTransfers, int nTransfers, float flScale )
+{
+	Row_t &row = m_Rows[ndxPatch];
+	Assert( !row.m_pColumns );
+	if ( nTransfers <= 0 )
+		return;
+
+	// Gathering in patch order keeps the reads of the shooting patches moving forward
+	transfer_t *pSorted = (transfer_t *)malloc( nTransfers * sizeof( transfer_t ) );
+	if ( !pSorted )
+		Error( "Memory allocation failure" );
+	memcpy( pSorted, pTransfers, nTransfers * sizeof( transfer_t ) );
+	qsort( pSorted, nTransfers, sizeof( transfer_t ), CompareTransfers );
+
+	float flMax = 0.0f;
+	for ( int i = 0; i < nTransfers; i++ )
+	{
+		flMax = max( flMax, pSorted[i].transfer * flScale );
+	}
+
+	row.m_nTransfers = nTransfers;
+	row.m_flScale = flMax / 65535.0f;
+	row.m_pColumns = (int *)malloc( nTransfers * sizeof( int ) );
+	row.m_pWeights = (unsigned short *)malloc( nTransfers * sizeof( unsigned short ) );
+	if ( !row.m_pColumns || !row.m_pWeights )
+		Error( "Memory allocation failure" );
+
+	float flQuantize = ( flMax > 0.0f ) ? 65535.0f / flMax : 0.0f;
+	for ( int i = 0; i < nTransfers; i++ )
+	{
+		row.m_pColumns[i] = pSorted[i].patch;
+		row.m_pWeights[i] = (unsigned short)clamp( pSorted[i].transfer * flScale * flQuantize + 0.5f, 0.0f, 65535.0f );
+	}
+
+	free( pSorted );
+
+	if ( m_nBudget <= 0 )
+		return;
+
+	int nBytes = GetRowBytes( nTransfers );
+
+	ThreadLock();
+	if ( m_nRowBytes + nBytes <= m_nBudget )
+	{
+		m_nRowBytes += nBytes;
+		ThreadUnlock();
+		return;
+	}
+
+	// Over budget, the row waits on disk until Pack puts it in its block
+	if ( !m_pRowFile )
+	{
+		m_pRowFile = fopen( m_szRowFile, "wb" );
+		if ( !m_pRowFile )
+			Error( "Can't open %s to write the transfers that do not fit in memory", m_szRowFile );
+	}
+
+	if ( fwrite( row.m_pColumns, nTransfers * sizeof( int ), 1, m_pRowFile ) != 1 ||
+		 fwrite( row.m_pWeights, nTransfers * sizeof( unsigned short ), 1, m_pRowFile ) != 1 )
+		Error( "Can't write the transfers to %s", m_szRowFile );
+
+	row.m_nFileOffset = m_nRowFileSize;
+	m_nRowFileSize += nBytes;
+	ThreadUnlock();
+
+	free( row.m_pColumns );
+	free( row.m_pWeights );
+	row.m_pColumns = NULL;
+	row.m_pWeights = NULL;
+}
+
+int CTransferMatrix::GetBlockBytes( int nRows, int nTransfers )
+{
+	int nBytes = ( nRows + 1 ) * sizeof( int ) + nRows * sizeof( float ) + nTransfers * ( sizeof( int ) + sizeof( unsigned short ) );
+	return ( nBytes + 15 ) & ~15;
+}
+
+void CTransferMatrix::GetBlockArrays( const Block_t &block, byte *pData, BlockArrays_t &arrays )
+{
+	arrays.m_pRowStart = (int *)pData;
+	arrays.m_pRowScale = (float *)( arrays.m_pRowStart + block.m_nRows + 1 );
+	arrays.m_pColumns = (int *)( arrays.m_pRowScale + block.m_nRows );
+	arrays.m_pWeights = (unsigned short *)( arrays.m_pColumns + block.m_nTransfers );
+}
+
+void CTransferMatrix::Pack()
+{
+	Assert( m_Rows.Count() == g_Patches.Count() );
+
+	// The transfers the VMPI workers sent back are still in the patches
+	for ( int i = 0; i < m_Rows.Count(); i++ )
+	{
+		CPatch *patch = &g_Patches[i];
+		if ( m_Rows[i].m_nTransfers || !patch->transfers )
+			continue;
+
+		SetRow( i, patch->transfers, patch->numtransfers, 1.0f );
+		if ( !g_bValidateTransfers )
+		{
+			free( patch->transfers );
+			patch->transfers = NULL;
+		}
+	}
+
+	// The rows SetRow spilled are read back into their blocks
+	FILE *pRows = NULL;
+	if ( m_pRowFile )
+	{
+		fclose( m_pRowFile );
+		m_pRowFile = NULL;
+
+		pRows = fopen( m_szRowFile, "rb" );
+		if ( !pRows )
+			Error( "Can't open %s to read the transfers back", m_szRowFile );
+	}
+
+	FILE *pSpill = NULL;
+	int64 nFileOffset = 0;
+
+	for ( int iFirstRow = 0; iFirstRow < m_Rows.Count(); iFirstRow += TRANSFER_BLOCK_ROWS )
+	{
+		Block_t &block = m_Blocks[m_Blocks.AddToTail()];
+		block.m_iFirstRow = iFirstRow;
+		block.m_nRows = min( TRANSFER_BLOCK_ROWS, m_Rows.Count() - iFirstRow );
+		block.m_nTransfers = 0;
+		for ( int i = 0; i < block.m_nRows; i++ )
+		{
+			block.m_nTransfers += m_Rows[iFirstRow + i].m_nTransfers;
+		}
+		block.m_nBytes = GetBlockBytes( block.m_nRows, block.m_nTransfers );
+		block.m_pData = (byte *)malloc( block.m_nBytes );
+		block.m_nFileOffset = -1;
+		if ( !block.m_pData )
+			Error( "Memory allocation failure" );
+
+		BlockArrays_t arrays;
+		GetBlockArrays( block, block.m_pData, arrays );
+
+		int nOffset = 0;
+		for ( int i = 0; i < block.m_nRows; i++ )
+		{
+			Row_t &row = m_Rows[iFirstRow + i];
+			arrays.m_pRowStart[i] = nOffset;
+			arrays.m_pRowScale[i] = row.m_flScale;
+			if ( row.m_nTransfers && row.m_pColumns )
+			{
+				memcpy( arrays.m_pColumns + nOffset, row.m_pColumns, row.m_nTransfers * sizeof( int ) );
+				memcpy( arrays.m_pWeights + nOffset, row.m_pWeights, row.m_nTransfers * sizeof( unsigned short ) );
+				if ( m_nBudget > 0 )
+					m_nRowBytes -= GetRowBytes( row.m_nTransfers );
+			}
+			else if ( row.m_nTransfers )
+			{
+				if ( fseek64( pRows, row.m_nFileOffset, SEEK_SET ) ||
+					 fread( arrays.m_pColumns + nOffset, row.m_nTransfers * sizeof( int ), 1, pRows ) != 1 ||
+					 fread( arrays.m_pWeights + nOffset, row.m_nTransfers * sizeof( unsigned short ), 1, pRows ) != 1 )
+					Error( "Can't read the transfers back from %s", m_szRowFile );
+			}
+			nOffset += row.m_nTransfers;
+
+			free( row.m_pColumns );
+			free( row.m_pWeights );
+			row.m_pColumns = NULL;
+			row.m_pWeights = NULL;
+		}
+		arrays.m_pRowStart[block.m_nRows] = nOffset;
+		m_nTransfers += block.m_nTransfers;
+
+		// The rows still waiting for their blocks count against the budget too
+		if ( m_nBudget <= 0 || m_nResidentBytes + m_nRowBytes + block.m_nBytes <= m_nBudget )
+		{
+			m_nResidentBytes += block.m_nBytes;
+			continue;
+		}
+
+		// Over budget, the block is read back every time it is gathered
+		if ( !pSpill )
+		{
+			pSpill = fopen( m_szScratchFile, "wb" );
+			if ( !pSpill )
+				Error( "Can't open %s to write the transfers that do not fit in memory", m_szScratchFile );
+		}
+
+		if ( fwrite( block.m_pData, block.m_nBytes, 1, pSpill ) != 1 )
+			Error( "Can't write the transfers to %s", m_szScratchFile );
+
+		block.m_nFileOffset = nFileOffset;
+		nFileOffset += block.m_nBytes;
+		free( block.m_pData );
+		block.m_pData = NULL;
+	}
+
+	if ( pSpill )
+		fclose( pSpill );
+
+	if ( pRows )
+	{
+		fclose( pRows );
+		remove( m_szRowFile );
+	}
+	m_nRowFileSize = 0;
+
+	m_Rows.Purge();
+}
+
+int CTransferMatrix::GetSpilledBlockCount() const
+{
+	int nSpilled = 0;
+	FOR_EACH_VEC( m_Blocks, i )
+	{
+		if ( !m_Blocks[i].m_pData )
+			nSpilled++;
+	}
+	return nSpilled;
+}
+
+void CTransferMatrix::Shutdown()
+{
+	FOR_EACH_VEC( m_Rows, i )
+	{
+		free( m_Rows[i].m_pColumns );
+		free( m_Rows[i].m_pWeights );
+	}
+	m_Rows.Purge();
+
+	FOR_EACH_VEC( m_Blocks, i )
+	{
+		free( m_Blocks[i].m_pData );
+	}
+	m_Blocks.Purge();
+
+	for ( int i = 0; i < MAX_TOOL_THREADS+1; i++ )
+	{
+		if ( m_pScratchFiles[i] )
+		{
+			fclose( m_pScratchFiles[i] );
+			m_pScratchFiles[i] = NULL;
+		}
+		m_ThreadBuffers[i].Purge();
+	}
+
+	if ( m_pRowFile )
+	{
+		fclose( m_pRowFile );
+		m_pRowFile = NULL;
+		remove( m_szRowFile );
+	}
+	m_szRowFile[0] = 0;
+	m_nRowFileSize = 0;
+
+	if ( m_szScratchFile[0] )
+	{
+		remove( m_szScratchFile );
+		m_szScratchFile[0] = 0;
+	}
+
+	if ( m_pShoot )
+	{
+		MemAlloc_FreeAligned( m_pShoot );
+		m_pShoot = NULL;
+	}
+
+	m_nTransfers = 0;
+	m_nResidentBytes = 0;
+	m_nBudget = 0;
+	m_nRowBytes = 0;
+}
+
+void CTransferMatrix::GatherBlock( int iThread, int iBlock )
+{
+	const Block_t &block = m_Blocks[iBlock];
+
+	byte *pData = block.m_pData;
+	if ( !pData )
+	{
+		if ( !m_pScratchFiles[iThread] )
+		{
+			m_pScratchFiles[iThread] = fopen( m_szScratchFile, "rb" );
+			if ( !m_pScratchFiles[iThread] )
+				Error( "Can't open %s to read the transfers back", m_szScratchFile );
+		}
+
+		CUtlVector<byte> &buffer = m_ThreadBuffers[iThread];
+		if ( buffer.Count() < block.m_nBytes )
+			buffer.SetCount( block.m_nBytes );
+		pData = buffer.Base();
+
+		if ( fseek64( m_pScratchFiles[iThread], block.m_nFileOffset, SEEK_SET ) ||
+			 fread( pData, block.m_nBytes, 1, m_pScratchFiles[iThread] ) != 1 )
+			Error( "Can't read the transfers back from %s", m_szScratchFile );
+	}
+
+	BlockArrays_t arrays;
+	GetBlockArrays( block, pData, arrays );
+
+	for ( int i = 0; i < block.m_nRows; i++ )
+	{
+		int ndxPatch = block.m_iFirstRow + i;
+		CPatch *patch = &g_Patches[ndxPatch];
+		const int *pColumns = arrays.m_pColumns;
+		const unsigned short *pWeights = arrays.m_pWeights;
+		int nStart = arrays.m_pRowStart[i];
+		int nEnd = arrays.m_pRowStart[i+1];
+
+		if ( !patch->needsBumpmap )
+		{
+			// Two sums to hide the latency of the multiply-adds
+			fltx4 sum0 = Four_Zeros;
+			fltx4 sum1 = Four_Zeros;
+			int k = nStart;
+			for ( ; k + 1 < nEnd; k += 2 )
+			{
+				sum0 = MaddSIMD( ReplicateX4( (float)pWeights[k] ), LoadAlignedSIMD( &m_pShoot[pColumns[k] * 4] ), sum0 );
+				sum1 = MaddSIMD( ReplicateX4( (float)pWeights[k+1] ), LoadAlignedSIMD( &m_pShoot[pColumns[k+1] * 4] ), sum1 );
+			}
+			if ( k < nEnd )
+			{
+				sum0 = MaddSIMD( ReplicateX4( (float)pWeights[k] ), LoadAlignedSIMD( &m_pShoot[pColumns[k] * 4] ), sum0 );
+			}
+			sum0 = MulSIMD( AddSIMD( sum0, sum1 ), ReplicateX4( arrays.m_pRowScale[i] ) );
+
+			addlight[ndxPatch].light[0].Init( SubFloat( sum0, 0 ), SubFloat( sum0, 1 ), SubFloat( sum0, 2 ) );
+			continue;
+		}
+
+		Vector normals[NUM_BUMP_VECTS+1];
+		Vector bumpSum[NUM_BUMP_VECTS+1];
+		GetPatchBumpNormals( patch, normals );
+		for ( int j = 0; j < NUM_BUMP_VECTS+1; j++ )
+		{
+			VectorFill( bumpSum[j], 0 );
+		}
+
+		for ( int k = nStart; k < nEnd; k++ )
+		{
+			const float *pShoot = &m_pShoot[pColumns[k] * 4];
+
+			// get vector to other patch
+			Vector delta;
+			VectorSubtract( g_Patches[pColumns[k]].origin, patch->origin, delta );
+			VectorNormalize( delta );
+
+			// remove normal already factored into transfer steradian
+			float scale = pWeights[k] * arrays.m_pRowScale[i] / DotProduct( delta, patch->normal );
+			Vector v( pShoot[0] * scale, pShoot[1] * scale, pShoot[2] * scale );
+
+			for ( int j = 0; j < NUM_BUMP_VECTS+1; j++ )
+			{
+				float dot = DotProduct( delta, normals[j] );
+				if ( dot <= 0 )
+					continue;
+				VectorMA( bumpSum[j], dot, v, bumpSum[j] );
+			}
+		}
+
+		for ( int j = 0; j < NUM_BUMP_VECTS+1; j++ )
+		{
+			VectorCopy( bumpSum[j], addlight[ndxPatch].light[j] );
+		}
+	}
+}
+
+static void GatherTransferBlocks( int iThread, void *pUserData )
+{
+	while ( 1 )
+	{
+		int iBlock = GetThreadWork();
+		if ( iBlock == -1 )
+			break;
+
+		g_TransferMatrix.GatherBlock( iThread, iBlock );
+	}
+}
+
+void CTransferMatrix::Gather()
+{
+	Assert( IsPacked() );
+
+	int nPatches = g_Patches.Count();
+	if ( !m_pShoot )
+	{
+		m_pShoot = (float *)MemAlloc_AllocAligned( nPatches * 4 * sizeof( float ), 16 );
+		if ( !m_pShoot )
+			Error( "Memory allocation failure" );
+	}
+
+	// the light each patch sends out, padded to a fltx4
+	for ( int i = 0; i < nPatches; i++ )
+	{
+		const Vector &reflectivity = g_Patches[i].reflectivity;
+		float *pShoot = &m_pShoot[i * 4];
+		pShoot[0] = emitlight[i][0] * reflectivity[0];
+		pShoot[1] = emitlight[i][1] * reflectivity[1];
+		pShoot[2] = emitlight[i][2] * reflectivity[2];
+		pShoot[3] = 0.0f;
+	}
+
+	RunThreadsOn( m_Blocks.Count(), true, GatherTransferBlocks );
+}
+
+
+void ValidateTransferMatrix()
+{
+	int nPatches = g_Patches.Count();
+
+	CUtlVector<bumplights_t> packedLight;
+	packedLight.CopyArray( addlight.Base(), nPatches );
+
+	RunThreadsOn( nPatches, true, GatherLight );
+
+	double flTotalError = 0.0;
+	double flTotal = 0.0;
+	float flMaxError = 0.0f;
+	int iMaxErrorPatch = -1;
+	for ( int i = 0; i < nPatches; i++ )
+	{
+		int normalCount = g_Patches[i].needsBumpmap ? NUM_BUMP_VECTS+1 : 1;
+		for ( int j = 0; j < normalCount; j++ )
+		{
+			const Vector &reference = addlight[i].light[j];
+			float flError = ( packedLight[i].light[j] - reference ).Length();
+			float flLength = reference.Length();
+
+			flTotalError += flError;
+			flTotal += flLength;
+
+			// Ignore the patches that barely get anything, any error is large there
+			if ( flLength > 1.0f && flError / flLength > flMaxError )
+			{
+				flMaxError = flError / flLength;
+				iMaxErrorPatch = i;
+			}
+		}
+
+		// Keep bouncing with the packed transfers
+		addlight[i] = packedLight[i];
+	}
+
+	float flRelativeError = ( flTotal > 0.0 ) ? (float)( flTotalError / flTotal ) : 0.0f;
+	Msg( "Transfer matrix: %.4f%% error overall, %.4f%% at most (patch %d)\n", flRelativeError * 100.0f, flMaxError * 100.0f, iMaxErrorPatch );
+	if ( flRelativeError > 0.01f )
+	{
+		Warning( "The packed transfers are more than 1%% off the original ones!\n" );
+	}
+
+	// Not needed anymore
+	for ( int i = 0; i < nPatches; i++ )
+	{
+		free( g_Patches[i].transfers );
+		g_Patches[i].transfers = NULL;
+	}
+}
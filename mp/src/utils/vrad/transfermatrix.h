@@ -0,0 +1,117 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Compressed storage of the patch to patch transfers used by the
+//			radiosity bounces.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef TRANSFERMATRIX_H
+#define TRANSFERMATRIX_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "utlvector.h"
+#include "threads.h"
+
+struct transfer_t;
+
+// Receiving patches packed together, also the unit of work of a bounce
+#define TRANSFER_BLOCK_ROWS		256
+
+//-----------------------------------------------------------------------------
+// The transfers as a compressed sparse row matrix: a row per receiving patch,
+// holding the patches it gathers from (sorted) and 16 bit weights quantized
+// against the largest weight of the row. Rows are packed in blocks of
+// consecutive patches, the blocks that do not fit in the memory budget are
+// kept in a scratch file and read back whenever they are gathered. Rows set
+// while over the budget already go to a second scratch file as they come in,
+// so building the matrix does not need more memory than gathering it.
+//-----------------------------------------------------------------------------
+class CTransferMatrix
+{
+public:
+	CTransferMatrix();
+	~CTransferMatrix();
+
+	// A budget of 0 keeps everything in memory, otherwise the scratch files are named after pScratchFile
+	void Init( int nPatches, int nMemoryBudgetMB, const char *pScratchFile );
+
+	// Takes the transfers of a patch, scaled by flScale. Thread safe for different patches.
+	void SetRow( int ndxPatch, const transfer_t *pTransfers, int nTransfers, float flScale );
+
+	// Packs the rows set so far (and the transfers of patches that have no row yet, as
+	// received from VMPI workers) into blocks, spilling the blocks past the budget to disk.
+	void Pack();
+	bool IsPacked() const { return m_Blocks.Count() > 0; }
+	void Shutdown();
+
+	// addlight of every patch = its transfers * (emitlight * reflectivity)
+	void Gather();
+	void GatherBlock( int iThread, int iBlock );
+
+	int64 GetTransferCount() const { return m_nTransfers; }
+	int64 GetResidentBytes() const { return m_nResidentBytes; }
+	int GetBlockCount() const { return m_Blocks.Count(); }
+	int GetSpilledBlockCount() const;
+
+private:
+	struct Row_t
+	{
+		int m_nTransfers;
+		float m_flScale;			// weight = quantized weight * scale
+		int *m_pColumns;			// both null if spilled
+		unsigned short *m_pWeights;
+		int64 m_nFileOffset;		// In the row scratch file if spilled, the columns followed by the weights
+	};
+
+	struct Block_t
+	{
+		int m_iFirstRow;
+		int m_nRows;
+		int m_nTransfers;
+		int m_nBytes;
+		byte *m_pData;				// null if spilled
+		int64 m_nFileOffset;
+	};
+
+	// Where the arrays of a block are in its data
+	struct BlockArrays_t
+	{
+		int *m_pRowStart;			// m_nRows + 1 offsets into the columns and weights
+		float *m_pRowScale;
+		int *m_pColumns;
+		unsigned short *m_pWeights;
+	};
+
+	static int GetRowBytes( int nTransfers ) { return nTransfers * ( sizeof( int ) + sizeof( unsigned short ) ); }
+	static int GetBlockBytes( int nRows, int nTransfers );
+	static void GetBlockArrays( const Block_t &block, byte *pData, BlockArrays_t &arrays );
+
+	CUtlVector<Row_t> m_Rows;		// Only until packed
+	CUtlVector<Block_t> m_Blocks;
+	float *m_pShoot;				// emitlight * reflectivity of every patch, 4 floats each
+
+	int64 m_nTransfers;
+	int64 m_nResidentBytes;
+	int64 m_nBudget;
+	int64 m_nRowBytes;				// Of the rows in memory, while they are being set
+
+	char m_szScratchFile[MAX_PATH];
+	char m_szRowFile[MAX_PATH];
+	FILE *m_pRowFile;				// Only written to while the rows are set, under the thread lock
+	int64 m_nRowFileSize;
+	FILE *m_pScratchFiles[MAX_TOOL_THREADS+1];	// One reader per thread
+	CUtlVector<byte> m_ThreadBuffers[MAX_TOOL_THREADS+1];
+};
+
+extern CTransferMatrix g_TransferMatrix;
+
+extern int g_nTransferMemoryMB;		// "-transfermem", 0 keeps every transfer in memory
+extern bool g_bValidateTransfers;	// "-transfercheck"
+
+// Gathers the first bounce with the original float transfers too, and reports how far off the matrix is
+void ValidateTransferMatrix();
+
+#endif // TRANSFERMATRIX_H
@@ -15,9 +15,13 @@
 #include "vmpi.h"
 #include "macro_texture.h"
 #include "vmpi_tools_shared.h"
+#include "vmpi_local_distribute.h"
 #include "leaf_ambient_lighting.h"
 #include "tools_minidump.h"
+#include "phasetimes.h"
 #include "loadcmdline.h"
+#include "transfermatrix.h"
+#include "vradcheckpoint.h"
 
 #define ALLOWDEBUGOPTIONS (0 || _DEBUG)
 
@@ -1216,10 +1220,6 @@ void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 		}
 
 
-		patch->transfers = ( transfer_t* )calloc (1, patch->numtransfers * sizeof(transfer_t));
-		if (!patch->transfers)
-			Error ("Memory allocation failure");
-
 		// get total transfer energy
 		t2 = all_transfers;
 
@@ -1235,12 +1235,25 @@ void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 		else	
 			total = 1.0f/M_PI;
 
-		t = patch->transfers;
-		t2 = all_transfers;
-		for (j=0 ; j<patch->numtransfers ; j++, t++, t2++)
+		// the bounces gather through the transfer matrix, the VMPI workers send the transfers back as they are
+		if ( !g_bUseMPI )
+		{
+			g_TransferMatrix.SetRow( ndxPatch, all_transfers, patch->numtransfers, total );
+		}
+
+		if ( g_bUseMPI || g_bValidateTransfers )
 		{
-			t->transfer = t2->transfer*total;
-			t->patch = t2->patch;
+			patch->transfers = ( transfer_t* )calloc (1, patch->numtransfers * sizeof(transfer_t));
+			if (!patch->transfers)
+				Error ("Memory allocation failure");
+
+			t = patch->transfers;
+			t2 = all_transfers;
+			for (j=0 ; j<patch->numtransfers ; j++, t++, t2++)
+			{
+				t->transfer = t2->transfer*total;
+				t->patch = t2->patch;
+			}
 		}
 		if (patch->numtransfers > max_transfer)
 		{
@@ -1529,6 +1542,39 @@ void PreGetBumpNormalsForDisp( texinfo_t *pTexinfo, Vector &vecU, Vector &vecV,
 	vecV = vecTexV;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: The normals a bumped patch receives light on, the flat normal first
+//-----------------------------------------------------------------------------
+void GetPatchBumpNormals( CPatch *patch, Vector normals[NUM_BUMP_VECTS+1] )
+{
+	// Disps
+	bool bDisp = ( g_pFaces[patch->faceNumber].dispinfo != -1 ); 
+	if ( bDisp )
+	{
+		normals[0] = patch->normal;
+		texinfo_t *pTexinfo = &texinfo[g_pFaces[patch->faceNumber].texinfo];
+		Vector vecTexU, vecTexV;
+		PreGetBumpNormalsForDisp( pTexinfo, vecTexU, vecTexV, normals[0] );
+
+		// use facenormal along with the smooth normal to build the three bump map vectors
+		GetBumpNormals( vecTexU, vecTexV, normals[0], normals[0], &normals[1] ); 
+	}
+	else
+	{
+		GetPhongNormal( patch->faceNumber, patch->origin, normals[0] );
+
+		texinfo_t *pTexinfo = &texinfo[g_pFaces[patch->faceNumber].texinfo];
+		// use facenormal along with the smooth normal to build the three bump map vectors
+		GetBumpNormals( pTexinfo->textureVecsTexelsPerWorldUnits[0], 
+			pTexinfo->textureVecsTexelsPerWorldUnits[1], patch->normal, 
+			normals[0], &normals[1] );
+	}
+
+	// force the base lightmap to use the flat normal instead of the phong normal
+	// FIXME: why does the patch not use the phong normal?
+	normals[0] = patch->normal;
+}
+
 void GatherLight (int threadnum, void *pUserData)
 {
 	int			i, j, k;
@@ -1553,32 +1599,7 @@ void GatherLight (int threadnum, void *pUserData)
 			Vector bumpSum[NUM_BUMP_VECTS+1];
 			Vector normals[NUM_BUMP_VECTS+1];
 
-			// Disps
-			bool bDisp = ( g_pFaces[patch->faceNumber].dispinfo != -1 ); 
-			if ( bDisp )
-			{
-				normals[0] = patch->normal;
-				texinfo_t *pTexinfo = &texinfo[g_pFaces[patch->faceNumber].texinfo];
-				Vector vecTexU, vecTexV;
-				PreGetBumpNormalsForDisp( pTexinfo, vecTexU, vecTexV, normals[0] );
-
-				// use facenormal along with the smooth normal to build the three bump map vectors
-				GetBumpNormals( vecTexU, vecTexV, normals[0], normals[0], &normals[1] ); 
-			}
-			else
-			{
-				GetPhongNormal( patch->faceNumber, patch->origin, normals[0] );
-
-				texinfo_t *pTexinfo = &texinfo[g_pFaces[patch->faceNumber].texinfo];
-				// use facenormal along with the smooth normal to build the three bump map vectors
-				GetBumpNormals( pTexinfo->textureVecsTexelsPerWorldUnits[0], 
-					pTexinfo->textureVecsTexelsPerWorldUnits[1], patch->normal, 
-					normals[0], &normals[1] );
-			}
-
-			// force the base lightmap to use the flat normal instead of the phong normal
-			// FIXME: why does the patch not use the phong normal?
-			normals[0] = patch->normal;
+			GetPatchBumpNormals( patch, normals );
 
 			for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
 			{
@@ -1647,21 +1668,25 @@ void GatherLight (int threadnum, void *pUserData)
 BounceLight
 =============
 */
-void BounceLight (void)
+void BounceLight ( unsigned nFirstBounce )
 {
 	unsigned i;
 	Vector	added;
 	char		name[64];
 	qboolean	bouncing = numbounce > 0;
 
-	unsigned int uiPatchCount = g_Patches.Size();
-	for (i=0 ; i<uiPatchCount; i++)
+	// resuming from a checkpoint, emitlight and totallight are where that bounce left them
+	if ( nFirstBounce == 0 )
 	{
-		// totallight has a copy of the direct lighting.  Move it to the emitted light and zero it out (to integrate bounces only)
-		VectorCopy( g_Patches[i].totallight.light[0], emitlight[i] );
+		unsigned int uiPatchCount = g_Patches.Size();
+		for (i=0 ; i<uiPatchCount; i++)
+		{
+			// totallight has a copy of the direct lighting.  Move it to the emitted light and zero it out (to integrate bounces only)
+			VectorCopy( g_Patches[i].totallight.light[0], emitlight[i] );
 
-		// NOTE: This means that only the bounced light is integrated into totallight!
-		VectorFill( g_Patches[i].totallight.light[0], 0 );
+			// NOTE: This means that only the bounced light is integrated into totallight!
+			VectorFill( g_Patches[i].totallight.light[0], 0 );
+		}
 	}
 
 #if 0
@@ -1697,13 +1722,17 @@ void BounceLight (void)
 	}
 #endif
 
-	i = 0;
+	i = nFirstBounce;
 	while ( bouncing )
 	{
 		// transfer light from to the leaf patches from other patches via transfers
 		// this moves shooter->emitlight to receiver->addlight
-		unsigned int uPatchCount = g_Patches.Size();
-		RunThreadsOn (uPatchCount, true, GatherLight);
+		g_TransferMatrix.Gather();
+
+		// check the packed transfers against the original ones once
+		if ( g_bValidateTransfers && i == nFirstBounce )
+			ValidateTransferMatrix();
+
 		// move newly received light (addlight) to light to be sent out (emitlight)
 		// start at children and pull light up to parents
 		// light is always received to leaf patches
@@ -1720,7 +1749,11 @@ void BounceLight (void)
 			sprintf (name, "bounce%i.txt", i);
 			WriteWorld (name, 0);
 		}
+
+		Checkpoint_SaveBounce( i, !bouncing );
 	}
+
+	g_TransferMatrix.Shutdown();
 }
 
 
@@ -1921,16 +1954,24 @@ void BuildFacesVisibleToLights( bool bAllVisible )
 
 void MakeAllScales (void)
 {
+	// Rows past -transfermem already go to disk while the visibility is built
+	char szScratchFile[MAX_PATH];
+	V_StripExtension( source, szScratchFile, sizeof( szScratchFile ) );
+	V_strncat( szScratchFile, ".transfers", sizeof( szScratchFile ) );
+	g_TransferMatrix.Init( g_Patches.Count(), g_nTransferMemoryMB, szScratchFile );
+
 	// determine visibility between patches
 	BuildVisMatrix ();
 	
 	// release visibility matrix
 	FreeVisMatrix ();
 
+	g_TransferMatrix.Pack();
+
 	Msg("transfers %d, max %d\n", total_transfer, max_transfer );
 
-	qprintf ("transfer lists: %5.1f megs\n"
-		, (float)total_transfer * sizeof(transfer_t) / (1024*1024));
+	qprintf ("transfer lists: %5.1f megs in memory, %d of %d blocks on disk\n"
+		, (float)g_TransferMatrix.GetResidentBytes() / (1024*1024), g_TransferMatrix.GetSpilledBlockCount(), g_TransferMatrix.GetBlockCount() );
 }
 
 
@@ -2016,8 +2057,20 @@ bool RadWorld_Go()
 		BuildFacesVisibleToLights( true );
 	}
 
+	// -resume skips the phases a previous run of this compile checkpointed
+	CheckpointStage_t resumeStage = Checkpoint_GetResumeStage();
+
 	// build initial facelights
-	if (g_bUseMPI) 
+	PhaseTimes_Begin( "direct_lighting" );
+	if ( resumeStage == CHECKPOINT_FINAL_LIGHT )
+	{
+		// the lightmaps are done, the facelights aren't needed
+	}
+	else if ( resumeStage != CHECKPOINT_NONE )
+	{
+		Checkpoint_LoadDirectLighting();
+	}
+	else if (g_bUseMPI) 
 	{
 		// RunThreadsOnIndividual (numfaces, true, BuildFacelights);
 		RunMPIBuildFacelights();
@@ -2025,7 +2078,9 @@ bool RadWorld_Go()
 	else 
 	{
 		RunThreadsOnIndividual (numfaces, true, BuildFacelights);
+		Checkpoint_SaveDirectLighting();
 	}
+	PhaseTimes_End();
 
 	// Was the process interrupted?
 	if( g_pIncremental && (g_iCurFace != numfaces) )
@@ -2044,6 +2099,13 @@ bool RadWorld_Go()
 		// free up the direct lights now that we have facelights
 		ExportDirectLightsToWorldLights();
 
+		if ( resumeStage == CHECKPOINT_FINAL_LIGHT )
+		{
+			Checkpoint_LoadFinalLight();
+			Msg("FinalLightFace Done (from checkpoint)\n"); fflush(stdout);
+			return true;
+		}
+
 		if ( g_bDumpPatches )
 		{
 			for( int iBump = 0; iBump < 4; ++iBump )
@@ -2056,16 +2118,28 @@ bool RadWorld_Go()
 
 		if (numbounce > 0)
 		{
+			CPhaseTimesScope phase( "bounce" );
+
 			// allocate memory for emitlight/addlight
 			emitlight.SetSize( g_Patches.Size() );
 			memset( emitlight.Base(), 0, g_Patches.Size() * sizeof( Vector ) );
 			addlight.SetSize( g_Patches.Size() );
 			memset( addlight.Base(), 0, g_Patches.Size() * sizeof( bumplights_t ) );
 
-			MakeAllScales ();
+			int nBouncesDone = 0;
+			bool bBouncesDone = false;
+			if ( resumeStage == CHECKPOINT_BOUNCE )
+			{
+				Checkpoint_LoadBounce( nBouncesDone, bBouncesDone );
+			}
+
+			if ( !bBouncesDone )
+			{
+				MakeAllScales ();
 
-			// spread light around
-			BounceLight ();
+				// spread light around
+				BounceLight ( nBouncesDone );
+			}
 		}
 
 		//
@@ -2078,8 +2152,12 @@ bool RadWorld_Go()
 
 		// blend bounced light into direct light and save
 		VMPI_SetCurrentStage( "FinalLightFace" );
+		PhaseTimes_Begin( "final_light" );
 		if ( !g_bUseMPI || g_bMPIMaster )
 			RunThreadsOnIndividual (numfaces, true, FinalLightFace);
+		PhaseTimes_End();
+
+		Checkpoint_SaveFinalLight();
 		
 		// Distribute the lighting data to workers.
 		VMPI_DistributeLightData();
@@ -2295,14 +2373,18 @@ void VRAD_ComputeOtherLighting()
 	// Compute lighting for the bsp file
 	if ( !g_bNoDetailLighting )
 	{
+		CPhaseTimesScope phase( "detail_props" );
 		ComputeDetailPropLighting( THREADINDEX_MAIN );
 	}
 
+	PhaseTimes_Begin( "leaf_ambient" );
 	ComputePerLeafAmbientLighting();
+	PhaseTimes_End();
 
 	// bake the static props high quality vertex lighting into the bsp
 	if ( !do_fast && g_bStaticPropLighting )
 	{
+		CPhaseTimesScope phase( "static_props" );
 		StaticPropMgr()->ComputeLighting( THREADINDEX_MAIN );
 	}
 }
@@ -2322,6 +2404,7 @@ void VRAD_Finish()
 	Msg( "Writing %s\n", source );
 	VMPI_SetCurrentStage( "WriteBSPFile" );
 	WriteBSPFile(source);
+	Checkpoint_Finish();
 
 	if ( g_bDumpPatches )
 	{
@@ -2460,6 +2543,23 @@ int ParseCommandLine( int argc, char **argv, bool *onlydetail )
 				return -1;
 			}
 		}
+		else if (!Q_stricmp(argv[i],"-localworkers"))
+		{
+			if ( ++i < argc )
+			{
+				g_nLocalWorkers = atoi (argv[i]);
+				if ( g_nLocalWorkers <= 0 )
+				{
+					Warning("Error: expected positive value after '-localworkers'\n" );
+					return -1;
+				}
+			}
+			else
+			{
+				Warning("Error: expected a value after '-localworkers'\n" );
+				return -1;
+			}
+		}
 		else if ( !Q_stricmp(argv[i], "-lights" ) )
 		{
 			if ( ++i < argc && *argv[i] )
@@ -2484,6 +2584,27 @@ int ParseCommandLine( int argc, char **argv, bool *onlydetail )
 		{
 			g_bFastAmbient = true;
 		}
+		else if ( !Q_stricmp(argv[i], "-transfermem") )
+		{
+			if ( ++i < argc )
+			{
+				g_nTransferMemoryMB = atoi( argv[i] );
+				if ( g_nTransferMemoryMB < 0 )
+				{
+					Warning("Error: expected non-negative value after '-transfermem'\n" );
+					return -1;
+				}
+			}
+			else
+			{
+				Warning("Error: expected a value after '-transfermem'\n" );
+				return -1;
+			}
+		}
+		else if ( !Q_stricmp(argv[i], "-transfercheck") )
+		{
+			g_bValidateTransfers = true;
+		}
 		else if (!Q_stricmp(argv[i],"-fast"))
 		{
 			do_fast = true;
@@ -2602,6 +2723,30 @@ int ParseCommandLine( int argc, char **argv, bool *onlydetail )
 		{
 			EnableFullMinidumps( true );
 		}
+		else if ( !Q_stricmp( argv[i], "-phasetimes" ) )
+		{
+			if ( ++i < argc && *argv[i] )
+			{
+				// VMPI workers share the command line, only the master's phases are timed
+				if ( !g_bUseMPI || g_bMPIMaster )
+				{
+					PhaseTimes_Init( "vrad", argv[i] );
+				}
+			}
+			else
+			{
+				Warning("Error: expected a file name after '-phasetimes'\n" );
+				return -1;
+			}
+		}
+		else if ( !Q_stricmp( argv[i], "-checkpoint" ) )
+		{
+			g_bCheckpoint = true;
+		}
+		else if ( !Q_stricmp( argv[i], "-resume" ) )
+		{
+			g_bResume = true;
+		}
 		else if ( !Q_stricmp( argv[i], "-hdr" ) )
 		{
 			SetHDRMode( true );
@@ -2826,18 +2971,32 @@ void PrintUsage( int argc, char **argv )
 		"                    radiosity.\n"
 		"  -stoponexit	   : Wait for a keypress on exit.\n"
 		"  -mpi_pw <pw>    : Use a password to choose a specific set of VMPI workers.\n"
+		"  -localworkers # : Compute the static prop and per-leaf ambient lighting in #\n"
+		"                    worker processes on this machine instead of threads\n"
+		"                    (Linux only).\n"
 		"  -nodetaillight  : Don't light detail props.\n"
 		"  -centersamples  : Move sample centers.\n"
 		"  -luxeldensity # : Rescale all luxels by the specified amount (default: 1.0).\n"
 		"                    The number specified must be less than 1.0 or it will be\n"
 		"                    ignored.\n"
 		"  -loghash        : Log the sample hash table to samplehash.txt.\n"
+		"  -transfermem #  : Megabytes of patch transfers kept in memory, the rest is\n"
+		"                    read back from a scratch file at each bounce (default: 0,\n"
+		"                    no limit).\n"
+		"  -transfercheck  : Compare the first bounce against the uncompressed\n"
+		"                    transfers and report the error.\n"
 		"  -onlydetail     : Only light detail props and per-leaf lighting.\n"
 		"  -maxdispsamplesize #: Set max displacement sample size (default: 512).\n"
 		"  -softsun <n>    : Treat the sun as an area light source of size <n> degrees."
 		"                    Produces soft shadows.\n"
 		"                    Recommended values are between 0 and 5. Default is 0.\n"
 		"  -FullMinidumps  : Write large minidumps on crash.\n"
+		"  -phasetimes <file> : Write the time and peak memory of each lighting phase\n"
+		"                    to <file> as JSON.\n"
+		"  -checkpoint     : Save the lighting next to the bsp as each phase finishes.\n"
+		"  -resume         : Continue a -checkpoint compile that didn't finish, after\n"
+		"                    the last phase it saved. Implies -checkpoint, doesn't work\n"
+		"                    with -dump.\n"
 		"  -chop           : Smallest number of luxel widths for a bounce patch, used on edges\n"
 		"  -maxchop		   : Coarsest allowed number of luxel widths for a patch, used in face interiors\n"
 		"\n"
@@ -2908,7 +3067,11 @@ int RunVRAD( int argc, char **argv )
 	CmdLib_InitFileSystem( argv[ i ] );
 	Q_FileBase( source, source, sizeof( source ) );
 
+	PhaseTimes_Begin( "load_bsp" );
 	VRAD_LoadBSP( argv[i] );
+	PhaseTimes_End();
+
+	Checkpoint_Init( argc, argv );
 
 	if ( (! onlydetail) && (! g_bOnlyStaticProps ) )
 	{
@@ -0,0 +1,589 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Saves the results of the long lighting phases next to the bsp
+//			("-checkpoint") so a compile that dies can pick up after the last
+//			phase it finished ("-resume").
+//
+//=============================================================================//
+
+#include "vrad.h"
+#include "lightmap.h"
+#include "vradcheckpoint.h"
+#include "checksum_crc.h"
+#include "vmpi.h"
+
+extern CUtlVector<Vector> emitlight;
+
+
+#define CHECKPOINT_IDENT	(('K'<<24)+('C'<<16)+('R'<<8)+'V')
+#define CHECKPOINT_VERSION	1
+
+// What a checkpoint was saved from, it is only loaded back into the same compile
+struct CheckpointKey_t
+{
+	CRC32_t		m_nBSPCRC;			// the bsp as it was loaded, before any lighting
+	CRC32_t		m_nOptionsCRC;		// the command line, less the options that don't change the lighting
+	int			m_bHDR;
+	int			m_nFaces;
+	int			m_nPatches;
+};
+
+struct CheckpointHeader_t
+{
+	int				m_nIdent;
+	int				m_nVersion;
+	int				m_nStage;
+	CheckpointKey_t	m_Key;
+};
+
+// the direct light BuildPatchLights leaves on a patch
+struct CheckpointPatchLight_t
+{
+	bumplights_t	m_TotalLight;
+	Vector			m_DirectLight;
+	Vector			m_SampleLight;
+	float			m_flSampleArea;
+};
+
+static const char *s_pStageSuffixes[CHECKPOINT_STAGE_COUNT] =
+{
+	NULL,
+	".checkpoint_direct",
+	".checkpoint_bounce",
+	".checkpoint_final",
+	".checkpoint_props",
+};
+
+static const char *s_pStageNames[CHECKPOINT_STAGE_COUNT] =
+{
+	NULL,
+	"direct lighting",
+	"bounce",
+	"final light",
+	"static prop",
+};
+
+bool g_bCheckpoint = false;
+bool g_bResume = false;
+
+static CheckpointKey_t s_Key;
+static char s_szCheckpointBase[MAX_PATH];
+
+
+static void GetCheckpointFileName( CheckpointStage_t stage, char *pFileName, int nMaxLen )
+{
+	V_strncpy( pFileName, s_szCheckpointBase, nMaxLen );
+	V_strncat( pFileName, s_pStageSuffixes[stage], nMaxLen );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: CRC of a whole file, read a block at a time
+//-----------------------------------------------------------------------------
+static bool CRCFile( const char *pFileName, CRC32_t *pCRC )
+{
+	FILE *fp = fopen( pFileName, "rb" );
+	if ( !fp )
+		return false;
+
+	CRC32_Init( pCRC );
+
+	const int nBlockSize = 1024 * 1024;
+	byte *pBlock = (byte *)malloc( nBlockSize );
+	size_t nRead;
+	while ( ( nRead = fread( pBlock, 1, nBlockSize, fp ) ) > 0 )
+	{
+		CRC32_ProcessBuffer( pCRC, pBlock, (int)nRead );
+	}
+	free( pBlock );
+	fclose( fp );
+
+	CRC32_Final( pCRC );
+	return true;
+}
+
+
+void Checkpoint_Init( int argc, char **argv )
+{
+	if ( g_bResume )
+	{
+		g_bCheckpoint = true;
+	}
+
+	if ( !g_bCheckpoint )
+		return;
+
+	if ( g_bUseMPI || g_pIncremental )
+	{
+		Warning( "-checkpoint and -resume don't work with %s, ignoring them.\n", g_bUseMPI ? "VMPI" : "incremental lighting" );
+		g_bCheckpoint = g_bResume = false;
+		return;
+	}
+
+	if ( g_bResume && g_bDumpPatches )
+	{
+		// -dump writes out the sample windings, which the checkpoints don't keep
+		Warning( "-resume doesn't work with -dump, starting over.\n" );
+		g_bResume = false;
+	}
+
+	// source has the path and extension of the bsp by now
+	V_StripExtension( source, s_szCheckpointBase, sizeof( s_szCheckpointBase ) );
+
+	memset( &s_Key, 0, sizeof( s_Key ) );
+	if ( !CRCFile( source, &s_Key.m_nBSPCRC ) )
+	{
+		Warning( "Can't read %s back for its checksum, turning -checkpoint off.\n", source );
+		g_bCheckpoint = g_bResume = false;
+		return;
+	}
+
+	// Options that can't change the lighting don't have to match to resume
+	CRC32_Init( &s_Key.m_nOptionsCRC );
+	for ( int i = 1; i < argc; i++ )
+	{
+		if ( !Q_stricmp( argv[i], "-checkpoint" ) || !Q_stricmp( argv[i], "-resume" ) || !Q_stricmp( argv[i], "-low" ) )
+			continue;
+
+		if ( !Q_stricmp( argv[i], "-threads" ) || !Q_stricmp( argv[i], "-phasetimes" ) )
+		{
+			i++;
+			continue;
+		}
+
+		CRC32_ProcessBuffer( &s_Key.m_nOptionsCRC, argv[i], V_strlen( argv[i] ) + 1 );
+	}
+	CRC32_Final( &s_Key.m_nOptionsCRC );
+
+	s_Key.m_bHDR = g_bHDR;
+	s_Key.m_nFaces = numfaces;
+	s_Key.m_nPatches = g_Patches.Count();
+}
+
+
+CheckpointStage_t Checkpoint_GetResumeStage()
+{
+	if ( !g_bResume )
+		return CHECKPOINT_NONE;
+
+	CheckpointStage_t stage = CHECKPOINT_NONE;
+	CCheckpointFile file;
+	if ( file.OpenRead( CHECKPOINT_FINAL_LIGHT ) )
+	{
+		stage = CHECKPOINT_FINAL_LIGHT;
+	}
+	else if ( file.OpenRead( CHECKPOINT_DIRECT_LIGHTING ) )
+	{
+		// the bounces are only any use with the facelights they started from
+		stage = CHECKPOINT_DIRECT_LIGHTING;
+		file.Close();
+		if ( numbounce > 0 && file.OpenRead( CHECKPOINT_BOUNCE ) )
+		{
+			stage = CHECKPOINT_BOUNCE;
+		}
+	}
+	file.Close();
+
+	char szFileName[MAX_PATH];
+	if ( stage == CHECKPOINT_NONE )
+	{
+		GetCheckpointFileName( CHECKPOINT_DIRECT_LIGHTING, szFileName, sizeof( szFileName ) );
+		Msg( "No checkpoint of this compile to resume from (%s), starting over.\n", szFileName );
+	}
+	else
+	{
+		GetCheckpointFileName( stage, szFileName, sizeof( szFileName ) );
+		Msg( "Resuming after the %s checkpoint in %s\n", s_pStageNames[stage], szFileName );
+	}
+
+	return stage;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Facelights and patch direct light, everything BuildFacelights makes
+//-----------------------------------------------------------------------------
+void Checkpoint_SaveDirectLighting()
+{
+	if ( !g_bCheckpoint )
+		return;
+
+	CCheckpointFile file;
+	if ( !file.OpenWrite( CHECKPOINT_DIRECT_LIGHTING ) )
+		return;
+
+	file.WriteValue( numfaces );
+	for ( int i = 0; i < numfaces; i++ )
+	{
+		facelight_t *fl = &facelight[i];
+
+		// the pointers only say which arrays follow
+		file.WriteValue( g_pFaces[i] );
+		file.WriteValue( *fl );
+		if ( fl->sample )
+		{
+			file.Write( fl->sample, fl->numsamples * sizeof( sample_t ) );
+		}
+		for ( int j = 0; j < MAXLIGHTMAPS; j++ )
+		{
+			for ( int n = 0; n < NUM_BUMP_VECTS+1; n++ )
+			{
+				if ( fl->light[j][n] )
+				{
+					file.Write( fl->light[j][n], fl->numsamples * sizeof( LightingValue_t ) );
+				}
+			}
+		}
+		if ( fl->luxel )
+		{
+			file.Write( fl->luxel, fl->numluxels * sizeof( Vector ) );
+		}
+		if ( fl->luxelNormals )
+		{
+			file.Write( fl->luxelNormals, fl->numluxels * sizeof( Vector ) );
+		}
+	}
+
+	int nPatches = g_Patches.Count();
+	file.WriteValue( nPatches );
+	for ( int i = 0; i < nPatches; i++ )
+	{
+		const CPatch &patch = g_Patches[i];
+		CheckpointPatchLight_t light;
+		light.m_TotalLight = patch.totallight;
+		light.m_DirectLight = patch.directlight;
+		light.m_SampleLight = patch.samplelight;
+		light.m_flSampleArea = patch.samplearea;
+		file.WriteValue( light );
+	}
+
+	file.Close();
+}
+
+
+void Checkpoint_LoadDirectLighting()
+{
+	CCheckpointFile file;
+	if ( !file.OpenRead( CHECKPOINT_DIRECT_LIGHTING ) )
+		Error( "Lost the direct lighting checkpoint while resuming" );
+
+	int nFaces;
+	file.ReadValue( nFaces );
+	if ( nFaces != numfaces )
+		Error( "The direct lighting checkpoint has %d faces, the bsp %d", nFaces, numfaces );
+
+	for ( int i = 0; i < numfaces; i++ )
+	{
+		facelight_t *fl = &facelight[i];
+
+		file.ReadValue( g_pFaces[i] );
+		file.ReadValue( *fl );
+
+		if ( fl->sample )
+		{
+			fl->sample = (sample_t *)calloc( fl->numsamples, sizeof( sample_t ) );
+			file.Read( fl->sample, fl->numsamples * sizeof( sample_t ) );
+			for ( int j = 0; j < fl->numsamples; j++ )
+			{
+				// the windings were freed once the face was lit, -dump can't resume
+				fl->sample[j].w = NULL;
+			}
+		}
+
+		for ( int j = 0; j < MAXLIGHTMAPS; j++ )
+		{
+			for ( int n = 0; n < NUM_BUMP_VECTS+1; n++ )
+			{
+				if ( fl->light[j][n] )
+				{
+					fl->light[j][n] = (LightingValue_t *)calloc( fl->numsamples, sizeof( LightingValue_t ) );
+					file.Read( fl->light[j][n], fl->numsamples * sizeof( LightingValue_t ) );
+				}
+			}
+		}
+		if ( fl->luxel )
+		{
+			fl->luxel = (Vector *)calloc( fl->numluxels, sizeof( Vector ) );
+			file.Read( fl->luxel, fl->numluxels * sizeof( Vector ) );
+		}
+		if ( fl->luxelNormals )
+		{
+			fl->luxelNormals = (Vector *)calloc( fl->numluxels, sizeof( Vector ) );
+			file.Read( fl->luxelNormals, fl->numluxels * sizeof( Vector ) );
+		}
+	}
+
+	int nPatches;
+	file.ReadValue( nPatches );
+	if ( nPatches != g_Patches.Count() )
+		Error( "The direct lighting checkpoint has %d patches, this compile %d", nPatches, g_Patches.Count() );
+
+	for ( int i = 0; i < nPatches; i++ )
+	{
+		CPatch &patch = g_Patches[i];
+		CheckpointPatchLight_t light;
+		file.ReadValue( light );
+		patch.totallight = light.m_TotalLight;
+		patch.directlight = light.m_DirectLight;
+		patch.samplelight = light.m_SampleLight;
+		patch.samplearea = light.m_flSampleArea;
+	}
+
+	file.Close();
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: The light the patches send out next and what they took in so far
+//-----------------------------------------------------------------------------
+void Checkpoint_SaveBounce( int nBounces, bool bDone )
+{
+	if ( !g_bCheckpoint )
+		return;
+
+	CCheckpointFile file;
+	if ( !file.OpenWrite( CHECKPOINT_BOUNCE ) )
+		return;
+
+	int nPatches = g_Patches.Count();
+	file.WriteValue( nBounces );
+	file.WriteValue( (int)bDone );
+	file.WriteValue( nPatches );
+	file.Write( emitlight.Base(), nPatches * sizeof( Vector ) );
+	for ( int i = 0; i < nPatches; i++ )
+	{
+		file.WriteValue( g_Patches[i].totallight );
+	}
+
+	if ( file.Close() )
+	{
+		qprintf( "\tSaved bounce #%i\n", nBounces );
+	}
+}
+
+
+void Checkpoint_LoadBounce( int &nBounces, bool &bDone )
+{
+	CCheckpointFile file;
+	if ( !file.OpenRead( CHECKPOINT_BOUNCE ) )
+		Error( "Lost the bounce checkpoint while resuming" );
+
+	int nDone, nPatches;
+	file.ReadValue( nBounces );
+	file.ReadValue( nDone );
+	file.ReadValue( nPatches );
+	if ( nPatches != g_Patches.Count() || nPatches != emitlight.Count() )
+		Error( "The bounce checkpoint has %d patches, this compile %d", nPatches, g_Patches.Count() );
+
+	file.Read( emitlight.Base(), nPatches * sizeof( Vector ) );
+	for ( int i = 0; i < nPatches; i++ )
+	{
+		file.ReadValue( g_Patches[i].totallight );
+	}
+	bDone = ( nDone != 0 );
+
+	file.Close();
+
+	Msg( "%d bounce(s) already done%s\n", nBounces, bDone ? ", that's all of them" : "" );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: The faces and lightmaps FinalLightFace makes. Nothing before it is
+//			needed after that, so the earlier checkpoints go.
+//-----------------------------------------------------------------------------
+void Checkpoint_SaveFinalLight()
+{
+	if ( !g_bCheckpoint )
+		return;
+
+	CCheckpointFile file;
+	if ( !file.OpenWrite( CHECKPOINT_FINAL_LIGHT ) )
+		return;
+
+	file.WriteValue( numfaces );
+	file.Write( g_pFaces, numfaces * sizeof( dface_t ) );
+
+	int nLightData = pdlightdata->Count();
+	file.WriteValue( nLightData );
+	file.Write( pdlightdata->Base(), nLightData );
+
+	if ( file.Close() )
+	{
+		char szFileName[MAX_PATH];
+		GetCheckpointFileName( CHECKPOINT_DIRECT_LIGHTING, szFileName, sizeof( szFileName ) );
+		remove( szFileName );
+		GetCheckpointFileName( CHECKPOINT_BOUNCE, szFileName, sizeof( szFileName ) );
+		remove( szFileName );
+	}
+}
+
+
+void Checkpoint_LoadFinalLight()
+{
+	CCheckpointFile file;
+	if ( !file.OpenRead( CHECKPOINT_FINAL_LIGHT ) )
+		Error( "Lost the final light checkpoint while resuming" );
+
+	int nFaces;
+	file.ReadValue( nFaces );
+	if ( nFaces != numfaces )
+		Error( "The final light checkpoint has %d faces, the bsp %d", nFaces, numfaces );
+	file.Read( g_pFaces, numfaces * sizeof( dface_t ) );
+
+	int nLightData;
+	file.ReadValue( nLightData );
+	pdlightdata->SetSize( nLightData );
+	file.Read( pdlightdata->Base(), nLightData );
+
+	file.Close();
+}
+
+
+void Checkpoint_Finish()
+{
+	if ( !g_bCheckpoint )
+		return;
+
+	for ( int i = CHECKPOINT_NONE + 1; i < CHECKPOINT_STAGE_COUNT; i++ )
+	{
+		char szFileName[MAX_PATH];
+		GetCheckpointFileName( (CheckpointStage_t)i, szFileName, sizeof( szFileName ) );
+		remove( szFileName );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// CCheckpointFile
+//-----------------------------------------------------------------------------
+CCheckpointFile::CCheckpointFile()
+{
+	m_pFile = NULL;
+	m_bWriting = false;
+	m_bFailed = false;
+	m_szFileName[0] = 0;
+	m_szTempFileName[0] = 0;
+}
+
+CCheckpointFile::~CCheckpointFile()
+{
+	Close();
+}
+
+bool CCheckpointFile::OpenWrite( CheckpointStage_t stage )
+{
+	Close();
+	if ( !g_bCheckpoint )
+		return false;
+
+	GetCheckpointFileName( stage, m_szFileName, sizeof( m_szFileName ) );
+	V_snprintf( m_szTempFileName, sizeof( m_szTempFileName ), "%s.tmp", m_szFileName );
+
+	m_pFile = fopen( m_szTempFileName, "wb" );
+	if ( !m_pFile )
+	{
+		Warning( "Can't write the %s checkpoint to %s, turning -checkpoint off.\n", s_pStageNames[stage], m_szTempFileName );
+		g_bCheckpoint = false;
+		return false;
+	}
+
+	m_bWriting = true;
+	m_bFailed = false;
+
+	CheckpointHeader_t header;
+	memset( &header, 0, sizeof( header ) );
+	header.m_nIdent = CHECKPOINT_IDENT;
+	header.m_nVersion = CHECKPOINT_VERSION;
+	header.m_nStage = stage;
+	header.m_Key = s_Key;
+	WriteValue( header );
+	return true;
+}
+
+bool CCheckpointFile::OpenRead( CheckpointStage_t stage )
+{
+	Close();
+	if ( !g_bResume )
+		return false;
+
+	GetCheckpointFileName( stage, m_szFileName, sizeof( m_szFileName ) );
+	m_pFile = fopen( m_szFileName, "rb" );
+	if ( !m_pFile )
+		return false;
+
+	m_bWriting = false;
+	m_bFailed = false;
+
+	CheckpointHeader_t header;
+	if ( fread( &header, sizeof( header ), 1, m_pFile ) != 1 ||
+		 header.m_nIdent != CHECKPOINT_IDENT || header.m_nVersion != CHECKPOINT_VERSION || header.m_nStage != stage )
+	{
+		Warning( "%s isn't a vrad checkpoint of this version, ignoring it.\n", m_szFileName );
+		Close();
+		return false;
+	}
+
+	if ( memcmp( &header.m_Key, &s_Key, sizeof( s_Key ) ) )
+	{
+		Warning( "%s is from another bsp or different options, ignoring it.\n", m_szFileName );
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void CCheckpointFile::Write( const void *pData, size_t nBytes )
+{
+	Assert( m_pFile && m_bWriting );
+	if ( m_bFailed || !nBytes )
+		return;
+
+	if ( fwrite( pData, nBytes, 1, m_pFile ) != 1 )
+	{
+		m_bFailed = true;
+	}
+}
+
+void CCheckpointFile::Read( void *pData, size_t nBytes )
+{
+	Assert( m_pFile && !m_bWriting );
+	if ( !nBytes )
+		return;
+
+	if ( fread( pData, nBytes, 1, m_pFile ) != 1 )
+		Error( "%s is cut short. Delete it and run again.", m_szFileName );
+}
+
+bool CCheckpointFile::Close()
+{
+	if ( !m_pFile )
+		return true;
+
+	if ( fclose( m_pFile ) != 0 )
+	{
+		m_bFailed = true;
+	}
+	m_pFile = NULL;
+
+	if ( !m_bWriting )
+		return true;
+
+	m_bWriting = false;
+
+	// replace the old checkpoint in one step, so a crash leaves either the old or the new one
+#ifdef _WIN32
+	if ( m_bFailed || !MoveFileEx( m_szTempFileName, m_szFileName, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH ) )
+#else
+	if ( m_bFailed || rename( m_szTempFileName, m_szFileName ) != 0 )
+#endif
+	{
+		Warning( "Can't write the checkpoint %s (out of disk space?), turning -checkpoint off.\n", m_szFileName );
+		remove( m_szTempFileName );
+		g_bCheckpoint = false;
+		return false;
+	}
+
+	return true;
+}
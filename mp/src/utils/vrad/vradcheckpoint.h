@@ -0,0 +1,91 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Saves the results of the long lighting phases next to the bsp
+//			("-checkpoint") so a compile that dies can pick up after the last
+//			phase it finished ("-resume").
+//
+//=============================================================================//
+
+#ifndef VRADCHECKPOINT_H
+#define VRADCHECKPOINT_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include <stdio.h>
+
+
+// The phases a compile can be resumed after, in the order they run
+enum CheckpointStage_t
+{
+	CHECKPOINT_NONE = 0,
+	CHECKPOINT_DIRECT_LIGHTING,		// facelights and the direct light on the patches
+	CHECKPOINT_BOUNCE,				// patch light after the bounces done so far
+	CHECKPOINT_FINAL_LIGHT,			// the lightmaps, replaces the two above
+	CHECKPOINT_STATIC_PROPS,		// the static props lit so far
+
+	CHECKPOINT_STAGE_COUNT
+};
+
+extern bool g_bCheckpoint;		// -checkpoint, save as the phases finish
+extern bool g_bResume;			// -resume, load what a previous run saved (and keep saving)
+
+// Identifies the compile the checkpoints belong to by the unlit bsp and the
+// options. Call once the bsp is loaded and the patches are made.
+void Checkpoint_Init( int argc, char **argv );
+
+// The latest phase of RadWorld_Go that -resume can skip, CHECKPOINT_NONE when
+// it has to start over. Only looks at the stages up to CHECKPOINT_FINAL_LIGHT.
+CheckpointStage_t Checkpoint_GetResumeStage();
+
+void Checkpoint_SaveDirectLighting();
+void Checkpoint_LoadDirectLighting();
+
+// nBounces is how many bounces are done, bDone whether those were all of them
+void Checkpoint_SaveBounce( int nBounces, bool bDone );
+void Checkpoint_LoadBounce( int &nBounces, bool &bDone );
+
+void Checkpoint_SaveFinalLight();
+void Checkpoint_LoadFinalLight();
+
+// Deletes the checkpoints once the bsp is written
+void Checkpoint_Finish();
+
+
+//-----------------------------------------------------------------------------
+// One checkpoint file. Written to a temporary file that only replaces the
+// previous checkpoint of the stage once it is complete, so a crash while
+// saving leaves the last good one.
+//-----------------------------------------------------------------------------
+class CCheckpointFile
+{
+public:
+	CCheckpointFile();
+	~CCheckpointFile();
+
+	bool OpenWrite( CheckpointStage_t stage );
+
+	// Fails unless there's a checkpoint of this compile for the stage
+	bool OpenRead( CheckpointStage_t stage );
+
+	void Write( const void *pData, size_t nBytes );
+	// Error()s if the file is short, the state it was restoring is half loaded by then
+	void Read( void *pData, size_t nBytes );
+
+	template< class T > void WriteValue( const T &value )	{ Write( &value, sizeof( value ) ); }
+	template< class T > void ReadValue( T &value )			{ Read( &value, sizeof( value ) ); }
+
+	// Returns false if anything could not be written. The checkpoint is
+	// dropped then and -checkpoint is turned off for the rest of the compile.
+	bool Close();
+
+private:
+	FILE	*m_pFile;
+	bool	m_bWriting;
+	bool	m_bFailed;
+	char	m_szFileName[MAX_PATH];
+	char	m_szTempFileName[MAX_PATH];
+};
+
+
+#endif // VRADCHECKPOINT_H
@@ -616,6 +616,21 @@ void CalcRayAmbientLighting( int iThread, const Vector &vStart, const Vector &vE
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Adds the ambient lighting of a ray that is known to hit the sky, which is
+// what CalcRayAmbientLighting adds once it finds the sky surface.
+//-----------------------------------------------------------------------------
+void CalcSkyAmbientLighting( Vector color[MAX_LIGHTSTYLES] )
+{
+	directlight_t *pSkyLight = FindAmbientSkyLight();
+	if ( pSkyLight )
+	{
+		// add in sky ambient
+		Vector amb = pSkyLight->light.intensity / 255.0f; 
+		color[0] += amb;
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Compute ambient lighting component at specified position.
 //-----------------------------------------------------------------------------
@@ -26,6 +26,9 @@ void CalcRayAmbientLighting(
 	Vector color[MAX_LIGHTSTYLES]	// The color contribution from each lightstyle.
 	);
 
+// Same as CalcRayAmbientLighting for a ray that hits the sky.
+void CalcSkyAmbientLighting( Vector color[MAX_LIGHTSTYLES] );
+
 bool CastRayInLeaf( int iThread, const Vector &start, const Vector &end, int leafIndex, float *pFraction, Vector *pNormal );
 
 void ComputeDetailPropLighting( int iThread );
@@ -37,6 +37,8 @@
 #include "messbuf.h"
 #include "vmpi.h"
 #include "vmpi_distribute_work.h"
+#include "vmpi_local_distribute.h"
+#include "vradcheckpoint.h"
 
 
 #define ALIGN_TO_POW2(x,y) (((x)+(y-1))&~(y-1))
@@ -70,6 +72,27 @@ struct colorTexel_t
 
 };
 
+// a vertex or texel waiting to be lit, lit in batches once every prop has its samples
+struct propSample_t
+{
+	Vector		m_Position;
+	Vector		m_Normal;
+	Vector		*m_pColor;			// receives direct + indirect lighting
+	int			m_nSkipProp;
+	int			m_nFlags;			// GATHERLFLAGS_xxx
+	bool		m_bIndirect;
+	bool		m_bIgnoreNormals;	// for the indirect lighting
+};
+
+// samples lit by one thread in one go, all from the same prop
+#define STATIC_PROP_SAMPLES_PER_BATCH	64
+
+// props lit at once, only their samples and results are in memory at the same time
+#define STATIC_PROP_LIGHTING_WINDOW		256
+
+// with -checkpoint the lighting is saved this many times along the way
+#define STATIC_PROP_CHECKPOINT_GROUPS	10
+
 class CComputeStaticPropLightingResults
 {
 public:
@@ -81,6 +104,9 @@ public:
 	
 	CUtlVector< CUtlVector<colorVertex_t>* > m_ColorVertsArrays;
 	CUtlVector< CUtlVector<colorTexel_t>* > m_ColorTexelsArrays;
+
+	// Point into the arrays above
+	CUtlVector< propSample_t > m_Samples;
 };
 
 //-----------------------------------------------------------------------------
@@ -230,9 +256,10 @@ IPhysicsCollision *s_pPhysCollision = NULL;
 static void ConvertTexelDataToTexture(unsigned int _resX, unsigned int _resY, ImageFormat _destFmt, const CUtlVector<colorTexel_t>& _srcTexels, CUtlMemory<byte>* _outTexture);
 
 // Such a monstrosity. :(
-static void GenerateLightmapSamplesForMesh( const matrix3x4_t& _matPos, const matrix3x4_t& _matNormal, int _iThread, int _skipProp, int _nFlags, int _lightmapResX, int _lightmapResY, 
+static void GenerateLightmapSamplesForMesh( const matrix3x4_t& _matPos, const matrix3x4_t& _matNormal, int _lightmapResX, int _lightmapResY, 
 											studiohdr_t* _pStudioHdr, mstudiomodel_t* _pStudioModel, OptimizedModel::ModelHeader_t* _pVtxModel, int _meshID, 
 											CComputeStaticPropLightingResults *_pResults );
+static void AddLightmapSamples( int _skipProp, int _flags, int _lightmapResX, int _lightmapResY, CComputeStaticPropLightingResults *_pResults );
 
 // Debug function, converts lightmaps to linear space then dumps them out. 
 // TODO: Write out the file in a .dds instead of a .tga, in whatever format we're supposed to use.
@@ -264,9 +291,14 @@ private:
 	void VMPI_ProcessStaticProp( int iThread, int iStaticProp, MessageBuffer *pBuf );
 	void VMPI_ReceiveStaticPropResults( int iStaticProp, MessageBuffer *pBuf, int iWorker );
 	
-	// local thread version
-	static void ThreadComputeStaticPropLighting( int iThread, void *pUserData );
-	void ComputeLightingForProp( int iThread, int iStaticProp );
+	// local thread version, split in samples so big props are lit by every thread
+	static void ThreadGenerateStaticPropSamples( int iThread, void *pUserData );
+	static void ThreadLightStaticPropSamples( int iThread, void *pUserData );
+	static void ThreadApplyStaticPropLighting( int iThread, void *pUserData );
+
+	// -checkpoint/-resume, the vertex and texel lighting of the props lit so far
+	void SaveLightingCheckpoint( const CUtlVector<bool> &propLit );
+	int LoadLightingCheckpoint( CUtlVector<bool> &propLit );
 
 	// Methods associated with unserializing static props
 	void UnserializeModelDict( CUtlBuffer& buf );
@@ -345,7 +377,21 @@ private:
 
 	bool m_bIgnoreStaticPropTrace;
 
+	// The props being lit, the lighting results of each and the batches their samples are lit in.
+	// m_PropResults and SampleBatch_t::m_nProp index m_PropsToLight.
+	struct SampleBatch_t
+	{
+		int m_nProp;
+		int m_nFirstSample;
+		int m_nSamples;
+	};
+	CUtlVector<int>									m_PropsToLight;
+	CUtlVector<CComputeStaticPropLightingResults *>	m_PropResults;
+	CUtlVector<SampleBatch_t>						m_SampleBatches;
+
 	void ComputeLighting( CStaticProp &prop, int iThread, int prop_index, CComputeStaticPropLightingResults *pResults );
+	void GenerateLightingSamples( CStaticProp &prop, int prop_index, CComputeStaticPropLightingResults *pResults );
+	static void LightSamples( propSample_t *pSamples, int nSamples, int iThread );
 	void ApplyLightingToStaticProp( int iStaticProp, CStaticProp &prop, const CComputeStaticPropLightingResults *pResults );
 
 	void SerializeLighting();
@@ -1155,17 +1201,36 @@ bool PositionInSolid( Vector &position )
 }
 
 //-----------------------------------------------------------------------------
-// Trace from a vertex to each direct light source, accumulating its contribution.
+// Trace from up to 4 samples to each direct light source, accumulating its contribution.
+// The samples must skip the same prop and use the same flags, their rays are traced together.
 //-----------------------------------------------------------------------------
-void ComputeDirectLightingAtPoint( Vector &position, Vector &normal, Vector &outColor, int iThread,
-								   int static_prop_id_to_skip=-1, int nLFlags = 0)
+static void ComputeDirectLightingAtPoints( propSample_t * const *ppSamples, int nSamples, Vector *pOutColors, int iThread )
 {
+	Assert( nSamples > 0 && nSamples <= 4 );
+
 	SSE_sampleLightOutput_t	sampleOutput;
 
-	outColor.Init();
+	// unused lanes repeat the last sample
+	const propSample_t *pLanes[4];
+	int clusters[4];
+	for ( int i = 0; i < 4; i++ )
+	{
+		pLanes[i] = ppSamples[min( i, nSamples - 1 )];
+		clusters[i] = ClusterFromPoint( pLanes[i]->m_Position );
+	}
+
+	for ( int i = 0; i < nSamples; i++ )
+	{
+		pOutColors[i].Init();
+	}
+
+	FourVectors normal4;
+	normal4.LoadAndSwizzle( pLanes[0]->m_Normal, pLanes[1]->m_Normal, pLanes[2]->m_Normal, pLanes[3]->m_Normal );
+
+	const int nSkipProp = pLanes[0]->m_nSkipProp;
+	const int nLFlags = pLanes[0]->m_nFlags;
 
 	// Iterate over all direct lights and accumulate their contribution
-	int cluster = ClusterFromPoint( position );
 	for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
 	{
 		if ( dl->light.style )
@@ -1175,43 +1240,88 @@ void ComputeDirectLightingAtPoint( Vector &position, Vector &normal, Vector &out
 		}
 
 		// is this lights cluster visible?
-		if ( !PVSCheck( dl->pvs, cluster ) )
-			continue;
+		bool bVisible[4];
+		bool bAnyVisible = false;
+		for ( int i = 0; i < 4; i++ )
+		{
+			bVisible[i] = ( i < nSamples ) && PVSCheck( dl->pvs, clusters[i] );
+			bAnyVisible |= bVisible[i];
+		}
 
-		// push the vertex towards the light to avoid surface acne
-		Vector adjusted_pos = position;
-		float flEpsilon = 0.0;
+		if ( !bAnyVisible )
+			continue;
 
-		if  (dl->light.type != emit_skyambient)
+		// push the vertexes towards the light to avoid surface acne
+		Vector adjusted_pos[4];
+		for ( int i = 0; i < 4; i++ )
 		{
-			// push towards the light
-			Vector fudge;
-			if ( dl->light.type == emit_skylight )
-				fudge = -( dl->light.normal);
+			const Vector &position = pLanes[i]->m_Position;
+			if ( dl->light.type != emit_skyambient )
+			{
+				Vector fudge;
+				if ( dl->light.type == emit_skylight )
+					fudge = -( dl->light.normal );
+				else
+				{
+					fudge = dl->light.origin - position;
+					VectorNormalize( fudge );
+				}
+				adjusted_pos[i] = position + fudge * 4.0;
+			}
 			else
 			{
-				fudge = dl->light.origin-position;
-				VectorNormalize( fudge );
+				// push out along normal
+				adjusted_pos[i] = position + 4.0 * pLanes[i]->m_Normal;
 			}
-			fudge *= 4.0;
-			adjusted_pos += fudge;
-		}
-		else 
-		{
-			// push out along normal
-			adjusted_pos += 4.0 * normal;
-//			flEpsilon = 1.0;
 		}
 
 		FourVectors adjusted_pos4;
-		FourVectors normal4;
-		adjusted_pos4.DuplicateVector( adjusted_pos );
-		normal4.DuplicateVector( normal );
+		adjusted_pos4.LoadAndSwizzle( adjusted_pos[0], adjusted_pos[1], adjusted_pos[2], adjusted_pos[3] );
 
 		GatherSampleLightSSE( sampleOutput, dl, -1, adjusted_pos4, &normal4, 1, iThread, nLFlags | GATHERLFLAGS_FORCE_FAST,
-		                      static_prop_id_to_skip, flEpsilon );
-		
-		VectorMA( outColor, sampleOutput.m_flFalloff.m128_f32[0] * sampleOutput.m_flDot[0].m128_f32[0], dl->light.intensity, outColor );
+		                      nSkipProp, 0.0f );
+
+		for ( int i = 0; i < nSamples; i++ )
+		{
+			if ( bVisible[i] )
+			{
+				VectorMA( pOutColors[i], SubFloat( sampleOutput.m_flFalloff, i ) * SubFloat( sampleOutput.m_flDot[0], i ), dl->light.intensity, pOutColors[i] );
+			}
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Lights samples, 4 at a time when they go together
+//-----------------------------------------------------------------------------
+void CVradStaticPropMgr::LightSamples( propSample_t *pSamples, int nSamples, int iThread )
+{
+	int nSample = 0;
+	while ( nSample < nSamples )
+	{
+		propSample_t *pPacket[4];
+		int nPacket = 0;
+		do
+		{
+			pPacket[nPacket++] = &pSamples[nSample++];
+		}
+		while ( nPacket < 4 && nSample < nSamples &&
+				pSamples[nSample].m_nSkipProp == pPacket[0]->m_nSkipProp &&
+				pSamples[nSample].m_nFlags == pPacket[0]->m_nFlags );
+
+		Vector directColors[4];
+		ComputeDirectLightingAtPoints( pPacket, nPacket, directColors, iThread );
+
+		for ( int i = 0; i < nPacket; i++ )
+		{
+			propSample_t *pSample = pPacket[i];
+			Vector indirectColor( 0, 0, 0 );
+			if ( pSample->m_bIndirect )
+			{
+				ComputeIndirectLightingAtPoint( pSample->m_Position, pSample->m_Normal, indirectColor, iThread, true, pSample->m_bIgnoreNormals );
+			}
+			VectorAdd( directColors[i], indirectColor, *pSample->m_pColor );
+		}
 	}
 }
 
@@ -1317,6 +1427,19 @@ void CVradStaticPropMgr::ApplyLightingToStaticProp( int iStaticProp, CStaticProp
 // into the rendering layout.
 //-----------------------------------------------------------------------------
 void CVradStaticPropMgr::ComputeLighting( CStaticProp &prop, int iThread, int prop_index, CComputeStaticPropLightingResults *pResults )
+{
+	GenerateLightingSamples( prop, prop_index, pResults );
+
+	VMPI_SetCurrentStage( "ComputeLighting" );
+	LightSamples( pResults->m_Samples.Base(), pResults->m_Samples.Count(), iThread );
+	pResults->m_Samples.Purge();
+}
+
+//-----------------------------------------------------------------------------
+// Fills in the positions of the unique vertexes and lightmap texels of a prop,
+// and lists the ones to light as samples.
+//-----------------------------------------------------------------------------
+void CVradStaticPropMgr::GenerateLightingSamples( CStaticProp &prop, int prop_index, CComputeStaticPropLightingResults *pResults )
 {
 	CUtlVector<badVertex_t>		badVerts;
 
@@ -1339,8 +1462,6 @@ void CVradStaticPropMgr::ComputeLighting( CStaticProp &prop, int iThread, int pr
 	const int skip_prop = (g_bDisablePropSelfShadowing || (prop.m_Flags & STATIC_PROP_NO_SELF_SHADOWING)) ? prop_index : -1;
 	const int nFlags = ( prop.m_Flags & STATIC_PROP_IGNORE_NORMALS ) ? GATHERLFLAGS_IGNORE_NORMALS : 0;
 
-	VMPI_SetCurrentStage( "ComputeLighting" );
-
 	matrix3x4_t	matPos, matNormal;
 	AngleMatrix(prop.m_Angles, prop.m_Origin, matPos);
 	AngleMatrix(prop.m_Angles, matNormal);
@@ -1380,7 +1501,7 @@ void CVradStaticPropMgr::ComputeLighting( CStaticProp &prop, int iThread, int pr
 				// TODO: Move this into its own function. In fact, refactor this whole function.
 				if (withTexelLighting)
 				{
-					GenerateLightmapSamplesForMesh( matPos, matNormal, iThread, skip_prop, nFlags, prop.m_LightmapImageWidth, prop.m_LightmapImageHeight, pStudioHdr, pStudioModel, pVtxModel, meshID, pResults );
+					GenerateLightmapSamplesForMesh( matPos, matNormal, prop.m_LightmapImageWidth, prop.m_LightmapImageHeight, pStudioHdr, pStudioModel, pVtxModel, meshID, pResults );
 				}
 
 				// If we do lightmapping, we also do vertex lighting as a potential fallback. This may change.
@@ -1403,39 +1524,37 @@ void CVradStaticPropMgr::ComputeLighting( CStaticProp &prop, int iThread, int pr
 					}
 					else
 					{
-						Vector direct_pos=samplePosition;
-							
-						
-
-						Vector directColor(0,0,0);
-						ComputeDirectLightingAtPoint( direct_pos,
-														sampleNormal, directColor, iThread,
-														skip_prop, nFlags );
-						Vector indirectColor(0,0,0);
+						colorVerts[numVertexes].m_bValid = true;
+						colorVerts[numVertexes].m_Position = samplePosition;
 
 						if (g_bShowStaticPropNormals)
 						{
-							directColor= sampleNormal;
-							directColor += Vector(1.0,1.0,1.0);
-							directColor *= 50.0;
+							colorVerts[numVertexes].m_Color = sampleNormal;
+							colorVerts[numVertexes].m_Color += Vector(1.0,1.0,1.0);
+							colorVerts[numVertexes].m_Color *= 50.0;
 						}
 						else
 						{
-							if (numbounce >= 1)
-								ComputeIndirectLightingAtPoint( 
-									samplePosition, sampleNormal, 
-									indirectColor, iThread, true,
-									( prop.m_Flags & STATIC_PROP_IGNORE_NORMALS) != 0 );
+							propSample_t &sample = pResults->m_Samples[pResults->m_Samples.AddToTail()];
+							sample.m_Position = samplePosition;
+							sample.m_Normal = sampleNormal;
+							sample.m_pColor = &colorVerts[numVertexes].m_Color;
+							sample.m_nSkipProp = skip_prop;
+							sample.m_nFlags = nFlags;
+							sample.m_bIndirect = numbounce >= 1;
+							sample.m_bIgnoreNormals = ( prop.m_Flags & STATIC_PROP_IGNORE_NORMALS ) != 0;
 						}
-						
-						colorVerts[numVertexes].m_bValid = true;
-						colorVerts[numVertexes].m_Position = samplePosition;
-						VectorAdd( directColor, indirectColor, colorVerts[numVertexes].m_Color );
 					}
 					
 					numVertexes++;
 				}
 			}
+
+			// the texels that ended up rasterized
+			if (withTexelLighting)
+			{
+				AddLightmapSamples( skip_prop, nFlags, prop.m_LightmapImageWidth, prop.m_LightmapImageHeight, pResults );
+			}
 			
 			// color in the bad vertexes
 			// when entire model has no lighting origin and no valid neighbors
@@ -1490,17 +1609,18 @@ void CVradStaticPropMgr::ComputeLighting( CStaticProp &prop, int iThread, int pr
 					}
 
 					// re-light from better position
-					Vector directColor;
-					ComputeDirectLightingAtPoint( bestPosition, badVerts[nBadVertex].m_Normal, directColor, iThread );
-
-					Vector indirectColor;
-					ComputeIndirectLightingAtPoint( bestPosition, badVerts[nBadVertex].m_Normal,
-													indirectColor, iThread, true );
+					propSample_t &sample = pResults->m_Samples[pResults->m_Samples.AddToTail()];
+					sample.m_Position = bestPosition;
+					sample.m_Normal = badVerts[nBadVertex].m_Normal;
+					sample.m_pColor = &colorVerts[badVerts[nBadVertex].m_ColorVertex].m_Color;
+					sample.m_nSkipProp = -1;
+					sample.m_nFlags = 0;
+					sample.m_bIndirect = true;
+					sample.m_bIgnoreNormals = false;
 
 					// save results, not changing valid status
 					// to ensure this offset position is not considered as a viable candidate
 					colorVerts[badVerts[nBadVertex].m_ColorVertex].m_Position = bestPosition;
-					VectorAdd( directColor, indirectColor, colorVerts[badVerts[nBadVertex].m_ColorVertex].m_Color );
 				}
 			}
 			
@@ -1751,23 +1871,45 @@ void CVradStaticPropMgr::VMPI_ReceiveStaticPropResults( int iStaticProp, Message
 }
 
 
-void CVradStaticPropMgr::ComputeLightingForProp( int iThread, int iStaticProp )
+void CVradStaticPropMgr::ThreadGenerateStaticPropSamples( int iThread, void *pUserData )
 {
-	// Compute the lighting.
-	CComputeStaticPropLightingResults results;
-	ComputeLighting( m_StaticProps[iStaticProp], iThread, iStaticProp, &results );
-	ApplyLightingToStaticProp( iStaticProp, m_StaticProps[iStaticProp], &results );
+	while (1)
+	{
+		int j = GetThreadWork ();
+		if (j == -1)
+			break;
+		int iStaticProp = g_StaticPropMgr.m_PropsToLight[j];
+		g_StaticPropMgr.GenerateLightingSamples( g_StaticPropMgr.m_StaticProps[iStaticProp], iStaticProp, g_StaticPropMgr.m_PropResults[j] );
+	}
+}
+
+void CVradStaticPropMgr::ThreadLightStaticPropSamples( int iThread, void *pUserData )
+{
+	while (1)
+	{
+		int j = GetThreadWork ();
+		if (j == -1)
+			break;
+		const SampleBatch_t &batch = g_StaticPropMgr.m_SampleBatches[j];
+		CComputeStaticPropLightingResults *pResults = g_StaticPropMgr.m_PropResults[batch.m_nProp];
+		LightSamples( &pResults->m_Samples[batch.m_nFirstSample], batch.m_nSamples, iThread );
+	}
 }
 
-void CVradStaticPropMgr::ThreadComputeStaticPropLighting( int iThread, void *pUserData )
+void CVradStaticPropMgr::ThreadApplyStaticPropLighting( int iThread, void *pUserData )
 {
 	while (1)
 	{
 		int j = GetThreadWork ();
 		if (j == -1)
 			break;
-		CComputeStaticPropLightingResults results;
-		g_StaticPropMgr.ComputeLightingForProp( iThread, j );
+		int iStaticProp = g_StaticPropMgr.m_PropsToLight[j];
+		CComputeStaticPropLightingResults *pResults = g_StaticPropMgr.m_PropResults[j];
+		g_StaticPropMgr.ApplyLightingToStaticProp( iStaticProp, g_StaticPropMgr.m_StaticProps[iStaticProp], pResults );
+
+		// done with it, the props keep the encoded results
+		delete pResults;
+		g_StaticPropMgr.m_PropResults[j] = NULL;
 	}
 }
 
@@ -1790,6 +1932,8 @@ void CVradStaticPropMgr::ComputeLighting( int iThread )
 	// ensure any traces against us are ignored because we have no inherit lighting contribution
 	m_bIgnoreStaticPropTrace = true;
 
+	char szTimings[256] = "";
+
 	if ( g_bUseMPI )
 	{
 		// Distribute the work among the workers.
@@ -1801,9 +1945,99 @@ void CVradStaticPropMgr::ComputeLighting( int iThread )
 			&CVradStaticPropMgr::VMPI_ProcessStaticProp_Static, 
 			&CVradStaticPropMgr::VMPI_ReceiveStaticPropResults_Static );
 	}
+	else if ( LocalWorkersEnabled() )
+	{
+		LocalDistributeWork( 
+			count, 
+			false,
+			&CVradStaticPropMgr::VMPI_ProcessStaticProp_Static, 
+			&CVradStaticPropMgr::VMPI_ReceiveStaticPropResults_Static );
+	}
 	else
 	{
-		RunThreadsOn(count, true, ThreadComputeStaticPropLighting);
+		// Every vertex and texel of every prop is a sample, lit in small batches so a few huge props
+		// don't leave the other threads idle, and 4 at a time so their rays are traced together
+		CUtlVector<bool> propLit;
+		int nLit = LoadLightingCheckpoint( propLit );
+
+		CUtlVector<int> remaining;
+		for ( int i = 0; i < count; i++ )
+		{
+			if ( !propLit[i] )
+			{
+				remaining.AddToTail( i );
+			}
+		}
+
+		// The props are lit a window at a time, with -checkpoint a crash only loses what was lit since the last save
+		int nCheckpointProps = MAX( 1, ( count + STATIC_PROP_CHECKPOINT_GROUPS - 1 ) / STATIC_PROP_CHECKPOINT_GROUPS );
+		int nUnsavedProps = 0;
+
+		int nSamples = 0;
+		int nBatches = 0;
+		double flSamplesTime = 0.0, flLightTime = 0.0, flApplyTime = 0.0;
+		for ( int nFirstProp = 0; nFirstProp < remaining.Count(); nFirstProp += STATIC_PROP_LIGHTING_WINDOW )
+		{
+			double flStartTime = Plat_FloatTime();
+
+			int nGroupProps = MIN( STATIC_PROP_LIGHTING_WINDOW, remaining.Count() - nFirstProp );
+			m_PropsToLight.CopyArray( &remaining[nFirstProp], nGroupProps );
+			m_PropResults.SetCount( nGroupProps );
+			for ( int i = 0; i < nGroupProps; i++ )
+			{
+				m_PropResults[i] = new CComputeStaticPropLightingResults;
+			}
+			RunThreadsOn( nGroupProps, false, ThreadGenerateStaticPropSamples );
+
+			m_SampleBatches.RemoveAll();
+			for ( int i = 0; i < nGroupProps; i++ )
+			{
+				int nPropSamples = m_PropResults[i]->m_Samples.Count();
+				for ( int nFirst = 0; nFirst < nPropSamples; nFirst += STATIC_PROP_SAMPLES_PER_BATCH )
+				{
+					SampleBatch_t &batch = m_SampleBatches[m_SampleBatches.AddToTail()];
+					batch.m_nProp = i;
+					batch.m_nFirstSample = nFirst;
+					batch.m_nSamples = min( STATIC_PROP_SAMPLES_PER_BATCH, nPropSamples - nFirst );
+				}
+				nSamples += nPropSamples;
+			}
+			nBatches += m_SampleBatches.Count();
+
+			double flGeneratedTime = Plat_FloatTime();
+			RunThreadsOn( m_SampleBatches.Count(), false, ThreadLightStaticPropSamples );
+
+			double flLitTime = Plat_FloatTime();
+			RunThreadsOn( nGroupProps, false, ThreadApplyStaticPropLighting );
+
+			double flEndTime = Plat_FloatTime();
+			flSamplesTime += flGeneratedTime - flStartTime;
+			flLightTime += flLitTime - flGeneratedTime;
+			flApplyTime += flEndTime - flLitTime;
+
+			for ( int i = 0; i < nGroupProps; i++ )
+			{
+				propLit[m_PropsToLight[i]] = true;
+			}
+
+			nUnsavedProps += nGroupProps;
+			if ( nUnsavedProps >= nCheckpointProps || nFirstProp + nGroupProps == remaining.Count() )
+			{
+				SaveLightingCheckpoint( propLit );
+				nUnsavedProps = 0;
+			}
+
+			UpdatePacifier( (float)( nFirstProp + nGroupProps ) / remaining.Count() );
+		}
+
+		V_snprintf( szTimings, sizeof( szTimings ), "Static prop lighting: %d samples in %d batches, %d props from the checkpoint\n"
+			"  samples %.2fs, lighting %.2fs, applying %.2fs\n",
+			nSamples, nBatches, nLit,
+			flSamplesTime, flLightTime, flApplyTime );
+
+		m_PropsToLight.Purge();
+		m_PropResults.Purge();
+		m_SampleBatches.Purge();
 	}
 
 	// restore default
@@ -1813,6 +2047,99 @@ void CVradStaticPropMgr::ComputeLighting( int iThread )
 	SerializeLighting();
 
 	EndPacifier( true );
+
+	if ( szTimings[0] )
+		qprintf( "%s", szTimings );
+}
+
+//-----------------------------------------------------------------------------
+// Saves the lighting of the props lit so far for -resume
+//-----------------------------------------------------------------------------
+void CVradStaticPropMgr::SaveLightingCheckpoint( const CUtlVector<bool> &propLit )
+{
+	if ( !g_bCheckpoint )
+		return;
+
+	CCheckpointFile file;
+	if ( !file.OpenWrite( CHECKPOINT_STATIC_PROPS ) )
+		return;
+
+	int count = m_StaticProps.Count();
+	file.WriteValue( count );
+	for ( int i = 0; i < count; i++ )
+	{
+		const CStaticProp &prop = m_StaticProps[i];
+		int nMeshes = propLit[i] ? prop.m_MeshData.Count() : -1;
+		file.WriteValue( nMeshes );
+		for ( int j = 0; j < nMeshes; j++ )
+		{
+			const MeshData_t &mesh = prop.m_MeshData[j];
+			int nVertexes = mesh.m_VertexColors.Count();
+			int nTexelBytes = mesh.m_TexelsEncoded.Count();
+			file.WriteValue( mesh.m_nLod );
+			file.WriteValue( nVertexes );
+			file.Write( mesh.m_VertexColors.Base(), nVertexes * sizeof( Vector ) );
+			file.WriteValue( nTexelBytes );
+			file.Write( mesh.m_TexelsEncoded.Base(), nTexelBytes );
+		}
+	}
+
+	file.Close();
+}
+
+
+//-----------------------------------------------------------------------------
+// Restores the props a previous run saved with -checkpoint. Returns how many.
+//-----------------------------------------------------------------------------
+int CVradStaticPropMgr::LoadLightingCheckpoint( CUtlVector<bool> &propLit )
+{
+	int count = m_StaticProps.Count();
+	propLit.SetCount( count );
+	for ( int i = 0; i < count; i++ )
+	{
+		propLit[i] = false;
+	}
+
+	CCheckpointFile file;
+	if ( !file.OpenRead( CHECKPOINT_STATIC_PROPS ) )
+		return 0;
+
+	int nSavedProps;
+	file.ReadValue( nSavedProps );
+	if ( nSavedProps != count )
+		Error( "The static prop checkpoint has %d props, the bsp %d", nSavedProps, count );
+
+	int nLit = 0;
+	for ( int i = 0; i < count; i++ )
+	{
+		int nMeshes;
+		file.ReadValue( nMeshes );
+		if ( nMeshes < 0 )
+			continue;
+
+		CStaticProp &prop = m_StaticProps[i];
+		prop.m_MeshData.SetCount( nMeshes );
+		for ( int j = 0; j < nMeshes; j++ )
+		{
+			MeshData_t &mesh = prop.m_MeshData[j];
+			int nVertexes, nTexelBytes;
+			file.ReadValue( mesh.m_nLod );
+			file.ReadValue( nVertexes );
+			mesh.m_VertexColors.SetCount( nVertexes );
+			file.Read( mesh.m_VertexColors.Base(), nVertexes * sizeof( Vector ) );
+			file.ReadValue( nTexelBytes );
+			mesh.m_TexelsEncoded.EnsureCapacity( nTexelBytes );
+			file.Read( mesh.m_TexelsEncoded.Base(), nTexelBytes );
+		}
+
+		propLit[i] = true;
+		nLit++;
+	}
+
+	file.Close();
+
+	Msg( "%d of %d static props lit from the checkpoint\n", nLit, count );
+	return nLit;
 }
 
 //-----------------------------------------------------------------------------
@@ -2284,7 +2611,7 @@ inline float ComputeBarycentricDistanceToTri( Vector _barycentricCoord, Vector2D
 }
 
 // ------------------------------------------------------------------------------------------------
-static void GenerateLightmapSamplesForMesh( const matrix3x4_t& _matPos, const matrix3x4_t& _matNormal, int _iThread, int _skipProp, int _flags, int _lightmapResX, int _lightmapResY, studiohdr_t* _pStudioHdr, mstudiomodel_t* _pStudioModel, OptimizedModel::ModelHeader_t* _pVtxModel, int _meshID, CComputeStaticPropLightingResults *_outResults )
+static void GenerateLightmapSamplesForMesh( const matrix3x4_t& _matPos, const matrix3x4_t& _matNormal, int _lightmapResX, int _lightmapResY, studiohdr_t* _pStudioHdr, mstudiomodel_t* _pStudioModel, OptimizedModel::ModelHeader_t* _pVtxModel, int _meshID, CComputeStaticPropLightingResults *_outResults )
 {
 	// Could iterate and gen this if needed.
 	int nLod = 0;
@@ -2402,6 +2729,17 @@ static void GenerateLightmapSamplesForMesh( const matrix3x4_t& _matPos, const ma
 			}
 		}
 	}
+}
+
+// ------------------------------------------------------------------------------------------------
+static void AddLightmapSamples( int _skipProp, int _flags, int _lightmapResX, int _lightmapResY, CComputeStaticPropLightingResults *_outResults )
+{
+	CUtlVector<colorTexel_t> &colorTexels = (*_outResults->m_ColorTexelsArrays.Tail());
+	if ( colorTexels.Count() == 0 )
+	{
+		// no mesh was rasterized
+		return;
+	}
 
 	// Process neighbors to the valid region. Walk through the existing array, look for samples that
 	// are not valid but are adjacent to valid samples. Works if we are only bilinearly sampling
@@ -2433,17 +2771,14 @@ static void GenerateLightmapSamplesForMesh( const matrix3x4_t& _matPos, const ma
 
 			if (shouldProcess)
 			{
-				Vector directColor(0, 0, 0),
-					   indirectColor(0, 0, 0);
-
-
-				ComputeDirectLightingAtPoint( colorTexels[linearPos].m_WorldPosition, colorTexels[linearPos].m_WorldNormal, directColor, _iThread, _skipProp, _flags);
-
-				if (numbounce >= 1) {
-					ComputeIndirectLightingAtPoint( colorTexels[linearPos].m_WorldPosition, colorTexels[linearPos].m_WorldNormal, indirectColor, _iThread, true, (_flags & GATHERLFLAGS_IGNORE_NORMALS) != 0 );
-				}
-
-				VectorAdd(directColor, indirectColor, colorTexels[linearPos].m_Color);
+				propSample_t &sample = _outResults->m_Samples[_outResults->m_Samples.AddToTail()];
+				sample.m_Position = colorTexels[linearPos].m_WorldPosition;
+				sample.m_Normal = colorTexels[linearPos].m_WorldNormal;
+				sample.m_pColor = &colorTexels[linearPos].m_Color;
+				sample.m_nSkipProp = _skipProp;
+				sample.m_nFlags = _flags;
+				sample.m_bIndirect = numbounce >= 1;
+				sample.m_bIgnoreNormals = (_flags & GATHERLFLAGS_IGNORE_NORMALS) != 0;
 			}
 
 			++linearPos;
@@ -0,0 +1,461 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Keeps the portal visibility of the last compile in <map>.vvc and
+//			reuses it for the portals the map changes didn't reach.
+//
+//			A portal is identified by a hash of its winding and the leafs on
+//			either side. Its flow only ever looks at the portals in its
+//			mightsee set (portalflood), so its old portalvis is still right if
+//			it kept its hash, and its new mightsee has the same portals, with
+//			the same hashes, as the old one. Like a threaded full run, the
+//			result can differ from a single-threaded one by a few bits, since
+//			the flow clips against whichever portals happen to be done.
+//
+//=============================================================================//
+
+#include "vis.h"
+#include "threads.h"
+#include "tier1/generichash.h"
+#include "tier1/utlvector.h"
+#include "tier1/utlmap.h"
+
+
+#define VISCACHE_IDENT		(('C'<<24)+('V'<<16)+('V'<<8)+'I')
+#define VISCACHE_VERSION	1
+
+struct VisCacheHeader_t
+{
+	int		m_nIdent;
+	int		m_nVersion;
+	int		m_nPortals;			// memory portals, twice the count in the portal file
+	int		m_nClusters;
+	int		m_bUseRadius;
+	double	m_flVisRadius;
+};
+
+struct CachedPortal_t
+{
+	const byte	*m_pFlood;		// compressed portalflood, over the old portal numbers
+	const byte	*m_pVis;		// compressed portalvis
+};
+
+static CUtlVector<uint64>			s_PortalHashes;		// for the portals being compiled
+
+static byte							*s_pCacheFile;
+static int							s_nCachePortals;
+static int							s_nCachePortalBytes;
+static CUtlVector<CachedPortal_t>	s_CachedPortals;
+static CUtlVector<int>				s_OldToNew;			// old portal number to new, -1 if it's gone
+static CUtlVector<int>				s_NewToOld;			// new portal number to old, -1 if it's new
+
+static CUtlVector<byte>				s_Reused;			// the portals that got their portalvis from the cache
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Run length encodes the zeros of a portal bit vector, the same way
+//			the PVS is compressed.
+//-----------------------------------------------------------------------------
+static void CompressPortalBits( const byte *pBits, int nBytes, CUtlVector<byte> &out )
+{
+	for ( int i = 0; i < nBytes; i++ )
+	{
+		out.AddToTail( pBits[i] );
+		if ( pBits[i] )
+			continue;
+
+		int nRep = 1;
+		while ( i + 1 < nBytes && !pBits[i+1] && nRep < 255 )
+		{
+			i++;
+			nRep++;
+		}
+		out.AddToTail( nRep );
+	}
+}
+
+static void DecompressPortalBits( const byte *pIn, byte *pOut, int nBytes )
+{
+	byte *pEnd = pOut + nBytes;
+	while ( pOut < pEnd )
+	{
+		if ( *pIn )
+		{
+			*pOut++ = *pIn++;
+			continue;
+		}
+
+		int nRep = MIN( (int)pIn[1], (int)( pEnd - pOut ) );
+		memset( pOut, 0, nRep );
+		pOut += nRep;
+		pIn += 2;
+	}
+}
+
+static const byte *SkipCompressedPortalBits( const byte *pIn, const byte *pFileEnd, int nBytes )
+{
+	int nOut = 0;
+	while ( nOut < nBytes )
+	{
+		if ( pIn >= pFileEnd )
+			return NULL;
+
+		if ( *pIn )
+		{
+			nOut++;
+			pIn++;
+			continue;
+		}
+
+		if ( pIn + 1 >= pFileEnd || !pIn[1] )
+			return NULL;
+
+		nOut += pIn[1];
+		pIn += 2;
+	}
+	return pIn;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Hashes the winding of every memory portal along with the leafs it
+//			connects, in LoadPortals' order.
+//-----------------------------------------------------------------------------
+static void HashPortals()
+{
+	s_PortalHashes.SetCount( g_numportals * 2 );
+
+	for ( int iLeaf = 0; iLeaf < portalclusters; iLeaf++ )
+	{
+		leaf_t *pLeaf = &leafs[iLeaf];
+		for ( int i = 0; i < pLeaf->portals.Count(); i++ )
+		{
+			portal_t *p = pLeaf->portals[i];
+			winding_t *w = p->winding;
+
+			int leafnums[2] = { iLeaf, p->leaf };
+			uint32 nHash0 = MurmurHash3_32( leafnums, sizeof( leafnums ), w->numpoints );
+			uint32 nHash1 = MurmurHash3_32( leafnums, sizeof( leafnums ), ~w->numpoints );
+			nHash0 = MurmurHash3_32( w->points, w->numpoints * sizeof( Vector ), nHash0 );
+			nHash1 = MurmurHash3_32( w->points, w->numpoints * sizeof( Vector ), nHash1 );
+
+			s_PortalHashes[p - portals] = ( (uint64)nHash1 << 32 ) | nHash0;
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Reads the cache and matches its portals with the ones being compiled.
+// Output : false if there's no usable cache.
+//-----------------------------------------------------------------------------
+static bool LoadVisCache( const char *pszFileName )
+{
+	if ( !FileExists( pszFileName ) )
+	{
+		Msg( "No vis cache at %s, computing everything\n", pszFileName );
+		return false;
+	}
+
+	int nFileSize = LoadFile( pszFileName, (void **)&s_pCacheFile );
+	const byte *pFileEnd = s_pCacheFile + nFileSize;
+
+	VisCacheHeader_t *pHeader = (VisCacheHeader_t *)s_pCacheFile;
+	if ( nFileSize < (int)sizeof( VisCacheHeader_t ) || pHeader->m_nIdent != VISCACHE_IDENT || pHeader->m_nVersion != VISCACHE_VERSION )
+	{
+		Warning( "%s isn't a vis cache of this version, computing everything\n", pszFileName );
+		return false;
+	}
+
+	if ( ( pHeader->m_bUseRadius != 0 ) != g_bUseRadius || ( g_bUseRadius && pHeader->m_flVisRadius != g_VisRadius ) )
+	{
+		Msg( "The vis radius changed since the vis cache was written, computing everything\n" );
+		return false;
+	}
+
+	s_nCachePortals = pHeader->m_nPortals;
+	s_nCachePortalBytes = ( ( s_nCachePortals + 63 ) & ~63 ) >> 3;
+
+	const uint64 *pHashes = (const uint64 *)( pHeader + 1 );
+	const byte *pData = (const byte *)( pHashes + s_nCachePortals );
+	if ( s_nCachePortals < 0 || s_nCachePortals >= MAX_PORTALS || pData > pFileEnd )
+	{
+		Warning( "%s is truncated, computing everything\n", pszFileName );
+		return false;
+	}
+
+	s_CachedPortals.SetCount( s_nCachePortals );
+	for ( int i = 0; i < s_nCachePortals; i++ )
+	{
+		CachedPortal_t &cached = s_CachedPortals[i];
+		cached.m_pFlood = pData;
+		pData = SkipCompressedPortalBits( pData, pFileEnd, s_nCachePortalBytes );
+		if ( pData )
+		{
+			cached.m_pVis = pData;
+			pData = SkipCompressedPortalBits( pData, pFileEnd, s_nCachePortalBytes );
+		}
+		if ( !pData )
+		{
+			Warning( "%s is truncated, computing everything\n", pszFileName );
+			return false;
+		}
+	}
+
+	//
+	// Match the portals by hash. A hash that shows up twice on either side can't
+	// be trusted to mean the same portal.
+	//
+	CUtlMap<uint64, int> oldByHash( DefLessFunc( uint64 ) );
+	for ( int i = 0; i < s_nCachePortals; i++ )
+	{
+		int iMap = oldByHash.Find( pHashes[i] );
+		if ( iMap == oldByHash.InvalidIndex() )
+		{
+			oldByHash.Insert( pHashes[i], i );
+		}
+		else
+		{
+			oldByHash[iMap] = -1;
+		}
+	}
+
+	s_OldToNew.SetCount( s_nCachePortals );
+	for ( int i = 0; i < s_nCachePortals; i++ )
+	{
+		s_OldToNew[i] = -1;
+	}
+
+	s_NewToOld.SetCount( g_numportals * 2 );
+	int nMatched = 0;
+	for ( int i = 0; i < g_numportals * 2; i++ )
+	{
+		s_NewToOld[i] = -1;
+
+		int iMap = oldByHash.Find( s_PortalHashes[i] );
+		if ( iMap == oldByHash.InvalidIndex() || oldByHash[iMap] == -1 )
+			continue;
+
+		int iOld = oldByHash[iMap];
+		if ( s_OldToNew[iOld] != -1 )
+		{
+			// already taken by a portal with the same hash
+			s_NewToOld[s_OldToNew[iOld]] = -1;
+			s_OldToNew[iOld] = -1;
+			oldByHash[iMap] = -1;
+			nMatched--;
+			continue;
+		}
+
+		s_OldToNew[iOld] = i;
+		s_NewToOld[i] = iOld;
+		nMatched++;
+	}
+
+	Msg( "%d of %d portals unchanged since the last compile\n", nMatched, g_numportals * 2 );
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Takes the cached portalvis of one portal if its mightsee set didn't
+//			change.
+//-----------------------------------------------------------------------------
+static void ReusePortalVisThread( int iThread, int portalnum )
+{
+	portal_t *p = &portals[portalnum];
+	s_Reused[portalnum] = false;
+
+	int iOld = s_NewToOld[portalnum];
+	if ( iOld == -1 )
+		return;
+
+	byte oldBits[MAX_PORTALS/8];
+	const CachedPortal_t &cached = s_CachedPortals[iOld];
+	DecompressPortalBits( cached.m_pFlood, oldBits, s_nCachePortalBytes );
+
+	if ( CountBits( oldBits, s_nCachePortals ) != p->nummightsee )
+		return;
+
+	// Every portal it might see has to be an old one it could already see
+	for ( int i = 0; i < portalbytes; i++ )
+	{
+		if ( !p->portalflood[i] )
+			continue;
+
+		for ( int j = i << 3; j < ( i << 3 ) + 8; j++ )
+		{
+			if ( !CheckBit( p->portalflood, j ) )
+				continue;
+
+			int iOldOther = s_NewToOld[j];
+			if ( iOldOther == -1 || !CheckBit( oldBits, iOldOther ) )
+				return;
+		}
+	}
+
+	DecompressPortalBits( cached.m_pVis, oldBits, s_nCachePortalBytes );
+	memset( p->portalvis, 0, portalbytes );
+	for ( int i = 0; i < s_nCachePortalBytes; i++ )
+	{
+		if ( !oldBits[i] )
+			continue;
+
+		for ( int j = i << 3; j < ( i << 3 ) + 8 && j < s_nCachePortals; j++ )
+		{
+			if ( !CheckBit( oldBits, j ) )
+				continue;
+
+			// The portalvis is a subset of the mightsee we just matched
+			if ( s_OldToNew[j] == -1 )
+			{
+				memset( p->portalvis, 0, portalbytes );
+				return;
+			}
+			SetBit( p->portalvis, s_OldToNew[j] );
+		}
+	}
+
+	p->status = stat_done;
+	s_Reused[portalnum] = true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Fills in the portalvis of the portals the cache still covers, and
+//			moves the rest to the front of sorted_portals (in the same order).
+// Input  : pszFileName - the vis cache, <map>.vvc
+// Output : How many portals still have to flow.
+//-----------------------------------------------------------------------------
+int ReuseCachedPortalVis( const char *pszFileName )
+{
+	HashPortals();
+
+	s_Reused.SetCount( g_numportals * 2 );
+	memset( s_Reused.Base(), 0, s_Reused.Count() );
+
+	if ( LoadVisCache( pszFileName ) )
+	{
+		RunThreadsOnIndividual( g_numportals * 2, false, ReusePortalVisThread );
+	}
+
+	int nToFlow = 0;
+	CUtlVector<portal_t *> reused;
+	for ( int i = 0; i < g_numportals * 2; i++ )
+	{
+		portal_t *p = sorted_portals[i];
+		if ( s_Reused[p - portals] )
+		{
+			reused.AddToTail( p );
+		}
+		else
+		{
+			sorted_portals[nToFlow++] = p;
+		}
+	}
+	memcpy( &sorted_portals[nToFlow], reused.Base(), reused.Count() * sizeof( portal_t * ) );
+
+	Msg( "Reusing the vis of %d portals, flowing %d\n", reused.Count(), nToFlow );
+
+	free( s_pCacheFile );
+	s_pCacheFile = NULL;
+	s_CachedPortals.Purge();
+	s_OldToNew.Purge();
+	s_NewToOld.Purge();
+
+	return nToFlow;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Flows every portal again and compares the result with the one that
+//			reused the cache. The full results are kept.
+//-----------------------------------------------------------------------------
+void CheckIncrementalPortalVis()
+{
+	int nPortals = g_numportals * 2;
+	byte *pIncremental = (byte *)malloc( nPortals * portalbytes );
+
+	for ( int i = 0; i < nPortals; i++ )
+	{
+		memcpy( pIncremental + i * portalbytes, portals[i].portalvis, portalbytes );
+		memset( portals[i].portalvis, 0, portalbytes );
+		portals[i].status = stat_none;
+	}
+
+	Msg( "Flowing all portals to check the incremental vis\n" );
+	SortPortals();
+	RunThreadsOnIndividual( nPortals, true, PortalFlow );
+
+	int nDiffer = 0, nReusedDiffer = 0, nExtraBits = 0, nMissingBits = 0;
+	for ( int i = 0; i < nPortals; i++ )
+	{
+		byte *pOld = pIncremental + i * portalbytes;
+		byte *pNew = portals[i].portalvis;
+		if ( !memcmp( pOld, pNew, portalbytes ) )
+			continue;
+
+		nDiffer++;
+		if ( s_Reused.Count() && s_Reused[i] )
+		{
+			nReusedDiffer++;
+		}
+
+		for ( int j = 0; j < nPortals; j++ )
+		{
+			byte bit = 1 << ( j & 7 );
+			bool bOld = ( pOld[j >> 3] & bit ) != 0;
+			bool bNew = ( pNew[j >> 3] & bit ) != 0;
+			nExtraBits += ( bOld && !bNew );
+			nMissingBits += ( bNew && !bOld );
+		}
+	}
+
+	if ( nDiffer )
+	{
+		// PortalFlow clips against the vis of portals that already finished, so
+		// the result depends a little on the order portals are flowed in (threaded
+		// full runs differ between each other the same way).
+		Warning( "Incremental vis differs from a full run for %d portals (%d of them reused from the cache), %d extra and %d missing bits\n",
+			nDiffer, nReusedDiffer, nExtraBits, nMissingBits );
+	}
+	else
+	{
+		Msg( "Incremental vis matches a full run\n" );
+	}
+
+	free( pIncremental );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Saves the hash, mightsee and portalvis of every portal for the next
+//			incremental compile.
+//-----------------------------------------------------------------------------
+void WriteVisCache( const char *pszFileName )
+{
+	if ( s_PortalHashes.Count() != g_numportals * 2 )
+	{
+		HashPortals();
+	}
+
+	VisCacheHeader_t header;
+	memset( &header, 0, sizeof( header ) );
+	header.m_nIdent = VISCACHE_IDENT;
+	header.m_nVersion = VISCACHE_VERSION;
+	header.m_nPortals = g_numportals * 2;
+	header.m_nClusters = portalclusters;
+	header.m_bUseRadius = g_bUseRadius;
+	header.m_flVisRadius = g_VisRadius;
+
+	CUtlVector<byte> data;
+	data.AddMultipleToTail( sizeof( header ), (byte *)&header );
+	data.AddMultipleToTail( s_PortalHashes.Count() * sizeof( uint64 ), (byte *)s_PortalHashes.Base() );
+	for ( int i = 0; i < g_numportals * 2; i++ )
+	{
+		CompressPortalBits( portals[i].portalflood, portalbytes, data );
+		CompressPortalBits( portals[i].portalvis, portalbytes, data );
+	}
+
+	SaveFile( (char *)pszFileName, data.Base(), data.Count() );
+	Msg( "Wrote the vis cache to %s (%d bytes)\n", pszFileName, data.Count() );
+}
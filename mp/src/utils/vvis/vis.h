@@ -112,6 +112,12 @@ void BasePortalVis (int iThread, int portalnum);
 void BetterPortalVis (int portalnum);
 void PortalFlow (int iThread, int portalnum);
 void WritePortalTrace( const char *source );
+void SortPortals (void);
+
+// incrementalvis.cpp
+int ReuseCachedPortalVis( const char *pszFileName );
+void CheckIncrementalPortalVis();
+void WriteVisCache( const char *pszFileName );
 
 extern	portal_t	*sorted_portals[MAX_MAP_PORTALS*2];
 extern int g_TraceClusterStart, g_TraceClusterStop;
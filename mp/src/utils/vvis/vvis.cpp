@@ -20,6 +20,7 @@
 #include "vmpi_tools_shared.h"
 #include "ilaunchabledll.h"
 #include "tools_minidump.h"
+#include "phasetimes.h"
 #include "loadcmdline.h"
 #include "byteswap_valve.h"
 
@@ -56,6 +57,10 @@ double		g_VisRadius = 4096.0f * 4096.0f;
 
 bool		g_bLowPriority = false;
 
+bool		g_bIncrementalVis = false;		// reuse the portal vis of the last compile from <map>.vvc
+bool		g_bCheckIncrementalVis = false;	// and compare it against a full run
+char		g_szVisCacheFile[MAX_PATH];
+
 //=============================================================================
 
 void PlaneFromWinding (winding_t *w, plane_t *plane)
@@ -286,7 +291,7 @@ static int CompressAndCrosscheckClusterVis( int clusternum )
 CalcPortalVis
 ==================
 */
-void CalcPortalVis (void)
+void CalcPortalVis (int nSortedPortals)
 {
 	int		i;
 
@@ -308,7 +313,7 @@ void CalcPortalVis (void)
 	}
 	else 
 	{
-		RunThreadsOnIndividual (g_numportals*2, true, PortalFlow);
+		RunThreadsOnIndividual (nSortedPortals, true, PortalFlow);
 	}
 }
 
@@ -331,6 +336,7 @@ void CalcVis (void)
 {
 	int		i;
 
+	PhaseTimes_Begin( "base_vis" );
 	if (g_bUseMPI) 
 	{
 		RunMPIBasePortalVis();
@@ -339,14 +345,34 @@ void CalcVis (void)
 	{
 	    RunThreadsOnIndividual (g_numportals*2, true, BasePortalVis);
 	}
+	PhaseTimes_End();
 
+	PhaseTimes_Begin( "vis_flow" );
 	SortPortals ();
 
-	CalcPortalVis ();
+	// only the portals whose surroundings changed since the last compile have to flow
+	int nSortedPortals = g_numportals*2;
+	if ( g_bIncrementalVis && !fastvis )
+	{
+		nSortedPortals = ReuseCachedPortalVis( g_szVisCacheFile );
+	}
+
+	CalcPortalVis ( nSortedPortals );
+
+	if ( g_bIncrementalVis && !fastvis )
+	{
+		if ( g_bCheckIncrementalVis )
+		{
+			CheckIncrementalPortalVis();
+		}
+		WriteVisCache( g_szVisCacheFile );
+	}
+	PhaseTimes_End();
 
 	//
 	// assemble the leaf vis lists by oring the portal lists
 	//
+	PhaseTimes_Begin( "cluster_merge" );
 	for ( i = 0; i < portalclusters; i++ )
 	{
 		ClusterMerge( i );
@@ -358,6 +384,7 @@ void CalcVis (void)
 	{
 		count += CompressAndCrosscheckClusterVis( i );
 	}
+	PhaseTimes_End();
 
 		
 	Msg ("Optimized: %d visible clusters (%.2f%%)\n", count, count*100.0/totalvis);
@@ -957,6 +984,24 @@ int ParseCommandLine( int argc, char **argv )
 		{
 			EnableFullMinidumps( true );
 		}
+		else if ( !Q_stricmp( argv[i], "-incremental" ) )
+		{
+			g_bIncrementalVis = true;
+		}
+		else if ( !Q_stricmp( argv[i], "-incrementalcheck" ) )
+		{
+			g_bIncrementalVis = true;
+			g_bCheckIncrementalVis = true;
+		}
+		else if ( !Q_stricmp( argv[i], "-phasetimes" ) && i < argc - 1 )
+		{
+			// VMPI workers share the command line, only the master's phases are timed
+			if ( !g_bUseMPI || g_bMPIMaster )
+			{
+				PhaseTimes_Init( "vvis", argv[i+1] );
+			}
+			i++;
+		}
 		else if ( !Q_stricmp( argv[i], CMDLINEOPTION_NOVCONFIG ) )
 		{
 		}
@@ -1034,6 +1079,11 @@ void PrintUsage( int argc, char **argv )
 		"  -tmpout         : Make portals come from \\tmp\\<mapname>.\n"
 		"  -trace <start cluster> <end cluster> : Writes a linefile that traces the vis from one cluster to another for debugging map vis.\n"
 		"  -FullMinidumps  : Write large minidumps on crash.\n"
+		"  -incremental    : Reuse the portal vis of the last -incremental compile for the\n"
+		"                    parts of the map that didn't change (kept in <map>.vvc).\n"
+		"  -incrementalcheck : Same as -incremental, then flow every portal again and\n"
+		"                    report any difference.\n"
+		"  -phasetimes <file> : Write the time and peak memory of each phase to <file> as JSON.\n"
 		"\n"
 #if 1 // Disabled for the initial SDK release with VMPI so we can get feedback from selected users.
 		);
@@ -1157,14 +1207,26 @@ int RunVVis( int argc, char **argv )
 	}
 	strcat (portalfile, ".prt");
 
+	if ( g_bIncrementalVis && g_bUseMPI )
+	{
+		Warning( "-incremental isn't supported with -mpi, computing everything\n" );
+		g_bIncrementalVis = false;
+	}
+	V_snprintf( g_szVisCacheFile, sizeof( g_szVisCacheFile ), "%s.vvc", source );
+
 	Msg ("reading %s\n", portalfile);
+	PhaseTimes_Begin( "load_portals" );
 	LoadPortals (portalfile);
+	PhaseTimes_End();
 
 	// don't write out results when simply doing a trace
 	if ( g_TraceClusterStart < 0 )
 	{
 		CalcVis ();
+
+		PhaseTimes_Begin( "pas" );
 		CalcPAS ();
+		PhaseTimes_End();
 
 		// We need a mapping from cluster to leaves, since the PVS
 		// deals with clusters for both CalcVisibleFogVolumes and
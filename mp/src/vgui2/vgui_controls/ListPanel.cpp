@@ -484,6 +484,7 @@ ListPanel::ListPanel(Panel *parent, const char *panelName) : BaseClass(parent, p
 
 	m_nUserConfigFileVersion = 1;
     m_bCenterEmptyListText = false;
+    m_bIndexColumns = true;
 }
 
 //-----------------------------------------------------------------------------
@@ -654,6 +655,9 @@ void ListPanel::ResortColumnRBTree(int col)
 {
 	Assert(m_CurrentColumns.IsValidIndex(col));
 
+	if ( !m_bIndexColumns )
+		return;
+
 	unsigned char dataColumnIndex = m_CurrentColumns[col];
 	int columnHistoryIndex = m_ColumnsHistory.Find(dataColumnIndex);
 	column_t &column = m_ColumnsData[dataColumnIndex];
@@ -1107,6 +1111,9 @@ void ListPanel::ApplyItemChanges(int itemID)
 //-----------------------------------------------------------------------------
 void ListPanel::IndexItem(int itemID)
 {
+	if ( !m_bIndexColumns )
+		return;
+
 	FastSortListPanelItem *newitem = (FastSortListPanelItem*) m_DataItems[itemID];
 
 	// remove the item from the indexes and re-add
@@ -1199,9 +1206,10 @@ void ListPanel::RemoveItem(int itemID)
 	if (!data)
 		return;
 
-	// remove from column sorted indexes
+	// remove from column sorted indexes (items are not indexed if the owner sorts them)
 	int i;
-	for ( i = 0; i < m_ColumnsHistory.Count(); i++ )
+	int maxCount = min(m_ColumnsHistory.Count(), data->m_SortedTreeIndexes.Count());
+	for ( i = 0; i < maxCount; i++ )
 	{
 		if ( m_ColumnsHistory[i] == m_ColumnsData.InvalidIndex())
 			continue;
@@ -2549,7 +2557,7 @@ void ListPanel::SortList( void )
 {
 	m_bNeedsSort = false;
 
-	if ( m_VisibleItems.Count() <= 1 )
+	if ( m_VisibleItems.Count() <= 1 || !m_bIndexColumns )
 	{
 		return;
 	}
@@ -2794,6 +2802,42 @@ void ListPanel::SetItemVisible(int itemID, bool state)
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: replaces the rows with the given items, in the given order
+//-----------------------------------------------------------------------------
+void ListPanel::SetVisibleItems(const CUtlVector<int> &items)
+{
+	FOR_EACH_LL( m_DataItems, i )
+	{
+		((FastSortListPanelItem*) m_DataItems[i])->visible = false;
+	}
+
+	FOR_EACH_VEC( items, i )
+	{
+		((FastSortListPanelItem*) m_DataItems[items[i]])->visible = true;
+	}
+
+	// drop the selection of anything that got hidden
+	bool bDeselected = false;
+	for ( int i = m_SelectedItems.Count() - 1; i >= 0; i-- )
+	{
+		if ( !((FastSortListPanelItem*) m_DataItems[m_SelectedItems[i]])->visible )
+		{
+			m_SelectedItems.Remove(i);
+			bDeselected = true;
+		}
+	}
+
+	if ( bDeselected )
+	{
+		PostActionSignal( new KeyValues("ItemDeselected") );
+	}
+
+	m_VisibleItems.CopyArray(items.Base(), items.Count());
+	m_bNeedsSort = false;
+	Repaint();
+}
+
 //-----------------------------------------------------------------------------
 // Is the item visible?
 //-----------------------------------------------------------------------------